@@ -0,0 +1,14 @@
+#ifndef _LWIP_HOOKS_H
+#define _LWIP_HOOKS_H
+
+// included by the lwip sources using LWIP_HOOK_* from lwipopts.h
+
+#include "lwip/err.h"
+
+struct tcp_pcb;
+struct pbuf;
+
+// request headers for ETags, see http.c
+err_t http_tcp_in(struct tcp_pcb *pcb, struct pbuf *p);
+
+#endif /* _LWIP_HOOKS_H */
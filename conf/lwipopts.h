@@ -9,6 +9,7 @@
 #define MEM_ALIGNMENT               4
 #define MEM_SIZE                    4000
 #define MEMP_NUM_TCP_SEG            32
+#define MEMP_NUM_TCP_PCB            8
 #define MEMP_NUM_ARP_QUEUE          10
 #define PBUF_POOL_SIZE              24
 #define LWIP_ARP                    1
@@ -79,7 +80,13 @@
 #define LWIP_HTTPD_CUSTOM_FILES 1
 #define LWIP_HTTPD_FILE_EXTENSION 1
 #define LWIP_HTTPD_DYNAMIC_HEADERS 1
+#define LWIP_HTTPD_DYNAMIC_FILE_READ 1
+#define LWIP_HTTPD_SUPPORT_POST 1
 #define LWIP_HTTPD_FILE_EXTENSION 1
 #define HTTPD_FSDATA_FILE "httpd_fsdata.c"
 
+// see https://www.nongnu.org/lwip/2_1_x/group__lwip__opts__hooks.html
+#define LWIP_HOOK_FILENAME "lwip_hooks.h"
+#define LWIP_HOOK_TCP_INPACKET_PBUF(pcb, hdr, optlen, opt1len, opt2, p) http_tcp_in(pcb, p)
+
 #endif /* __LWIPOPTS_H__ */
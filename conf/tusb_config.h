@@ -30,6 +30,8 @@
 #ifndef _TUSB_CONFIG_H_
 #define _TUSB_CONFIG_H_
 
+#include "config.h"
+
 #ifdef __cplusplus
  extern "C" {
 #endif
@@ -105,6 +107,12 @@
 #define CFG_TUD_MIDI              0
 #define CFG_TUD_VENDOR            0
 
+#if defined(USB_NETWORK) && !defined(PICOWOTA)
+#define CFG_TUD_NCM               1
+#else
+#define CFG_TUD_NCM               0
+#endif
+
 // HID buffer size Should be sufficient to hold ID (if any) + Data
 #define CFG_TUD_HID_EP_BUFSIZE    16
 
@@ -118,6 +126,10 @@
 // MSC Buffer size of Device Mass storage
 #define CFG_TUD_MSC_EP_BUFSIZE   512
 
+// Ethernet frame with header, for the CDC-NCM network interface
+#define CFG_TUD_NET_MTU          1514
+#define CFG_TUD_NET_ENDPOINT_SIZE (TUD_OPT_HIGH_SPEED ? 512 : 64)
+
 #ifdef __cplusplus
  }
 #endif
@@ -0,0 +1,100 @@
+/*
+ * api.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __API_H__
+#define __API_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "vaporizer.h"
+
+// httpd only sends headers for names with an extension, see http.c
+#define API_STATE_URI "/api/state"
+#define API_STATE_FILE "/api/state.json"
+#define API_WORKFLOWS_URI "/api/workflows"
+#define API_WORKFLOWS_FILE "/api/workflows.json"
+#define API_START_URI "/api/workflow/start"
+#define API_START_FILE "/api/start.json"
+
+#define API_VALUES (VAP_PUMP + 1)
+
+// last known device state, never read from the device when requested
+struct api_state {
+    uint8_t dev; // enum known_devices, DEV_UNKNOWN when not connected
+    uint8_t known; // bit per enum vaporizer_value
+    int16_t values[API_VALUES];
+
+    bool running, stopping, error;
+    uint16_t flow, step, steps;
+    int32_t eta; // seconds, < 0 if unknown
+};
+
+struct api_result {
+    bool ok;
+    const char *error;
+    uint16_t flow;
+};
+
+enum api_doc_type {
+    API_DOC_STATE = 0,
+    API_DOC_WORKFLOWS,
+    API_DOC_START,
+};
+
+// response served by httpd, rendered a piece at a time
+struct api_doc {
+    enum api_doc_type type;
+    struct api_state state; // as of api_open()
+    struct api_result result;
+    uint32_t pos, len;
+};
+
+/*
+ * Non-blocking, call api_run() from the main loop. It collects the
+ * state and pushes changes to the Server-Sent Events clients
+ * connected on API_EVENTS_PORT.
+ *
+ * api_work() starts requested workflows and reads values from the
+ * device. It uses the BLE link, so only call it from the top level
+ * of the main loop, like wf_run(), never from main_loop_hw().
+ */
+void api_init(void);
+void api_run(void);
+void api_work(void);
+void api_status(void);
+
+// value confirmed by the device, from the workflow engine
+void api_value(enum vaporizer_value what, int16_t value);
+
+// waits for a read of the API still in flight, before a device screen takes the link
+void api_release_link(void);
+
+// false if name is not part of the API, len is set for Content-Length
+bool api_open(struct api_doc *d, const char *name);
+
+// returns bytes put into buff, 0 at the end
+int api_read(struct api_doc *d, char *buff, size_t len);
+
+// POST requests, api_post_end() returns the name of the response
+bool api_post_begin(const char *uri);
+void api_post_data(const char *data, size_t len);
+const char *api_post_end(void);
+
+#endif // __API_H__
@@ -20,11 +20,15 @@
 #define __BLE_H__
 
 #include "btstack.h"
+#include "ring.h"
+#include "models.h"
 
 #define BLE_MAX_NAME_LENGTH 32
 #define BLE_MAX_DATA_LENGTH 26
 #define BLE_MAX_SCAN_RESULTS 32
 #define BLE_MAX_VALUE_LEN 64
+#define BLE_MAX_CONNECTIONS 3
+#define BLE_MAX_NOTIFICATIONS 4
 
 enum ble_scan_mode {
     BLE_SCAN_OFF    = 0,
@@ -32,6 +36,13 @@ enum ble_scan_mode {
     BLE_SCAN_TOGGLE = 2,
 };
 
+enum ble_profile {
+    BLE_PROFILE_IDLE = 0,
+    BLE_PROFILE_INTERACTIVE,
+
+    BLE_PROFILE_COUNT
+};
+
 struct ble_scan_result {
     bool set;
     uint32_t time;
@@ -39,6 +50,7 @@ struct ble_scan_result {
     bd_addr_t addr;
     bd_addr_type_t type;
     int8_t rssi;
+    enum known_devices dev;
     char name[BLE_MAX_NAME_LENGTH + 1];
     uint8_t data[BLE_MAX_DATA_LENGTH];
     size_t data_len;
@@ -49,17 +61,55 @@ bool ble_is_ready(void);
 
 void ble_scan(enum ble_scan_mode mode);
 int32_t ble_get_scan_results(struct ble_scan_result *buf, uint16_t len);
+void ble_scan_status(void);
 
 void ble_connect(bd_addr_t addr, bd_addr_type_t type);
+int8_t ble_connect_known(const struct known_device *list, uint16_t count);
+void ble_connect_known_cancel(void);
 bool ble_is_connected(void);
 void ble_disconnect(void);
+bool ble_is_connected_to(bd_addr_t addr);
+int8_t ble_get_active_addr(bd_addr_t addr);
+
+// changes with every new link, 0 when not connected
+uint32_t ble_get_connection_id(void);
+
+// ATT MTU of the active link, as negotiated after connecting, 0 when not connected
+uint16_t ble_get_mtu(void);
+void ble_connection_status(void);
+void ble_set_profile(enum ble_profile p);
+
+// number of GATT requests sent since boot
+uint32_t ble_round_trips(void);
+
+// true while a blocking call below runs the main loop
+bool ble_is_blocking(void);
 
 int8_t ble_discover(const uint8_t *service, const uint8_t *characteristic);
 
 int32_t ble_read(const uint8_t *characteristic, uint8_t *buff, uint16_t buff_len);
+
+/*
+ * Same as ble_read(), without waiting for the response.
+ * ble_read_poll() returns 0 while pending, the value length
+ * when done, or < 0 on error and after BLE_READ_TIMEOUT_MS.
+ */
+int8_t ble_read_start(const uint8_t *characteristic);
+int32_t ble_read_poll(uint8_t *buff, uint16_t buff_len);
 int8_t ble_write(const uint8_t *service, const uint8_t *characteristic,
                  const uint8_t *buff, uint16_t buff_len);
 
+/*
+ * Same as ble_write(), without waiting for the response. Only for
+ * characteristics already discovered on this link, eg. with ble_discover().
+ * ble_write_poll() returns 0 while pending, 1 when confirmed,
+ * or < 0 on error and after BLE_WRTE_TIMEOUT_MS.
+ * Shares its slot with ble_read_start(), only one can be in flight.
+ */
+int8_t ble_write_start(const uint8_t *service, const uint8_t *characteristic,
+                       const uint8_t *buff, uint16_t buff_len);
+int8_t ble_write_poll(void);
+
 int8_t ble_notification_disable(const uint8_t *service, const uint8_t *characteristic);
 int8_t ble_notification_enable(const uint8_t *service, const uint8_t *characteristic);
 bool ble_notification_ready(void);
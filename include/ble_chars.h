@@ -0,0 +1,97 @@
+/*
+ * ble_chars.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BLE_CHARS_H__
+#define __BLE_CHARS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Every GATT characteristic used by the device drivers.
+ * The value doubles as a dense slot index, eg. for caching handles.
+ */
+enum ble_char_id {
+    CHAR_VOLCANO_FIRMWARE = 0,
+    CHAR_VOLCANO_PRJSTAT1,
+    CHAR_VOLCANO_PRJSTAT2,
+    CHAR_VOLCANO_PRJSTAT3,
+    CHAR_VOLCANO_CURRENT_TEMP,
+    CHAR_VOLCANO_TARGET_TEMP,
+    CHAR_VOLCANO_BRIGHTNESS,
+    CHAR_VOLCANO_SHUTOFF_TIME,
+    CHAR_VOLCANO_HEATER_ON,
+    CHAR_VOLCANO_HEATER_OFF,
+    CHAR_VOLCANO_PUMP_ON,
+    CHAR_VOLCANO_PUMP_OFF,
+    CHAR_VOLCANO_HEAT_HOURS,
+    CHAR_VOLCANO_HEAT_MINUTES,
+
+    CHAR_CRAFTY_CURRENT_TEMP,
+    CHAR_CRAFTY_TARGET_TEMP,
+    CHAR_CRAFTY_BATTERY,
+    CHAR_CRAFTY_HEATER_ON,
+    CHAR_CRAFTY_HEATER_OFF,
+
+    CHAR_VENTY_CMD,
+
+    CHAR_COUNT,
+    CHAR_INVALID = CHAR_COUNT
+};
+
+enum ble_char_access {
+    CHAR_READ   = (1 << 0),
+    CHAR_WRITE  = (1 << 1),
+    CHAR_NOTIFY = (1 << 2),
+};
+
+struct ble_char_desc {
+    const char *name;
+    uint8_t service[16]; // used for discovery and writes
+    uint8_t uuid[16];
+    uint8_t width; // in bytes, 0 for raw buffers
+    bool big_endian;
+    uint8_t access;
+};
+
+extern const struct ble_char_desc ble_chars[CHAR_COUNT];
+
+// returns CHAR_INVALID if uuid is not one of ours
+enum ble_char_id ble_char_find(const uint8_t *uuid);
+
+// returns < 0 on error
+int8_t ble_char_discover(enum ble_char_id id);
+int8_t ble_char_read(enum ble_char_id id, uint32_t *value);
+int8_t ble_char_write(enum ble_char_id id, uint32_t value);
+
+// see ble_read_start(), poll returns 0 while pending, 1 when value is set
+int8_t ble_char_read_start(enum ble_char_id id);
+int8_t ble_char_read_poll(enum ble_char_id id, uint32_t *value);
+
+// see ble_write_start(), poll returns 0 while pending, 1 when confirmed
+int8_t ble_char_write_start(enum ble_char_id id, uint32_t value);
+int8_t ble_char_write_poll(void);
+
+// for CHAR_*_FIRMWARE and CHAR_VENTY_CMD, returns length or < 0 on error
+int32_t ble_char_read_raw(enum ble_char_id id, uint8_t *buff, uint16_t len);
+int8_t ble_char_write_raw(enum ble_char_id id, const uint8_t *buff, uint16_t len);
+int8_t ble_char_write_raw_start(enum ble_char_id id, const uint8_t *buff, uint16_t len);
+
+void ble_char_status(void);
+
+#endif // __BLE_CHARS_H__
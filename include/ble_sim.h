@@ -0,0 +1,59 @@
+/*
+ * ble_sim.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BLE_SIM_H__
+#define __BLE_SIM_H__
+
+#include "ble.h"
+
+struct ble_sim_advert {
+    bd_addr_t addr;
+    bd_addr_type_t type;
+    int8_t rssi;
+    const char *name;
+    const uint8_t *data;
+    uint8_t data_len;
+};
+
+void ble_sim_init(void);
+
+uint ble_sim_count(void);
+const struct ble_sim_advert *ble_sim_get_advert(uint dev);
+int ble_sim_find(bd_addr_t addr);
+
+// link emulation, returns false when the transaction got lost
+bool ble_sim_link(void);
+uint16_t ble_sim_latency(void);
+void ble_sim_set_link(uint16_t latency_ms, uint8_t loss_percent);
+
+// return value length, or < 0 on error
+int32_t ble_sim_read(int dev, const uint8_t *characteristic,
+                     uint8_t *buff, uint16_t buff_len);
+
+// return length of notification sent in response, or < 0 on error
+int32_t ble_sim_write(int dev, const uint8_t *characteristic,
+                      const uint8_t *buff, uint16_t buff_len,
+                      uint8_t *resp, uint16_t resp_len);
+
+void ble_sim_status(void);
+
+// wf < 0 only benchmarks discovery and config page,
+// otherwise the workflow also runs on every simulated device
+void ble_sim_bench(int wf);
+
+#endif // __BLE_SIM_H__
@@ -14,7 +14,8 @@
 // for the client
 #if RUNNING_AS_CLIENT
 #define ENABLE_LE_CENTRAL
-#define MAX_NR_GATT_CLIENTS 1
+// one GATT client per connection, keep in sync with BLE_MAX_CONNECTIONS
+#define MAX_NR_GATT_CLIENTS 3
 #else
 #define MAX_NR_GATT_CLIENTS 0
 #endif
@@ -23,7 +24,7 @@
 #define HCI_OUTGOING_PRE_BUFFER_SIZE 4
 #define HCI_ACL_PAYLOAD_SIZE (255 + 4)
 #define HCI_ACL_CHUNK_SIZE_ALIGNMENT 4
-#define MAX_NR_HCI_CONNECTIONS 1
+#define MAX_NR_HCI_CONNECTIONS 3
 #define MAX_NR_SM_LOOKUP_ENTRIES 3
 #define MAX_NR_WHITELIST_ENTRIES 16
 #define MAX_NR_LE_DEVICE_DB_ENTRIES 16
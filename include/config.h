@@ -28,6 +28,37 @@
 #define VOLCANO_AUTO_CONNECT_TIMEOUT_MS 2000
 #define VOLCANO_AUTO_CONNECT_WITHIN_MS 10000
 
+// how long values read from the Volcano are re-used
+#define VOLCANO_CACHE_TTL_MS 2000
+#define VOLCANO_CACHE_TEMP_TTL_MS 250
+#define VENTY_CACHE_TTL_MS 2000
+
+// how often Crafty values are refreshed in the background
+#define CRAFTY_POLL_TEMP_MS 1000
+#define CRAFTY_POLL_TARGET_MS 5000
+#define CRAFTY_POLL_BATTERY_MS 30000
+#define CRAFTY_POLL_GAP_MS 250 // minimum time between two reads
+
+// pump steps on devices without a pump wait for the same time instead of being skipped
+#define WF_PUMP_AS_WAIT
+
+// workflow engine, each wf_run() call does at most one BLE transaction
+#define WF_TEMP_POLL_MS 500
+#define WF_WRITE_ATTEMPTS 4
+#define WF_WRITE_BACKOFF_MS 50 // doubled after each failed attempt
+#define WF_RAMP_INTERVAL_MS 2000 // minimum time between setpoint changes of a ramp
+
+// start a wait after a temperature step early, when predicted to be hot in time
+#define WF_PREROLL_MS 10000
+
+// leave devices connected when going back to the scan menu
+#define BLE_KEEP_CONNECTIONS
+
+// fake Volcano, Crafty+ and Venty, for testing without hardware
+//#define BLE_SIMULATION
+#define BLE_SIM_LATENCY_MS 15
+#define BLE_SIM_LOSS_PERCENT 0
+
 #define COUNTRY_CODE CYW43_COUNTRY_GERMANY
 
 #ifdef NDEBUG
@@ -39,6 +70,29 @@
 //#define INFLUXDB_HOST "IP_V4_HERE"
 //#define INFLUXDB_PORT 8086
 //#define INFLUXDB_DATABASE "db_name"
+#define INFLUXDB_QUEUE_LEN 64 // points, oldest are dropped when full
+#define INFLUXDB_BATCH_POINTS 16 // points per POST
+#define INFLUXDB_FLUSH_MS 5000 // max. age of queued points before a POST
+#define INFLUXDB_SPOOL_SECTORS 4 // 16K of flash for points taken while wifi is down
+#define INFLUXDB_SPOOL_DRAIN_POINTS 8 // backfilled per interval, live points go first
+#define INFLUXDB_SPOOL_DRAIN_MS 1000
+
+#define HTTP_MAX_OPEN_FILES 3 // concurrent downloads from disk, FIL has a sector buffer each
+#define HTTP_HANDLE_CACHE 4 // recently served files, opened again without directory lookup
+
+#define API_EVENTS_PORT 8081 // Server-Sent Events stream of /api/state
+#define API_EVENTS_CLIENTS 2
+#define API_EVENTS_KEEPALIVE_MS 15000
+#define API_EVENTS_TIMEOUT_MS 5000 // for the request after connecting
+#define API_UPDATE_MS 250 // state is collected and pushed at most this often
+#define API_POLL_MS 2000 // device is read while idle and someone is watching
+#define API_WATCH_MS 10000 // after the last request
+
+// CDC-NCM network interface on the USB port, web UI and API without wifi
+#define USB_NETWORK
+#define USB_NET_IP "192.168.7.1" // host gets the next address via DHCP
+#define USB_NET_TX_QUEUE 8 // frames waiting for the USB endpoint
+#define USB_NET_LEASE_S 3600
 
 #define WATCHDOG_PERIOD_MS 1000
 #define FLASH_LOCK_TIMEOUT_MS 500
@@ -22,6 +22,27 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "vaporizer.h"
+
+struct crafty_state {
+    int16_t current_temp; // 1/10th degrees C
+    int16_t target_temp; // 1/10th degrees C
+    int8_t battery; // percent
+    uint32_t updates; // incremented for every new value
+    uint32_t errors;
+};
+
+/*
+ * Background refresh of the cached state, see CRAFTY_POLL_* in config.h.
+ * crafty_poll_run() never blocks, each call starts or polls one BLE read.
+ */
+void crafty_poll_start(void);
+void crafty_poll_run(void);
+struct crafty_state crafty_get_state(void);
+
+// time source in ms for the poll schedule, NULL for the system clock
+void crafty_poll_set_clock(uint32_t (*clock)(void));
+
 // in 1/10th degrees C, or < 0 on error
 int16_t crafty_get_current_temp(void);
 int16_t crafty_get_target_temp(void);
@@ -35,4 +56,12 @@ int8_t crafty_set_heater_state(bool value);
 // in percent, or < 0 on error
 int8_t crafty_get_battery_state(void);
 
+// see struct vaporizer_ops, only temperatures can be read
+int8_t crafty_discover(void);
+int8_t crafty_read_start(enum vaporizer_value v);
+int8_t crafty_read_poll(enum vaporizer_value v, int16_t *value);
+int8_t crafty_get_cached(enum vaporizer_value v, int16_t *value);
+int8_t crafty_write_start(enum vaporizer_value v, uint16_t value);
+int8_t crafty_write_poll(void);
+
 #endif // __CRAFTY_H__
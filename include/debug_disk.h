@@ -19,9 +19,18 @@
 #ifndef __DEBUG_DISK_H__
 #define __DEBUG_DISK_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// no-op while mounted, unless the USB host wrote to the medium since then
 int debug_disk_mount(void);
 int debug_disk_unmount(void);
 
+bool debug_disk_stale(void);
+
+// changes on every (re-)mount, files opened before are invalid then
+uint32_t debug_disk_generation(void);
+
 void debug_disk_init_log(void);
 
 #endif // __DEBUG_DISK_H__
@@ -19,6 +19,28 @@
 #ifndef __HTTP_H__
 #define __HTTP_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// embedded web files, generated by make_fsdata.sh
+struct http_etag {
+    const char *name; // NULL at the end
+    uint32_t etag; // CRC32 of the content
+};
+
 void http_init(void);
+void http_status(void);
+
+uint32_t http_chunk_len(uint32_t pos, uint32_t left, uint32_t count);
+
+const char *http_mime_type(const char *name);
+
+// value of an If-None-Match request header, weak comparison
+bool http_etag_match(const char *value, uint32_t etag);
+
+// header of a response with size bytes, 304 Not Modified if size < 0
+size_t http_header(char *buff, size_t len, const char *name, int32_t size,
+                   uint32_t etag, bool weak);
 
 #endif // __HTTP_H__
@@ -0,0 +1,41 @@
+/*
+ * influx.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INFLUX_H__
+#define __INFLUX_H__
+
+#include "config.h"
+
+#if defined(INFLUXDB_HOST) && defined(INFLUXDB_PORT) && defined(INFLUXDB_DATABASE)
+#define VOLCANO_INFLUX_DB
+#endif
+
+/*
+ * Points are queued with their timestamp and written in batches,
+ * over one keep-alive HTTP/1.1 connection that is reopened on errors.
+ * The time of day comes from the Date header of the server.
+ * Once it is known, points taken while wifi is down go to a flash
+ * spool, which is drained slowly when the connection is back.
+ * name has to be a string constant, only the pointer is kept.
+ */
+void influx_point(const char *name, float value);
+
+void influx_run(void);
+void influx_status(void);
+
+#endif // __INFLUX_H__
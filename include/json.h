@@ -0,0 +1,72 @@
+/*
+ * json.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define JSON_MAX_DEPTH 32
+
+/*
+ * Renders into a window of the output, everything else is only counted.
+ * So a document can be rendered once without buffer to get its length,
+ * then again piece by piece into small buffers, without any allocation.
+ */
+struct json_out {
+    char *buff; // NULL to only count
+    uint32_t start, end; // window of the output that goes into buff
+    uint32_t pos; // length of the output so far
+
+    uint32_t members; // bit per nesting level, set after its first member
+    uint8_t depth;
+    bool key; // value follows a key, no comma
+};
+
+// window of len bytes of the output, starting at start
+void json_init(struct json_out *o, char *buff, uint32_t start, uint32_t len);
+
+// output did not fit into the window
+bool json_full(const struct json_out *o);
+
+// bytes that went into buff
+uint32_t json_len(const struct json_out *o);
+
+// as-is, without any separators
+void json_raw_c(struct json_out *o, char c);
+void json_raw(struct json_out *o, const char *s);
+void json_raw_u(struct json_out *o, uint32_t v);
+void json_escaped_c(struct json_out *o, char c);
+
+// values and members, commas are added as needed
+void json_obj_begin(struct json_out *o);
+void json_obj_end(struct json_out *o);
+void json_arr_begin(struct json_out *o);
+void json_arr_end(struct json_out *o);
+void json_key(struct json_out *o, const char *key);
+
+void json_str(struct json_out *o, const char *s);
+void json_str_n(struct json_out *o, const char *s, size_t max);
+void json_int(struct json_out *o, int32_t v);
+void json_tenths(struct json_out *o, int32_t v); // 123 as 12.3
+void json_bool(struct json_out *o, bool v);
+void json_null(struct json_out *o);
+
+#endif // __JSON_H__
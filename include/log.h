@@ -55,4 +55,19 @@ void debug_handle_input(const void *buff, size_t len);
 #include "ring.h"
 struct ring_buffer *log_get(void);
 
+// one debug() call in the log ring, may wrap around its end
+struct log_record {
+    uint32_t seq;
+    const uint8_t *a;
+    size_t a_len;
+    const uint8_t *b;
+    size_t b_len;
+};
+
+uint32_t log_first_seq(void);
+uint32_t log_next_seq(void);
+
+// returns < 0 when seq is no longer (or not yet) in the ring
+int log_record(uint32_t seq, struct log_record *r);
+
 #endif // __LOG_H__
@@ -0,0 +1,56 @@
+/*
+ * log_json.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LOG_JSON_H__
+#define __LOG_JSON_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Renders the debug log ring as JSON array, a piece at a time,
+ * straight from the ring without copying it:
+ * [{"seq":1,"time":1234,"level":"debug","module":"func","line":42,"msg":"..."},...]
+ */
+struct log_json {
+    uint32_t begin, end; // records [begin, end) as of log_json_open()
+    uint32_t seq; // next to render
+    uint32_t off; // bytes of it already rendered
+    bool lost; // it is rendered as placeholder
+    uint32_t pos, len;
+};
+
+// value of the ?since= parameter, -1 when missing or invalid
+int64_t log_json_since(const char *s);
+
+/*
+ * Records newer than since, or all of them when since is negative.
+ * Returns length of the whole document, for Content-Length.
+ */
+uint32_t log_json_open(struct log_json *j, int64_t since);
+
+/*
+ * Returns bytes put into buff, 0 at the end, < 0 if a record was
+ * overwritten while it was partially sent. Records overwritten before
+ * they were started are replaced by {"seq":N,"lost":true}, and the
+ * document is padded with whitespace to the length promised before.
+ */
+int log_json_read(struct log_json *j, char *buff, size_t len);
+
+#endif // __LOG_JSON_H__
@@ -27,6 +27,7 @@
 
 #include "workflow.h"
 #include "wifi.h"
+#include "models.h"
 
 /*
  * Last two flash pages are used by BTstack.
@@ -36,7 +37,7 @@
 #define EEPROM_FLASH_OFFSET (PICO_FLASH_BANK_STORAGE_OFFSET - FLASH_SECTOR_SIZE)
 
 // to migrate settings when struct changes between releases
-#define MEM_VERSION 0
+#define MEM_VERSION 3
 
 struct mem_data {
     // wifi networks
@@ -49,6 +50,10 @@ struct mem_data {
     bool wf_auto_connect;
     bool enable_wifi;
 
+    // recently used devices, most recent first
+    uint16_t known_count;
+    struct known_device known[MODELS_MAX_KNOWN];
+
     // workflows
     uint16_t wf_count;
     struct workflow wf[WF_MAX_FLOWS];
@@ -59,6 +64,7 @@ struct mem_data {
     .backlight = (0xFF00 >> 1),   \
     .wf_auto_connect = false,     \
     .enable_wifi = false,         \
+    .known_count = 0,             \
     .wf_count = 0,                \
     .net_count = 0,               \
 }
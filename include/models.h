@@ -19,6 +19,7 @@
 #ifndef __MODELS_H__
 #define __MODELS_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
 enum known_devices {
@@ -28,6 +29,15 @@ enum known_devices {
     DEV_VENTY,
 };
 
+#define MODELS_MAX_KNOWN 4
+
+// plain types, so this can also be stored in flash by mem.c
+struct known_device {
+    uint8_t addr[6];
+    uint8_t type;
+    uint8_t dev;
+};
+
 enum unit {
     UNIT_C = 0,
     UNIT_F,
@@ -40,4 +50,9 @@ int8_t models_get_serial(enum known_devices dev, const char *name,
                          const uint8_t *data, size_t data_len,
                          char *buff, size_t buff_len);
 
+void models_known_add(struct known_device *list, uint16_t *count,
+                      const uint8_t *addr, uint8_t type, enum known_devices dev);
+int models_known_find(const struct known_device *list, uint16_t count,
+                      const uint8_t *addr);
+
 #endif // __MODELS_H__
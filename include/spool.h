@@ -0,0 +1,47 @@
+/*
+ * spool.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SPOOL_H__
+#define __SPOOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SPOOL_MAX_FIELDS 16
+
+/*
+ * Append-only ring of sectors in flash, for telemetry points that
+ * can not be sent right now. Times are absolute, in ms since epoch.
+ * Sectors are erased once read, or overwritten when the ring is full.
+ * Returns < 0 on error.
+ */
+void spool_init(void);
+
+int8_t spool_append(uint8_t field, int64_t t, float value);
+
+// write out partially filled page, so everything can be read
+void spool_flush(void);
+
+bool spool_empty(void);
+
+// returns 1 when a point was read, 0 if there is none
+int8_t spool_read(uint8_t *field, int64_t *t, float *value);
+
+void spool_status(void);
+
+#endif // __SPOOL_H__
@@ -38,7 +38,15 @@ enum system_state {
     STATE_INVALID,
 };
 
+#include <stdbool.h>
+
 void state_switch(enum system_state next);
 void state_run(void);
 
+// device screen reading from the link itself, the API must not poll then
+bool state_uses_link(void);
+
+// unsaved changes would be lost when switching away
+bool state_is_editor(void);
+
 #endif // __STATE_H__
@@ -22,7 +22,11 @@
 #include <ble.h>
 
 void state_volcano_run_index(uint16_t index);
-void state_volcano_run_target(bd_addr_t addr, bd_addr_type_t type);
+
+// workflow already running on the active connection, eg. from the web
+void state_volcano_run_attach(uint16_t index);
+void state_volcano_run_target(bd_addr_t addr, bd_addr_type_t type,
+                              enum known_devices dev);
 
 void state_volcano_run_enter(void);
 void state_volcano_run_exit(void);
@@ -0,0 +1,71 @@
+/*
+ * thermal.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __THERMAL_H__
+#define __THERMAL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define THERMAL_AMBIENT_TEMP 250 // 1/10th degrees C
+
+/*
+ * Online estimate of a first-order heating curve,
+ * dT/dt = (T_inf - T) / tau, fitted with weighted least squares
+ * of the heating rate over temperature. Older samples fade out.
+ * Pure code, no hardware or SDK dependencies.
+ */
+struct thermal_est {
+    uint32_t samples;
+    uint32_t last_t; // ms
+    int16_t last_temp; // 1/10th degrees C
+
+    // decayed sums over (x = temperature, y = rate)
+    float sw, sx, sy, sxx, sxy;
+};
+
+void thermal_init(struct thermal_est *e);
+
+// t in ms, temp in 1/10th degrees C
+void thermal_sample(struct thermal_est *e, uint32_t t, int16_t temp);
+
+// in 1/10th degrees C per second at the last temperature, 0 if unknown
+float thermal_rate(const struct thermal_est *e);
+
+// ms until target is reached, 0 if already there, < 0 if unknown
+int32_t thermal_eta(const struct thermal_est *e, int16_t target);
+
+/*
+ * Very simple first order model of a heater, heating up faster than
+ * it cools down, with a fixed drop while the pump is running.
+ * Used by the BLE simulation and the workflow simulator.
+ */
+struct thermal_model {
+    int16_t current; // 1/10th degrees C
+    int16_t target; // 1/10th degrees C
+    bool heater;
+    bool pump;
+    uint32_t last_update; // ms
+};
+
+void thermal_model_init(struct thermal_model *m, uint32_t t);
+
+// advance model to t in ms
+void thermal_model_run(struct thermal_model *m, uint32_t t);
+
+#endif // __THERMAL_H__
@@ -0,0 +1,51 @@
+/*
+ * tx_queue.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TX_QUEUE_H__
+#define __TX_QUEUE_H__
+
+#include <stdint.h>
+
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+
+#include "config.h"
+
+// frames from lwIP, referenced until they are copied to the USB endpoint
+struct tx_queue {
+    struct pbuf *frames[USB_NET_TX_QUEUE];
+    uint8_t head, count;
+    uint8_t peak;
+};
+
+/*
+ * Takes a reference to p, ERR_MEM when the queue is full.
+ * lwIP lock has to be held for all of these.
+ */
+err_t tx_queue_push(struct tx_queue *q, struct pbuf *p);
+
+// oldest frame, NULL when empty
+struct pbuf *tx_queue_peek(struct tx_queue *q);
+
+// removes the oldest frame, the caller frees it
+struct pbuf *tx_queue_pop(struct tx_queue *q);
+
+// frees all frames, returns how many there were
+uint8_t tx_queue_drop(struct tx_queue *q);
+
+#endif // __TX_QUEUE_H__
@@ -0,0 +1,66 @@
+/*
+ * usb_dhcp.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __USB_DHCP_H__
+#define __USB_DHCP_H__
+
+#include <stdint.h>
+
+#include "lwip/ip4_addr.h"
+
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+#define DHCP_MAX_LEN 576
+#define DHCP_OPTIONS 240 // after the fixed part and magic cookie
+#define DHCP_REPLY_LEN 300 // minimum BOOTP message
+
+#define DHCP_DISCOVER 1
+#define DHCP_OFFER 2
+#define DHCP_REQUEST 3
+#define DHCP_ACK 5
+#define DHCP_NAK 6
+
+#define DHCP_OPT_MASK 1
+#define DHCP_OPT_REQUESTED_IP 50
+#define DHCP_OPT_LEASE_TIME 51
+#define DHCP_OPT_TYPE 53
+#define DHCP_OPT_SERVER_ID 54
+#define DHCP_OPT_END 255
+
+// addresses of the USB link, as set up by usb_net_init()
+struct usb_dhcp_link {
+    ip4_addr_t server;
+    ip4_addr_t mask;
+    ip4_addr_t host; // the only one handed out
+};
+
+/*
+ * Value of an option of a DHCP message, at least min_len bytes long.
+ * NULL if not present or cut off by the end of the message.
+ */
+const uint8_t *usb_dhcp_option(const uint8_t *msg, uint16_t len, uint8_t code, uint8_t min_len);
+
+/*
+ * Answer to a DISCOVER or REQUEST of the host, written to reply with
+ * space for DHCP_REPLY_LEN bytes. Returns the length of the reply,
+ * 0 if there is none. The type is in its DHCP_OPT_TYPE option.
+ */
+uint16_t usb_dhcp_reply(const struct usb_dhcp_link *link,
+                        const uint8_t *req, uint16_t len, uint8_t *reply);
+
+#endif // __USB_DHCP_H__
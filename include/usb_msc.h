@@ -19,6 +19,9 @@
 #ifndef __USB_MSC_H__
 #define __USB_MSC_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+
 /*
  * Available: a disk is present in the drive
  * Locked: the host wants to prevent disk removal
@@ -30,4 +33,7 @@ bool msc_is_medium_available(void);
 // should only be set to false when unlocked
 void msc_set_medium_available(bool state);
 
+// writes by the host, FatFS state is outdated when this changes
+uint32_t msc_write_count(void);
+
 #endif // __USB_MSC_H__
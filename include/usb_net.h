@@ -0,0 +1,34 @@
+/*
+ * usb_net.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __USB_NET_H__
+#define __USB_NET_H__
+
+/*
+ * lwIP network interface on the CDC-NCM function of the USB port.
+ * The host gets an address from a DHCP responder for just this link,
+ * without router or DNS, so its internet connection is left alone.
+ *
+ * usb_net_init() needs lwIP, so call it after cyw43_arch_init().
+ * usb_net_run() is called from usb_run().
+ */
+void usb_net_init(void);
+void usb_net_run(void);
+void usb_net_status(void);
+
+#endif // __USB_NET_H__
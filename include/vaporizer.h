@@ -0,0 +1,86 @@
+/*
+ * vaporizer.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __VAPORIZER_H__
+#define __VAPORIZER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "models.h"
+
+enum vaporizer_caps {
+    VAP_CAP_NONE = 0,
+    VAP_CAP_PUMP = (1 << 0), // set_pump is available
+    VAP_CAP_NOTIFY = (1 << 1), // values are pushed, poll() has to be called
+    VAP_CAP_STATE = (1 << 2), // heater and pump state can be read back
+};
+
+enum vaporizer_value {
+    VAP_CURRENT_TEMP = 0, // 1/10th degrees C
+    VAP_TARGET_TEMP, // 1/10th degrees C
+    VAP_HEATER, // bool
+    VAP_PUMP, // bool
+};
+
+/*
+ * Common operations of all supported devices, used by the workflow engine.
+ * Temperatures in 1/10th degrees C, functions return < 0 on error.
+ * Optional functions are NULL when the device does not support them.
+ */
+struct vaporizer_ops {
+    const char *name;
+    enum known_devices dev;
+    uint8_t caps;
+    uint8_t temp_resolution; // smallest reported step, 1/10th degrees C
+
+    int8_t (*discover)(void); // blocking, once before the non-blocking calls
+    void (*poll)(void); // optional
+
+    int16_t (*get_current_temp)(void);
+    int16_t (*get_target_temp)(void);
+    int8_t (*set_target_temp)(uint16_t v);
+    int8_t (*set_heater)(bool value);
+    int8_t (*set_pump)(bool value); // optional
+
+    /*
+     * Non-blocking reads, only one can be in flight at a time.
+     * read_poll() returns 0 while pending, 1 when value is set.
+     */
+    int8_t (*read_start)(enum vaporizer_value v);
+    int8_t (*read_poll)(enum vaporizer_value v, int16_t *value);
+
+    // last value read by anyone, never uses the link, < 0 if there is none
+    int8_t (*get_cached)(enum vaporizer_value v, int16_t *value);
+
+    /*
+     * Non-blocking writes of target temperature, heater and pump,
+     * sharing the slot of the reads. Needs discover() first.
+     * write_poll() returns 0 while pending, 1 when confirmed.
+     */
+    int8_t (*write_start)(enum vaporizer_value v, uint16_t value);
+    int8_t (*write_poll)(void);
+};
+
+// returns NULL for unknown devices
+const struct vaporizer_ops *vaporizer_get(enum known_devices dev);
+
+// type of the active connection from known devices, DEV_UNKNOWN if not found
+enum known_devices vaporizer_active(void);
+
+#endif // __VAPORIZER_H__
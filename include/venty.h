@@ -22,7 +22,53 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "vaporizer.h"
+
+struct venty_state {
+    int16_t current_temp; // 1/10th degrees C
+    int16_t target_temp; // 1/10th degrees C
+    uint8_t battery; // percent
+    bool heater;
+    bool eco_current;
+    bool eco_voltage;
+    uint32_t settings_time; // last settings frame, ms since boot
+    uint32_t settings_count;
+
+    uint8_t brightness; // 1 to 9
+    bool vibration;
+    uint32_t interface_time; // last interface frame, ms since boot
+    uint32_t interface_count;
+};
+
+/*
+ * Notifications are enabled once per connection.
+ * Every frame the Venty sends, asked for or not, updates
+ * the state. Getters re-use it for VENTY_CACHE_TTL_MS.
+ */
+
+// decodes one notification into s, returns frame type or < 0 on error
+int8_t venty_parse(const uint8_t *frame, uint16_t len, struct venty_state *s);
+
+// handle pending notifications
+void venty_poll(void);
+struct venty_state venty_get_state(void);
+
+// query settings and interface frames, returns < 0 on error
+int8_t venty_refresh(struct venty_state *s);
+
+/*
+ * See struct vaporizer_ops. Discovery subscribes to the notifications,
+ * a read sends a settings query and waits for its frame.
+ */
+int8_t venty_discover(void);
+int8_t venty_read_start(enum vaporizer_value v);
+int8_t venty_read_poll(enum vaporizer_value v, int16_t *value);
+int8_t venty_get_cached(enum vaporizer_value v, int16_t *value);
+int8_t venty_write_start(enum vaporizer_value v, uint16_t value);
+int8_t venty_write_poll(void);
+
 // in 1/10th degrees C, or < 0 on error
+int16_t venty_get_current_temp(void);
 int16_t venty_get_target_temp(void);
 
 // v in 1/10th degrees C, returns < 0 on error
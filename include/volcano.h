@@ -23,6 +23,7 @@
 #include <stdbool.h>
 
 #include "models.h"
+#include "vaporizer.h"
 
 #define VOLCANO_FW_LEN 12
 
@@ -33,9 +34,29 @@ enum volcano_state {
     VOLCANO_STATE_INVALID = 0xFF,
 };
 
+struct volcano_snapshot {
+    int16_t current_temp; // 1/10th degrees C
+    int16_t target_temp; // 1/10th degrees C
+    enum volcano_state state;
+    enum unit unit;
+    bool vibration;
+    bool display_cooling;
+    uint16_t auto_shutoff; // seconds
+    uint8_t brightness; // 0 - 100
+};
+
 // returns < 0 on error
 int8_t volcano_discover_characteristics(bool wf, bool conf);
 
+/*
+ * Getters below are served from a cache, refreshed after
+ * VOLCANO_CACHE_TTL_MS. Setters invalidate the fields they change.
+ * Fetches all stale values at once, returns < 0 on error.
+ */
+int8_t volcano_snapshot(struct volcano_snapshot *snap);
+void volcano_invalidate(void);
+void volcano_cache_status(void);
+
 // in 1/10th degrees C, or < 0 on error
 int16_t volcano_get_current_temp(void);
 int16_t volcano_get_target_temp(void);
@@ -43,6 +64,13 @@ int16_t volcano_get_target_temp(void);
 // v in 1/10th degrees C, returns < 0 on error
 int8_t volcano_set_target_temp(uint16_t v);
 
+// see struct vaporizer_ops, answered from the cache while fresh, refreshing it otherwise
+int8_t volcano_read_start(enum vaporizer_value v);
+int8_t volcano_read_poll(enum vaporizer_value v, int16_t *value);
+int8_t volcano_get_cached(enum vaporizer_value v, int16_t *value);
+int8_t volcano_write_start(enum vaporizer_value v, uint16_t value);
+int8_t volcano_write_poll(void);
+
 // returns < 0 on error
 int8_t volcano_set_heater_state(bool value);
 int8_t volcano_set_pump_state(bool value);
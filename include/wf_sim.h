@@ -0,0 +1,49 @@
+/*
+ * wf_sim.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WF_SIM_H__
+#define __WF_SIM_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct wf_sim_result {
+    uint32_t duration_ms; // virtual time until the workflow finished
+    uint32_t pump_ms;
+    int16_t max_temp; // 1/10th degrees C
+    bool error; // did not finish in time, or engine gave up
+
+    // device commands
+    uint32_t target_writes;
+    uint32_t heater_writes;
+    uint32_t pump_writes;
+    uint32_t reads;
+};
+
+/*
+ * Runs the workflow engine against a modelled Volcano on a virtual
+ * clock, so a full workflow only takes a fraction of a second.
+ * With csv set, a timeline of setpoint, temperature, heater and pump
+ * is printed. Returns < 0 if the engine is busy, also while a request
+ * left over by wf_reset() is still drained by wf_run(), or index is invalid.
+ */
+int8_t wf_sim_run(uint16_t index, bool csv, struct wf_sim_result *r);
+
+void wf_sim_print(const struct wf_sim_result *r);
+
+#endif // __WF_SIM_H__
@@ -20,6 +20,7 @@
 #define __WIFI_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #define WIFI_MAX_NET_COUNT 5
 #define WIFI_MAX_NAME_LEN 32
@@ -28,6 +29,11 @@
 struct net_credentials {
     char name[WIFI_MAX_NAME_LEN];
     char pass[WIFI_MAX_PASS_LEN];
+
+    // access point of the last successful join, to skip the scan
+    uint8_t bssid[6];
+    uint8_t channel; // 0 when unknown
+    uint32_t auth;
 };
 
 void wifi_init(void);
@@ -36,9 +42,8 @@ void wifi_deinit(void);
 bool wifi_initialized(void);
 bool wifi_ready(void);
 const char *wifi_state(void);
+void wifi_status(void);
 
 void wifi_run(void);
 
-void wifi_tcp_send(const char *ip, uint16_t port, const char *packet, unsigned int len);
-
 #endif // __WIFI_H__
@@ -20,21 +20,41 @@
 #define __WORKFLOW_H__
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "models.h"
+
+struct vaporizer_ops;
 
 #define WF_MAX_STR_LEN 10
 #define WF_MAX_STEPS 42
 #define WF_MAX_FLOWS 6
 
+#define WF_MAX_LOOPS 4 // nested, including those in snippets
+#define WF_MAX_CALLS 1 // snippets can not call other snippets
+
 enum wf_op {
     OP_SET_TEMPERATURE = 0,
     OP_WAIT_TEMPERATURE,
     OP_WAIT_TIME,
     OP_PUMP_TIME,
+
+    OP_RAMP_TEMPERATURE, // from last setpoint to val, over arg seconds
+    OP_WAIT_TEMP_TIMEOUT, // wait for val without setting it, at most arg seconds
+    OP_LOOP, // run the previous arg steps val times in total
+    OP_CALL, // run snippet number val
+
+    OP_COUNT
 };
 
+/*
+ * arg uses what was padding in the first version of this
+ * struct, so the size and flash layout stay the same.
+ */
 struct wf_step {
     enum wf_op op;
     uint16_t val;
+    uint16_t arg;
 };
 
 struct workflow {
@@ -52,10 +72,15 @@ enum wf_status {
 struct wf_state {
     enum wf_status status;
 
+    uint16_t flow; // running workflow
     uint16_t index;
     uint16_t count;
-    struct wf_step *step;
+    const struct wf_step *step;
     uint16_t start_val, curr_val;
+    bool error; // last run was aborted, device did not confirm a write
+    bool stopping; // turning off pump and heater
+    bool io_pending; // request left over by wf_reset() not drained yet
+    int32_t eta; // ms until temperature is reached, < 0 if unknown
 };
 
 uint16_t wf_count(void);
@@ -72,15 +97,40 @@ void wf_move_step_down(uint16_t index, uint16_t step);
 void wf_move_step_up(uint16_t index, uint16_t step);
 
 struct wf_step *wf_get_step(uint16_t index, uint16_t step);
-const char *wf_step_str(struct wf_step *step);
+const char *wf_step_str(const struct wf_step *step);
+
+// returns < 0 if the workflow can not be run, see debug log for reason
+int8_t wf_validate(const struct workflow *wf, bool snippet);
+
+// fold repeated steps into loops, only if the device sees the same commands
+void wf_compact(struct workflow *wf);
 
 struct wf_state wf_status(void);
-void wf_start(uint16_t index);
 
+// device selects the driver used for all steps, see vaporizer.h
+void wf_start(uint16_t index, enum known_devices device);
+void wf_start_ops(uint16_t index, const struct vaporizer_ops *ops);
+
+/*
+ * Non-blocking, call wf_run() from the main loop. Each call starts or
+ * polls at most one BLE read or write, only the discovery on the first
+ * call blocks. wf_stop() turns off pump and heater on the following calls,
+ * wf_reset() forgets about the running workflow immediately. A request
+ * still in flight is then dropped by the next wf_run() calls.
+ */
+void wf_stop(void);
 void wf_reset(void);
 void wf_run(void);
+void wf_stats(void);
+
+// time source in ms for all timing decisions, NULL for the system clock
+void wf_set_clock(uint32_t (*clock)(void));
 
 extern const uint16_t wf_default_count;
 extern const struct workflow wf_default_data[];
 
+// shared parts, for OP_CALL
+extern const uint16_t wf_snippet_count;
+extern const struct workflow wf_snippet_data[];
+
 #endif // __WORKFLOW_H__
@@ -0,0 +1,150 @@
+#!/bin/bash
+
+# ----------------------------------------------------------------------------
+# Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# See <http://www.gnu.org/licenses/>.
+# ----------------------------------------------------------------------------
+
+# Replacement for the lwip makefsdata Perl script.
+# Files are gzip compressed when that makes them smaller, and get
+# complete HTTP headers with a strong ETag from the CRC32 of the content.
+#
+# Usage: make_fsdata.sh <directory> <output.c>
+
+set -euo pipefail
+
+IN="$1"
+OUT="$2"
+TMP="$(mktemp)"
+trap 'rm -f "$TMP"' EXIT
+
+mime_type() {
+    case "${1##*.}" in
+        html|htm) echo "text/html" ;;
+        css) echo "text/css" ;;
+        js) echo "application/javascript" ;;
+        json) echo "application/json" ;;
+        txt|md) echo "text/plain" ;;
+        svg) echo "image/svg+xml" ;;
+        png) echo "image/png" ;;
+        jpg|jpeg) echo "image/jpeg" ;;
+        ico) echo "image/x-icon" ;;
+        xz) echo "application/x-xz" ;;
+        gz) echo "application/gzip" ;;
+        *) echo "application/octet-stream" ;;
+    esac
+}
+
+# crc32 of the uncompressed data, little endian in the gzip trailer
+gzip_crc() {
+    tail -c 8 "$1" | head -c 4 | xxd -p | sed 's/\(..\)\(..\)\(..\)\(..\)/\4\3\2\1/'
+}
+
+c_bytes() {
+    xxd -i | sed 's/^ */    /; $ s/$/,/'
+}
+
+exec 3> "$OUT"
+echo "/* generated by make_fsdata.sh, do not edit */" >&3
+echo "" >&3
+echo "#include \"lwip/apps/fs.h\"" >&3
+echo "#include \"lwip/def.h\"" >&3
+echo "#include \"http.h\"" >&3
+echo "" >&3
+echo "#define file_NULL (struct fsdata_file *) NULL" >&3
+echo "" >&3
+
+PREV="file_NULL"
+COUNT=0
+TOTAL_RAW=0
+TOTAL=0
+ETAGS=""
+
+echo "Packing web files from $IN"
+while IFS= read -r -d '' FILE; do
+    NAME="/${FILE#"$IN"/}"
+    VAR="$(echo "$NAME" | sed 's/[^a-zA-Z0-9]/_/g')"
+
+    gzip -9 -n -c "$FILE" > "$TMP"
+    RAW_LEN=$(stat -c %s "$FILE")
+    GZ_LEN=$(stat -c %s "$TMP")
+    CRC="$(gzip_crc "$TMP")"
+
+    ENCODING=""
+    DATA="$FILE"
+    LEN=$RAW_LEN
+    if [ "$GZ_LEN" -lt "$RAW_LEN" ]; then
+        ENCODING="Content-Encoding: gzip\r\n"
+        DATA="$TMP"
+        LEN=$GZ_LEN
+    fi
+
+    # error pages keep their status, like with makefsdata, and are never cached
+    STATUS="200 OK"
+    case "$NAME" in
+        /404.*) STATUS="404 File not found" ;;
+    esac
+
+    HEADER="HTTP/1.0 $STATUS\r\n"
+    HEADER+="Content-Length: $LEN\r\n"
+    HEADER+="Content-Type: $(mime_type "$NAME")\r\n"
+    HEADER+="$ENCODING"
+    if [ "$STATUS" = "200 OK" ]; then
+        HEADER+="ETag: \"$CRC\"\r\n"
+        ETAGS+="    { \"$NAME\", 0x$CRC },"$'\n'
+    fi
+    HEADER+="Cache-Control: no-cache\r\n"
+    HEADER+="\r\n"
+
+    NAME_LEN=$(( ${#NAME} + 1 ))
+    HEADER_LEN=$(printf "$HEADER" | wc -c)
+
+    echo "static const unsigned char data_${VAR}[] = {" >&3
+    echo "    /* $NAME ($NAME_LEN chars) */" >&3
+    printf '%s\0' "$NAME" | c_bytes >&3
+    echo "    /* HTTP header ($HEADER_LEN bytes) */" >&3
+    printf "$HEADER" | c_bytes >&3
+    echo "    /* ${ENCODING:+gzip }data ($LEN bytes) */" >&3
+    c_bytes < "$DATA" >&3
+    echo "};" >&3
+    echo "" >&3
+
+    echo "const struct fsdata_file file_${VAR}[] = { {" >&3
+    echo "    $PREV," >&3
+    echo "    data_${VAR}," >&3
+    echo "    data_${VAR} + $NAME_LEN," >&3
+    echo "    sizeof(data_${VAR}) - $NAME_LEN," >&3
+    echo "    FS_FILE_FLAGS_HEADER_INCLUDED | FS_FILE_FLAGS_HEADER_PERSISTENT," >&3
+    echo "} };" >&3
+    echo "" >&3
+
+    PREV="file_${VAR}"
+    COUNT=$(( COUNT + 1 ))
+    TOTAL_RAW=$(( TOTAL_RAW + RAW_LEN ))
+    TOTAL=$(( TOTAL + NAME_LEN + HEADER_LEN + LEN ))
+
+    echo "  $NAME: $RAW_LEN -> $LEN bytes${ENCODING:+ (gzip)}, ETag $CRC"
+done < <(find "$IN" -type f -print0 | sort -z)
+
+echo "/* for If-None-Match, see http.c */" >&3
+echo "const struct http_etag http_fsdata_etags[] = {" >&3
+printf "%s" "$ETAGS" >&3
+echo "    { NULL, 0 }," >&3
+echo "};" >&3
+echo "" >&3
+echo "#define FS_ROOT $PREV" >&3
+echo "#define FS_NUMFILES $COUNT" >&3
+exec 3>&-
+
+echo "fsdata: $COUNT files, $TOTAL_RAW bytes, $TOTAL bytes with names and headers"
@@ -0,0 +1,699 @@
+/*
+ * api.c
+ *
+ * https://html.spec.whatwg.org/multipage/server-sent-events.html
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/tcp.h"
+
+#include "config.h"
+#include "log.h"
+#include "json.h"
+#include "ble.h"
+#include "main.h"
+#include "workflow.h"
+#include "state.h"
+#include "state_volcano_run.h"
+#include "api.h"
+
+#define API_EVENT_LEN 384
+#define API_POST_LEN 64
+
+static const char events_header[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "\r\n"
+    "retry: 2000\n\n";
+
+static const char events_keepalive[] = ": keep-alive\n\n";
+
+// Server-Sent Events stream, one per browser tab
+struct api_client {
+    struct tcp_pcb *pcb; // NULL when unused
+    bool request; // request received, path is not checked
+    bool started; // response header sent
+    bool closed;
+    bool error; // lwip already freed the pcb
+    uint32_t version; // of the state last sent
+    uint32_t t; // last write
+};
+
+struct api_stats {
+    uint32_t requests;
+    uint32_t posts;
+    uint32_t clients;
+    uint32_t rejected;
+    uint32_t events;
+    uint32_t deferred;
+    uint32_t polls;
+    uint32_t poll_errors;
+};
+
+// shared with lwip callbacks, only changed with the lwip lock held
+static struct api_state state = {0};
+static uint32_t version = 0;
+static struct api_client clients[API_EVENTS_CLIENTS] = {0};
+static struct tcp_pcb *listener = NULL;
+static volatile uint32_t last_request = 0;
+static volatile int32_t start_request = -1;
+static struct api_result result = {0};
+
+// main loop only
+static uint8_t dev = DEV_UNKNOWN;
+static uint8_t known = 0;
+static int16_t values[API_VALUES] = {0};
+static uint32_t update_t = 0;
+static bool polling = false;
+static enum vaporizer_value poll_what = VAP_CURRENT_TEMP;
+static uint32_t poll_t = 0;
+static uint32_t poll_check_t = 0;
+static char event[API_EVENT_LEN];
+static uint32_t event_len = 0;
+static uint32_t event_version = 0;
+
+static char post_body[API_POST_LEN + 1];
+static size_t post_len = 0;
+
+static struct api_stats stats = {0};
+
+static const char *value_names[API_VALUES] = {
+    "current", "target", "heater", "pump",
+};
+
+static uint32_t now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+static void render_state(struct json_out *o, const struct api_state *s) {
+    const struct vaporizer_ops *ops = vaporizer_get(s->dev);
+
+    json_obj_begin(o);
+    json_key(o, "device");
+    if (ops != NULL) {
+        json_str(o, ops->name);
+    } else {
+        json_null(o);
+    }
+
+    // temperatures in degrees C
+    for (int i = 0; i < API_VALUES; i++) {
+        json_key(o, value_names[i]);
+        if (!(s->known & (1 << i))) {
+            json_null(o);
+        } else if (i <= VAP_TARGET_TEMP) {
+            json_tenths(o, s->values[i]);
+        } else {
+            json_bool(o, s->values[i] != 0);
+        }
+    }
+
+    json_key(o, "workflow");
+    json_obj_begin(o);
+    json_key(o, "running");
+    json_bool(o, s->running);
+    if (s->running) {
+        json_key(o, "index");
+        json_int(o, s->flow);
+        if (s->flow < wf_count()) {
+            json_key(o, "name");
+            json_str_n(o, wf_name(s->flow), WF_MAX_STR_LEN);
+        }
+        json_key(o, "step");
+        json_int(o, s->step);
+        json_key(o, "steps");
+        json_int(o, s->steps);
+        json_key(o, "stopping");
+        json_bool(o, s->stopping);
+        json_key(o, "eta");
+        if (s->eta >= 0) {
+            json_int(o, s->eta);
+        } else {
+            json_null(o);
+        }
+    }
+    json_key(o, "error");
+    json_bool(o, s->error);
+    json_obj_end(o);
+
+    json_obj_end(o);
+}
+
+static void render_workflows(struct json_out *o) {
+    json_arr_begin(o);
+    for (uint16_t i = 0; i < wf_count(); i++) {
+        json_obj_begin(o);
+        json_key(o, "index");
+        json_int(o, i);
+        json_key(o, "name");
+        json_str_n(o, wf_name(i), WF_MAX_STR_LEN);
+        json_key(o, "author");
+        json_str_n(o, wf_author(i), WF_MAX_STR_LEN);
+        json_key(o, "steps");
+        json_int(o, wf_steps(i));
+        json_obj_end(o);
+    }
+    json_arr_end(o);
+}
+
+static void render_result(struct json_out *o, const struct api_result *r) {
+    json_obj_begin(o);
+    json_key(o, "ok");
+    json_bool(o, r->ok);
+    if (r->ok) {
+        json_key(o, "index");
+        json_int(o, r->flow);
+    } else {
+        json_key(o, "error");
+        json_str(o, r->error);
+    }
+    json_obj_end(o);
+}
+
+static void render(struct json_out *o, const struct api_doc *d) {
+    switch (d->type) {
+    case API_DOC_STATE:
+        render_state(o, &d->state);
+        break;
+
+    case API_DOC_WORKFLOWS:
+        render_workflows(o);
+        break;
+
+    case API_DOC_START:
+        render_result(o, &d->result);
+        break;
+    }
+    json_raw_c(o, '\n');
+}
+
+bool api_open(struct api_doc *d, const char *name) {
+    if (strcmp(name, API_STATE_FILE) == 0) {
+        d->type = API_DOC_STATE;
+    } else if (strcmp(name, API_WORKFLOWS_FILE) == 0) {
+        d->type = API_DOC_WORKFLOWS;
+    } else if (strcmp(name, API_START_FILE) == 0) {
+        d->type = API_DOC_START;
+    } else {
+        return false;
+    }
+
+    d->state = state;
+    d->result = result;
+    d->pos = 0;
+    last_request = now_ms();
+    stats.requests++;
+
+    struct json_out o;
+    json_init(&o, NULL, 0, 0);
+    render(&o, d);
+    d->len = o.pos;
+    return true;
+}
+
+int api_read(struct api_doc *d, char *buff, size_t len) {
+    struct json_out o;
+    json_init(&o, buff, d->pos, len);
+    render(&o, d);
+
+    // workflows can be edited in between, never more than promised
+    uint32_t n = json_len(&o);
+    if ((d->pos + n) > d->len) {
+        n = d->len - d->pos;
+    }
+    while ((n < len) && ((d->pos + n) < d->len)) {
+        buff[n++] = ' ';
+    }
+    d->pos += n;
+    return n;
+}
+
+bool api_post_begin(const char *uri) {
+    if (strcmp(uri, API_START_URI) != 0) {
+        return false;
+    }
+
+    post_len = 0;
+    stats.posts++;
+    return true;
+}
+
+void api_post_data(const char *data, size_t len) {
+    // only a short form or JSON body is expected, the rest is ignored
+    size_t n = MIN(len, API_POST_LEN - post_len);
+    memcpy(post_body + post_len, data, n);
+    post_len += n;
+}
+
+static void start_result(bool ok, const char *error, uint16_t flow) {
+    result.ok = ok;
+    result.error = error;
+    result.flow = flow;
+    if (!ok) {
+        debug("error: %s", error);
+    }
+}
+
+// "index=1" or {"index":1}, the workflow is started from api_work()
+const char *api_post_end(void) {
+    post_body[post_len] = '\0';
+
+    const char *p = strstr(post_body, "index");
+    if (p != NULL) {
+        p += strlen("index");
+        while ((*p != '\0') && ((*p < '0') || (*p > '9'))) {
+            p++;
+        }
+    }
+
+    if ((p == NULL) || (*p == '\0')) {
+        start_result(false, "index missing", 0);
+    } else if (strtol(p, NULL, 10) >= wf_count()) {
+        start_result(false, "unknown workflow", 0);
+    } else if (state.dev == DEV_UNKNOWN) {
+        start_result(false, "no device connected", 0);
+    } else if (state.running || (start_request >= 0)) {
+        start_result(false, "workflow in progress", 0);
+    } else if (state_is_editor()) {
+        start_result(false, "editor open on the device", 0);
+    } else {
+        start_request = strtol(p, NULL, 10);
+        start_result(true, NULL, start_request);
+    }
+    return API_START_FILE;
+}
+
+void api_value(enum vaporizer_value what, int16_t value) {
+    if (what >= API_VALUES) {
+        return;
+    }
+    values[what] = value;
+    known |= 1 << what;
+}
+
+static bool watched(uint32_t now) {
+    for (int c = 0; c < API_EVENTS_CLIENTS; c++) {
+        if (clients[c].started) {
+            return true;
+        }
+    }
+    return (last_request != 0) && ((now - last_request) < API_WATCH_MS);
+}
+
+/*
+ * Reads values from the device while no workflow is running and someone
+ * is looking, one after another with the non-blocking reads. While one is
+ * running the workflow engine reads on its own and reports to api_value().
+ * Device screens read on their own as well, with blocking calls that fail
+ * while a read is in flight, so their cached values are taken instead.
+ */
+static void poll_values(uint32_t now) {
+    const struct vaporizer_ops *ops = vaporizer_get(dev);
+    if (ops == NULL) {
+        polling = false;
+        return;
+    }
+
+    if (polling) {
+        int16_t v;
+        int8_t r = ops->read_poll(poll_what, &v);
+        if (r == 0) {
+            return;
+        }
+
+        polling = false;
+        if (r > 0) {
+            api_value(poll_what, v);
+        } else {
+            stats.poll_errors++;
+        }
+
+        poll_what++;
+        if (!(ops->caps & VAP_CAP_STATE) && (poll_what > VAP_TARGET_TEMP)) {
+            poll_what = API_VALUES;
+        }
+        if (poll_what >= API_VALUES) {
+            poll_what = VAP_CURRENT_TEMP;
+            poll_t = now;
+            return;
+        }
+    } else if ((poll_what == VAP_CURRENT_TEMP) && ((now - poll_t) < API_POLL_MS)) {
+        return;
+    }
+
+    bool running = (start_request >= 0) || (wf_status().status != WF_IDLE);
+    if (running || !watched(now)) {
+        poll_what = VAP_CURRENT_TEMP;
+        return;
+    }
+
+    if (state_uses_link()) {
+        for (int i = 0; i < API_VALUES; i++) {
+            int16_t v;
+            if (ops->get_cached(i, &v) >= 0) {
+                api_value(i, v);
+            }
+        }
+        poll_what = VAP_CURRENT_TEMP;
+        poll_t = now;
+        return;
+    }
+
+    if (ops->read_start(poll_what) < 0) {
+        stats.poll_errors++;
+        poll_what = VAP_CURRENT_TEMP;
+        poll_t = now;
+        return;
+    }
+    polling = true;
+    stats.polls++;
+}
+
+void api_release_link(void) {
+    if (!polling) {
+        return;
+    }
+
+    // read_poll() gives up on its own after the read timeout
+    const struct vaporizer_ops *ops = vaporizer_get(dev);
+    while (ops != NULL) {
+        int16_t v;
+        int8_t r = ops->read_poll(poll_what, &v);
+        if (r > 0) {
+            api_value(poll_what, v);
+            break;
+        } else if (r < 0) {
+            stats.poll_errors++;
+            break;
+        }
+
+        sleep_ms(1);
+        main_loop_hw();
+    }
+
+    polling = false;
+    poll_what = VAP_CURRENT_TEMP;
+    poll_t = now_ms();
+}
+
+static void update(void) {
+    struct api_state s;
+    memset(&s, 0, sizeof(s));
+
+    enum known_devices d = vaporizer_active();
+    if (d != dev) {
+        // values of the previous device are meaningless now
+        dev = d;
+        known = 0;
+        polling = false;
+        poll_what = VAP_CURRENT_TEMP;
+    }
+    s.dev = dev;
+    s.known = known;
+    memcpy(s.values, values, sizeof(s.values));
+
+    struct wf_state wf = wf_status();
+    s.running = (wf.status != WF_IDLE) || (start_request >= 0);
+    s.error = wf.error;
+    if (wf.status != WF_IDLE) {
+        s.stopping = wf.stopping;
+        s.flow = wf.flow;
+        s.step = wf.index;
+        s.steps = wf.count;
+        s.eta = (wf.eta < 0) ? -1 : ((wf.eta + 999) / 1000);
+    } else {
+        s.eta = -1;
+    }
+
+    if (memcmp(&s, &state, sizeof(struct api_state)) != 0) {
+        cyw43_arch_lwip_begin();
+        state = s;
+        version++;
+        cyw43_arch_lwip_end();
+    }
+}
+
+static err_t client_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    (void)err;
+    int c = (int)arg;
+    if (p == NULL) {
+        clients[c].closed = true;
+    } else {
+        tcp_recved(pcb, p->tot_len);
+        pbuf_free(p);
+        clients[c].request = true;
+    }
+    return ERR_OK;
+}
+
+static void client_error(void *arg, err_t err) {
+    int c = (int)arg;
+    debug("tcp err %d", err);
+    clients[c].error = true;
+}
+
+static err_t client_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+    (void)arg;
+    if ((err != ERR_OK) || (pcb == NULL)) {
+        return ERR_VAL;
+    }
+
+    int c = -1;
+    for (int i = 0; i < API_EVENTS_CLIENTS; i++) {
+        if (clients[i].pcb == NULL) {
+            c = i;
+            break;
+        }
+    }
+    if (c < 0) {
+        stats.rejected++;
+        tcp_abort(pcb);
+        return ERR_ABRT;
+    }
+
+    memset(&clients[c], 0, sizeof(struct api_client));
+    clients[c].pcb = pcb;
+    clients[c].t = now_ms();
+    tcp_arg(pcb, (void *)c);
+    tcp_err(pcb, client_error);
+    tcp_recv(pcb, client_recv);
+    stats.clients++;
+    return ERR_OK;
+}
+
+static void client_close(int c) {
+    struct api_client *client = &clients[c];
+    if (!client->error && (client->pcb != NULL)) {
+        tcp_arg(client->pcb, NULL);
+        tcp_err(client->pcb, NULL);
+        tcp_recv(client->pcb, NULL);
+        if (tcp_close(client->pcb) != ERR_OK) {
+            tcp_abort(client->pcb);
+        }
+    }
+    client->pcb = NULL;
+    client->started = false;
+}
+
+// false when it does not fit into the send buffer right now
+static bool client_write(int c, const char *data, uint16_t len, uint32_t now) {
+    struct api_client *client = &clients[c];
+    if (tcp_sndbuf(client->pcb) < len) {
+        return false;
+    }
+
+    err_t err = tcp_write(client->pcb, data, len, TCP_WRITE_FLAG_COPY);
+    if (err == ERR_MEM) {
+        return false;
+    } else if (err != ERR_OK) {
+        debug("tcp_write error %d", err);
+        client_close(c);
+        return false;
+    }
+
+    client->t = now;
+    return true;
+}
+
+static void render_event(void) {
+    if ((event_len > 0) && (event_version == version)) {
+        return;
+    }
+
+    struct json_out o;
+    json_init(&o, event, 0, sizeof(event));
+    json_raw(&o, "event: state\ndata: ");
+    render_state(&o, &state);
+    json_raw(&o, "\n\n");
+    if (json_full(&o)) {
+        debug("error: event too long (%lu)", o.pos);
+        event_len = 0;
+        return;
+    }
+
+    event_len = o.pos;
+    event_version = version;
+}
+
+static void client_run(int c, uint32_t now) {
+    struct api_client *client = &clients[c];
+
+    if (client->error) {
+        client->pcb = NULL;
+        client->started = false;
+        return;
+    }
+    if (client->closed) {
+        client_close(c);
+        return;
+    }
+    if (!client->request) {
+        if ((now - client->t) >= API_EVENTS_TIMEOUT_MS) {
+            debug("no request, closing");
+            client_close(c);
+        }
+        return;
+    }
+
+    if (!client->started) {
+        if (!client_write(c, events_header, strlen(events_header), now)) {
+            return;
+        }
+        client->started = true;
+        client->version = version - 1;
+    }
+
+    if (client->version != version) {
+        // only the latest state is sent to slow clients
+        render_event();
+        if ((event_len > 0) && client_write(c, event, event_len, now)) {
+            client->version = version;
+            stats.events++;
+        } else {
+            stats.deferred++;
+        }
+    } else if ((now - client->t) >= API_EVENTS_KEEPALIVE_MS) {
+        client_write(c, events_keepalive, strlen(events_keepalive), now);
+    }
+
+    if ((client->pcb != NULL) && (tcp_output(client->pcb) != ERR_OK)) {
+        debug("tcp_output error");
+        client_close(c);
+    }
+}
+
+void api_init(void) {
+    cyw43_arch_lwip_begin();
+
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (pcb == NULL) {
+        cyw43_arch_lwip_end();
+        debug("no tcp pcb");
+        return;
+    }
+
+    if (tcp_bind(pcb, IP_ANY_TYPE, API_EVENTS_PORT) != ERR_OK) {
+        tcp_close(pcb);
+        cyw43_arch_lwip_end();
+        debug("can not bind port %d", API_EVENTS_PORT);
+        return;
+    }
+
+    listener = tcp_listen_with_backlog(pcb, API_EVENTS_CLIENTS);
+    if (listener == NULL) {
+        tcp_close(pcb);
+        cyw43_arch_lwip_end();
+        debug("listen failed");
+        return;
+    }
+    tcp_accept(listener, client_accept);
+
+    cyw43_arch_lwip_end();
+}
+
+void api_run(void) {
+    uint32_t now = now_ms();
+
+    if ((now - update_t) >= API_UPDATE_MS) {
+        update_t = now;
+        update();
+    }
+
+    cyw43_arch_lwip_begin();
+    for (int c = 0; c < API_EVENTS_CLIENTS; c++) {
+        if (clients[c].pcb != NULL) {
+            client_run(c, now);
+        }
+    }
+    cyw43_arch_lwip_end();
+}
+
+void api_work(void) {
+    // the link is only used from the top of the main loop
+    if (ble_is_blocking()) {
+        return;
+    }
+
+    uint32_t now = now_ms();
+
+    // the editor would lose its changes, it was opened after the request
+    if ((start_request >= 0) && state_is_editor()) {
+        debug("editor open, not starting workflow %ld from web", start_request);
+        start_request = -1;
+        update_t = now - API_UPDATE_MS;
+    }
+
+    // the workflow engine needs the link for itself
+    if ((start_request >= 0) && !polling) {
+        uint16_t index = start_request;
+        start_request = -1;
+        debug("starting workflow %d from web", index);
+        wf_start(index, dev);
+        if (wf_status().status != WF_IDLE) {
+            state_volcano_run_attach(index);
+            state_switch(STATE_VOLCANO_RUN);
+        }
+        update_t = now - API_UPDATE_MS;
+    }
+
+    if (polling || ((now - poll_check_t) >= API_UPDATE_MS)) {
+        poll_check_t = now;
+        poll_values(now);
+    }
+}
+
+void api_status(void) {
+    int open = 0;
+    for (int c = 0; c < API_EVENTS_CLIENTS; c++) {
+        if (clients[c].started) {
+            open++;
+        }
+    }
+
+    println("API: %d / %d event clients on port %d", open, API_EVENTS_CLIENTS, API_EVENTS_PORT);
+    println("Requests: %lu, posts: %lu, clients: %lu, rejected: %lu",
+            stats.requests, stats.posts, stats.clients, stats.rejected);
+    println("Events: %lu, deferred: %lu, state version %lu",
+            stats.events, stats.deferred, version);
+    println("Polls: %lu, errors: %lu", stats.polls, stats.poll_errors);
+}
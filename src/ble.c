@@ -27,6 +27,7 @@
 #include "main.h"
 #include "util.h"
 #include "ble.h"
+#include "ble_sim.h"
 
 #define BLE_READ_TIMEOUT_MS (3 * 500)
 #define BLE_SRVC_TIMEOUT_MS (3 * 500)
@@ -34,8 +35,11 @@
 #define BLE_WRTE_TIMEOUT_MS (3 * 500)
 #define BLE_NOTY_TIMEOUT_MS (3 * 500)
 #define BLE_MAX_SCAN_AGE_MS (10 * 1000)
+#define BLE_SCAN_TABLE_SIZE (2 * BLE_MAX_SCAN_RESULTS) // power of two
 #define BLE_MAX_SERVICES 8
 #define BLE_MAX_CHARACTERISTICS 8
+#define BLE_SIM_HANDLE_BASE 0x0F00
+#define BLE_SIM_VALUE_HANDLE_BASE 0x0100
 
 enum ble_state {
     TC_OFF = 0,
@@ -65,96 +69,533 @@ struct ble_service {
     struct ble_characteristic chars[BLE_MAX_CHARACTERISTICS];
 };
 
+struct ble_conn_params {
+    uint16_t interval_min; // 1.25ms units
+    uint16_t interval_max; // 1.25ms units
+    uint16_t latency; // connection events
+    uint16_t timeout; // 10ms units
+};
+
+static const struct ble_conn_params profiles[BLE_PROFILE_COUNT] = {
+    [BLE_PROFILE_IDLE] = {
+        .interval_min = 80, // 100ms
+        .interval_max = 160, // 200ms
+        .latency = 4,
+        .timeout = 600, // 6s
+    },
+    [BLE_PROFILE_INTERACTIVE] = {
+        .interval_min = 6, // 7.5ms
+        .interval_max = 24, // 30ms
+        .latency = 0,
+        .timeout = 200, // 2s
+    },
+};
+
+struct ble_rtt {
+    uint32_t count;
+    uint32_t sum_us;
+    uint32_t min_us;
+    uint32_t max_us;
+};
+
+struct ble_notification {
+    uint16_t value_handle;
+    uint16_t len;
+    uint8_t data[BLE_MAX_VALUE_LEN];
+};
+
+/*
+ * Everything we know about one link to a peripheral.
+ * The stack state (off, idle, scanning) is global,
+ * the GATT state machine is kept per connection.
+ */
+struct ble_connection {
+    bool set;
+    uint32_t id; // unique for every new link
+    hci_con_handle_t handle;
+    enum ble_state state;
+    bd_addr_t addr;
+    bd_addr_type_t type;
+    uint32_t last_used;
+
+    uint16_t mtu;
+    uint16_t interval; // 1.25ms units, as reported by controller
+    enum ble_profile profile;
+    struct ble_rtt rtt;
+
+    uint16_t read_len;
+    uint8_t data_buff[BLE_MAX_VALUE_LEN];
+    uint32_t async_start; // ms since boot, read started by ble_read_start()
+    uint32_t async_rtt; // us since boot
+
+    struct ble_notification notify_buff[BLE_MAX_NOTIFICATIONS];
+    struct ring_buffer notify_rb;
+
+    struct ble_service services[BLE_MAX_SERVICES];
+    uint8_t service_idx;
+    uint8_t characteristic_idx;
+
+#ifdef BLE_SIMULATION
+    int8_t sim; // index into ble_sim devices, or -1 for real hardware
+    uint32_t sim_due; // ms since boot, async request completes, 0 when lost
+#endif
+};
+
 static btstack_packet_callback_registration_t hci_event_callback_registration;
-static hci_con_handle_t connection_handle;
 static enum ble_state state = TC_OFF;
 
-static struct ble_scan_result scans[BLE_MAX_SCAN_RESULTS] = {0};
+// open addressed hash table, keyed by device address
+static struct ble_scan_result scans[BLE_SCAN_TABLE_SIZE] = {0};
+static uint scan_count = 0;
+static uint32_t scan_evicted = 0;
+static uint32_t scan_dropped = 0;
+
+static struct ble_connection conns[BLE_MAX_CONNECTIONS] = {0};
+static int active = -1;
+static uint32_t conn_ids = 0;
+static uint32_t async_id = 0; // link of the request started by ble_read_start() or ble_write_start()
+
+// filter accept list connection to previously used devices
+static struct known_device known[MODELS_MAX_KNOWN] = {0};
+static uint16_t known_count = 0;
+static bool known_pending = false;
+static bool known_cancelled = false;
+
+// gap_connect_cancel() sent, its LE Connection Complete is not in yet
+static bool cancel_pending = false;
+static uint32_t deferred_id = 0; // link waiting for the cancel to start connecting
+
+static enum ble_profile profile = BLE_PROFILE_IDLE;
+
+// number of GATT requests sent, for benchmarking
+static uint32_t round_trips = 0;
+
+// blocking calls running the main loop while they wait, main loop only
+static uint32_t blocking = 0;
+
+#ifdef BLE_SIMULATION
+#define CONN_IS_SIM(c) ((c)->sim >= 0)
+#else
+#define CONN_IS_SIM(c) false
+#endif
+
+static struct ble_connection *conn_by_handle(hci_con_handle_t handle) {
+    for (uint i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (conns[i].set && (conns[i].handle == handle)) {
+            return &conns[i];
+        }
+    }
+    return NULL;
+}
 
-static uint16_t read_len = 0;
-static uint8_t data_buff[BLE_MAX_VALUE_LEN] = {0};
-static uint16_t value_handle = 0;
+static int conn_by_addr(bd_addr_t addr) {
+    for (uint i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (conns[i].set && (memcmp(conns[i].addr, addr, sizeof(bd_addr_t)) == 0)) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-static struct ble_service services[BLE_MAX_SERVICES] = {0};
-static uint8_t service_idx = 0;
-static uint8_t characteristic_idx = 0;
+static struct ble_connection *conn_by_id(uint32_t id) {
+    for (uint i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (conns[i].set && (conns[i].id == id)) {
+            return &conns[i];
+        }
+    }
+    return NULL;
+}
 
-static void hci_add_scan_result(bd_addr_t addr, bd_addr_type_t type, int8_t rssi) {
-    int unused = -1;
+static struct ble_connection *conn_active(void) {
+    if ((active < 0) || (!conns[active].set)) {
+        return NULL;
+    }
+    conns[active].last_used = to_ms_since_boot(get_absolute_time());
+    return &conns[active];
+}
 
-    for (uint i = 0; i < BLE_MAX_SCAN_RESULTS; i++) {
-        if (!scans[i].set) {
-            if (unused < 0) {
-                unused = i;
-            }
-            continue;
+static void conn_reset(struct ble_connection *conn) {
+    conn->set = false;
+    conn->handle = HCI_CON_HANDLE_INVALID;
+    conn->state = TC_IDLE;
+    conn->read_len = 0;
+    conn->mtu = ATT_DEFAULT_MTU;
+    conn->interval = 0;
+    conn->profile = BLE_PROFILE_INTERACTIVE; // see gap_set_connection_parameters() in ble_init()
+    memset(&conn->rtt, 0, sizeof(conn->rtt));
+#ifdef BLE_SIMULATION
+    conn->sim = -1;
+#endif
+    conn->notify_rb = (struct ring_buffer)RB_INIT(conn->notify_buff, BLE_MAX_NOTIFICATIONS,
+                                                  sizeof(struct ble_notification));
+    for (uint i = 0; i < BLE_MAX_SERVICES; i++) {
+        conn->services[i].set = false;
+        for (uint j = 0; j < BLE_MAX_CHARACTERISTICS; j++) {
+            conn->services[i].chars[j].set = false;
         }
+    }
+}
 
-        if (memcmp(addr, scans[i].addr, sizeof(bd_addr_t)) == 0) {
-            // already in list, just update changing values
-            scans[i].time = to_ms_since_boot(get_absolute_time());
-            scans[i].rssi = rssi;
-            return;
+// use a free slot, or drop the least recently used connection
+static int conn_alloc(void) {
+    int lru = -1;
+    for (int i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (!conns[i].set) {
+            return i;
+        }
+
+        if ((lru < 0) || (conns[i].last_used < conns[lru].last_used)) {
+            lru = i;
         }
     }
 
-    if (unused < 0) {
-        debug("no space in scan results for %s", bd_addr_to_str(addr));
+    debug("dropping connection to %s", bd_addr_to_str(conns[lru].addr));
+    if ((conns[lru].handle != HCI_CON_HANDLE_INVALID) && !CONN_IS_SIM(&conns[lru])) {
+        gap_disconnect(conns[lru].handle);
+    }
+    return lru;
+}
+
+static void conn_apply_profile(struct ble_connection *conn, enum ble_profile p) {
+    if ((conn->handle == HCI_CON_HANDLE_INVALID) || (conn->profile == p)) {
         return;
     }
 
-    debug("new device with addr %s", bd_addr_to_str(addr));
-    scans[unused].set = true;
-    scans[unused].time = to_ms_since_boot(get_absolute_time());
-    memcpy(scans[unused].addr, addr, sizeof(bd_addr_t));
-    scans[unused].type = type;
-    scans[unused].rssi = rssi;
-    scans[unused].name[0] = '\0';
-    scans[unused].data_len = 0;
+    if (CONN_IS_SIM(conn)) {
+        conn->profile = p;
+        return;
+    }
+
+    const struct ble_conn_params *c = &profiles[p];
+    int r = gap_update_connection_parameters(conn->handle, c->interval_min, c->interval_max,
+                                             c->latency, c->timeout);
+    if (r != ERROR_CODE_SUCCESS) {
+        debug("connection parameter update failed %d", r);
+        return;
+    }
+
+    conn->profile = p;
 }
 
-static void hci_scan_result_add_name(bd_addr_t addr, const uint8_t *data, uint8_t data_size) {
-    for (uint i = 0; i < BLE_MAX_SCAN_RESULTS; i++) {
-        if (!scans[i].set) {
-            continue;
+// BTstack only supports one outgoing connection attempt
+static void connect_cancel(void) {
+    if (gap_connect_cancel() == ERROR_CODE_SUCCESS) {
+        cancel_pending = true;
+    }
+}
+
+// stops a connection attempt, whether it was started already or not
+static void conn_cancel(struct ble_connection *conn) {
+    if (conn->id == deferred_id) {
+        deferred_id = 0;
+    } else {
+        connect_cancel();
+    }
+    conn_reset(conn);
+}
+
+static void conn_start(struct ble_connection *conn) {
+    // the controller disallows a new attempt until the cancelled one is reported
+    if (cancel_pending) {
+        debug("connecting to %s once cancelled", bd_addr_to_str(conn->addr));
+        deferred_id = conn->id;
+        return;
+    }
+
+    debug("connecting to %s", bd_addr_to_str(conn->addr));
+    uint8_t r = gap_connect(conn->addr, conn->type);
+    if (r != ERROR_CODE_SUCCESS) {
+        debug("gap_connect failed 0x%02X", r);
+        conn_reset(conn);
+    }
+}
+
+static void conn_start_deferred(void) {
+    uint32_t id = deferred_id;
+    deferred_id = 0;
+
+    for (uint i = 0; (id != 0) && (i < BLE_MAX_CONNECTIONS); i++) {
+        if (conns[i].set && (conns[i].id == id) && (conns[i].state == TC_W4_CONNECT)) {
+            conn_start(&conns[i]);
+            return;
         }
-        if (memcmp(addr, scans[i].addr, sizeof(bd_addr_t)) != 0) {
-            continue;
+    }
+}
+
+static void conn_rtt(struct ble_connection *conn, uint32_t start_us) {
+    uint32_t t = to_us_since_boot(get_absolute_time()) - start_us;
+    if ((conn->rtt.count == 0) || (t < conn->rtt.min_us)) {
+        conn->rtt.min_us = t;
+    }
+    if (t > conn->rtt.max_us) {
+        conn->rtt.max_us = t;
+    }
+    conn->rtt.sum_us += t;
+    conn->rtt.count++;
+}
+
+// the slot may be dropped and re-used for another link while waiting
+static bool conn_owned(const struct ble_connection *conn, uint32_t id, hci_con_handle_t handle) {
+    return conn->set && (conn->id == id) && (conn->handle == handle);
+}
+
+// link is up, a GATT request may be in flight
+static bool conn_up(const struct ble_connection *conn) {
+    enum ble_state s = conn->state;
+    return (s == TC_READY)
+        || (s == TC_W4_READ)
+        || (s == TC_READ_COMPLETE)
+        || (s == TC_W4_SERVICE)
+        || (s == TC_W4_CHARACTERISTIC)
+        || (s == TC_W4_WRITE)
+        || (s == TC_WRITE_COMPLETE);
+}
+
+/*
+ * Runs the main loop until the GATT request pending on conn leaves
+ * wait_state. Called without lock, returns with lock held.
+ * Returns the new state, or TC_OFF on timeout and when the link is gone.
+ * The slot is only reset on timeout while it still belongs to the link.
+ */
+static enum ble_state conn_wait(struct ble_connection *conn, enum ble_state wait_state,
+                                uint32_t timeout_ms, const char *what) {
+    cyw43_thread_enter();
+    uint32_t id = conn->id;
+    hci_con_handle_t handle = conn->handle;
+    cyw43_thread_exit();
+
+    enum ble_state r = TC_OFF;
+    uint32_t start_time = to_ms_since_boot(get_absolute_time());
+    blocking++;
+    while (1) {
+        sleep_ms(1);
+        main_loop_hw();
+
+        cyw43_thread_enter();
+        if (!conn_owned(conn, id, handle)) {
+            debug("connection lost waiting for %s", what);
+            break;
         }
 
-        uint8_t len = data_size;
-        if (len > BLE_MAX_NAME_LENGTH) {
-            len = BLE_MAX_NAME_LENGTH;
+        if (conn->state != wait_state) {
+            r = conn->state;
+            break;
         }
-        memcpy(scans[i].name, data, len);
-        scans[i].name[len] = '\0';
-        scans[i].time = to_ms_since_boot(get_absolute_time());
-        return;
+
+        uint32_t now = to_ms_since_boot(get_absolute_time());
+        if ((now - start_time) >= timeout_ms) {
+            debug("timeout waiting for %s", what);
+            conn->state = TC_READY;
+            break;
+        }
+        cyw43_thread_exit();
     }
+    blocking--;
+    return r;
+}
 
-    debug("no matching entry for %s to add name '%.*s' to", bd_addr_to_str(addr), data_size, data);
+static uint scan_hash(const bd_addr_t addr) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (uint i = 0; i < sizeof(bd_addr_t); i++) {
+        h ^= addr[i];
+        h *= 16777619u;
+    }
+    return h & (BLE_SCAN_TABLE_SIZE - 1);
 }
 
-static void hci_scan_result_add_data(bd_addr_t addr, const uint8_t *data, uint8_t data_size) {
-    for (uint i = 0; i < BLE_MAX_SCAN_RESULTS; i++) {
+static int scan_find(const bd_addr_t addr) {
+    uint i = scan_hash(addr);
+    for (uint n = 0; n < BLE_SCAN_TABLE_SIZE; n++) {
         if (!scans[i].set) {
+            return -1;
+        }
+        if (memcmp(addr, scans[i].addr, sizeof(bd_addr_t)) == 0) {
+            return i;
+        }
+        i = (i + 1) & (BLE_SCAN_TABLE_SIZE - 1);
+    }
+    return -1;
+}
+
+static void scan_remove(uint i) {
+    // backward shift deletion, keeps probe chains intact without tombstones
+    uint j = i;
+    while (1) {
+        j = (j + 1) & (BLE_SCAN_TABLE_SIZE - 1);
+        if (!scans[j].set) {
+            break;
+        }
+
+        // entry at j may only move if its home slot is not in (i, j]
+        uint k = scan_hash(scans[j].addr);
+        bool stays = (i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j));
+        if (stays) {
             continue;
         }
-        if (memcmp(addr, scans[i].addr, sizeof(bd_addr_t)) != 0) {
+
+        memcpy(&scans[i], &scans[j], sizeof(struct ble_scan_result));
+        i = j;
+    }
+
+    scans[i].set = false;
+    scan_count--;
+}
+
+static bool scan_evict(void) {
+    // drop the least recently seen device we don't know how to talk to
+    int lru = -1;
+    for (uint i = 0; i < BLE_SCAN_TABLE_SIZE; i++) {
+        if ((!scans[i].set) || (scans[i].dev != DEV_UNKNOWN)
+            || (conn_by_addr(scans[i].addr) >= 0)) {
             continue;
         }
 
-        uint8_t len = data_size;
-        if (len > BLE_MAX_DATA_LENGTH) {
-            len = BLE_MAX_DATA_LENGTH;
+        if ((lru < 0) || ((int32_t)(scans[i].time - scans[lru].time) < 0)) {
+            lru = i;
         }
-        memcpy(scans[i].data, data, len);
-        scans[i].data_len = len;
+    }
+
+    if (lru < 0) {
+        return false;
+    }
+
+    //debug("evicting %s", bd_addr_to_str(scans[lru].addr));
+    scan_remove(lru);
+    scan_evicted++;
+    return true;
+}
+
+static void hci_add_scan_result(bd_addr_t addr, bd_addr_type_t type, int8_t rssi) {
+    int i = scan_find(addr);
+    if (i >= 0) {
+        // already in list, just update changing values
         scans[i].time = to_ms_since_boot(get_absolute_time());
+        scans[i].rssi = rssi;
+        return;
+    }
+
+    if ((scan_count >= BLE_MAX_SCAN_RESULTS) && !scan_evict()) {
+        //debug("no space in scan results for %s", bd_addr_to_str(addr));
+        scan_dropped++;
+        return;
+    }
+
+    i = scan_hash(addr);
+    while (scans[i].set) {
+        i = (i + 1) & (BLE_SCAN_TABLE_SIZE - 1);
+    }
+
+    debug("new device with addr %s", bd_addr_to_str(addr));
+    scans[i].set = true;
+    scans[i].time = to_ms_since_boot(get_absolute_time());
+    memcpy(scans[i].addr, addr, sizeof(bd_addr_t));
+    scans[i].type = type;
+    scans[i].rssi = rssi;
+    scans[i].dev = DEV_UNKNOWN;
+    scans[i].name[0] = '\0';
+    scans[i].data_len = 0;
+    scan_count++;
+}
+
+static void hci_scan_result_add_name(bd_addr_t addr, const uint8_t *data, uint8_t data_size) {
+    int i = scan_find(addr);
+    if (i < 0) {
+        //debug("no matching entry for %s to add name '%.*s' to", bd_addr_to_str(addr), data_size, data);
+        return;
+    }
+
+    uint8_t len = data_size;
+    if (len > BLE_MAX_NAME_LENGTH) {
+        len = BLE_MAX_NAME_LENGTH;
+    }
+    memcpy(scans[i].name, data, len);
+    scans[i].name[len] = '\0';
+    scans[i].time = to_ms_since_boot(get_absolute_time());
+
+    // classify once here, instead of on every menu redraw
+    scans[i].dev = models_filter_name(scans[i].name);
+}
+
+static void hci_scan_result_add_data(bd_addr_t addr, const uint8_t *data, uint8_t data_size) {
+    int i = scan_find(addr);
+    if (i < 0) {
+        //debug("no matching entry for %s to add data to", bd_addr_to_str(addr));
+        return;
+    }
+
+    uint8_t len = data_size;
+    if (len > BLE_MAX_DATA_LENGTH) {
+        len = BLE_MAX_DATA_LENGTH;
+    }
+    memcpy(scans[i].data, data, len);
+    scans[i].data_len = len;
+    scans[i].time = to_ms_since_boot(get_absolute_time());
+}
+
+static void hci_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size);
+
+static int hci_adopt_known(bd_addr_t addr, bd_addr_type_t type) {
+    debug("known device %s connected", bd_addr_to_str(addr));
+
+    int c = conn_alloc();
+    conn_reset(&conns[c]);
+    conns[c].set = true;
+    conns[c].id = ++conn_ids;
+    conns[c].state = TC_W4_CONNECT;
+    memcpy(conns[c].addr, addr, sizeof(bd_addr_t));
+    conns[c].type = type;
+    conns[c].last_used = to_ms_since_boot(get_absolute_time());
+    if ((active < 0) || !conns[active].set) {
+        active = c;
+    }
+
+    // peripherals stop advertising while connected, so make sure it shows up
+    if (scan_find(addr) < 0) {
+        hci_add_scan_result(addr, type, INT8_MIN);
+    }
+    int k = models_known_find(known, known_count, addr);
+    int s = scan_find(addr);
+    if ((k >= 0) && (s >= 0) && (scans[s].dev == DEV_UNKNOWN)) {
+        scans[s].dev = known[k].dev;
+    }
+
+    return c;
+}
+
+static void hci_connection_complete(uint8_t *packet) {
+    bd_addr_t addr;
+    hci_subevent_le_connection_complete_get_peer_address(packet, addr);
+    uint8_t status = hci_subevent_le_connection_complete_get_status(packet);
+    int c = conn_by_addr(addr);
+    if ((c < 0) && known_pending) {
+        known_pending = false;
+        if (status != ERROR_CODE_SUCCESS) {
+            debug("known device connection stopped 0x%02X", status);
+            return;
+        }
+        c = hci_adopt_known(addr, hci_subevent_le_connection_complete_get_peer_address_type(packet));
+    } else if ((c < 0) || (conns[c].state != TC_W4_CONNECT)) {
+        debug("unexpected connection to %s", bd_addr_to_str(addr));
         return;
     }
 
-    debug("no matching entry for %s to add data to", bd_addr_to_str(addr));
+    if (status != ERROR_CODE_SUCCESS) {
+        debug("connection to %s failed 0x%02X", bd_addr_to_str(addr), status);
+        conn_reset(&conns[c]);
+        return;
+    }
+
+    debug("connection complete");
+    conns[c].handle = hci_subevent_le_connection_complete_get_connection_handle(packet);
+    conns[c].interval = hci_subevent_le_connection_complete_get_conn_interval(packet);
+    conns[c].state = TC_READY;
+
+    // negotiate larger MTU right away, instead of before first request
+    gatt_client_send_mtu_negotiation(hci_event_handler, conns[c].handle);
+
+    // background links don't need a short interval
+    conn_apply_profile(&conns[c], (c == active) ? profile : BLE_PROFILE_IDLE);
 }
 
 static void hci_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet, uint16_t size) {
@@ -179,6 +620,12 @@ static void hci_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *pa
             } else {
                 debug("BTstack down (%d)", btstack_event_state_get_state(packet));
                 state = TC_OFF;
+                for (uint i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+                    conn_reset(&conns[i]);
+                }
+                known_pending = false;
+                cancel_pending = false;
+                deferred_id = 0;
             }
         break;
 
@@ -234,14 +681,36 @@ static void hci_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *pa
 
     case HCI_EVENT_LE_META:
         switch (hci_event_le_meta_get_subevent_code(packet)) {
-            case HCI_SUBEVENT_LE_CONNECTION_COMPLETE:
-                if (state != TC_W4_CONNECT) {
+            case HCI_SUBEVENT_LE_CONNECTION_COMPLETE: {
+                uint8_t status = hci_subevent_le_connection_complete_get_status(packet);
+                if (!cancel_pending) {
+                    hci_connection_complete(packet);
+                    break;
+                }
+
+                // end of the cancelled attempt, or it connected just before
+                cancel_pending = false;
+                if (status == ERROR_CODE_SUCCESS) {
+                    hci_connection_complete(packet);
+                } else {
+                    debug("connection attempt cancelled 0x%02X", status);
+                    known_pending = false;
+                }
+                conn_start_deferred();
+                break;
+            }
+
+            case HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE: {
+                hci_con_handle_t handle = hci_subevent_le_connection_update_complete_get_connection_handle(packet);
+                struct ble_connection *conn = conn_by_handle(handle);
+                if (conn == NULL) {
                     return;
                 }
-                debug("connection complete");
-                connection_handle = hci_subevent_le_connection_complete_get_connection_handle(packet);
-                state = TC_READY;
+
+                conn->interval = hci_subevent_le_connection_update_complete_get_conn_interval(packet);
+                debug("connection interval now %.2fms", conn->interval * 1.25f);
                 break;
+            }
 
             default:
                 //debug("unexpected LE meta event 0x%02X", hci_event_le_meta_get_subevent_code(packet));
@@ -249,100 +718,133 @@ static void hci_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *pa
         }
         break;
 
-    case HCI_EVENT_DISCONNECTION_COMPLETE:
-        debug("disconnected");
-        connection_handle = HCI_CON_HANDLE_INVALID;
-        state = TC_IDLE;
+    case HCI_EVENT_DISCONNECTION_COMPLETE: {
+        struct ble_connection *conn = conn_by_handle(hci_event_disconnection_complete_get_connection_handle(packet));
+        if (conn == NULL) {
+            // slot has already been re-used
+            return;
+        }
+
+        debug("disconnected from %s", bd_addr_to_str(conn->addr));
+        conn_reset(conn);
         break;
+    }
 
-    case GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT:
-        if (state != TC_W4_READ) {
-            debug("gatt value query result in invalid state %d", state);
+    case GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT: {
+        struct ble_connection *conn = conn_by_handle(gatt_event_characteristic_value_query_result_get_handle(packet));
+        if ((conn == NULL) || (conn->state != TC_W4_READ)) {
+            debug("gatt value query result in invalid state %d", conn ? (int)conn->state : -1);
             return;
         }
         uint16_t len = gatt_event_characteristic_value_query_result_get_value_length(packet);
-        if ((read_len + len) > BLE_MAX_VALUE_LEN) {
-            debug("not enough space for value (%d + %d > %d)", read_len, len, BLE_MAX_VALUE_LEN);
+        if ((conn->read_len + len) > BLE_MAX_VALUE_LEN) {
+            debug("not enough space for value (%d + %d > %d)", conn->read_len, len, BLE_MAX_VALUE_LEN);
             return;
         }
-        memcpy(data_buff + read_len,
+        memcpy(conn->data_buff + conn->read_len,
                gatt_event_characteristic_value_query_result_get_value(packet),
                len);
-        read_len += len;
+        conn->read_len += len;
         break;
+    }
 
-    case GATT_EVENT_SERVICE_QUERY_RESULT:
-        if (state != TC_W4_SERVICE) {
-            debug("gatt service query result in invalid state %d", state);
+    case GATT_EVENT_SERVICE_QUERY_RESULT: {
+        struct ble_connection *conn = conn_by_handle(gatt_event_service_query_result_get_handle(packet));
+        if ((conn == NULL) || (conn->state != TC_W4_SERVICE)) {
+            debug("gatt service query result in invalid state %d", conn ? (int)conn->state : -1);
             return;
         }
-        gatt_event_service_query_result_get_service(packet, &services[service_idx].service);
-        //debug("got service %s result", uuid128_to_str(services[service_idx].service.uuid128));
+        gatt_event_service_query_result_get_service(packet, &conn->services[conn->service_idx].service);
+        //debug("got service %s result", uuid128_to_str(conn->services[conn->service_idx].service.uuid128));
         break;
+    }
 
-    case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT:
-        if (state != TC_W4_CHARACTERISTIC) {
-            debug("gatt characteristic query result in invalid state %d", state);
+    case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT: {
+        struct ble_connection *conn = conn_by_handle(gatt_event_characteristic_query_result_get_handle(packet));
+        if ((conn == NULL) || (conn->state != TC_W4_CHARACTERISTIC)) {
+            debug("gatt characteristic query result in invalid state %d", conn ? (int)conn->state : -1);
             return;
         }
-        gatt_event_characteristic_query_result_get_characteristic(packet, &services[service_idx].chars[characteristic_idx].c);
-        //debug("got characteristic %s result", uuid128_to_str(services[service_idx].chars[characteristic_idx].c.uuid128));
+        gatt_event_characteristic_query_result_get_characteristic(packet, &conn->services[conn->service_idx].chars[conn->characteristic_idx].c);
+        //debug("got characteristic %s result", uuid128_to_str(conn->services[conn->service_idx].chars[conn->characteristic_idx].c.uuid128));
         break;
+    }
 
     case GATT_EVENT_QUERY_COMPLETE: {
+        struct ble_connection *conn = conn_by_handle(gatt_event_query_complete_get_handle(packet));
+        if (conn == NULL) {
+            debug("gatt query complete for unknown connection");
+            return;
+        }
+
         uint8_t att_status = gatt_event_query_complete_get_att_status(packet);
         if (att_status != ATT_ERROR_SUCCESS){
-            debug("query result has ATT Error 0x%02x in %d", att_status, state);
-            state = TC_READY;
+            debug("query result has ATT Error 0x%02x in %d", att_status, conn->state);
+            conn->state = TC_READY;
             break;
         }
 
-        switch (state) {
+        switch (conn->state) {
         case TC_W4_READ:
-            state = TC_READ_COMPLETE;
+            conn->state = TC_READ_COMPLETE;
             break;
 
         case TC_W4_SERVICE:
-            //debug("service %s complete", uuid128_to_str(services[service_idx].service.uuid128));
-            state = TC_READY;
+            //debug("service %s complete", uuid128_to_str(conn->services[conn->service_idx].service.uuid128));
+            conn->state = TC_READY;
             break;
 
         case TC_W4_CHARACTERISTIC:
-            //debug("characteristic %s complete", uuid128_to_str(services[service_idx].chars[characteristic_idx].c.uuid128));
-            state = TC_READY;
+            //debug("characteristic %s complete", uuid128_to_str(conn->services[conn->service_idx].chars[conn->characteristic_idx].c.uuid128));
+            conn->state = TC_READY;
             break;
 
         case TC_W4_WRITE:
             //debug("write complete");
-            state = TC_WRITE_COMPLETE;
+            conn->state = TC_WRITE_COMPLETE;
             break;
 
         case TC_W4_NOTIFY_ENABLE:
             //debug("notify enable complete");
-            state = TC_NOTIFY_ENABLED;
+            conn->state = TC_NOTIFY_ENABLED;
             break;
 
         default:
-            debug("gatt query complete in invalid state %d", state);
+            debug("gatt query complete in invalid state %d", conn->state);
             break;
         }
         break;
     }
 
+    case GATT_EVENT_MTU: {
+        struct ble_connection *conn = conn_by_handle(gatt_event_mtu_get_handle(packet));
+        if (conn == NULL) {
+            return;
+        }
+
+        conn->mtu = gatt_event_mtu_get_MTU(packet);
+        debug("mtu now %d", conn->mtu);
+        break;
+    }
+
     case GATT_EVENT_NOTIFICATION: {
-        if ((state != TC_READY) && (state != TC_WRITE_COMPLETE)) {
-            debug("gatt notification in invalid state %d", state);
+        struct ble_connection *conn = conn_by_handle(gatt_event_notification_get_handle(packet));
+        if (conn == NULL) {
+            debug("gatt notification for unknown connection");
             return;
         }
 
-        uint16_t value_length = gatt_event_notification_get_value_length(packet);
-        const uint8_t *value = gatt_event_notification_get_value(packet);
-        value_handle = gatt_event_notification_get_value_handle(packet);
-        if ((read_len + value_length) <= BLE_MAX_VALUE_LEN) {
-            memcpy(data_buff + read_len, value, value_length);
-            read_len += value_length;
+        struct ble_notification n;
+        n.value_handle = gatt_event_notification_get_value_handle(packet);
+        n.len = gatt_event_notification_get_value_length(packet);
+        if (n.len > BLE_MAX_VALUE_LEN) {
+            debug("notification too long (%d > %d)", n.len, BLE_MAX_VALUE_LEN);
+            n.len = BLE_MAX_VALUE_LEN;
         }
+        memcpy(n.data, gatt_event_notification_get_value(packet), n.len);
 
+        // oldest entry is overwritten when queue is full
+        rb_push(&conn->notify_rb, &n);
         break;
     }
 
@@ -352,27 +854,183 @@ static void hci_event_handler(uint8_t packet_type, uint16_t channel, uint8_t *pa
     }
 }
 
+#ifdef BLE_SIMULATION
+static void sim_scan(void) {
+    for (uint i = 0; i < ble_sim_count(); i++) {
+        const struct ble_sim_advert *a = ble_sim_get_advert(i);
+        bd_addr_t addr;
+        memcpy(addr, a->addr, sizeof(bd_addr_t));
+
+        hci_add_scan_result(addr, a->type, a->rssi);
+        hci_scan_result_add_name(addr, (const uint8_t *)a->name, strlen(a->name));
+        if (a->data_len > 0) {
+            hci_scan_result_add_data(addr, a->data, a->data_len);
+        }
+    }
+}
+
+static void sim_wait(uint32_t ms) {
+    uint32_t start_time = to_ms_since_boot(get_absolute_time());
+    blocking++;
+    while ((to_ms_since_boot(get_absolute_time()) - start_time) < ms) {
+        sleep_ms(1);
+        main_loop_hw();
+    }
+    blocking--;
+}
+
+// called with lock held, returns without
+static int32_t sim_read(struct ble_connection *conn, const uint8_t *characteristic,
+                        uint8_t *buff, uint16_t buff_len) {
+    round_trips++;
+    conn->state = TC_W4_READ;
+    int dev = conn->sim;
+    uint32_t id = conn->id;
+    hci_con_handle_t handle = conn->handle;
+    bool ok = ble_sim_link();
+    uint32_t rtt_start = to_us_since_boot(get_absolute_time());
+    cyw43_thread_exit();
+
+    sim_wait(ok ? ble_sim_latency() : BLE_READ_TIMEOUT_MS);
+    int32_t r = ok ? ble_sim_read(dev, characteristic, buff, buff_len) : -3;
+    if (!ok) {
+        debug("timeout waiting for read");
+    }
+
+    cyw43_thread_enter();
+    if (!conn_owned(conn, id, handle)) {
+        cyw43_thread_exit();
+        debug("connection lost waiting for read");
+        return -3;
+    }
+    conn->state = TC_READY;
+    if (r >= 0) {
+        conn_rtt(conn, rtt_start);
+    }
+    cyw43_thread_exit();
+    return r;
+}
+
+// called with lock held, value is kept until the link latency passed
+static int8_t sim_read_start(struct ble_connection *conn, const uint8_t *characteristic) {
+    round_trips++;
+    conn->state = TC_W4_READ;
+    conn->async_start = to_ms_since_boot(get_absolute_time());
+    conn->async_rtt = to_us_since_boot(get_absolute_time());
+
+    int32_t r = ble_sim_read(conn->sim, characteristic,
+                             conn->data_buff, sizeof(conn->data_buff));
+    conn->read_len = (r > 0) ? r : 0;
+    conn->sim_due = ((r > 0) && ble_sim_link()) ? (conn->async_start + ble_sim_latency()) : 0;
+    return 0;
+}
+
+// called with lock held, returns without
+static int8_t sim_write(struct ble_connection *conn, int srvc, int ch,
+                        const uint8_t *characteristic,
+                        const uint8_t *buff, uint16_t buff_len) {
+    round_trips++;
+    conn->state = TC_W4_WRITE;
+    int dev = conn->sim;
+    uint32_t id = conn->id;
+    hci_con_handle_t handle = conn->handle;
+    bool ok = ble_sim_link();
+    uint32_t rtt_start = to_us_since_boot(get_absolute_time());
+    cyw43_thread_exit();
+
+    sim_wait(ok ? ble_sim_latency() : BLE_WRTE_TIMEOUT_MS);
+    if (!ok) {
+        debug("timeout waiting for write");
+        cyw43_thread_enter();
+        if (conn_owned(conn, id, handle)) {
+            conn->state = TC_READY;
+        }
+        cyw43_thread_exit();
+        return -7;
+    }
+
+    struct ble_notification n;
+    int32_t r = ble_sim_write(dev, characteristic, buff, buff_len, n.data, sizeof(n.data));
+
+    cyw43_thread_enter();
+    if (!conn_owned(conn, id, handle)) {
+        cyw43_thread_exit();
+        debug("connection lost waiting for write");
+        return -7;
+    }
+    conn->state = TC_READY;
+    conn_rtt(conn, rtt_start);
+    if (r > 0) {
+        // peripheral answers with a notification, eg. Venty
+        n.value_handle = conn->services[srvc].chars[ch].c.value_handle;
+        n.len = r;
+        rb_push(&conn->notify_rb, &n);
+    }
+    cyw43_thread_exit();
+    return (r < 0) ? -8 : 0;
+}
+
+// called with lock held, like sim_read_start() the value is written right away
+static int8_t sim_write_start(struct ble_connection *conn, int srvc, int ch,
+                              const uint8_t *characteristic,
+                              const uint8_t *buff, uint16_t buff_len) {
+    round_trips++;
+    conn->state = TC_W4_WRITE;
+    conn->async_start = to_ms_since_boot(get_absolute_time());
+    conn->async_rtt = to_us_since_boot(get_absolute_time());
+    conn->sim_due = 0;
+
+    if (!ble_sim_link()) {
+        return 0;
+    }
+
+    struct ble_notification n;
+    int32_t r = ble_sim_write(conn->sim, characteristic, buff, buff_len, n.data, sizeof(n.data));
+    if (r < 0) {
+        conn->state = TC_READY;
+        return -8;
+    }
+    if (r > 0) {
+        n.value_handle = conn->services[srvc].chars[ch].c.value_handle;
+        n.len = r;
+        rb_push(&conn->notify_rb, &n);
+    }
+    conn->sim_due = conn->async_start + ble_sim_latency();
+    return 0;
+}
+#endif // BLE_SIMULATION
+
 void ble_init(void) {
     cyw43_thread_enter();
 
     state = TC_OFF;
-    for (uint i = 0; i < BLE_MAX_SCAN_RESULTS; i++) {
+    for (uint i = 0; i < BLE_SCAN_TABLE_SIZE; i++) {
         scans[i].set = false;
     }
-    for (uint i = 0; i < BLE_MAX_SERVICES; i++) {
-        services[i].set = false;
-        for (uint j = 0; j < BLE_MAX_CHARACTERISTICS; j++) {
-            services[i].chars[j].set = false;
-        }
+    scan_count = 0;
+    for (uint i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        conn_reset(&conns[i]);
     }
+    active = -1;
+    known_pending = false;
 
     cyw43_thread_exit();
 
+#ifdef BLE_SIMULATION
+    ble_sim_init();
+#endif
+
     l2cap_init();
     sm_init();
     sm_set_io_capabilities(IO_CAPABILITY_NO_INPUT_NO_OUTPUT);
 
     gatt_client_init();
+    gatt_client_mtu_enable_auto_negotiation(0);
+
+    // new connections always start out interactive
+    const struct ble_conn_params *c = &profiles[BLE_PROFILE_INTERACTIVE];
+    gap_set_connection_parameters(0x0060, 0x0030, c->interval_min, c->interval_max,
+                                  c->latency, c->timeout, 0x0002, 0x0030);
 
     hci_event_callback_registration.callback = &hci_event_handler;
     hci_add_event_handler(&hci_event_callback_registration);
@@ -423,128 +1081,478 @@ void ble_scan(enum ble_scan_mode mode) {
             ble_scan(1);
             return;
 
-        default:
-            debug("invalid state %d", state);
-            break;
-        }
-        break;
+        default:
+            debug("invalid state %d", state);
+            break;
+        }
+        break;
+
+    default:
+        debug("invalid mode %d", mode);
+        break;
+    }
+
+    cyw43_thread_exit();
+}
+
+int32_t ble_get_scan_results(struct ble_scan_result *buf, uint16_t len) {
+    if (!buf || (len <= 0)) {
+        return -1;
+    }
+
+    cyw43_thread_enter();
+
+    if (state == TC_OFF) {
+        cyw43_thread_exit();
+        return -1;
+    }
+
+    // only age out entries while scanning, otherwise keep results cached.
+    // connected devices usually stop advertising, so keep them as well.
+    if (state == TC_W4_SCAN) {
+        uint32_t now = to_ms_since_boot(get_absolute_time());
+        for (uint i = 0; i < BLE_SCAN_TABLE_SIZE; i++) {
+            // removal may shift another entry into this slot, so check again
+            while (scans[i].set
+                   && ((now - scans[i].time) >= BLE_MAX_SCAN_AGE_MS)
+                   && (conn_by_addr(scans[i].addr) < 0)) {
+                //debug("removing %s due to age", bd_addr_to_str(scans[i].addr));
+                scan_remove(i);
+            }
+        }
+
+#ifdef BLE_SIMULATION
+        sim_scan();
+#endif
+    }
+
+    // insertion sort by signal strength, strongest first
+    uint16_t pos = 0;
+    for (uint i = 0; i < BLE_SCAN_TABLE_SIZE; i++) {
+        if (!scans[i].set) {
+            continue;
+        }
+
+        int j = pos;
+        if (pos >= len) {
+            // buffer is full, only replace the weakest entry
+            if (scans[i].rssi <= buf[len - 1].rssi) {
+                continue;
+            }
+            j = len - 1;
+        } else {
+            pos++;
+        }
+
+        while ((j > 0) && (buf[j - 1].rssi < scans[i].rssi)) {
+            memcpy(buf + j, buf + j - 1, sizeof(struct ble_scan_result));
+            j--;
+        }
+        memcpy(buf + j, scans + i, sizeof(struct ble_scan_result));
+    }
+
+    cyw43_thread_exit();
+    return pos;
+}
+
+void ble_scan_status(void) {
+    cyw43_thread_enter();
+    uint count = scan_count;
+    uint32_t evicted = scan_evicted;
+    uint32_t dropped = scan_dropped;
+    cyw43_thread_exit();
+
+    println("Scan table: %d / %d entries (%d slots)",
+            count, BLE_MAX_SCAN_RESULTS, BLE_SCAN_TABLE_SIZE);
+    println("Evicted unknown devices: %d", evicted);
+    println("Dropped advertisements: %d", dropped);
+}
+
+void ble_connect(bd_addr_t addr, bd_addr_type_t type) {
+    cyw43_thread_enter();
+
+    if (state == TC_OFF) {
+        debug("invalid state for connect %d", state);
+        cyw43_thread_exit();
+        return;
+    }
+
+    // already connected (or connecting) in the background, just switch over
+    int c = conn_by_addr(addr);
+    if (c >= 0) {
+        debug("switching to %s", bd_addr_to_str(addr));
+        if ((active >= 0) && (active != c) && conns[active].set) {
+            conn_apply_profile(&conns[active], BLE_PROFILE_IDLE);
+        }
+        active = c;
+        conn_apply_profile(&conns[c], profile);
+        conns[c].last_used = to_ms_since_boot(get_absolute_time());
+        cyw43_thread_exit();
+        return;
+    }
+
+    if (known_pending && !known_cancelled) {
+        // BTstack only supports one outgoing connection attempt
+        debug("cancel connecting to known devices");
+        connect_cancel();
+        known_cancelled = true;
+    }
+
+    for (uint i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (conns[i].set && (conns[i].state == TC_W4_CONNECT)) {
+            // BTstack only supports one outgoing connection attempt
+            debug("cancel connecting to %s", bd_addr_to_str(conns[i].addr));
+            conn_cancel(&conns[i]);
+        }
+    }
+
+    if (state == TC_W4_SCAN) {
+        cyw43_thread_exit();
+        ble_scan(0);
+        cyw43_thread_enter();
+    }
+
+    if ((active >= 0) && conns[active].set) {
+        conn_apply_profile(&conns[active], BLE_PROFILE_IDLE);
+    }
+
+    c = conn_alloc();
+    conn_reset(&conns[c]);
+    conns[c].set = true;
+    conns[c].id = ++conn_ids;
+    conns[c].state = TC_W4_CONNECT;
+    memcpy(conns[c].addr, addr, sizeof(bd_addr_t));
+    conns[c].type = type;
+    conns[c].last_used = to_ms_since_boot(get_absolute_time());
+    active = c;
+
+#ifdef BLE_SIMULATION
+    int sim = ble_sim_find(addr);
+    if (sim >= 0) {
+        debug("connecting to simulated %s", bd_addr_to_str(addr));
+        conns[c].sim = sim;
+        conns[c].handle = BLE_SIM_HANDLE_BASE + c;
+        conns[c].state = TC_READY;
+        conns[c].interval = profiles[BLE_PROFILE_INTERACTIVE].interval_max;
+        cyw43_thread_exit();
+        return;
+    }
+#endif
+
+    conn_start(&conns[c]);
+
+    cyw43_thread_exit();
+}
+
+int8_t ble_connect_known(const struct known_device *list, uint16_t count) {
+    if ((list == NULL) || (count == 0)) {
+        return -1;
+    }
+
+    cyw43_thread_enter();
+
+    if ((state == TC_OFF) || known_pending || cancel_pending) {
+        debug("invalid state for known connect %d", state);
+        cyw43_thread_exit();
+        return -2;
+    }
+
+    for (uint i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (conns[i].set && (conns[i].state == TC_W4_CONNECT)) {
+            debug("already connecting to %s", bd_addr_to_str(conns[i].addr));
+            cyw43_thread_exit();
+            return -3;
+        }
+    }
+
+    if (count > MODELS_MAX_KNOWN) {
+        count = MODELS_MAX_KNOWN;
+    }
+    memcpy(known, list, count * sizeof(struct known_device));
+    known_count = count;
+
+    // let the controller connect to whichever known device advertises first
+    gap_whitelist_clear();
+    uint16_t added = 0;
+    for (uint16_t i = 0; i < known_count; i++) {
+        if (conn_by_addr(known[i].addr) >= 0) {
+            continue;
+        }
+
+        debug("adding %s to accept list", bd_addr_to_str(known[i].addr));
+        if (gap_whitelist_add(known[i].type, known[i].addr) == ERROR_CODE_SUCCESS) {
+            added++;
+        }
+    }
+
+    if (added == 0) {
+        cyw43_thread_exit();
+        return -4;
+    }
+
+    uint8_t r = gap_connect_with_whitelist();
+    if (r != ERROR_CODE_SUCCESS) {
+        debug("gap_connect_with_whitelist failed 0x%02X", r);
+        cyw43_thread_exit();
+        return -5;
+    }
+
+    known_pending = true;
+    known_cancelled = false;
+
+    cyw43_thread_exit();
+    return 0;
+}
+
+void ble_connect_known_cancel(void) {
+    cyw43_thread_enter();
+
+    // known_pending is cleared by the connection complete event.
+    // the device may still have connected before the cancel went through.
+    if (known_pending && !known_cancelled) {
+        debug("cancel connecting to known devices");
+        connect_cancel();
+        known_cancelled = true;
+    }
+
+    cyw43_thread_exit();
+}
+
+bool ble_is_connected(void) {
+    cyw43_thread_enter();
+
+    bool v = false;
+    if ((active >= 0) && conns[active].set) {
+        v = conn_up(&conns[active]);
+    }
+
+    cyw43_thread_exit();
+    return v;
+}
+
+bool ble_is_connected_to(bd_addr_t addr) {
+    cyw43_thread_enter();
+
+    int c = conn_by_addr(addr);
+    bool v = (c >= 0) && (conns[c].state != TC_W4_CONNECT);
+
+    cyw43_thread_exit();
+    return v;
+}
+
+uint32_t ble_get_connection_id(void) {
+    cyw43_thread_enter();
+
+    uint32_t id = 0;
+    if ((active >= 0) && conns[active].set) {
+        id = conns[active].id;
+    }
+
+    cyw43_thread_exit();
+    return id;
+}
+
+uint16_t ble_get_mtu(void) {
+    cyw43_thread_enter();
+
+    uint16_t mtu = 0;
+    if ((active >= 0) && conns[active].set) {
+        mtu = conns[active].mtu;
+    }
+
+    cyw43_thread_exit();
+    return mtu;
+}
+
+int8_t ble_get_active_addr(bd_addr_t addr) {
+    cyw43_thread_enter();
+
+    int8_t r = -1;
+    if ((active >= 0) && conns[active].set) {
+        memcpy(addr, conns[active].addr, sizeof(bd_addr_t));
+        r = 0;
+    }
+
+    cyw43_thread_exit();
+    return r;
+}
 
-    default:
-        debug("invalid mode %d", mode);
-        break;
+void ble_disconnect(void) {
+    cyw43_thread_enter();
+
+    struct ble_connection *conn = conn_active();
+    if ((conn != NULL) && CONN_IS_SIM(conn)) {
+        debug("disconnecting simulated device");
+        conn_reset(conn);
+    } else if ((conn != NULL) && conn_up(conn)) {
+        debug("disconnecting");
+        gap_disconnect(conn->handle);
+    } else if ((conn != NULL) && (conn->state == TC_W4_CONNECT)) {
+        debug("cancel connecting");
+        conn_cancel(conn);
+    } else {
+        debug("invalid state for disconnect %d", conn ? (int)conn->state : -1);
     }
 
     cyw43_thread_exit();
 }
 
-int32_t ble_get_scan_results(struct ble_scan_result *buf, uint16_t len) {
-    if (!buf || (len <= 0)) {
-        return -1;
+void ble_set_profile(enum ble_profile p) {
+    if (p >= BLE_PROFILE_COUNT) {
+        return;
     }
 
     cyw43_thread_enter();
 
-    if (state == TC_OFF) {
-        cyw43_thread_exit();
-        return -1;
+    profile = p;
+    if ((active >= 0) && conns[active].set && (conns[active].state != TC_W4_CONNECT)) {
+        conn_apply_profile(&conns[active], p);
     }
 
-    uint16_t pos = 0;
-    for (uint16_t i = 0; i < BLE_MAX_SCAN_RESULTS; i++) {
-        if (!scans[i].set) {
-            continue;
-        }
+    cyw43_thread_exit();
+}
 
-        // only age out entries while scanning, otherwise keep results cached
-        if (state == TC_W4_SCAN) {
-            uint32_t diff = to_ms_since_boot(get_absolute_time()) - scans[i].time;
-            if (diff >= BLE_MAX_SCAN_AGE_MS) {
-                //debug("removing %s due to age", bd_addr_to_str(scans[i].addr));
-                scans[i].set = false;
-            }
-        }
+void ble_connection_status(void) {
+    struct {
+        bool set;
+        bd_addr_t addr;
+        hci_con_handle_t handle;
+        enum ble_state state;
+        size_t notifications;
+        uint32_t last_used;
+        uint16_t mtu;
+        uint16_t interval;
+        enum ble_profile profile;
+        struct ble_rtt rtt;
+    } info[BLE_MAX_CONNECTIONS];
+
+    // take a snapshot so we don't print while holding the lock
+    cyw43_thread_enter();
+    int active_cached = active;
+    for (uint i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        info[i].set = conns[i].set;
+        memcpy(info[i].addr, conns[i].addr, sizeof(bd_addr_t));
+        info[i].handle = conns[i].handle;
+        info[i].state = conns[i].state;
+        info[i].notifications = rb_len(&conns[i].notify_rb);
+        info[i].last_used = conns[i].last_used;
+        info[i].mtu = conns[i].mtu;
+        info[i].interval = conns[i].interval;
+        info[i].profile = conns[i].profile;
+        info[i].rtt = conns[i].rtt;
+    }
+    cyw43_thread_exit();
 
-        memcpy(buf + pos, scans + i, sizeof(struct ble_scan_result));
-        pos++;
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    size_t count = 0;
+    for (uint i = 0; i < BLE_MAX_CONNECTIONS; i++) {
+        if (!info[i].set) {
+            continue;
+        }
 
-        if (pos >= len) {
-            break;
+        println("Connection %d%s:", i, (active_cached == (int)i) ? " (active)" : "");
+        println("  Address: %s", bd_addr_to_str(info[i].addr));
+        println("  Handle: 0x%04X", info[i].handle);
+        println("  State: %d", info[i].state);
+        println("  Notifications: %d", info[i].notifications);
+        println("  Idle: %.1fs", (now - info[i].last_used) / 1000.0f);
+        println("  MTU: %d", info[i].mtu);
+        println("  Interval: %.2fms (%s)", info[i].interval * 1.25f,
+                (info[i].profile == BLE_PROFILE_INTERACTIVE) ? "interactive" : "idle");
+        if (info[i].rtt.count > 0) {
+            println("  RTT: %.1fms avg, %.1fms min, %.1fms max (%lu)",
+                    info[i].rtt.sum_us / info[i].rtt.count / 1000.0f,
+                    info[i].rtt.min_us / 1000.0f, info[i].rtt.max_us / 1000.0f,
+                    info[i].rtt.count);
         }
+        count++;
     }
 
-    cyw43_thread_exit();
-    return pos;
+    println("Total connections: %d", count);
 }
 
-void ble_connect(bd_addr_t addr, bd_addr_type_t type) {
+int32_t ble_read(const uint8_t *characteristic, uint8_t *buff, uint16_t buff_len) {
     cyw43_thread_enter();
 
-    switch (state) {
-    case TC_W4_SCAN:
+    struct ble_connection *conn = conn_active();
+    if ((conn == NULL) || (conn->state != TC_READY)) {
         cyw43_thread_exit();
-        ble_scan(0);
-        cyw43_thread_enter();
-        break;
-
-    case TC_READY:
-        gap_disconnect(connection_handle);
-        break;
+        debug("invalid state for read (%d)", conn ? (int)conn->state : -1);
+        return -1;
+    }
 
-    case TC_IDLE:
-        break;
+#ifdef BLE_SIMULATION
+    if (CONN_IS_SIM(conn)) {
+        return sim_read(conn, characteristic, buff, buff_len);
+    }
+#endif
 
-    default:
-        debug("invalid state for connect %d", state);
+    uint8_t r = gatt_client_read_value_of_characteristics_by_uuid128(hci_event_handler,
+                                                                     conn->handle,
+                                                                     0x0001, 0xFFFF,
+                                                                     characteristic);
+    if (r != ERROR_CODE_SUCCESS) {
         cyw43_thread_exit();
-        return;
+        debug("gatt read failed %d", r);
+        return -2;
     }
 
-    debug("connecting to %s", bd_addr_to_str(addr));
-    state = TC_W4_CONNECT;
-    gap_connect(addr, type);
-
+    round_trips++;
+    conn->state = TC_W4_READ;
+    conn->read_len = 0;
+    uint32_t rtt_start = to_us_since_boot(get_absolute_time());
     cyw43_thread_exit();
-}
 
-bool ble_is_connected(void) {
-    cyw43_thread_enter();
+    enum ble_state s = conn_wait(conn, TC_W4_READ, BLE_READ_TIMEOUT_MS, "read");
+    if (s != TC_READ_COMPLETE) {
+        if (s != TC_OFF) {
+            // ATT error
+            debug("read failed");
+        }
+        cyw43_thread_exit();
+        return -3;
+    }
 
-    bool v = (state == TC_READY)
-             || (state == TC_W4_READ)
-             || (state == TC_READ_COMPLETE)
-             || (state == TC_W4_SERVICE)
-             || (state == TC_W4_CHARACTERISTIC)
-             || (state == TC_W4_WRITE)
-             || (state == TC_WRITE_COMPLETE);
+    conn->state = TC_READY;
+    conn_rtt(conn, rtt_start);
 
-    cyw43_thread_exit();
-    return v;
-}
+    if (conn->read_len > buff_len) {
+        debug("buffer too short (%d < %d)", buff_len, conn->read_len);
+        cyw43_thread_exit();
+        return -4;
+    }
 
-void ble_disconnect(void) {
-    cyw43_thread_enter();
+    memcpy(buff, conn->data_buff, conn->read_len);
 
-    if (state == TC_READY) {
-        debug("disconnecting");
-        gap_disconnect(connection_handle);
-    } else {
-        debug("invalid state for disconnect %d", state);
-    }
+    uint16_t tmp = conn->read_len;
+    conn->read_len = 0;
 
     cyw43_thread_exit();
+    return tmp;
 }
 
-int32_t ble_read(const uint8_t *characteristic, uint8_t *buff, uint16_t buff_len) {
+int8_t ble_read_start(const uint8_t *characteristic) {
     cyw43_thread_enter();
 
-    if (state != TC_READY) {
+    struct ble_connection *conn = conn_active();
+    if ((conn == NULL) || (conn->state != TC_READY)) {
         cyw43_thread_exit();
-        debug("invalid state for read (%d)", state);
+        debug("invalid state for read (%d)", conn ? (int)conn->state : -1);
         return -1;
     }
 
+    async_id = conn->id;
+
+#ifdef BLE_SIMULATION
+    if (CONN_IS_SIM(conn)) {
+        int8_t r = sim_read_start(conn, characteristic);
+        cyw43_thread_exit();
+        return r;
+    }
+#endif
+
     uint8_t r = gatt_client_read_value_of_characteristics_by_uuid128(hci_event_handler,
-                                                                     connection_handle,
+                                                                     conn->handle,
                                                                      0x0001, 0xFFFF,
                                                                      characteristic);
     if (r != ERROR_CODE_SUCCESS) {
@@ -553,64 +1561,97 @@ int32_t ble_read(const uint8_t *characteristic, uint8_t *buff, uint16_t buff_len
         return -2;
     }
 
-    state = TC_W4_READ;
-    read_len = 0;
+    round_trips++;
+    conn->state = TC_W4_READ;
+    conn->read_len = 0;
+    conn->async_start = to_ms_since_boot(get_absolute_time());
+    conn->async_rtt = to_us_since_boot(get_absolute_time());
+
     cyw43_thread_exit();
+    return 0;
+}
 
-    uint32_t start_time = to_ms_since_boot(get_absolute_time());
-    while (1) {
-        sleep_ms(1);
-        main_loop_hw();
+int32_t ble_read_poll(uint8_t *buff, uint16_t buff_len) {
+    cyw43_thread_enter();
 
-        uint32_t now = to_ms_since_boot(get_absolute_time());
-        if ((now - start_time) >= BLE_READ_TIMEOUT_MS) {
+    // only touch the link the read was started on, it is gone when re-used
+    struct ble_connection *conn = conn_by_id(async_id);
+    if ((conn == NULL) || ((conn->state != TC_W4_READ) && (conn->state != TC_READ_COMPLETE))) {
+        cyw43_thread_exit();
+        debug("no read in progress (%d)", conn ? (int)conn->state : -1);
+        return -1;
+    }
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+#ifdef BLE_SIMULATION
+    if (CONN_IS_SIM(conn) && (conn->sim_due != 0) && ((int32_t)(now - conn->sim_due) >= 0)) {
+        conn->state = TC_READ_COMPLETE;
+    }
+#endif
+
+    if (conn->state == TC_W4_READ) {
+        if ((now - conn->async_start) >= BLE_READ_TIMEOUT_MS) {
             debug("timeout waiting for read");
-            cyw43_thread_enter();
-            state = TC_READY;
+            conn->state = TC_READY;
             cyw43_thread_exit();
             return -3;
         }
 
-        cyw43_thread_enter();
-        enum ble_state state_cached = state;
         cyw43_thread_exit();
-
-        if (state_cached == TC_READ_COMPLETE) {
-            break;
-        }
+        return 0;
     }
 
-    cyw43_thread_enter();
-
-    state = TC_READY;
+    conn->state = TC_READY;
+    conn_rtt(conn, conn->async_rtt);
 
-    if (read_len > buff_len) {
-        debug("buffer too short (%d < %d)", buff_len, read_len);
+    if (conn->read_len > buff_len) {
+        debug("buffer too short (%d < %d)", buff_len, conn->read_len);
         cyw43_thread_exit();
         return -4;
     }
 
-    memcpy(buff, data_buff, read_len);
+    memcpy(buff, conn->data_buff, conn->read_len);
 
-    uint16_t tmp = read_len;
-    read_len = 0;
+    uint16_t tmp = conn->read_len;
+    conn->read_len = 0;
 
     cyw43_thread_exit();
     return tmp;
 }
 
-static int discover_service(const uint8_t *service) {
+// already discovered characteristic, without asking the peripheral
+static int find_characteristic(struct ble_connection *conn, const uint8_t *service,
+                               const uint8_t *characteristic, int *srvc) {
+    for (int i = 0; i < BLE_MAX_SERVICES; i++) {
+        if (!conn->services[i].set
+            || (memcmp(conn->services[i].service.uuid128, service, 16) != 0)) {
+            continue;
+        }
+
+        for (int j = 0; j < BLE_MAX_CHARACTERISTICS; j++) {
+            if (conn->services[i].chars[j].set
+                && (memcmp(conn->services[i].chars[j].c.uuid128, characteristic, 16) == 0)) {
+                *srvc = i;
+                return j;
+            }
+        }
+    }
+    return -1;
+}
+
+static int discover_service(struct ble_connection *conn, const uint8_t *service) {
     // check if service has already been discovered
     int srvc = -1, free_srvc = -1;
     for (int i = 0; i < BLE_MAX_SERVICES; i++) {
-        if (!services[i].set) {
+        if (!conn->services[i].set) {
             if (free_srvc < 0) {
                 free_srvc = i;
             }
             continue;
         }
 
-        if (memcmp(services[i].service.uuid128, service, 16) == 0) {
+        if (memcmp(conn->services[i].service.uuid128, service, 16) == 0) {
             srvc = i;
             break;
         }
@@ -623,12 +1664,30 @@ static int discover_service(const uint8_t *service) {
             free_srvc = 0;
         }
         srvc = free_srvc;
-        services[srvc].set = true;
+        conn->services[srvc].set = true;
 
         debug("discovering service %s at %d", uuid128_to_str(service), srvc);
+        round_trips++;
+
+#ifdef BLE_SIMULATION
+        if (CONN_IS_SIM(conn)) {
+            memcpy(conn->services[srvc].service.uuid128, service, 16);
+            uint32_t id = conn->id;
+            hci_con_handle_t handle = conn->handle;
+            cyw43_thread_exit();
+            sim_wait(ble_sim_latency());
+            cyw43_thread_enter();
+            if (!conn_owned(conn, id, handle)) {
+                cyw43_thread_exit();
+                debug("connection lost waiting for service");
+                return -3;
+            }
+            return srvc;
+        }
+#endif
 
         uint8_t r = gatt_client_discover_primary_services_by_uuid128(hci_event_handler,
-                                                                     connection_handle,
+                                                                     conn->handle,
                                                                      service);
         if (r != ERROR_CODE_SUCCESS) {
             cyw43_thread_exit();
@@ -636,51 +1695,31 @@ static int discover_service(const uint8_t *service) {
             return -2;
         }
 
-        state = TC_W4_SERVICE;
-        service_idx = srvc;
+        conn->state = TC_W4_SERVICE;
+        conn->service_idx = srvc;
         cyw43_thread_exit();
 
-        uint32_t start_time = to_ms_since_boot(get_absolute_time());
-        while (1) {
-            sleep_ms(1);
-            main_loop_hw();
-
-            uint32_t now = to_ms_since_boot(get_absolute_time());
-            if ((now - start_time) >= BLE_SRVC_TIMEOUT_MS) {
-                debug("timeout waiting for service");
-                cyw43_thread_enter();
-                state = TC_READY;
-                cyw43_thread_exit();
-                return -3;
-            }
-
-            cyw43_thread_enter();
-            enum ble_state state_cached = state;
+        if (conn_wait(conn, TC_W4_SERVICE, BLE_SRVC_TIMEOUT_MS, "service") != TC_READY) {
             cyw43_thread_exit();
-
-            if (state_cached == TC_READY) {
-                break;
-            }
+            return -3;
         }
-
-        cyw43_thread_enter();
     }
 
     return srvc;
 }
 
-static int discover_characteristic(int srvc, const uint8_t *characteristic) {
+static int discover_characteristic(struct ble_connection *conn, int srvc, const uint8_t *characteristic) {
     // check if characteristic has already been discovered
     int ch = -1, free_ch = -1;
     for (int i = 0; i < BLE_MAX_CHARACTERISTICS; i++) {
-        if (!services[srvc].chars[i].set) {
+        if (!conn->services[srvc].chars[i].set) {
             if (free_ch < 0) {
                 free_ch = i;
             }
             continue;
         }
 
-        if (memcmp(services[srvc].chars[i].c.uuid128, characteristic, 16) == 0) {
+        if (memcmp(conn->services[srvc].chars[i].c.uuid128, characteristic, 16) == 0) {
             ch = i;
             break;
         }
@@ -693,13 +1732,33 @@ static int discover_characteristic(int srvc, const uint8_t *characteristic) {
             free_ch = 0;
         }
         ch = free_ch;
-        services[srvc].chars[ch].set = true;
+        conn->services[srvc].chars[ch].set = true;
 
         debug("discovering characteristic %s at %d", uuid128_to_str(characteristic), ch);
+        round_trips++;
+
+#ifdef BLE_SIMULATION
+        if (CONN_IS_SIM(conn)) {
+            gatt_client_characteristic_t *c = &conn->services[srvc].chars[ch].c;
+            memcpy(c->uuid128, characteristic, 16);
+            c->value_handle = BLE_SIM_VALUE_HANDLE_BASE + srvc * BLE_MAX_CHARACTERISTICS + ch;
+            uint32_t id = conn->id;
+            hci_con_handle_t handle = conn->handle;
+            cyw43_thread_exit();
+            sim_wait(ble_sim_latency());
+            cyw43_thread_enter();
+            if (!conn_owned(conn, id, handle)) {
+                cyw43_thread_exit();
+                debug("connection lost waiting for characteristic");
+                return -5;
+            }
+            return ch;
+        }
+#endif
 
         uint8_t r = gatt_client_discover_characteristics_for_service_by_uuid128(hci_event_handler,
-                                                                                connection_handle,
-                                                                                &services[srvc].service,
+                                                                                conn->handle,
+                                                                                &conn->services[srvc].service,
                                                                                 characteristic);
         if (r != ERROR_CODE_SUCCESS) {
             cyw43_thread_exit();
@@ -707,34 +1766,15 @@ static int discover_characteristic(int srvc, const uint8_t *characteristic) {
             return -4;
         }
 
-        state = TC_W4_CHARACTERISTIC;
-        characteristic_idx = ch;
+        conn->state = TC_W4_CHARACTERISTIC;
+        conn->service_idx = srvc;
+        conn->characteristic_idx = ch;
         cyw43_thread_exit();
 
-        uint32_t start_time = to_ms_since_boot(get_absolute_time());
-        while (1) {
-            sleep_ms(1);
-            main_loop_hw();
-
-            uint32_t now = to_ms_since_boot(get_absolute_time());
-            if ((now - start_time) >= BLE_CHAR_TIMEOUT_MS) {
-                debug("timeout waiting for characteristic");
-                cyw43_thread_enter();
-                state = TC_READY;
-                cyw43_thread_exit();
-                return -5;
-            }
-
-            cyw43_thread_enter();
-            enum ble_state state_cached = state;
+        if (conn_wait(conn, TC_W4_CHARACTERISTIC, BLE_CHAR_TIMEOUT_MS, "characteristic") != TC_READY) {
             cyw43_thread_exit();
-
-            if (state_cached == TC_READY) {
-                break;
-            }
+            return -5;
         }
-
-        cyw43_thread_enter();
     }
 
     return ch;
@@ -744,19 +1784,20 @@ int8_t ble_write(const uint8_t *service, const uint8_t *characteristic,
                  const uint8_t *buff, uint16_t buff_len) {
     cyw43_thread_enter();
 
-    if (state != TC_READY) {
+    struct ble_connection *conn = conn_active();
+    if ((conn == NULL) || (conn->state != TC_READY)) {
         cyw43_thread_exit();
-        debug("invalid state for write (%d)", state);
+        debug("invalid state for write (%d)", conn ? (int)conn->state : -1);
         return -1;
     }
 
-    int srvc = discover_service(service);
+    int srvc = discover_service(conn, service);
     if (srvc < 0) {
         debug("error discovering service (%d)", srvc);
         return srvc;
     }
 
-    int ch = discover_characteristic(srvc, characteristic);
+    int ch = discover_characteristic(conn, srvc, characteristic);
     if (ch < 0) {
         debug("error discovering characteristic (%d)", ch);
         return ch;
@@ -765,69 +1806,156 @@ int8_t ble_write(const uint8_t *service, const uint8_t *characteristic,
     if (buff_len > BLE_MAX_VALUE_LEN) {
         buff_len = BLE_MAX_VALUE_LEN;
     }
-    memcpy(data_buff, buff, buff_len);
+
+#ifdef BLE_SIMULATION
+    if (CONN_IS_SIM(conn)) {
+        return sim_write(conn, srvc, ch, characteristic, buff, buff_len);
+    }
+#endif
+
+    memcpy(conn->data_buff, buff, buff_len);
 
     uint8_t r = gatt_client_write_value_of_characteristic(hci_event_handler,
-                                                          connection_handle,
-                                                          services[srvc].chars[ch].c.value_handle,
-                                                          buff_len, data_buff);
+                                                          conn->handle,
+                                                          conn->services[srvc].chars[ch].c.value_handle,
+                                                          buff_len, conn->data_buff);
     if (r != ERROR_CODE_SUCCESS) {
         cyw43_thread_exit();
         debug("gatt write failed %d", r);
         return -6;
     }
 
-    state = TC_W4_WRITE;
+    round_trips++;
+    conn->state = TC_W4_WRITE;
+    uint32_t rtt_start = to_us_since_boot(get_absolute_time());
     cyw43_thread_exit();
 
-    uint32_t start_time = to_ms_since_boot(get_absolute_time());
-    while (1) {
-        sleep_ms(1);
-        main_loop_hw();
+    enum ble_state s = conn_wait(conn, TC_W4_WRITE, BLE_WRTE_TIMEOUT_MS, "write");
+    if (s == TC_OFF) {
+        cyw43_thread_exit();
+        return -7;
+    }
 
-        uint32_t now = to_ms_since_boot(get_absolute_time());
-        if ((now - start_time) >= BLE_WRTE_TIMEOUT_MS) {
-            debug("timeout waiting for write");
-            cyw43_thread_enter();
-            state = TC_READY;
-            cyw43_thread_exit();
-            return -7;
-        }
+    int8_t ret = (s == TC_WRITE_COMPLETE) ? 0 : -8;
+    if (ret == 0) {
+        conn_rtt(conn, rtt_start);
+    }
+    conn->state = TC_READY;
 
-        cyw43_thread_enter();
-        enum ble_state state_cached = state;
+    cyw43_thread_exit();
+    return ret;
+}
+
+int8_t ble_write_start(const uint8_t *service, const uint8_t *characteristic,
+                       const uint8_t *buff, uint16_t buff_len) {
+    cyw43_thread_enter();
+
+    struct ble_connection *conn = conn_active();
+    if ((conn == NULL) || (conn->state != TC_READY)) {
         cyw43_thread_exit();
+        debug("invalid state for write (%d)", conn ? (int)conn->state : -1);
+        return -1;
+    }
 
-        if ((state_cached == TC_WRITE_COMPLETE) || (state_cached == TC_READY)) {
-            break;
-        }
+    // discovery would have to wait for the peripheral
+    int srvc = -1;
+    int ch = find_characteristic(conn, service, characteristic, &srvc);
+    if (ch < 0) {
+        cyw43_thread_exit();
+        debug("%s not discovered", uuid128_to_str(characteristic));
+        return -2;
+    }
+
+    if (buff_len > BLE_MAX_VALUE_LEN) {
+        buff_len = BLE_MAX_VALUE_LEN;
+    }
+
+    async_id = conn->id;
+
+#ifdef BLE_SIMULATION
+    if (CONN_IS_SIM(conn)) {
+        int8_t r = sim_write_start(conn, srvc, ch, characteristic, buff, buff_len);
+        cyw43_thread_exit();
+        return r;
+    }
+#endif
+
+    memcpy(conn->data_buff, buff, buff_len);
+
+    uint8_t r = gatt_client_write_value_of_characteristic(hci_event_handler,
+                                                          conn->handle,
+                                                          conn->services[srvc].chars[ch].c.value_handle,
+                                                          buff_len, conn->data_buff);
+    if (r != ERROR_CODE_SUCCESS) {
+        cyw43_thread_exit();
+        debug("gatt write failed %d", r);
+        return -3;
     }
 
+    round_trips++;
+    conn->state = TC_W4_WRITE;
+    conn->async_start = to_ms_since_boot(get_absolute_time());
+    conn->async_rtt = to_us_since_boot(get_absolute_time());
+
+    cyw43_thread_exit();
+    return 0;
+}
+
+int8_t ble_write_poll(void) {
     cyw43_thread_enter();
 
-    int8_t ret = (state == TC_WRITE_COMPLETE) ? 0 : -8;
-    state = TC_READY;
+    // only touch the link the write was started on, it is gone when re-used
+    struct ble_connection *conn = conn_by_id(async_id);
+    if ((conn == NULL) || ((conn->state != TC_W4_WRITE) && (conn->state != TC_WRITE_COMPLETE))) {
+        cyw43_thread_exit();
+        debug("no write in progress (%d)", conn ? (int)conn->state : -1);
+        return -1;
+    }
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+#ifdef BLE_SIMULATION
+    if (CONN_IS_SIM(conn) && (conn->sim_due != 0) && ((int32_t)(now - conn->sim_due) >= 0)) {
+        conn->state = TC_WRITE_COMPLETE;
+    }
+#endif
+
+    if (conn->state == TC_W4_WRITE) {
+        if ((now - conn->async_start) >= BLE_WRTE_TIMEOUT_MS) {
+            debug("timeout waiting for write");
+            conn->state = TC_READY;
+            cyw43_thread_exit();
+            return -3;
+        }
+
+        cyw43_thread_exit();
+        return 0;
+    }
+
+    conn->state = TC_READY;
+    conn_rtt(conn, conn->async_rtt);
 
     cyw43_thread_exit();
-    return ret;
+    return 1;
 }
 
 int8_t ble_discover(const uint8_t *service, const uint8_t *characteristic) {
     cyw43_thread_enter();
 
-    if (state != TC_READY) {
+    struct ble_connection *conn = conn_active();
+    if ((conn == NULL) || (conn->state != TC_READY)) {
         cyw43_thread_exit();
-        debug("invalid state for discovery (%d)", state);
+        debug("invalid state for discovery (%d)", conn ? (int)conn->state : -1);
         return -1;
     }
 
-    int srvc = discover_service(service);
+    int srvc = discover_service(conn, service);
     if (srvc < 0) {
         debug("error discovering service (%d)", srvc);
         return srvc;
     }
 
-    int ch = discover_characteristic(srvc, characteristic);
+    int ch = discover_characteristic(conn, srvc, characteristic);
     if (ch < 0) {
         debug("error discovering characteristic (%d)", ch);
         return ch;
@@ -840,25 +1968,28 @@ int8_t ble_discover(const uint8_t *service, const uint8_t *characteristic) {
 int8_t ble_notification_disable(const uint8_t *service, const uint8_t *characteristic) {
     cyw43_thread_enter();
 
-    if (state != TC_READY) {
+    struct ble_connection *conn = conn_active();
+    if ((conn == NULL) || (conn->state != TC_READY)) {
         cyw43_thread_exit();
-        debug("invalid state for notify (%d)", state);
+        debug("invalid state for notify (%d)", conn ? (int)conn->state : -1);
         return -1;
     }
 
-    int srvc = discover_service(service);
+    int srvc = discover_service(conn, service);
     if (srvc < 0) {
         debug("error discovering service (%d)", srvc);
         return srvc;
     }
 
-    int ch = discover_characteristic(srvc, characteristic);
+    int ch = discover_characteristic(conn, srvc, characteristic);
     if (ch < 0) {
         debug("error discovering characteristic (%d)", ch);
         return ch;
     }
 
-    gatt_client_stop_listening_for_characteristic_value_updates(&services[srvc].chars[ch].n);
+    if (!CONN_IS_SIM(conn)) {
+        gatt_client_stop_listening_for_characteristic_value_updates(&conn->services[srvc].chars[ch].n);
+    }
 
     cyw43_thread_exit();
     return 0;
@@ -867,83 +1998,82 @@ int8_t ble_notification_disable(const uint8_t *service, const uint8_t *character
 int8_t ble_notification_enable(const uint8_t *service, const uint8_t *characteristic) {
     cyw43_thread_enter();
 
-    if (state != TC_READY) {
+    struct ble_connection *conn = conn_active();
+    if ((conn == NULL) || (conn->state != TC_READY)) {
         cyw43_thread_exit();
-        debug("invalid state for notify (%d)", state);
+        debug("invalid state for notify (%d)", conn ? (int)conn->state : -1);
         return -1;
     }
 
-    int srvc = discover_service(service);
+    int srvc = discover_service(conn, service);
     if (srvc < 0) {
         debug("error discovering service (%d)", srvc);
         return srvc;
     }
 
-    int ch = discover_characteristic(srvc, characteristic);
+    int ch = discover_characteristic(conn, srvc, characteristic);
     if (ch < 0) {
         debug("error discovering characteristic (%d)", ch);
         return ch;
     }
 
-    gatt_client_listen_for_characteristic_value_updates(&services[srvc].chars[ch].n,
+    if (CONN_IS_SIM(conn)) {
+        cyw43_thread_exit();
+        return 0;
+    }
+
+    round_trips++;
+    gatt_client_listen_for_characteristic_value_updates(&conn->services[srvc].chars[ch].n,
                                                         hci_event_handler,
-                                                        connection_handle,
-                                                        &services[srvc].chars[ch].c);
+                                                        conn->handle,
+                                                        &conn->services[srvc].chars[ch].c);
 
     gatt_client_write_client_characteristic_configuration(hci_event_handler,
-                                                          connection_handle,
-                                                          &services[srvc].chars[ch].c,
+                                                          conn->handle,
+                                                          &conn->services[srvc].chars[ch].c,
                                                           GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
 
-    state = TC_W4_NOTIFY_ENABLE;
+    conn->state = TC_W4_NOTIFY_ENABLE;
     cyw43_thread_exit();
 
-    uint32_t start_time = to_ms_since_boot(get_absolute_time());
-    while (1) {
-        sleep_ms(1);
-        main_loop_hw();
-
-        uint32_t now = to_ms_since_boot(get_absolute_time());
-        if ((now - start_time) >= BLE_NOTY_TIMEOUT_MS) {
-            debug("timeout waiting for notify enable");
-            cyw43_thread_enter();
-            state = TC_READY;
-            cyw43_thread_exit();
-            return -6;
-        }
-
-        cyw43_thread_enter();
-        enum ble_state state_cached = state;
+    enum ble_state s = conn_wait(conn, TC_W4_NOTIFY_ENABLE, BLE_NOTY_TIMEOUT_MS, "notify enable");
+    if (s == TC_OFF) {
         cyw43_thread_exit();
-
-        if ((state_cached == TC_NOTIFY_ENABLED) || (state_cached == TC_READY)) {
-            break;
-        }
+        return -6;
     }
 
-    cyw43_thread_enter();
-
-    int8_t ret = (state == TC_NOTIFY_ENABLED) ? 0 : -7;
-    state = TC_READY;
+    int8_t ret = (s == TC_NOTIFY_ENABLED) ? 0 : -7;
+    conn->state = TC_READY;
 
     cyw43_thread_exit();
     return ret;
 }
 
+bool ble_is_blocking(void) {
+    return blocking > 0;
+}
+
+uint32_t ble_round_trips(void) {
+    cyw43_thread_enter();
+    uint32_t v = round_trips;
+    cyw43_thread_exit();
+    return v;
+}
+
 bool ble_notification_ready(void) {
     cyw43_thread_enter();
 
-    if (state != TC_READY) {
+    struct ble_connection *conn = conn_active();
+    if ((conn == NULL) || !conn_up(conn)) {
         cyw43_thread_exit();
-        debug("invalid state for notify (%d)", state);
-        return -1;
+        debug("invalid state for notify (%d)", conn ? (int)conn->state : -1);
+        return false;
     }
 
-    uint16_t tmp = read_len;
+    size_t tmp = rb_len(&conn->notify_rb);
 
     cyw43_thread_exit();
     return (tmp > 0);
-
 }
 
 uint16_t ble_notification_get(uint8_t *buff, uint16_t buff_len, uint8_t *characteristic) {
@@ -954,39 +2084,44 @@ uint16_t ble_notification_get(uint8_t *buff, uint16_t buff_len, uint8_t *charact
 
     cyw43_thread_enter();
 
-    if (state != TC_READY) {
+    struct ble_connection *conn = conn_active();
+    if ((conn == NULL) || !conn_up(conn)) {
         cyw43_thread_exit();
-        debug("invalid state for notify (%d)", state);
+        debug("invalid state for notify (%d)", conn ? (int)conn->state : -1);
         return -2;
     }
 
-    if (read_len <= 0) {
+    if (rb_len(&conn->notify_rb) <= 0) {
         debug("no data available");
         cyw43_thread_exit();
         return -3;
     }
 
-    if (read_len > buff_len) {
-        debug("buffer too short (%d < %d)", buff_len, read_len);
+    struct ble_notification n;
+    rb_peek(&conn->notify_rb, &n);
+
+    if (n.len > buff_len) {
+        debug("buffer too short (%d < %d)", buff_len, n.len);
         cyw43_thread_exit();
         return -4;
     }
 
-    memcpy(buff, data_buff, read_len);
+    rb_pop(&conn->notify_rb, &n);
+    memcpy(buff, n.data, n.len);
 
     bool found = false;
-    for (int i = 0; i < BLE_MAX_SERVICES; i++) {
-        if (!services[i].set) {
+    for (int i = 0; (i < BLE_MAX_SERVICES) && !found; i++) {
+        if (!conn->services[i].set) {
             continue;
         }
 
         for (int j = 0; j < BLE_MAX_CHARACTERISTICS; j++) {
-            if (!services[i].chars[j].set) {
+            if (!conn->services[i].chars[j].set) {
                 continue;
             }
 
-            if (services[i].chars[j].c.value_handle == value_handle) {
-                memcpy(characteristic, services[i].chars[j].c.uuid128, 16);
+            if (conn->services[i].chars[j].c.value_handle == n.value_handle) {
+                memcpy(characteristic, conn->services[i].chars[j].c.uuid128, 16);
                 found = true;
                 break;
             }
@@ -994,13 +2129,10 @@ uint16_t ble_notification_get(uint8_t *buff, uint16_t buff_len, uint8_t *charact
     }
 
     if (!found) {
-        debug("can not find characteristic for value handle 0x%04X", value_handle);
+        debug("can not find characteristic for value handle 0x%04X", n.value_handle);
         memset(characteristic, 0, 16);
     }
 
-    uint16_t tmp = read_len;
-    read_len = 0;
-
     cyw43_thread_exit();
-    return tmp;
+    return n.len;
 }
@@ -0,0 +1,259 @@
+/*
+ * ble_chars.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "log.h"
+#include "ble.h"
+#include "ble_chars.h"
+
+// Storz & Bickel "xxxxxxxx-5354-4f52-5a26-4249434b454c"
+#define UUID_SB(a, b, c, d) {                               \
+    a, b, c, d, 0x53, 0x54, 0x4f, 0x52,                     \
+    0x5a, 0x26, 0x42, 0x49, 0x43, 0x4b, 0x45, 0x4c,         \
+}
+
+// "10xx00xx-5354-4f52-5a26-4249434b454c"
+#define UUID_VOLCANO(srvc, ch) UUID_SB(0x10, srvc, 0x00, ch)
+
+// "000000xx-4c45-4b43-4942-265a524f5453"
+#define UUID_CRAFTY(ch) {                                   \
+    0x00, 0x00, 0x00, ch, 0x4c, 0x45, 0x4b, 0x43,           \
+    0x49, 0x42, 0x26, 0x5a, 0x52, 0x4f, 0x54, 0x53,         \
+}
+
+#define VOLCANO_SRVC_1 0x10
+#define VOLCANO_SRVC_2 0x11
+#define VOLCANO_WRITE_SRVC 0x00
+#define CRAFTY_WRITE_SRVC 0x01
+
+#define VOLCANO(id, srvc, ch, w, a) [id] = {                \
+    .name = #id,                                            \
+    .service = UUID_VOLCANO(srvc, VOLCANO_WRITE_SRVC),      \
+    .uuid = UUID_VOLCANO(srvc, ch),                         \
+    .width = w,                                             \
+    .big_endian = false,                                    \
+    .access = a,                                            \
+}
+
+#define CRAFTY(id, ch, w, a) [id] = {                       \
+    .name = #id,                                            \
+    .service = UUID_CRAFTY(CRAFTY_WRITE_SRVC),              \
+    .uuid = UUID_CRAFTY(ch),                                \
+    .width = w,                                             \
+    .big_endian = false,                                    \
+    .access = a,                                            \
+}
+
+const struct ble_char_desc ble_chars[CHAR_COUNT] = {
+    VOLCANO(CHAR_VOLCANO_FIRMWARE,     VOLCANO_SRVC_1, 0x03, 0, CHAR_READ),
+    VOLCANO(CHAR_VOLCANO_PRJSTAT1,     VOLCANO_SRVC_1, 0x0C, 4, CHAR_READ | CHAR_WRITE),
+    VOLCANO(CHAR_VOLCANO_PRJSTAT2,     VOLCANO_SRVC_1, 0x0D, 4, CHAR_READ | CHAR_WRITE),
+    VOLCANO(CHAR_VOLCANO_PRJSTAT3,     VOLCANO_SRVC_1, 0x0E, 4, CHAR_READ | CHAR_WRITE),
+    VOLCANO(CHAR_VOLCANO_CURRENT_TEMP, VOLCANO_SRVC_2, 0x01, 4, CHAR_READ),
+    VOLCANO(CHAR_VOLCANO_TARGET_TEMP,  VOLCANO_SRVC_2, 0x03, 4, CHAR_READ | CHAR_WRITE),
+    VOLCANO(CHAR_VOLCANO_BRIGHTNESS,   VOLCANO_SRVC_2, 0x05, 2, CHAR_READ | CHAR_WRITE),
+    VOLCANO(CHAR_VOLCANO_SHUTOFF_TIME, VOLCANO_SRVC_2, 0x0D, 2, CHAR_READ | CHAR_WRITE),
+    VOLCANO(CHAR_VOLCANO_HEATER_ON,    VOLCANO_SRVC_2, 0x0F, 1, CHAR_WRITE),
+    VOLCANO(CHAR_VOLCANO_HEATER_OFF,   VOLCANO_SRVC_2, 0x10, 1, CHAR_WRITE),
+    VOLCANO(CHAR_VOLCANO_PUMP_ON,      VOLCANO_SRVC_2, 0x13, 1, CHAR_WRITE),
+    VOLCANO(CHAR_VOLCANO_PUMP_OFF,     VOLCANO_SRVC_2, 0x14, 1, CHAR_WRITE),
+    VOLCANO(CHAR_VOLCANO_HEAT_HOURS,   VOLCANO_SRVC_2, 0x15, 4, CHAR_READ),
+    VOLCANO(CHAR_VOLCANO_HEAT_MINUTES, VOLCANO_SRVC_2, 0x16, 2, CHAR_READ),
+
+    CRAFTY(CHAR_CRAFTY_CURRENT_TEMP,   0x11, 2, CHAR_READ),
+    CRAFTY(CHAR_CRAFTY_TARGET_TEMP,    0x21, 2, CHAR_READ | CHAR_WRITE),
+    CRAFTY(CHAR_CRAFTY_BATTERY,        0x41, 2, CHAR_READ),
+    CRAFTY(CHAR_CRAFTY_HEATER_ON,      0x81, 2, CHAR_WRITE),
+    CRAFTY(CHAR_CRAFTY_HEATER_OFF,     0x91, 2, CHAR_WRITE),
+
+    // "00000000-..." service, "00000001-..." characteristic
+    [CHAR_VENTY_CMD] = {
+        .name = "CHAR_VENTY_CMD",
+        .service = UUID_SB(0x00, 0x00, 0x00, 0x00),
+        .uuid = UUID_SB(0x00, 0x00, 0x00, 0x01),
+        .width = 0,
+        .big_endian = false,
+        .access = CHAR_WRITE | CHAR_NOTIFY,
+    },
+};
+
+static bool check(enum ble_char_id id, uint8_t access, bool raw) {
+    if (id >= CHAR_COUNT) {
+        debug("invalid characteristic %d", id);
+        return false;
+    }
+
+    if (!(ble_chars[id].access & access)) {
+        debug("%s does not support access 0x%02X", ble_chars[id].name, access);
+        return false;
+    }
+
+    if (raw != (ble_chars[id].width == 0)) {
+        debug("%s accessed with wrong width", ble_chars[id].name);
+        return false;
+    }
+
+    return true;
+}
+
+enum ble_char_id ble_char_find(const uint8_t *uuid) {
+    for (uint i = 0; i < CHAR_COUNT; i++) {
+        if (memcmp(ble_chars[i].uuid, uuid, 16) == 0) {
+            return i;
+        }
+    }
+    return CHAR_INVALID;
+}
+
+int8_t ble_char_discover(enum ble_char_id id) {
+    if (id >= CHAR_COUNT) {
+        debug("invalid characteristic %d", id);
+        return -1;
+    }
+
+    return ble_discover(ble_chars[id].service, ble_chars[id].uuid);
+}
+
+static uint32_t decode(const struct ble_char_desc *c, const uint8_t *buff) {
+    uint32_t v = 0;
+    for (uint i = 0; i < c->width; i++) {
+        uint8_t b = c->big_endian ? buff[i] : buff[c->width - 1 - i];
+        v = (v << 8) | b;
+    }
+    return v;
+}
+
+int8_t ble_char_read(enum ble_char_id id, uint32_t *value) {
+    if ((value == NULL) || !check(id, CHAR_READ, false)) {
+        return -1;
+    }
+
+    const struct ble_char_desc *c = &ble_chars[id];
+    uint8_t buff[4];
+    int32_t r = ble_read(c->uuid, buff, c->width);
+    if (r != c->width) {
+        debug("%s read unexpected value %" PRId32, c->name, r);
+        return -2;
+    }
+
+    *value = decode(c, buff);
+    return 0;
+}
+
+int8_t ble_char_read_start(enum ble_char_id id) {
+    if (!check(id, CHAR_READ, false)) {
+        return -1;
+    }
+
+    return ble_read_start(ble_chars[id].uuid);
+}
+
+int8_t ble_char_read_poll(enum ble_char_id id, uint32_t *value) {
+    if ((value == NULL) || !check(id, CHAR_READ, false)) {
+        return -1;
+    }
+
+    const struct ble_char_desc *c = &ble_chars[id];
+    uint8_t buff[4];
+    int32_t r = ble_read_poll(buff, c->width);
+    if (r == 0) {
+        return 0;
+    } else if (r != c->width) {
+        debug("%s read unexpected value %" PRId32, c->name, r);
+        return -2;
+    }
+
+    *value = decode(c, buff);
+    return 1;
+}
+
+static void encode(const struct ble_char_desc *c, uint32_t value, uint8_t *buff) {
+    for (uint i = 0; i < c->width; i++) {
+        uint8_t b = (value >> (8 * i)) & 0xFF;
+        buff[c->big_endian ? (c->width - 1 - i) : i] = b;
+    }
+}
+
+int8_t ble_char_write(enum ble_char_id id, uint32_t value) {
+    if (!check(id, CHAR_WRITE, false)) {
+        return -1;
+    }
+
+    const struct ble_char_desc *c = &ble_chars[id];
+    uint8_t buff[4];
+    encode(c, value, buff);
+
+    int8_t r = ble_write(c->service, c->uuid, buff, c->width);
+    if (r != 0) {
+        debug("%s write unexpected value %" PRId8, c->name, r);
+    }
+    return r;
+}
+
+int8_t ble_char_write_start(enum ble_char_id id, uint32_t value) {
+    if (!check(id, CHAR_WRITE, false)) {
+        return -1;
+    }
+
+    const struct ble_char_desc *c = &ble_chars[id];
+    uint8_t buff[4];
+    encode(c, value, buff);
+    return ble_write_start(c->service, c->uuid, buff, c->width);
+}
+
+int8_t ble_char_write_poll(void) {
+    return ble_write_poll();
+}
+
+int32_t ble_char_read_raw(enum ble_char_id id, uint8_t *buff, uint16_t len) {
+    if ((buff == NULL) || !check(id, CHAR_READ, true)) {
+        return -1;
+    }
+
+    return ble_read(ble_chars[id].uuid, buff, len);
+}
+
+int8_t ble_char_write_raw(enum ble_char_id id, const uint8_t *buff, uint16_t len) {
+    if ((buff == NULL) || !check(id, CHAR_WRITE, true)) {
+        return -1;
+    }
+
+    return ble_write(ble_chars[id].service, ble_chars[id].uuid, buff, len);
+}
+
+int8_t ble_char_write_raw_start(enum ble_char_id id, const uint8_t *buff, uint16_t len) {
+    if ((buff == NULL) || !check(id, CHAR_WRITE, true)) {
+        return -1;
+    }
+
+    return ble_write_start(ble_chars[id].service, ble_chars[id].uuid, buff, len);
+}
+
+void ble_char_status(void) {
+    for (uint i = 0; i < CHAR_COUNT; i++) {
+        const struct ble_char_desc *c = &ble_chars[i];
+        println("%2d %s", i, c->name);
+        println("   %s", uuid128_to_str(c->service));
+        println("   %s width=%d %s%s%s", uuid128_to_str(c->uuid), c->width,
+                (c->access & CHAR_READ) ? "r" : "",
+                (c->access & CHAR_WRITE) ? "w" : "",
+                (c->access & CHAR_NOTIFY) ? "n" : "");
+    }
+}
@@ -0,0 +1,484 @@
+/*
+ * ble_sim.c
+ *
+ * Fake Storz & Bickel peripherals, for testing without real devices.
+ * Only the characteristics used by volcano.c, crafty.c and venty.c are
+ * modelled, together with the thermal model from thermal.c.
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "config.h"
+#include "log.h"
+#include "main.h"
+#include "volcano.h"
+#include "ble_chars.h"
+#include "thermal.h"
+#include "workflow.h"
+#include "ble_sim.h"
+
+#ifdef BLE_SIMULATION
+
+// Volcano, see volcano.c
+#define VOLCANO_PRJSTAT1_HEIZUNG_ENA      0x0020
+#define VOLCANO_PRJSTAT1_PUMPE_FET_ENABLE 0x2000
+#define VOLCANO_PRJSTAT_SET               0x10000
+
+// Venty, see venty.c
+#define VENTY_CMD_SETTINGS     1
+#define VENTY_CMD_INTERFACE    6
+#define VENTY_SET_TEMPERATURE  (1 << 1)
+#define VENTY_SET_HEATER       (1 << 5)
+#define VENTY_SET_SETTINGS     (1 << 7)
+#define VENTY_UI_BRIGHTNESS    (1 << 0)
+#define VENTY_UI_VIBRATION     (1 << 3)
+
+enum sim_devices {
+    SIM_VOLCANO = 0,
+    SIM_CRAFTY,
+    SIM_VENTY,
+
+    SIM_COUNT
+};
+
+
+static const uint8_t sim_data[] = {
+    // two bytes company id, then serial number
+    0x00, 0x00, 'S', 'I', 'M', '0', '0', '0', '0', '1',
+};
+
+static const struct ble_sim_advert adverts[SIM_COUNT] = {
+    [SIM_VOLCANO] = {
+        .addr = { 0x5A, 0x11, 0x11, 0x00, 0x00, 0x01 },
+        .type = 0,
+        .rssi = -40,
+        .name = "S&B VOLCANO H",
+        .data = sim_data,
+        .data_len = sizeof(sim_data),
+    },
+    [SIM_CRAFTY] = {
+        .addr = { 0x5A, 0x11, 0x11, 0x00, 0x00, 0x02 },
+        .type = 0,
+        .rssi = -50,
+        .name = "STORZ&BICKEL",
+        .data = sim_data,
+        .data_len = sizeof(sim_data),
+    },
+    [SIM_VENTY] = {
+        .addr = { 0x5A, 0x11, 0x11, 0x00, 0x00, 0x03 },
+        .type = 0,
+        .rssi = -60,
+        .name = "S&B VYSIM0003",
+        .data = NULL,
+        .data_len = 0,
+    },
+};
+
+static struct thermal_model thermal[SIM_COUNT] = {0};
+
+static uint32_t volcano_prjstat[3] = {0};
+static uint16_t volcano_brightness = 70;
+static uint16_t volcano_shutoff = 30 * 60;
+
+static int16_t crafty_battery = 80;
+
+static uint8_t venty_battery = 90;
+static uint8_t venty_settings = 0;
+static uint8_t venty_brightness = 5;
+static uint8_t venty_vibration = 1;
+
+static uint16_t link_latency = BLE_SIM_LATENCY_MS;
+static uint8_t link_loss = BLE_SIM_LOSS_PERCENT;
+static uint32_t link_count = 0;
+static uint32_t link_lost = 0;
+
+static void thermal_run(struct thermal_model *t) {
+    thermal_model_run(t, to_ms_since_boot(get_absolute_time()));
+}
+
+static void prjstat_write(uint32_t *stat, const uint8_t *buff, uint16_t len) {
+    if (len < 4) {
+        return;
+    }
+
+    uint32_t v;
+    memcpy(&v, buff, sizeof(v));
+    if (v & VOLCANO_PRJSTAT_SET) {
+        *stat |= v & 0xFFFF;
+    } else {
+        *stat &= ~(v & 0xFFFF);
+    }
+}
+
+static int32_t put(uint8_t *buff, uint16_t buff_len, const void *v, uint16_t len) {
+    if (len > buff_len) {
+        return -4;
+    }
+    memcpy(buff, v, len);
+    return len;
+}
+
+static int32_t volcano_read(enum ble_char_id id, uint8_t *buff, uint16_t len) {
+    struct thermal_model *t = &thermal[SIM_VOLCANO];
+    thermal_run(t);
+
+    volcano_prjstat[0] &= ~(VOLCANO_PRJSTAT1_HEIZUNG_ENA | VOLCANO_PRJSTAT1_PUMPE_FET_ENABLE);
+    volcano_prjstat[0] |= t->heater ? VOLCANO_PRJSTAT1_HEIZUNG_ENA : 0;
+    volcano_prjstat[0] |= t->pump ? VOLCANO_PRJSTAT1_PUMPE_FET_ENABLE : 0;
+
+    switch (id) {
+    case CHAR_VOLCANO_FIRMWARE: {
+        const char fw[VOLCANO_FW_LEN] = "V0.0.0SIM   ";
+        return put(buff, len, fw, sizeof(fw));
+    }
+
+    case CHAR_VOLCANO_PRJSTAT1:
+    case CHAR_VOLCANO_PRJSTAT2:
+    case CHAR_VOLCANO_PRJSTAT3:
+        return put(buff, len, &volcano_prjstat[id - CHAR_VOLCANO_PRJSTAT1], sizeof(uint32_t));
+
+    case CHAR_VOLCANO_CURRENT_TEMP: {
+        uint32_t v = t->current;
+        return put(buff, len, &v, sizeof(v));
+    }
+
+    case CHAR_VOLCANO_TARGET_TEMP: {
+        uint32_t v = t->target;
+        return put(buff, len, &v, sizeof(v));
+    }
+
+    case CHAR_VOLCANO_BRIGHTNESS:
+        return put(buff, len, &volcano_brightness, sizeof(volcano_brightness));
+
+    case CHAR_VOLCANO_SHUTOFF_TIME:
+        return put(buff, len, &volcano_shutoff, sizeof(volcano_shutoff));
+
+    case CHAR_VOLCANO_HEAT_HOURS: {
+        uint32_t v = 42;
+        return put(buff, len, &v, sizeof(v));
+    }
+
+    case CHAR_VOLCANO_HEAT_MINUTES: {
+        uint16_t v = 23;
+        return put(buff, len, &v, sizeof(v));
+    }
+
+    default:
+        break;
+    }
+
+    debug("unexpected volcano read %d", id);
+    return -1;
+}
+
+static int32_t volcano_write(enum ble_char_id id, const uint8_t *buff, uint16_t len) {
+    struct thermal_model *t = &thermal[SIM_VOLCANO];
+    thermal_run(t);
+
+    switch (id) {
+    case CHAR_VOLCANO_PRJSTAT1:
+    case CHAR_VOLCANO_PRJSTAT2:
+    case CHAR_VOLCANO_PRJSTAT3:
+        prjstat_write(&volcano_prjstat[id - CHAR_VOLCANO_PRJSTAT1], buff, len);
+        return 0;
+
+    case CHAR_VOLCANO_TARGET_TEMP: {
+        uint32_t v = 0;
+        memcpy(&v, buff, MIN(len, sizeof(v)));
+        t->target = v;
+        return 0;
+    }
+
+    case CHAR_VOLCANO_BRIGHTNESS:
+        memcpy(&volcano_brightness, buff, MIN(len, sizeof(volcano_brightness)));
+        return 0;
+
+    case CHAR_VOLCANO_SHUTOFF_TIME:
+        memcpy(&volcano_shutoff, buff, MIN(len, sizeof(volcano_shutoff)));
+        return 0;
+
+    case CHAR_VOLCANO_HEATER_ON:
+    case CHAR_VOLCANO_HEATER_OFF:
+        t->heater = (id == CHAR_VOLCANO_HEATER_ON);
+        return 0;
+
+    case CHAR_VOLCANO_PUMP_ON:
+    case CHAR_VOLCANO_PUMP_OFF:
+        t->pump = (id == CHAR_VOLCANO_PUMP_ON);
+        return 0;
+
+    default:
+        break;
+    }
+
+    debug("unexpected volcano write %d", id);
+    return -1;
+}
+
+static int32_t crafty_read(enum ble_char_id id, uint8_t *buff, uint16_t len) {
+    struct thermal_model *t = &thermal[SIM_CRAFTY];
+    thermal_run(t);
+
+    switch (id) {
+    case CHAR_CRAFTY_CURRENT_TEMP:
+        return put(buff, len, &t->current, sizeof(t->current));
+
+    case CHAR_CRAFTY_TARGET_TEMP:
+        return put(buff, len, &t->target, sizeof(t->target));
+
+    case CHAR_CRAFTY_BATTERY:
+        return put(buff, len, &crafty_battery, sizeof(crafty_battery));
+
+    default:
+        break;
+    }
+
+    debug("unexpected crafty read %d", id);
+    return -1;
+}
+
+static int32_t crafty_write(enum ble_char_id id, const uint8_t *buff, uint16_t len) {
+    struct thermal_model *t = &thermal[SIM_CRAFTY];
+    thermal_run(t);
+
+    switch (id) {
+    case CHAR_CRAFTY_TARGET_TEMP:
+        memcpy(&t->target, buff, MIN(len, sizeof(t->target)));
+        return 0;
+
+    case CHAR_CRAFTY_HEATER_ON:
+    case CHAR_CRAFTY_HEATER_OFF:
+        t->heater = (id == CHAR_CRAFTY_HEATER_ON);
+        return 0;
+
+    default:
+        break;
+    }
+
+    debug("unexpected crafty write %d", id);
+    return -1;
+}
+
+static int32_t venty_write(const uint8_t *buff, uint16_t len,
+                           uint8_t *resp, uint16_t resp_len) {
+    struct thermal_model *t = &thermal[SIM_VENTY];
+    thermal_run(t);
+
+    if ((len < 6) || (resp_len < len)) {
+        return -1;
+    }
+
+    memset(resp, 0, len);
+    resp[0] = buff[0];
+
+    if ((buff[0] == VENTY_CMD_SETTINGS) && (len >= 20)) {
+        if (buff[1] & VENTY_SET_TEMPERATURE) {
+            memcpy(&t->target, buff + 4, sizeof(t->target));
+        }
+        if (buff[1] & VENTY_SET_HEATER) {
+            t->heater = buff[11];
+        }
+        if (buff[1] & VENTY_SET_SETTINGS) {
+            venty_settings = (venty_settings & ~buff[15]) | (buff[14] & buff[15]);
+        }
+
+        memcpy(resp + 2, &t->current, sizeof(t->current));
+        memcpy(resp + 4, &t->target, sizeof(t->target));
+        resp[8] = venty_battery;
+        resp[11] = t->heater ? 1 : 0;
+        resp[14] = venty_settings;
+        return 20;
+    } else if (buff[0] == VENTY_CMD_INTERFACE) {
+        if (buff[1] & VENTY_UI_BRIGHTNESS) {
+            venty_brightness = buff[2];
+        }
+        if (buff[1] & VENTY_UI_VIBRATION) {
+            venty_vibration = buff[5];
+        }
+
+        resp[2] = venty_brightness;
+        resp[5] = venty_vibration;
+        return 6;
+    }
+
+    debug("unknown venty command %02X", buff[0]);
+    return -1;
+}
+
+void ble_sim_init(void) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    for (uint i = 0; i < SIM_COUNT; i++) {
+        thermal_model_init(&thermal[i], now);
+    }
+
+    srand(now);
+}
+
+uint ble_sim_count(void) {
+    return SIM_COUNT;
+}
+
+const struct ble_sim_advert *ble_sim_get_advert(uint dev) {
+    if (dev >= SIM_COUNT) {
+        return NULL;
+    }
+    return &adverts[dev];
+}
+
+int ble_sim_find(bd_addr_t addr) {
+    for (uint i = 0; i < SIM_COUNT; i++) {
+        if (memcmp(adverts[i].addr, addr, sizeof(bd_addr_t)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool ble_sim_link(void) {
+    link_count++;
+    if ((link_loss > 0) && ((uint)(rand() % 100) < link_loss)) {
+        link_lost++;
+        return false;
+    }
+    return true;
+}
+
+uint16_t ble_sim_latency(void) {
+    return link_latency;
+}
+
+void ble_sim_set_link(uint16_t latency_ms, uint8_t loss_percent) {
+    link_latency = latency_ms;
+    link_loss = MIN(loss_percent, 100);
+}
+
+int32_t ble_sim_read(int dev, const uint8_t *characteristic,
+                     uint8_t *buff, uint16_t buff_len) {
+    enum ble_char_id id = ble_char_find(characteristic);
+    if ((dev == SIM_VOLCANO) && (id <= CHAR_VOLCANO_HEAT_MINUTES)) {
+        return volcano_read(id, buff, buff_len);
+    } else if ((dev == SIM_CRAFTY) && (id >= CHAR_CRAFTY_CURRENT_TEMP)
+               && (id <= CHAR_CRAFTY_HEATER_OFF)) {
+        return crafty_read(id, buff, buff_len);
+    }
+
+    debug("unexpected read %s from %d", uuid128_to_str(characteristic), dev);
+    return -1;
+}
+
+int32_t ble_sim_write(int dev, const uint8_t *characteristic,
+                      const uint8_t *buff, uint16_t buff_len,
+                      uint8_t *resp, uint16_t resp_len) {
+    enum ble_char_id id = ble_char_find(characteristic);
+    if ((dev == SIM_VOLCANO) && (id <= CHAR_VOLCANO_HEAT_MINUTES)) {
+        return volcano_write(id, buff, buff_len);
+    } else if ((dev == SIM_CRAFTY) && (id >= CHAR_CRAFTY_CURRENT_TEMP)
+               && (id <= CHAR_CRAFTY_HEATER_OFF)) {
+        return crafty_write(id, buff, buff_len);
+    } else if ((dev == SIM_VENTY) && (id == CHAR_VENTY_CMD)) {
+        return venty_write(buff, buff_len, resp, resp_len);
+    }
+
+    debug("unexpected write %s to %d", uuid128_to_str(characteristic), dev);
+    return -1;
+}
+
+void ble_sim_status(void) {
+    println("Simulated link: %d ms latency, %d %% loss", link_latency, link_loss);
+    println("Transactions: %lu, lost: %lu", link_count, link_lost);
+
+    for (uint i = 0; i < SIM_COUNT; i++) {
+        thermal_run(&thermal[i]);
+        println("%s at %s:", adverts[i].name, bd_addr_to_str(adverts[i].addr));
+        println("  Temperature: %.1f C / %.1f C", thermal[i].current / 10.0f, thermal[i].target / 10.0f);
+        println("  Heater: %s, Pump: %s", thermal[i].heater ? "on" : "off", thermal[i].pump ? "on" : "off");
+    }
+}
+
+static void bench_print(const char *name, uint32_t start_us, uint32_t start_ops) {
+    uint32_t t = to_us_since_boot(get_absolute_time()) - start_us;
+    uint32_t ops = ble_round_trips() - start_ops;
+    println("%s: %lu round trips, %.1f ms", name, ops, t / 1000.0f);
+}
+
+void ble_sim_bench(int wf) {
+    bd_addr_t addr;
+    memcpy(addr, adverts[SIM_VOLCANO].addr, sizeof(bd_addr_t));
+    ble_connect(addr, adverts[SIM_VOLCANO].type);
+    if (!ble_is_connected()) {
+        println("error connecting to simulated Volcano");
+        return;
+    }
+
+    println("Link: %d ms latency, %d %% loss", link_latency, link_loss);
+
+    uint32_t start_us = to_us_since_boot(get_absolute_time());
+    uint32_t start_ops = ble_round_trips();
+    volcano_discover_characteristics(true, true);
+    bench_print("Discovery", start_us, start_ops);
+
+    // same requests as the Volcano config page
+    start_us = to_us_since_boot(get_absolute_time());
+    start_ops = ble_round_trips();
+    char fw[VOLCANO_FW_LEN + 1];
+    struct volcano_snapshot snap;
+    volcano_invalidate();
+    volcano_snapshot(&snap);
+    volcano_get_firmware(fw);
+    volcano_get_runtime();
+    bench_print("Config page", start_us, start_ops);
+
+    ble_disconnect();
+
+    if ((wf < 0) || (wf >= wf_count())) {
+        return;
+    }
+
+    // same workflow on every simulated device
+    for (uint i = 0; i < SIM_COUNT; i++) {
+        enum known_devices dev = models_filter_name(adverts[i].name);
+        memcpy(addr, adverts[i].addr, sizeof(bd_addr_t));
+        ble_connect(addr, adverts[i].type);
+        if (!ble_is_connected()) {
+            println("error connecting to %s", adverts[i].name);
+            continue;
+        }
+
+        println("Running workflow \"%s\" on %s...", wf_name(wf), adverts[i].name);
+
+        start_us = to_us_since_boot(get_absolute_time());
+        start_ops = ble_round_trips();
+        wf_start(wf, dev);
+        while (wf_status().status != WF_IDLE) {
+            sleep_ms(1);
+            main_loop_hw();
+            wf_run();
+        }
+        bench_print("Workflow", start_us, start_ops);
+        if (wf_status().error) {
+            println("Workflow failed");
+        }
+        wf_stats();
+
+        ble_disconnect();
+    }
+}
+
+#endif // BLE_SIMULATION
@@ -39,9 +39,10 @@ static_assert((DISK_SIZE % PAGE_SIZE) == 0, "Disk blocks need to fit cleanly int
 
 // PICO_FLASH_SIZE_BYTES is 2MB = 512 * 4K pages
 // BTstack uses the last two pages, we use one more for EEPROM config.
-// So 509 pages remain, minus the 48 pages for the FAT disk.
-// --> 461 pages remain for bootloader and application.
-// --> 461 * 4096 = 1888256 bytes
+// So 509 pages remain, minus the 48 pages for the FAT disk
+// and the 4 pages below it for the telemetry spool (see spool.c).
+// --> 457 pages remain for bootloader and application.
+// --> 457 * 4096 = 1871872 bytes
 #define CACHE_FLASH_OFFSET (EEPROM_FLASH_OFFSET - (DISK_PAGES * PAGE_SIZE))
 static_assert(DISK_PAGES == 48, "TODO conversions are hard-coded currently");
 
@@ -29,9 +29,12 @@
 #include "util.h"
 #include "usb_cdc.h"
 #include "usb_msc.h"
+#include "usb_net.h"
 #include "debug_disk.h"
 #include "lipo.h"
 #include "ble.h"
+#include "ble_sim.h"
+#include "ble_chars.h"
 #include "text.h"
 #include "lcd.h"
 #include "image.h"
@@ -41,8 +44,14 @@
 #include "models.h"
 #include "workflow.h"
 #include "crafty.h"
+#include "vaporizer.h"
+#include "wf_sim.h"
 #include "mem.h"
 #include "cache.h"
+#include "influx.h"
+#include "wifi.h"
+#include "http.h"
+#include "api.h"
 #include "console.h"
 
 #define CNSL_BUFF_SIZE 64
@@ -71,6 +80,15 @@ static char cnsl_repeated_command[CNSL_BUFF_SIZE + 1];
 static bool repeat_command = false;
 static uint32_t last_repeat_time = 0;
 
+static int find_workflow(const char *name) {
+    for (int i = 0; i < wf_count(); i++) {
+        if (strcmp(wf_name(i), name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 static void cnsl_interpret(const char *line) {
     if (strlen(line) == 0) {
         if ((strlen(cnsl_last_command) > 0) && (strcmp(cnsl_last_command, "repeat") != 0)) {
@@ -106,11 +124,27 @@ static void cnsl_interpret(const char *line) {
         println("     bl - print backlight pwm level");
         println("  cache - print flash cache status");
         println("  flush - flush flash cache");
+        println("   wifi - wifi connection status");
+        println("   http - web server file status");
+        println("    api - web API and event stream status");
+#ifdef USB_NETWORK
+        println(" usbnet - USB network interface status");
+#endif // USB_NETWORK
+#ifdef VOLCANO_INFLUX_DB
+        println(" influx - InfluxDB writer status");
+#endif // VOLCANO_INFLUX_DB
         println("");
         println("   scan - start or stop BLE scan");
         println("scanres - print list of found BLE devices");
         println("con M T - connect to (M)AC and (T)ype");
         println(" discon - disconnect from BLE device");
+        println("  conls - list open BLE connections");
+        println("  chars - list known GATT characteristics");
+#ifdef BLE_SIMULATION
+        println(" simls - show simulated BLE devices");
+        println("simlink L P - simulate (L)atency in ms and (P)acket loss in %%");
+        println("bench [X] - benchmark simulated Volcano, optionally run workflow on all");
+#endif // BLE_SIMULATION
         println("");
         println("  clear - blank screen");
         println(" splash - draw image on screen");
@@ -119,6 +153,7 @@ static void cnsl_interpret(const char *line) {
         println("    bat - draw battery indicator");
         println("");
         println("     vr - Volcano read values");
+        println(" vcache - Volcano value cache status");
         println(" vwtt X - Volcano write target temperature");
         println("  vwh X - Set heater to 1 or 0");
         println("  vwp X - Set pump to 1 or 0");
@@ -127,7 +162,10 @@ static void cnsl_interpret(const char *line) {
         println(" vwdc X - Set display cooling to 1 or 0");
         println("");
         println("    wfl - List available workflows");
+        println(" wfstat - workflow engine statistics");
         println("   wf X - Run workflow");
+        println("wfsim X - Simulate workflow on virtual clock");
+        println("wfcsv X - Simulate workflow, print CSV timeline");
         println("");
         println("   crct - Crafty read current temperature");
         println("   crtt - Crafty read target temperature");
@@ -165,6 +203,20 @@ static void cnsl_interpret(const char *line) {
         cache_status();
     } else if (strcmp(line, "flush") == 0) {
         cache_sync();
+    } else if (strcmp(line, "wifi") == 0) {
+        wifi_status();
+    } else if (strcmp(line, "http") == 0) {
+        http_status();
+    } else if (strcmp(line, "api") == 0) {
+        api_status();
+#ifdef USB_NETWORK
+    } else if (strcmp(line, "usbnet") == 0) {
+        usb_net_status();
+#endif // USB_NETWORK
+#ifdef VOLCANO_INFLUX_DB
+    } else if (strcmp(line, "influx") == 0) {
+        influx_status();
+#endif // VOLCANO_INFLUX_DB
     } else if (strcmp(line, "scan") == 0) {
         ble_scan(BLE_SCAN_TOGGLE);
     } else if (strcmp(line, "scanres") == 0) {
@@ -173,10 +225,11 @@ static void cnsl_interpret(const char *line) {
         if (n < 0) {
             println("Error reading results (%d)", n);
         } else {
+            ble_scan_status();
             println("%d results", n);
             for (int i = 0; i < n; i++) {
                 char info[32] = "";
-                enum known_devices dev = models_filter_name(results[i].name);
+                enum known_devices dev = results[i].dev;
                 if (dev != DEV_UNKNOWN) {
                     models_get_serial(dev, results[i].name,
                                       results[i].data, results[i].data_len,
@@ -212,6 +265,32 @@ static void cnsl_interpret(const char *line) {
         }
     } else if (strcmp(line, "discon") == 0) {
         ble_disconnect();
+    } else if (strcmp(line, "conls") == 0) {
+        ble_connection_status();
+    } else if (strcmp(line, "chars") == 0) {
+        ble_char_status();
+#ifdef BLE_SIMULATION
+    } else if (strcmp(line, "simls") == 0) {
+        ble_sim_status();
+    } else if (str_startswith(line, "simlink ")) {
+        unsigned int latency, loss;
+        int r = sscanf(line, "simlink %u %u", &latency, &loss);
+        if (r != 2) {
+            println("invalid input (%d)", r);
+        } else {
+            ble_sim_set_link(latency, loss);
+        }
+    } else if (strcmp(line, "bench") == 0) {
+        ble_sim_bench(-1);
+    } else if (str_startswith(line, "bench ")) {
+        int wf;
+        int r = sscanf(line, "bench %d", &wf);
+        if (r != 1) {
+            println("invalid input (%d)", r);
+        } else {
+            ble_sim_bench(wf);
+        }
+#endif // BLE_SIMULATION
     } else if (strcmp(line, "clear") == 0) {
         lcd_clear();
     } else if (strcmp(line, "splash") == 0) {
@@ -273,29 +352,22 @@ static void cnsl_interpret(const char *line) {
         DEV_AUTO_CONNECT(TEST_VOLCANO_AUTO_CONNECT);
 #endif // TEST_VOLCANO_AUTO_CONNECT
 
-        int16_t temp = volcano_get_current_temp();
-        println("volcano current temp: %.1f", temp / 10.0);
-
-        temp = volcano_get_target_temp();
-        println("volcano target temp: %.1f", temp / 10.0);
-
-        enum unit unit = volcano_get_unit();
-        println("volcano unit: %s", (unit == UNIT_C) ? "C" : "F");
-
-        enum volcano_state state = volcano_get_state();
-        println("volcano state: 0x%02X", state);
+        uint32_t reads = ble_round_trips();
 
-        int8_t r = volcano_get_vibration();
-        println("volcano vibration: %d", r);
-
-        r = volcano_get_display_cooling();
-        println("volcano display cooling: %d", r);
-
-        int16_t time = volcano_get_auto_shutoff();
-        println("volcano auto shutoff: %d", time);
-
-        r = volcano_get_brightness();
-        println("volcano brightness: %d", r);
+        struct volcano_snapshot snap;
+        int8_t r = volcano_snapshot(&snap);
+        if (r < 0) {
+            println("volcano snapshot error %d", r);
+        } else {
+            println("volcano current temp: %.1f", snap.current_temp / 10.0);
+            println("volcano target temp: %.1f", snap.target_temp / 10.0);
+            println("volcano unit: %s", (snap.unit == UNIT_C) ? "C" : "F");
+            println("volcano state: 0x%02X", snap.state);
+            println("volcano vibration: %d", snap.vibration);
+            println("volcano display cooling: %d", snap.display_cooling);
+            println("volcano auto shutoff: %d", snap.auto_shutoff);
+            println("volcano brightness: %d", snap.brightness);
+        }
 
         char fw[VOLCANO_FW_LEN + 1] = {0};
         r = volcano_get_firmware(fw);
@@ -304,9 +376,13 @@ static void cnsl_interpret(const char *line) {
         int32_t rt = volcano_get_runtime();
         println("volcano runtime: %ld min", rt);
 
+        println("BLE requests: %lu", ble_round_trips() - reads);
+
 #ifdef TEST_VOLCANO_AUTO_CONNECT
         ble_disconnect();
 #endif // TEST_VOLCANO_AUTO_CONNECT
+    } else if (strcmp(line, "vcache") == 0) {
+        volcano_cache_status();
     } else if (str_startswith(line, "vwtt ")) {
         float val;
         int r = sscanf(line, "vwtt %f", &val);
@@ -441,20 +517,25 @@ static void cnsl_interpret(const char *line) {
                 println("success");
             }
         }
+    } else if (strcmp(line, "wfstat") == 0) {
+        wf_stats();
     } else if (strcmp(line, "wfl") == 0) {
         println("%d workflows", wf_count());
         for (int i = 0; i < wf_count(); i++) {
             println("  '%s' by %s", wf_name(i), wf_author(i));
         }
-    } else if (str_startswith(line, "wf ")) {
-        int wf = -1;
-        for (int i = 0; i < wf_count(); i++) {
-            if (strcmp(wf_name(i), line + 3) == 0) {
-                wf = i;
-                break;
-            }
+    } else if (str_startswith(line, "wfsim ") || str_startswith(line, "wfcsv ")) {
+        int wf = find_workflow(line + 6);
+        struct wf_sim_result r;
+        if (wf < 0) {
+            println("unknown workflow");
+        } else if (wf_sim_run(wf, str_startswith(line, "wfcsv "), &r) < 0) {
+            println("workflow in progress");
+        } else {
+            wf_sim_print(&r);
         }
-
+    } else if (str_startswith(line, "wf ")) {
+        int wf = find_workflow(line + 3);
         if (wf < 0) {
             println("unknown workflow");
         } else {
@@ -466,8 +547,14 @@ static void cnsl_interpret(const char *line) {
                 DEV_AUTO_CONNECT(TEST_VOLCANO_AUTO_CONNECT);
 #endif // TEST_VOLCANO_AUTO_CONNECT
 
+                // workflows used to be Volcano only, keep that as default
+                enum known_devices dev = vaporizer_active();
+                if (dev == DEV_UNKNOWN) {
+                    dev = DEV_VOLCANO;
+                }
+
                 println("starting workflow");
-                wf_start(wf);
+                wf_start(wf, dev);
 
                 s = wf_status();
                 while (s.status != WF_IDLE) {
@@ -476,7 +563,7 @@ static void cnsl_interpret(const char *line) {
                     s = wf_status();
                 }
 
-                println("done");
+                println(s.error ? "failed" : "done");
 
 #ifdef TEST_VOLCANO_AUTO_CONNECT
                 ble_disconnect();
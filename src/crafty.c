@@ -16,106 +16,280 @@
  * See <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
+#include "pico/stdlib.h"
+
 #include "config.h"
 #include "log.h"
 #include "ble.h"
+#include "ble_chars.h"
 #include "crafty.h"
 
-// serviceUuidCrafty1      "00000001-4c45-4b43-4942-265a524f5453"
-// characteristicWriteTemp "00000021-4c45-4b43-4942-265a524f5453"
-// charactersiticCurrTemp  "00000011-4c45-4b43-4942-265a524f5453"
-// characteristicPower     "00000041-4c45-4b43-4942-265a524f5453"
-// characteristicHeaterOn  "00000081-4c45-4b43-4942-265a524f5453"
-// characteristicHeaterOff "00000091-4c45-4b43-4942-265a524f5453"
-
-// "000000xx-4c45-4b43-4942-265a524f5453"
-static uint8_t uuid_base[16] = {
-    0x00, 0x00, 0x00, 0xFF, 0x4c, 0x45, 0x4b, 0x43,
-    0x49, 0x42, 0x26, 0x5a, 0x52, 0x4f, 0x54, 0x53,
+struct crafty_poll {
+    enum ble_char_id id;
+    uint32_t interval; // ms
+    uint32_t next; // ms since boot
 };
-static uint8_t uuid_base2[16] = {
-    0x00, 0x00, 0x00, 0xFF, 0x4c, 0x45, 0x4b, 0x43,
-    0x49, 0x42, 0x26, 0x5a, 0x52, 0x4f, 0x54, 0x53,
+
+static struct crafty_poll polls[] = {
+    { CHAR_CRAFTY_CURRENT_TEMP, CRAFTY_POLL_TEMP_MS,    0 },
+    { CHAR_CRAFTY_TARGET_TEMP,  CRAFTY_POLL_TARGET_MS,  0 },
+    { CHAR_CRAFTY_BATTERY,      CRAFTY_POLL_BATTERY_MS, 0 },
 };
 
-// Crafty UUIDs are always the same, except for the 4th byte
-#define UUID_WRITE_SRVC   0x01
-#define UUID_CURRENT_TEMP 0x11
-#define UUID_TARGET_TEMP  0x21
-#define UUID_BATTERY      0x41
-#define UUID_HEATER_ON    0x81
-#define UUID_HEATER_OFF   0x91
+static struct crafty_state state = {0};
+static uint8_t known = 0; // bit per enum vaporizer_value, in state
+static uint32_t last_poll = 0;
+static int reading = -1; // entry of polls with a read in flight
 
-int16_t crafty_get_current_temp(void) {
-    uuid_base[3] = UUID_CURRENT_TEMP;
+// virtual time source for tests, NULL for the system clock
+static uint32_t (*poll_clock)(void) = NULL;
+
+// written by crafty_write_start(), stored when confirmed
+static enum ble_char_id async_id = CHAR_INVALID;
+static uint16_t async_value = 0;
+
+static const enum ble_char_id discover_wf[] = {
+    CHAR_CRAFTY_CURRENT_TEMP,
+    CHAR_CRAFTY_TARGET_TEMP,
+    CHAR_CRAFTY_HEATER_ON,
+    CHAR_CRAFTY_HEATER_OFF,
+};
+
+static uint32_t now_ms(void) {
+    if (poll_clock != NULL) {
+        return poll_clock();
+    }
+    return to_ms_since_boot(get_absolute_time());
+}
 
-    uint8_t buff[2];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read unexpected value %" PRId32, r);
+// most overdue entry, or -1 when nothing is due or the gap is not over yet
+static int poll_pick(uint32_t now) {
+    if ((now - last_poll) < CRAFTY_POLL_GAP_MS) {
         return -1;
     }
 
-    uint16_t *v = (uint16_t *)buff;
-    return *v;
+    int best = -1;
+    for (uint i = 0; i < count_of(polls); i++) {
+        int32_t late = now - polls[i].next;
+        if (late < 0) {
+            continue;
+        }
+
+        if ((best < 0) || (late > (int32_t)(now - polls[best].next))) {
+            best = i;
+        }
+    }
+    return best;
 }
 
-int16_t crafty_get_target_temp(void) {
-    uuid_base[3] = UUID_TARGET_TEMP;
+static void poll_store(enum ble_char_id id, int32_t v) {
+    if (id == CHAR_CRAFTY_CURRENT_TEMP) {
+        state.current_temp = v;
+        known |= 1 << VAP_CURRENT_TEMP;
+    } else if (id == CHAR_CRAFTY_TARGET_TEMP) {
+        state.target_temp = v;
+        known |= 1 << VAP_TARGET_TEMP;
+    } else if (id == CHAR_CRAFTY_BATTERY) {
+        state.battery = v;
+    }
+    state.updates++;
+}
+
+static void poll_reschedule(enum ble_char_id id, uint32_t when) {
+    for (uint i = 0; i < count_of(polls); i++) {
+        if (polls[i].id == id) {
+            polls[i].next = when;
+        }
+    }
+}
+
+void crafty_poll_set_clock(uint32_t (*clock)(void)) {
+    poll_clock = clock;
+}
 
-    uint8_t buff[2];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read unexpected value %" PRId32, r);
+void crafty_poll_start(void) {
+    memset(&state, 0, sizeof(state));
+    known = 0;
+
+    // stagger the first reads, so they don't all happen in one go
+    uint32_t now = now_ms();
+    for (uint i = 0; i < count_of(polls); i++) {
+        polls[i].next = now + i * CRAFTY_POLL_GAP_MS;
+    }
+    last_poll = now - CRAFTY_POLL_GAP_MS;
+}
+
+static void poll_done(int i, uint32_t now) {
+    // based on when it finished, not when it was due, so we can't pile up
+    polls[i].next = now + polls[i].interval;
+    last_poll = now;
+    reading = -1;
+}
+
+void crafty_poll_run(void) {
+    uint32_t now = now_ms();
+
+    if (reading >= 0) {
+        uint32_t v;
+        int8_t r = ble_char_read_poll(polls[reading].id, &v);
+        if (r == 0) {
+            return;
+        } else if (r < 0) {
+            state.errors++;
+        } else {
+            poll_store(polls[reading].id, v);
+        }
+        poll_done(reading, now);
+        return;
+    }
+
+    int i = poll_pick(now);
+    if (i < 0) {
+        return;
+    }
+
+    if (ble_char_read_start(polls[i].id) < 0) {
+        // eg. link busy with a workflow request, try again after the gap
+        state.errors++;
+        polls[i].next = now + CRAFTY_POLL_GAP_MS;
+        last_poll = now;
+        return;
+    }
+    reading = i;
+}
+
+struct crafty_state crafty_get_state(void) {
+    return state;
+}
+
+int16_t crafty_get_current_temp(void) {
+    uint32_t v;
+    if (ble_char_read(CHAR_CRAFTY_CURRENT_TEMP, &v) < 0) {
         return -1;
     }
+    return v;
+}
 
-    uint16_t *v = (uint16_t *)buff;
-    return *v;
+int16_t crafty_get_target_temp(void) {
+    uint32_t v;
+    if (ble_char_read(CHAR_CRAFTY_TARGET_TEMP, &v) < 0) {
+        return -1;
+    }
+    return v;
 }
 
-int8_t crafty_set_target_temp(uint16_t value) {
-    uuid_base[3] = UUID_WRITE_SRVC;
-    uuid_base2[3] = UUID_TARGET_TEMP;
+static void target_written(uint16_t value) {
+    poll_store(CHAR_CRAFTY_TARGET_TEMP, value);
 
-    uint8_t buff[2];
-    uint16_t *v = (uint16_t *)buff;
-    *v = value;
+    // read back soon, in case the device clamped the value
+    poll_reschedule(CHAR_CRAFTY_TARGET_TEMP, now_ms() + CRAFTY_POLL_GAP_MS);
+}
 
-    int8_t r = ble_write(uuid_base, uuid_base2, buff, sizeof(buff));
-    if (r != 0) {
-        debug("ble_write unexpected value %" PRId8, r);
+int8_t crafty_set_target_temp(uint16_t value) {
+    int8_t r = ble_char_write(CHAR_CRAFTY_TARGET_TEMP, value);
+    if (r == 0) {
+        target_written(value);
     }
     return r;
 }
 
 int8_t crafty_set_heater_state(bool value) {
-    uuid_base[3] = UUID_WRITE_SRVC;
+    return ble_char_write(value ? CHAR_CRAFTY_HEATER_ON : CHAR_CRAFTY_HEATER_OFF, 0);
+}
 
-    if (value) {
-        uuid_base2[3] = UUID_HEATER_ON;
-    } else {
-        uuid_base2[3] = UUID_HEATER_OFF;
+int8_t crafty_get_battery_state(void) {
+    uint32_t v;
+    if (ble_char_read(CHAR_CRAFTY_BATTERY, &v) < 0) {
+        return -1;
+    }
+    return v;
+}
+
+static enum ble_char_id value_char(enum vaporizer_value v) {
+    if (v == VAP_CURRENT_TEMP) {
+        return CHAR_CRAFTY_CURRENT_TEMP;
+    } else if (v == VAP_TARGET_TEMP) {
+        return CHAR_CRAFTY_TARGET_TEMP;
     }
+    return CHAR_INVALID;
+}
 
-    uint16_t d = 0;
-    int8_t r = ble_write(uuid_base, uuid_base2, (uint8_t *)&d, sizeof(d));
-    if (r != 0) {
-        debug("ble_write unexpected value %" PRId8, r);
+int8_t crafty_discover(void) {
+    for (uint i = 0; i < count_of(discover_wf); i++) {
+        int8_t r = ble_char_discover(discover_wf[i]);
+        if (r < 0) {
+            return r;
+        }
     }
-    return r;
+    return 0;
 }
 
-int8_t crafty_get_battery_state(void) {
-    uuid_base[3] = UUID_BATTERY;
+int8_t crafty_read_start(enum vaporizer_value v) {
+    enum ble_char_id id = value_char(v);
+    if (id == CHAR_INVALID) {
+        return -1;
+    }
+    return ble_char_read_start(id);
+}
 
-    uint8_t buff[2];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read unexpected value %" PRId32, r);
+int8_t crafty_read_poll(enum vaporizer_value v, int16_t *value) {
+    enum ble_char_id id = value_char(v);
+    if ((id == CHAR_INVALID) || (value == NULL)) {
         return -1;
     }
 
-    uint16_t *v = (uint16_t *)buff;
-    return *v;
+    uint32_t raw;
+    int8_t r = ble_char_read_poll(id, &raw);
+    if (r <= 0) {
+        if (r < 0) {
+            state.errors++;
+        }
+        return r;
+    }
+
+    poll_store(id, raw);
+    *value = raw;
+    return 1;
+}
+
+int8_t crafty_get_cached(enum vaporizer_value v, int16_t *value) {
+    if ((value_char(v) == CHAR_INVALID) || (value == NULL)) {
+        return -1;
+    }
+    if (!(known & (1 << v))) {
+        return -2;
+    }
+
+    *value = (v == VAP_CURRENT_TEMP) ? state.current_temp : state.target_temp;
+    return 0;
+}
+
+int8_t crafty_write_start(enum vaporizer_value v, uint16_t value) {
+    enum ble_char_id id = CHAR_INVALID;
+    if (v == VAP_TARGET_TEMP) {
+        id = CHAR_CRAFTY_TARGET_TEMP;
+    } else if (v == VAP_HEATER) {
+        id = value ? CHAR_CRAFTY_HEATER_ON : CHAR_CRAFTY_HEATER_OFF;
+        value = 0;
+    } else {
+        return -1;
+    }
+
+    int8_t r = ble_char_write_start(id, value);
+    async_id = (r == 0) ? id : CHAR_INVALID;
+    async_value = value;
+    return r;
+}
+
+int8_t crafty_write_poll(void) {
+    int8_t r = ble_char_write_poll();
+    if (r != 0) {
+        if ((r > 0) && (async_id == CHAR_CRAFTY_TARGET_TEMP)) {
+            target_written(async_value);
+        }
+        async_id = CHAR_INVALID;
+    }
+    return r;
 }
@@ -24,12 +24,25 @@
 
 #include "config.h"
 #include "log.h"
+#include "usb_msc.h"
 #include "debug_disk.h"
 
 static FATFS fs;
 static bool mounted = false;
+static uint32_t mount_msc_writes = 0;
+static uint32_t generation = 0;
 
+/*
+ * Writes go through a fresh mount, so FatFS starts from what the host
+ * left on the medium, and are unmounted again right after, so no
+ * FAT state of ours outlives them. Readers mount again on their own.
+ */
 void debug_disk_init_log(void) {
+    if (mounted && (debug_disk_unmount() != 0)) {
+        debug("error unmounting disk");
+        return;
+    }
+
     if (debug_disk_mount() != 0) {
         debug("error mounting disk");
         return;
@@ -42,12 +55,29 @@ void debug_disk_init_log(void) {
     }
 }
 
+bool debug_disk_stale(void) {
+    return mounted && (msc_write_count() != mount_msc_writes);
+}
+
+uint32_t debug_disk_generation(void) {
+    return generation;
+}
+
+/*
+ * Stays mounted until the USB host writes to the medium.
+ * Then FatFS state, and everything opened from it, is outdated
+ * and the next call mounts it again.
+ */
 int debug_disk_mount(void) {
-    if (mounted) {
-        debug("already mounted");
+    if (mounted && !debug_disk_stale()) {
         return 0;
     }
 
+    if (mounted) {
+        debug("medium changed by host, remounting");
+        debug_disk_unmount();
+    }
+
     FRESULT res = f_mount(&fs, "", 0);
     if (res != FR_OK) {
         debug("error: f_mount returned %d", res);
@@ -55,6 +85,8 @@ int debug_disk_mount(void) {
         return -1;
     }
 
+    mount_msc_writes = msc_write_count();
+    generation++;
     mounted = true;
     return 0;
 }
@@ -72,5 +104,6 @@ int debug_disk_unmount(void) {
     }
 
     mounted = false;
+    generation++;
     return 0;
 }
@@ -22,98 +22,680 @@
 
 #include "lwip/apps/httpd.h"
 #include "lwip/apps/fs.h"
+#include "lwip/tcp.h"
+#include "lwip_hooks.h"
 #include "ff.h"
 
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+
+#include "pico/stdlib.h"
 
 #include "config.h"
 #include "log.h"
+#include "log_json.h"
 #include "debug_disk.h"
+#include "api.h"
 #include "http.h"
 
-static char *fs_log_write_buf = NULL;
-static size_t fs_log_write_count = 0;
-static size_t fs_log_write_len = 0;
+#define HTTP_SECTOR_SIZE FF_MAX_SS
+#define HTTP_NAME_LEN 32
+#define HTTP_HEADER_LEN 160
+#define HTTP_MATCH_LEN 48 // If-None-Match, longer values are ignored
+
+// FIL is cached as it is after f_open, without its sector buffer
+#define HTTP_FIL_LEN offsetof(FIL, buf)
+static_assert((HTTP_FIL_LEN + FF_MAX_SS) == sizeof(FIL),
+              "FIL sector buffer needs to be at the end");
+
+enum http_kind {
+    HTTP_DISK = 0,
+    HTTP_LOG,
+    HTTP_API,
+    HTTP_EMPTY, // only the header
+};
+
+// file on disk, log or API response being streamed to one client
+struct http_file {
+    bool used;
+    enum http_kind kind;
+    union {
+        FIL f;
+        struct log_json log;
+        struct api_doc api;
+    };
+    bool cached; // f is a copy of a handle, closed when that is evicted
+    uint32_t start;
+
+    // sent before the data, httpd generates one when empty
+    char header[HTTP_HEADER_LEN];
+    uint16_t header_len;
+};
+
+// recently served file, opened again without walking the directory
+// it stays open until evicted, requests get a copy of the FIL
+struct http_handle {
+    char name[HTTP_NAME_LEN];
+    uint32_t generation; // of the mount it belongs to, 0 when unused
+    uint32_t last_used;
+    bool has_etag;
+    uint32_t etag;
+    uint8_t fil[HTTP_FIL_LEN];
+};
+
+// request httpd is parsing right now, see http_tcp_in()
+struct http_request {
+    bool valid;
+    bool http_09; // response without any header
+    char if_none_match[HTTP_MATCH_LEN];
+};
+
+struct http_stats {
+    uint32_t files;
+    uint32_t failed;
+    uint32_t bytes;
+    uint32_t busy_ms;
+    uint32_t last_len;
+    uint32_t last_ms;
+    int open_peak;
+
+    uint32_t handle_hits;
+    uint32_t handle_misses;
+    uint32_t open_us;
+    uint32_t open_us_max;
+    uint32_t not_modified;
+};
+
+static struct http_file files[HTTP_MAX_OPEN_FILES] = {0};
+static int open_files = 0;
+static struct http_handle handles[HTTP_HANDLE_CACHE] = {0};
+static uint32_t handle_uses = 0;
+static struct http_stats stats = {0};
+static int64_t log_since = -1;
+static struct http_request request = {0};
+
+extern const struct http_etag http_fsdata_etags[];
+
+// only to get the query parameters, httpd does not pass them to fs_open_custom()
+static const char *log_cgi(int index, int n, char *params[], char *values[]) {
+    (void)index;
+
+    log_since = -1;
+    for (int i = 0; i < n; i++) {
+        if (strcmp(params[i], "since") == 0) {
+            log_since = log_json_since(values[i]);
+        }
+    }
+    return "/log.json";
+}
+
+static const char *api_state_cgi(int index, int n, char *params[], char *values[]) {
+    (void)index;
+    (void)n;
+    (void)params;
+    (void)values;
+    return API_STATE_FILE;
+}
+
+static const char *api_workflows_cgi(int index, int n, char *params[], char *values[]) {
+    (void)index;
+    (void)n;
+    (void)params;
+    (void)values;
+    return API_WORKFLOWS_FILE;
+}
+
+static const tCGI cgi_handlers[] = {
+    { "/log.json", log_cgi },
+    { API_STATE_URI, api_state_cgi },
+    { API_WORKFLOWS_URI, api_workflows_cgi },
+};
+
+static bool request_starts(struct pbuf *p) {
+    return (pbuf_memcmp(p, 0, "GET ", 4) == 0)
+        || (pbuf_memcmp(p, 0, "HEAD ", 5) == 0)
+        || (pbuf_memcmp(p, 0, "POST ", 5) == 0);
+}
+
+static void request_parse(struct pbuf *p) {
+    memset(&request, 0, sizeof(request));
+
+    // continued requests are served without looking at their headers
+    if (!request_starts(p)) {
+        return;
+    }
+    request.valid = true;
+
+    u16_t eol = pbuf_memfind(p, "\r\n", 2, 0);
+    u16_t version = pbuf_memfind(p, " HTTP/", 6, 0);
+    request.http_09 = (eol != 0xFFFF) && ((version == 0xFFFF) || (version > eol));
+
+    static const char *names[] = { "If-None-Match:", "if-none-match:" };
+    for (size_t i = 0; i < LWIP_ARRAYSIZE(names); i++) {
+        u16_t off = pbuf_memfind(p, names[i], strlen(names[i]), 0);
+        if (off == 0xFFFF) {
+            continue;
+        }
+
+        char *v = request.if_none_match;
+        u16_t n = pbuf_copy_partial(p, v, HTTP_MATCH_LEN - 1, off + strlen(names[i]));
+        v[n] = '\0';
+        char *end = strpbrk(v, "\r\n");
+        if (end != NULL) {
+            *end = '\0';
+        } else {
+            v[0] = '\0';
+        }
+        break;
+    }
+}
+
+/*
+ * httpd does not pass request headers to fs_open_custom(), but it
+ * opens files while processing the segment with the request. lwip
+ * calls this hook for every incoming TCP segment right before, so the
+ * headers are looked at here, before httpd gets the same data.
+ */
+err_t http_tcp_in(struct tcp_pcb *pcb, struct pbuf *p) {
+    if ((pcb->local_port == HTTPD_SERVER_PORT) && (p->tot_len > 0)) {
+        request_parse(p);
+    }
+    return ERR_OK;
+}
 
 void http_init(void) {
+    http_set_cgi_handlers(cgi_handlers, LWIP_ARRAYSIZE(cgi_handlers));
     httpd_init();
 }
 
-static void fs_log_write(const void *b, size_t l) {
-    if ((fs_log_write_count + l) > fs_log_write_len) {
-        l = fs_log_write_len - fs_log_write_count;
+void http_status(void) {
+    println("HTTP: %d / %d files open, peak %d", open_files, HTTP_MAX_OPEN_FILES, stats.open_peak);
+    println("Files: %lu, failed: %lu, bytes: %lu", stats.files, stats.failed, stats.bytes);
+    if (stats.busy_ms > 0) {
+        println("Throughput: %.1f KiB/s", stats.bytes / 1.024f / stats.busy_ms);
+    }
+    if (stats.last_ms > 0) {
+        println("Last: %lu bytes in %lums (%.1f KiB/s)", stats.last_len, stats.last_ms,
+                stats.last_len / 1.024f / stats.last_ms);
+    }
+
+    uint32_t opens = stats.handle_hits + stats.handle_misses;
+    println("Handles: %lu hits, %lu misses, not modified: %lu",
+            stats.handle_hits, stats.handle_misses, stats.not_modified);
+    if (opens > 0) {
+        println("Open: %luus avg, %luus max", stats.open_us / opens, stats.open_us_max);
+    }
+    for (int i = 0; i < HTTP_HANDLE_CACHE; i++) {
+        if (handles[i].generation == debug_disk_generation()) {
+            println("  '%s'", handles[i].name);
+        }
+    }
+}
+
+/*
+ * Bytes to read at pos, with left bytes remaining in the file,
+ * into a buffer of count bytes.
+ * Reads end on a sector boundary when the buffer allows it,
+ * so the following ones go straight from disk into the buffer.
+ */
+uint32_t http_chunk_len(uint32_t pos, uint32_t left, uint32_t count) {
+    uint32_t n = MIN(left, count);
+    uint32_t end = ((pos + n) / HTTP_SECTOR_SIZE) * HTTP_SECTOR_SIZE;
+    if ((n < left) && (end > pos)) {
+        n = end - pos;
+    }
+    return n;
+}
+
+const char *http_mime_type(const char *name) {
+    static const char *types[][2] = {
+        { "html", "text/html" },
+        { "htm", "text/html" },
+        { "css", "text/css" },
+        { "js", "application/javascript" },
+        { "json", "application/json" },
+        { "txt", "text/plain" },
+        { "md", "text/plain" },
+        { "svg", "image/svg+xml" },
+        { "png", "image/png" },
+        { "jpg", "image/jpeg" },
+        { "jpeg", "image/jpeg" },
+        { "ico", "image/x-icon" },
+        { "xz", "application/x-xz" },
+        { "gz", "application/gzip" },
+    };
+
+    const char *ext = strrchr(name, '.');
+    if ((ext != NULL) && (strchr(ext, '/') == NULL)) {
+        for (size_t i = 0; i < LWIP_ARRAYSIZE(types); i++) {
+            if (strcasecmp(ext + 1, types[i][0]) == 0) {
+                return types[i][1];
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+bool http_etag_match(const char *value, uint32_t etag) {
+    char tag[11];
+    snprintf(tag, sizeof(tag), "\"%08lx\"", etag);
+
+    // list of tags, weak comparison ignores W/ on both sides, see RFC 9110
+    const char *p = value;
+    while (*p != '\0') {
+        while ((*p == ' ') || (*p == '\t') || (*p == ',')) {
+            p++;
+        }
+        if (*p == '*') {
+            return true;
+        }
+        if (strncmp(p, "W/", 2) == 0) {
+            p += 2;
+        }
+
+        // opaque quoted string, may contain commas itself
+        const char *end = p;
+        if (*p == '"') {
+            end = strchr(p + 1, '"');
+            end = (end != NULL) ? (end + 1) : (p + strlen(p));
+        }
+        if (((size_t)(end - p) == strlen(tag)) && (strncmp(p, tag, strlen(tag)) == 0)) {
+            return true;
+        }
+
+        p = end;
+        while ((*p != '\0') && (*p != ',')) {
+            p++;
+        }
+    }
+    return false;
+}
+
+size_t http_header(char *buff, size_t len, const char *name, int32_t size,
+                   uint32_t etag, bool weak) {
+    const char *w = weak ? "W/" : "";
+    int n;
+    if (size < 0) {
+        n = snprintf(buff, len,
+                     "HTTP/1.0 304 Not Modified\r\n"
+                     "ETag: %s\"%08lx\"\r\n"
+                     "Cache-Control: no-cache\r\n"
+                     "\r\n",
+                     w, etag);
+    } else {
+        n = snprintf(buff, len,
+                     "HTTP/1.0 200 OK\r\n"
+                     "Content-Length: %ld\r\n"
+                     "Content-Type: %s\r\n"
+                     "ETag: %s\"%08lx\"\r\n"
+                     "Cache-Control: no-cache\r\n"
+                     "\r\n",
+                     size, http_mime_type(name), w, etag);
+    }
+
+    // without one, httpd generates it
+    if ((n < 0) || ((size_t)n >= len)) {
+        return 0;
+    }
+    return n;
+}
+
+static struct http_file *http_file(struct fs_file *file) {
+    for (int i = 0; i < HTTP_MAX_OPEN_FILES; i++) {
+        if (file->pextension == &files[i]) {
+            return &files[i];
+        }
+    }
+    return NULL;
+}
+
+static struct http_file *http_file_open(void) {
+    for (int i = 0; i < HTTP_MAX_OPEN_FILES; i++) {
+        if (!files[i].used) {
+            files[i].header_len = 0;
+            return &files[i];
+        }
+    }
+    debug("error: too many open files");
+    stats.failed++;
+    return NULL;
+}
+
+static struct http_handle *handle_get(const char *name, FIL *f) {
+    for (int i = 0; i < HTTP_HANDLE_CACHE; i++) {
+        if ((handles[i].generation == debug_disk_generation())
+                && (strcmp(handles[i].name, name) == 0)) {
+            handles[i].last_used = ++handle_uses;
+            memcpy(f, handles[i].fil, HTTP_FIL_LEN);
+            return &handles[i];
+        }
+    }
+    return NULL;
+}
+
+// only valid on the mount it was opened on, unmounting closed it already
+static void handle_close(struct http_handle *h) {
+    if (h->generation == debug_disk_generation()) {
+        FIL f;
+        memcpy(&f, h->fil, HTTP_FIL_LEN);
+        f_close(&f);
     }
-    memcpy(fs_log_write_buf + fs_log_write_count, b, l);
-    fs_log_write_count += l;
+    h->generation = 0;
+}
+
+/*
+ * Copies still being served keep working after the handle is closed,
+ * FatFS does not track open files with FF_FS_LOCK disabled.
+ */
+static struct http_handle *handle_put(const char *name, const FIL *f) {
+    if (strlen(name) >= HTTP_NAME_LEN) {
+        return NULL;
+    }
+
+    // replace least recently used, entries from an old mount first
+    int lru = 0;
+    for (int i = 1; i < HTTP_HANDLE_CACHE; i++) {
+        bool old_i = handles[i].generation != debug_disk_generation();
+        bool old_lru = handles[lru].generation != debug_disk_generation();
+        if ((old_i && !old_lru)
+                || ((old_i == old_lru) && (handles[i].last_used < handles[lru].last_used))) {
+            lru = i;
+        }
+    }
+
+    handle_close(&handles[lru]);
+    strcpy(handles[lru].name, name);
+    handles[lru].generation = debug_disk_generation();
+    handles[lru].last_used = ++handle_uses;
+    handles[lru].has_etag = false;
+    memcpy(handles[lru].fil, f, HTTP_FIL_LEN);
+    return &handles[lru];
+}
+
+/*
+ * From the directory entry, without reading the content. It changes
+ * with the size, the timestamp or the first cluster of the file.
+ * Files with the same content can get different ones, so it is weak.
+ */
+static FRESULT http_etag(const FIL *f, const char *name, uint32_t *etag) {
+    FILINFO info;
+    FRESULT r = f_stat(name, &info);
+    if (r != FR_OK) {
+        return r;
+    }
+
+    const uint32_t v[] = {
+        info.fsize,
+        ((uint32_t)info.fdate << 16) | info.ftime,
+        f->obj.sclust,
+    };
+
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < LWIP_ARRAYSIZE(v); i++) {
+        for (size_t j = 0; j < 4; j++) {
+            h ^= (v[i] >> (j * 8)) & 0xFF;
+            h *= 16777619u;
+        }
+    }
+
+    *etag = h;
+    return FR_OK;
+}
+
+/*
+ * Same as f_open(), but remembers recently opened files.
+ * Their ETag is looked up once, when they are opened the first time.
+ * When cached is set, f is a copy the caller must not close.
+ */
+static FRESULT http_f_open(FIL *f, const char *name, uint32_t *etag, bool *cached) {
+    uint64_t start = to_us_since_boot(get_absolute_time());
+
+    // long-lived, only mounts again when the USB host changed the medium
+    if (debug_disk_mount() != 0) {
+        return FR_NOT_READY;
+    }
+
+    FRESULT r = FR_OK;
+    struct http_handle *h = handle_get(name, f);
+    if (h != NULL) {
+        stats.handle_hits++;
+    } else {
+        r = f_open(f, name, FA_READ);
+        if (r != FR_OK) {
+            return r;
+        }
+        h = handle_put(name, f);
+        stats.handle_misses++;
+    }
+
+    if ((h != NULL) && h->has_etag) {
+        *etag = h->etag;
+    } else {
+        r = http_etag(f, name, etag);
+        if (r != FR_OK) {
+            if (h != NULL) {
+                handle_close(h);
+            } else {
+                f_close(f);
+            }
+            return r;
+        }
+        if (h != NULL) {
+            h->etag = *etag;
+            h->has_etag = true;
+        }
+    }
+
+    *cached = (h != NULL);
+    uint32_t us = to_us_since_boot(get_absolute_time()) - start;
+    stats.open_us += us;
+    if (us > stats.open_us_max) {
+        stats.open_us_max = us;
+    }
+    return r;
+}
+
+static void http_file_opened(struct fs_file *file, struct http_file *hf, int len) {
+    hf->used = true;
+    hf->start = to_ms_since_boot(get_absolute_time());
+    open_files++;
+    if (open_files > stats.open_peak) {
+        stats.open_peak = open_files;
+    }
+
+    // data is read in fs_read_custom(), len is known for Content-Length
+    memset(file, 0, sizeof(struct fs_file));
+    file->data = NULL;
+    file->len = hf->header_len + len;
+    file->index = 0;
+    file->pextension = hf;
+    file->flags = FS_FILE_FLAGS_HEADER_PERSISTENT;
+    if (hf->header_len > 0) {
+        file->flags |= FS_FILE_FLAGS_HEADER_INCLUDED;
+    }
+    stats.files++;
+}
+
+// the client already has this version
+static bool http_not_modified(struct fs_file *file, struct http_file *hf,
+                              const char *name, uint32_t etag, bool weak) {
+    if (!request.valid || request.http_09
+            || !http_etag_match(request.if_none_match, etag)) {
+        return false;
+    }
+
+    hf->header_len = http_header(hf->header, HTTP_HEADER_LEN, name, -1, etag, weak);
+    if (hf->header_len == 0) {
+        return false;
+    }
+
+    hf->kind = HTTP_EMPTY;
+    http_file_opened(file, hf, 0);
+    stats.not_modified++;
+    return true;
 }
 
 int fs_open_custom(struct fs_file *file, const char *name) {
     debug("'%s'", name);
 
+    struct http_file *hf = http_file_open();
+    if (!hf) {
+        return 0;
+    }
+
     if (strcmp(name, "/log.json") == 0) {
-        size_t log_len = rb_len(log_get());
-        char *log = malloc(log_len);
-        if (!log) {
-            debug("error: not enough memory %d", log_len);
-            return 0;
-        }
-
-        fs_log_write_buf = log;
-        fs_log_write_count = 0;
-        fs_log_write_len = log_len;
-        rb_dump(log_get(), fs_log_write, 0);
-
-        memset(file, 0, sizeof(struct fs_file));
-        file->pextension = "/log.json";
-        file->data = log;
-        file->len = log_len;
-        file->index = file->len;
-        file->flags = FS_FILE_FLAGS_HEADER_PERSISTENT;
+        hf->kind = HTTP_LOG;
+        uint32_t len = log_json_open(&hf->log, log_since);
+        log_since = -1;
+        http_file_opened(file, hf, len);
         return 1;
     }
 
-    // TODO only do this when not mounted via USB
-    debug_disk_mount();
+    if (api_open(&hf->api, name)) {
+        hf->kind = HTTP_API;
+        http_file_opened(file, hf, hf->api.len);
+        return 1;
+    }
 
-    FIL f;
-    FRESULT r = f_open (&f, name, FA_READ);
-    if (r == FR_OK) {
-        FSIZE_t len = f_size(&f);
-        char *data = malloc(len);
-        if (!data) {
-            debug("error: not enough memory %ld", len);
-            f_close(&f);
-            debug_disk_unmount();
-            return 0;
+    uint32_t etag = 0;
+    if (http_f_open(&hf->f, name, &etag, &hf->cached) != FR_OK) {
+        // embedded file, with header from make_fsdata.sh
+        for (const struct http_etag *e = http_fsdata_etags; e->name != NULL; e++) {
+            if (strcmp(e->name, name) == 0) {
+                return http_not_modified(file, hf, name, e->etag, false) ? 1 : 0;
+            }
         }
+        return 0;
+    }
 
-        UINT read_count = 0;
-        r = f_read(&f, data, len, &read_count);
-        if ((r != FR_OK) || (read_count != len)) {
-            debug("invalid read: %d %d %ld", r, read_count, len);
+    if (http_not_modified(file, hf, name, etag, true)) {
+        if (!hf->cached) {
+            f_close(&hf->f);
         }
+        return 1;
+    }
 
-        memset(file, 0, sizeof(struct fs_file));
-        file->pextension = NULL;
-        file->data = data;
-        file->len = len;
-        file->index = file->len;
-        file->flags = FS_FILE_FLAGS_HEADER_PERSISTENT;
+    hf->kind = HTTP_DISK;
+    if (!request.http_09) {
+        hf->header_len = http_header(hf->header, HTTP_HEADER_LEN, name, f_size(&hf->f),
+                                     etag, true);
+    }
+    http_file_opened(file, hf, f_size(&hf->f));
+    return 1;
+}
 
-        f_close(&f);
-        debug_disk_unmount();
-        return 1;
+int fs_read_custom(struct fs_file *file, char *buffer, int count) {
+    struct http_file *hf = http_file(file);
+    if ((!hf) || (count <= 0)) {
+        return FS_READ_EOF;
+    }
+
+    if (file->index < hf->header_len) {
+        int n = MIN(count, hf->header_len - file->index);
+        memcpy(buffer, hf->header + file->index, n);
+        file->index += n;
+        stats.bytes += n;
+        return n;
+    }
+
+    if (hf->kind == HTTP_EMPTY) {
+        return FS_READ_EOF;
+    }
+
+    if (hf->kind != HTTP_DISK) {
+        int n = (hf->kind == HTTP_LOG) ? log_json_read(&hf->log, buffer, count)
+                                       : api_read(&hf->api, buffer, count);
+        if (n <= 0) {
+            stats.failed += (n < 0) ? 1 : 0;
+            return FS_READ_EOF;
+        }
+
+        file->index += n;
+        stats.bytes += n;
+        return n;
     }
 
-    debug_disk_unmount();
-    return 0;
+    if (debug_disk_stale()) {
+        debug("medium changed by host, aborting");
+        stats.failed++;
+        return FS_READ_EOF;
+    }
+
+    uint32_t n = http_chunk_len(file->index - hf->header_len, file->len - file->index, count);
+    if (n == 0) {
+        return FS_READ_EOF;
+    }
+
+    UINT read_count = 0;
+    FRESULT r = f_read(&hf->f, buffer, n, &read_count);
+    if ((r != FR_OK) || (read_count == 0)) {
+        debug("invalid read: %d %d %ld", r, read_count, n);
+        stats.failed++;
+        return FS_READ_EOF;
+    }
+
+    file->index += read_count;
+    stats.bytes += read_count;
+    return read_count;
 }
 
 void fs_close_custom(struct fs_file *file) {
     debug("len=%d", file->len);
 
-    if (file && file->data) {
-        free((void *)file->data);
-        file->data = NULL;
+    struct http_file *hf = http_file(file);
+    if (!hf) {
+        return;
     }
+
+    uint32_t ms = to_ms_since_boot(get_absolute_time()) - hf->start;
+    stats.busy_ms += ms;
+    stats.last_len = file->index;
+    stats.last_ms = ms;
+    debug("%d bytes in %lums", file->index, ms);
+
+    if ((hf->kind == HTTP_DISK) && !hf->cached) {
+        f_close(&hf->f);
+    }
+
+    hf->used = false;
+    file->pextension = NULL;
+    open_files--;
+}
+
+err_t httpd_post_begin(void *connection, const char *uri, const char *http_request,
+                       u16_t http_request_len, int content_len, char *response_uri,
+                       u16_t response_uri_len, u8_t *post_auto_wnd) {
+    (void)connection;
+    (void)http_request;
+    (void)http_request_len;
+    (void)post_auto_wnd;
+    debug("'%s' %d", uri, content_len);
+
+    if (!api_post_begin(uri)) {
+        snprintf(response_uri, response_uri_len, "/404.html");
+        return ERR_VAL;
+    }
+    return ERR_OK;
+}
+
+err_t httpd_post_receive_data(void *connection, struct pbuf *p) {
+    (void)connection;
+
+    char buff[32];
+    for (u16_t off = 0; off < p->tot_len; off += sizeof(buff)) {
+        u16_t n = pbuf_copy_partial(p, buff, sizeof(buff), off);
+        api_post_data(buff, n);
+    }
+
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+void httpd_post_finished(void *connection, char *response_uri, u16_t response_uri_len) {
+    (void)connection;
+    snprintf(response_uri, response_uri_len, "%s", api_post_end());
 }
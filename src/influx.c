@@ -0,0 +1,523 @@
+/*
+ * influx.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include "influx.h"
+
+#ifdef VOLCANO_INFLUX_DB
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/cyw43_arch.h"
+#include "lwip/tcp.h"
+
+#include "log.h"
+#include "spool.h"
+#include "usb_descriptors.h"
+#include "wifi.h"
+
+#define INFLUX_TIMEOUT_MS 5000 // for connect and each response
+#define INFLUX_RETRY_MS 10000 // after an error
+#define INFLUX_TX_LEN 1400 // one segment
+#define INFLUX_BODY_LEN 1200
+#define INFLUX_RX_LEN 512 // response headers, body is skipped
+
+enum influx_state {
+    IS_IDLE = 0,
+    IS_CONNECTING,
+    IS_PING,
+    IS_READY,
+    IS_WRITE,
+};
+
+struct influx_point {
+    int64_t t; // ms since boot, negative for points spooled before
+    const char *name;
+    float value;
+};
+
+struct influx_stats {
+    uint32_t points;
+    uint32_t batches;
+    uint32_t bytes;
+    uint32_t drops;
+    uint32_t spooled;
+    uint32_t backfilled;
+    uint32_t connects;
+    uint32_t errors;
+};
+
+// ids of fields in the flash spool, only these are spooled
+static const char *const fields[] = {
+    "current",
+    "target",
+    "heater",
+    "pump",
+};
+static_assert((sizeof(fields) / sizeof(fields[0])) <= SPOOL_MAX_FIELDS,
+              "Too many fields for spool encoding");
+
+static struct influx_point queue[INFLUXDB_QUEUE_LEN];
+static uint16_t head = 0, count = 0;
+static uint16_t in_flight = 0;
+
+static enum influx_state state = IS_IDLE;
+static uint32_t state_t = 0;
+static uint32_t retry_t = 0;
+static bool backoff = false;
+static bool synced = false;
+static int64_t epoch_offset = 0; // ms, boot time to unix time
+static uint32_t drain_t = 0;
+
+static char tx[INFLUX_TX_LEN];
+static char body[INFLUX_BODY_LEN];
+
+static struct influx_stats stats = {0};
+
+// set from lwip callbacks
+static struct tcp_pcb *pcb = NULL;
+static bool connected = false;
+static bool closed = false;
+static char rx[INFLUX_RX_LEN + 1];
+static uint16_t rx_len = 0;
+static bool rx_headers = false;
+static int32_t rx_remaining = 0;
+static bool resp_done = false;
+static int resp_status = 0;
+static int64_t resp_date = -1; // s since epoch
+
+// days since 1970-01-01 for a proleptic Gregorian date
+static int32_t days_from_civil(int y, int m, int d) {
+    y -= (m <= 2) ? 1 : 0;
+    int era = ((y >= 0) ? y : (y - 399)) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + ((m > 2) ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// "Mon, 19 Oct 2026 12:34:56 GMT", returns < 0 on error
+static int64_t parse_date(const char *s) {
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    int d, y, hh, mm, ss;
+    char mon[4] = {0};
+    if (sscanf(s, "%*3s, %d %3s %d %d:%d:%d", &d, mon, &y, &hh, &mm, &ss) != 6) {
+        return -1;
+    }
+
+    const char *p = strstr(months, mon);
+    if ((p == NULL) || (((p - months) % 3) != 0)) {
+        return -1;
+    }
+    int m = (p - months) / 3 + 1;
+
+    return (int64_t)days_from_civil(y, m, d) * 86400 + hh * 3600 + mm * 60 + ss;
+}
+
+static void parse_headers(void) {
+    resp_status = 0;
+    if (strncmp(rx, "HTTP/1.", 7) == 0) {
+        resp_status = atoi(rx + 9);
+    }
+
+    rx_remaining = 0;
+    for (char *line = strstr(rx, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            rx_remaining = atoi(line + 15);
+        } else if (strncasecmp(line, "Date:", 5) == 0) {
+            resp_date = parse_date(line + 5 + strspn(line + 5, " "));
+        }
+    }
+}
+
+static void rx_data(const char *data, uint16_t len) {
+    if (rx_headers) {
+        // skip the body, influx only sends one for errors
+        rx_remaining -= len;
+    } else {
+        uint16_t n = MIN(len, INFLUX_RX_LEN - rx_len);
+        memcpy(rx + rx_len, data, n);
+        rx_len += n;
+        rx[rx_len] = '\0';
+
+        char *end = strstr(rx, "\r\n\r\n");
+        if (end == NULL) {
+            if (rx_len >= INFLUX_RX_LEN) {
+                debug("influx response headers too long");
+                closed = true;
+            }
+            return;
+        }
+
+        *end = '\0';
+        rx_headers = true;
+        parse_headers();
+
+        // body bytes received together with the headers
+        uint16_t header_len = (end - rx) + 4;
+        rx_remaining -= (rx_len - header_len) + (len - n);
+    }
+
+    if (rx_remaining <= 0) {
+        resp_done = true;
+    }
+}
+
+static err_t influx_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
+    (void)arg;
+    (void)err;
+
+    if (p == NULL) {
+        closed = true;
+        return ERR_OK;
+    }
+
+    for (struct pbuf *q = p; q != NULL; q = q->next) {
+        rx_data(q->payload, q->len);
+    }
+    tcp_recved(tpcb, p->tot_len);
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static err_t influx_connected(void *arg, struct tcp_pcb *tpcb, err_t err) {
+    (void)arg;
+    (void)tpcb;
+    (void)err;
+    connected = true;
+    return ERR_OK;
+}
+
+static void influx_error(void *arg, err_t err) {
+    (void)arg;
+    debug("influx tcp err %d", err);
+    pcb = NULL; // lwip already freed it
+    closed = true;
+}
+
+static void disconnect(void) {
+    if (pcb != NULL) {
+        tcp_arg(pcb, NULL);
+        tcp_recv(pcb, NULL);
+        tcp_err(pcb, NULL);
+        if (tcp_close(pcb) != ERR_OK) {
+            tcp_abort(pcb);
+        }
+        pcb = NULL;
+    }
+
+    // queued points stay, a batch in flight is sent again
+    in_flight = 0;
+    state = IS_IDLE;
+}
+
+static void fail(uint32_t now, const char *why) {
+    debug("influx %s", why);
+    stats.errors++;
+    retry_t = now;
+    backoff = true;
+    disconnect();
+}
+
+static void open_connection(uint32_t now) {
+    ip4_addr_t ip;
+    if (!ip4addr_aton(INFLUXDB_HOST, &ip)) {
+        fail(now, "invalid IP: " INFLUXDB_HOST);
+        return;
+    }
+
+    pcb = tcp_new();
+    if (pcb == NULL) {
+        fail(now, "no pcb");
+        return;
+    }
+
+    connected = false;
+    closed = false;
+    tcp_arg(pcb, NULL);
+    tcp_err(pcb, influx_error);
+    tcp_recv(pcb, influx_recv);
+
+    stats.connects++;
+    state = IS_CONNECTING;
+    state_t = now;
+    if (tcp_connect(pcb, &ip, INFLUXDB_PORT, influx_connected) != ERR_OK) {
+        fail(now, "connect failed");
+    }
+}
+
+static bool request(uint32_t now, const char *data, uint16_t len) {
+    rx_len = 0;
+    rx_headers = false;
+    rx_remaining = 0;
+    resp_done = false;
+    resp_date = -1;
+
+    if ((len > tcp_sndbuf(pcb))
+            || (tcp_write(pcb, data, len, TCP_WRITE_FLAG_COPY) != ERR_OK)
+            || (tcp_output(pcb) != ERR_OK)) {
+        fail(now, "write failed");
+        return false;
+    }
+
+    state_t = now;
+    return true;
+}
+
+static void ping(uint32_t now) {
+    int n = snprintf(tx, sizeof(tx),
+                     "GET /ping HTTP/1.1\r\n"
+                     "Host: %s\r\n"
+                     "\r\n",
+                     INFLUXDB_HOST);
+    if (request(now, tx, n)) {
+        state = IS_PING;
+    }
+}
+
+static void write_batch(uint32_t now) {
+    uint16_t body_len = 0;
+    uint16_t n = 0;
+    while ((n < count) && (n < INFLUXDB_BATCH_POINTS)) {
+        const struct influx_point *p = &queue[(head + n) % INFLUXDB_QUEUE_LEN];
+        int64_t t = epoch_offset + p->t;
+        int r = snprintf(body + body_len, sizeof(body) - body_len,
+                         "volcano,device=%s %s=%.2f %lld\n",
+                         string_pico_serial, p->name, p->value, t);
+        if ((r < 0) || (r >= (int)(sizeof(body) - body_len))) {
+            break;
+        }
+        body_len += r;
+        n++;
+    }
+
+    int hl = snprintf(tx, sizeof(tx),
+                      "POST /write?db=%s&precision=ms HTTP/1.1\r\n"
+                      "Host: %s\r\n"
+                      "Content-Length: %u\r\n"
+                      "\r\n",
+                      INFLUXDB_DATABASE, INFLUXDB_HOST, body_len);
+    if ((hl + body_len) > (int)sizeof(tx)) {
+        n = 0; // can not happen with the sizes above
+        fail(now, "batch too large");
+        return;
+    }
+    memcpy(tx + hl, body, body_len);
+
+    if (request(now, tx, hl + body_len)) {
+        debug("influx write %u points", n);
+        in_flight = n;
+        stats.bytes += hl + body_len;
+        state = IS_WRITE;
+    }
+}
+
+static void write_done(uint32_t now) {
+    if ((resp_status >= 200) && (resp_status < 300)) {
+        stats.batches++;
+    } else if ((resp_status >= 400) && (resp_status < 500)) {
+        // would not be accepted on retry either
+        debug("influx rejected batch (%d)", resp_status);
+        stats.errors++;
+        stats.drops += in_flight;
+    } else {
+        fail(now, "server error");
+        return;
+    }
+
+    head = (head + in_flight) % INFLUXDB_QUEUE_LEN;
+    count -= in_flight;
+    in_flight = 0;
+    state = IS_READY;
+}
+
+static int8_t field_id(const char *name) {
+    for (uint8_t i = 0; i < (sizeof(fields) / sizeof(fields[0])); i++) {
+        if (strcmp(fields[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void enqueue(const char *name, int64_t t, float value) {
+    if (count >= INFLUXDB_QUEUE_LEN) {
+        if (in_flight > 0) {
+            // can not drop the oldest, they are being written
+            stats.drops++;
+            return;
+        }
+
+        head = (head + 1) % INFLUXDB_QUEUE_LEN;
+        count--;
+        stats.drops++;
+    }
+
+    struct influx_point *p = &queue[(head + count) % INFLUXDB_QUEUE_LEN];
+    p->t = t;
+    p->name = name;
+    p->value = value;
+    count++;
+}
+
+// move spooled points to the queue, leaving room for live ones
+static void drain(uint32_t now) {
+    if (spool_empty() || ((now - drain_t) < INFLUXDB_SPOOL_DRAIN_MS)) {
+        return;
+    }
+    drain_t = now;
+
+    spool_flush();
+    for (uint8_t n = 0; (n < INFLUXDB_SPOOL_DRAIN_POINTS)
+                        && (count < (INFLUXDB_QUEUE_LEN / 2)); n++) {
+        uint8_t field;
+        int64_t t;
+        float value;
+        if (spool_read(&field, &t, &value) != 1) {
+            break;
+        }
+        if (field >= (sizeof(fields) / sizeof(fields[0]))) {
+            stats.drops++;
+            continue;
+        }
+
+        enqueue(fields[field], t - epoch_offset, value);
+        stats.backfilled++;
+    }
+}
+
+void influx_point(const char *name, float value) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    stats.points++;
+
+    // without time of day the points can only stay in RAM
+    int8_t id = field_id(name);
+    if ((!wifi_ready()) && synced && (id >= 0)) {
+        if (spool_append(id, epoch_offset + now, value) == 0) {
+            stats.spooled++;
+            return;
+        }
+    }
+
+    enqueue(name, now, value);
+}
+
+void influx_run(void) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    if (wifi_ready() && synced) {
+        // flash access outside of the lwip lock
+        drain(now);
+    }
+
+    cyw43_arch_lwip_begin();
+
+    if (!wifi_ready()) {
+        if (state != IS_IDLE) {
+            disconnect();
+        }
+        cyw43_arch_lwip_end();
+        return;
+    }
+
+    if ((state != IS_IDLE) && closed) {
+        if ((state == IS_READY) && (pcb != NULL)) {
+            // server closed an idle keep-alive connection
+            debug("influx connection closed");
+            disconnect();
+        } else {
+            fail(now, "connection lost");
+        }
+    } else if ((state == IS_CONNECTING) || (state == IS_PING) || (state == IS_WRITE)) {
+        if ((now - state_t) >= INFLUX_TIMEOUT_MS) {
+            fail(now, "timeout");
+        }
+    }
+
+    switch (state) {
+    case IS_IDLE:
+        if ((count > 0) && (!backoff || ((now - retry_t) >= INFLUX_RETRY_MS))) {
+            backoff = false;
+            open_connection(now);
+        }
+        break;
+
+    case IS_CONNECTING:
+        if (connected) {
+            // refresh our time of day on every new connection
+            ping(now);
+        }
+        break;
+
+    case IS_PING:
+        if (resp_done) {
+            if (resp_date >= 0) {
+                epoch_offset = resp_date * 1000 - state_t;
+                synced = true;
+            } else if (synced) {
+                // some proxies strip it, our clock still runs from the last sync
+                debug("influx ping without date (%d), keeping local clock", resp_status);
+            } else {
+                // points can not be timestamped, try again later
+                fail(now, "ping without date");
+                break;
+            }
+            state = IS_READY;
+        }
+        break;
+
+    case IS_READY:
+        if (synced && (count > 0) && ((count >= INFLUXDB_BATCH_POINTS)
+                || ((now - queue[head].t) >= INFLUXDB_FLUSH_MS))) {
+            write_batch(now);
+        }
+        break;
+
+    case IS_WRITE:
+        if (resp_done) {
+            write_done(now);
+        }
+        break;
+    }
+
+    cyw43_arch_lwip_end();
+}
+
+void influx_status(void) {
+    static const char *names[] = {
+        [IS_IDLE] = "idle",
+        [IS_CONNECTING] = "connecting",
+        [IS_PING] = "syncing time",
+        [IS_READY] = "connected",
+        [IS_WRITE] = "writing",
+    };
+
+    println("InfluxDB %s:%d, %s, time %s", INFLUXDB_HOST, INFLUXDB_PORT,
+            names[state], synced ? "synced" : "unknown");
+    println("Queued: %u / %u, in flight: %u", count, INFLUXDB_QUEUE_LEN, in_flight);
+    println("Points: %lu, batches: %lu, bytes: %lu, drops: %lu",
+            stats.points, stats.batches, stats.bytes, stats.drops);
+    println("Spooled: %lu, backfilled: %lu", stats.spooled, stats.backfilled);
+    println("Connects: %lu, errors: %lu", stats.connects, stats.errors);
+    spool_status();
+}
+
+#endif // VOLCANO_INFLUX_DB
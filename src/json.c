@@ -0,0 +1,172 @@
+/*
+ * json.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "json.h"
+
+void json_init(struct json_out *o, char *buff, uint32_t start, uint32_t len) {
+    memset(o, 0, sizeof(struct json_out));
+    o->buff = buff;
+    o->start = start;
+    o->end = buff ? (start + len) : start;
+}
+
+bool json_full(const struct json_out *o) {
+    return o->pos > o->end;
+}
+
+uint32_t json_len(const struct json_out *o) {
+    if (o->pos <= o->start) {
+        return 0;
+    }
+    return ((o->pos < o->end) ? o->pos : o->end) - o->start;
+}
+
+void json_raw_c(struct json_out *o, char c) {
+    if ((o->pos >= o->start) && (o->pos < o->end)) {
+        o->buff[o->pos - o->start] = c;
+    }
+    o->pos++;
+}
+
+void json_raw(struct json_out *o, const char *s) {
+    while (*s) {
+        json_raw_c(o, *s++);
+    }
+}
+
+void json_raw_u(struct json_out *o, uint32_t v) {
+    char tmp[11];
+    snprintf(tmp, sizeof(tmp), "%lu", (unsigned long)v);
+    json_raw(o, tmp);
+}
+
+void json_escaped_c(struct json_out *o, char c) {
+    if (c == '"') {
+        json_raw(o, "\\\"");
+    } else if (c == '\\') {
+        json_raw(o, "\\\\");
+    } else if (c == '\n') {
+        json_raw(o, "\\n");
+    } else if (c == '\r') {
+        json_raw(o, "\\r");
+    } else if (c == '\t') {
+        json_raw(o, "\\t");
+    } else if ((c < 0x20) || (c >= 0x7F)) {
+        // not necessarily UTF-8, keep it valid JSON
+        char tmp[7];
+        snprintf(tmp, sizeof(tmp), "\\u%04X", (uint8_t)c);
+        json_raw(o, tmp);
+    } else {
+        json_raw_c(o, c);
+    }
+}
+
+// comma before all but the first value on this level
+static void json_sep(struct json_out *o) {
+    if (o->key) {
+        o->key = false;
+        return;
+    }
+
+    uint32_t bit = 1UL << (o->depth % JSON_MAX_DEPTH);
+    if (o->members & bit) {
+        json_raw_c(o, ',');
+    }
+    o->members |= bit;
+}
+
+static void json_push(struct json_out *o, char c) {
+    json_sep(o);
+    json_raw_c(o, c);
+    o->depth++;
+    o->members &= ~(1UL << (o->depth % JSON_MAX_DEPTH));
+}
+
+static void json_pop(struct json_out *o, char c) {
+    if (o->depth > 0) {
+        o->depth--;
+    }
+    json_raw_c(o, c);
+}
+
+void json_obj_begin(struct json_out *o) {
+    json_push(o, '{');
+}
+
+void json_obj_end(struct json_out *o) {
+    json_pop(o, '}');
+}
+
+void json_arr_begin(struct json_out *o) {
+    json_push(o, '[');
+}
+
+void json_arr_end(struct json_out *o) {
+    json_pop(o, ']');
+}
+
+void json_key(struct json_out *o, const char *key) {
+    json_str(o, key);
+    json_raw_c(o, ':');
+    o->key = true;
+}
+
+void json_str(struct json_out *o, const char *s) {
+    json_str_n(o, s, SIZE_MAX);
+}
+
+void json_str_n(struct json_out *o, const char *s, size_t max) {
+    json_sep(o);
+    json_raw_c(o, '"');
+    for (size_t i = 0; (i < max) && s[i]; i++) {
+        json_escaped_c(o, s[i]);
+    }
+    json_raw_c(o, '"');
+}
+
+void json_int(struct json_out *o, int32_t v) {
+    json_sep(o);
+    if (v < 0) {
+        json_raw_c(o, '-');
+    }
+    json_raw_u(o, (v < 0) ? -(uint32_t)v : (uint32_t)v);
+}
+
+void json_tenths(struct json_out *o, int32_t v) {
+    json_sep(o);
+    uint32_t u = (v < 0) ? -(uint32_t)v : (uint32_t)v;
+    if (v < 0) {
+        json_raw_c(o, '-');
+    }
+    json_raw_u(o, u / 10);
+    json_raw_c(o, '.');
+    json_raw_c(o, '0' + (u % 10));
+}
+
+void json_bool(struct json_out *o, bool v) {
+    json_sep(o);
+    json_raw(o, v ? "true" : "false");
+}
+
+void json_null(struct json_out *o) {
+    json_sep(o);
+    json_raw(o, "null");
+}
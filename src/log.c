@@ -32,6 +32,12 @@
 static uint8_t log_buff[4096] = {0};
 static struct ring_buffer log_rb = RB_INIT(log_buff, sizeof(log_buff), 1);
 
+// start of each record in log_rb, as offset from the very first byte
+#define LOG_RECORDS 128
+static uint32_t log_starts[LOG_RECORDS] = {0};
+static uint32_t log_count = 0;
+static uint32_t log_written = 0;
+
 static uint8_t line_buff[512] = {0};
 static volatile bool got_input = false;
 
@@ -40,6 +46,10 @@ static FIL log_file_fat;
 #endif // PICOWOTA
 
 static void add_to_log(const void *buff, size_t len) {
+    log_starts[log_count % LOG_RECORDS] = log_written;
+    log_count++;
+    log_written += len;
+
     rb_add(&log_rb, buff, len);
 }
 
@@ -47,6 +57,49 @@ struct ring_buffer *log_get(void) {
     return &log_rb;
 }
 
+uint32_t log_next_seq(void) {
+    return log_count;
+}
+
+static bool log_record_valid(uint32_t seq) {
+    if ((seq >= log_count) || ((log_count - seq) > LOG_RECORDS)) {
+        return false;
+    }
+
+    // oldest bytes of the ring may have been overwritten already
+    return (log_written - log_starts[seq % LOG_RECORDS]) <= rb_len(&log_rb);
+}
+
+uint32_t log_first_seq(void) {
+    uint32_t seq = (log_count > LOG_RECORDS) ? (log_count - LOG_RECORDS) : 0;
+    while ((seq < log_count) && !log_record_valid(seq)) {
+        seq++;
+    }
+    return seq;
+}
+
+int log_record(uint32_t seq, struct log_record *r) {
+    if (!log_record_valid(seq)) {
+        return -1;
+    }
+
+    uint32_t start = log_starts[seq % LOG_RECORDS];
+    uint32_t end = ((seq + 1) < log_count) ? log_starts[(seq + 1) % LOG_RECORDS] : log_written;
+    size_t back = log_written - start;
+    size_t pos = (log_rb.head + log_rb.size - back) % log_rb.size;
+
+    r->seq = seq;
+    r->a = (const uint8_t *)log_rb.buffer + pos;
+    r->a_len = end - start;
+    r->b = log_rb.buffer;
+    r->b_len = 0;
+    if ((pos + r->a_len) > log_rb.size) {
+        r->b_len = r->a_len - (log_rb.size - pos);
+        r->a_len = log_rb.size - pos;
+    }
+    return 0;
+}
+
 #ifndef PICOWOTA
 static void log_dump_to_x(void (*write)(const void *, size_t)) {
     if (rb_len(&log_rb) == 0) {
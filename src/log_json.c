@@ -0,0 +1,210 @@
+/*
+ * log_json.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include "log.h"
+#include "log_json.h"
+#include "json.h"
+
+static char rec_at(const struct log_record *r, size_t i) {
+    return (i < r->a_len) ? r->a[i] : r->b[i - r->a_len];
+}
+
+static bool rec_digit(const struct log_record *r, size_t i, size_t len) {
+    return (i < len) && (rec_at(r, i) >= '0') && (rec_at(r, i) <= '9');
+}
+
+static bool rec_starts(const struct log_record *r, size_t i, size_t len, const char *s) {
+    for (; *s; s++, i++) {
+        if ((i >= len) || ((rec_at(r, i) | 0x20) != *s)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void out_escaped(struct json_out *o, const struct log_record *r, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) {
+        json_escaped_c(o, rec_at(r, i));
+    }
+}
+
+static void render_record(struct json_out *o, const struct log_record *r, bool first) {
+    size_t len = r->a_len + r->b_len;
+    while ((len > 0) && ((rec_at(r, len - 1) == '\r') || (rec_at(r, len - 1) == '\n'))) {
+        len--;
+    }
+
+    // "%08lu func:line: msg", see debug() in log.h
+    uint32_t time = 0, line = 0;
+    size_t mod_start = 0, mod_end = 0, msg_start = 0;
+    size_t i = 0;
+    while (rec_digit(r, i, len)) {
+        time = (time * 10) + (rec_at(r, i++) - '0');
+    }
+    if ((i > 0) && (i < len) && (rec_at(r, i) == ' ')) {
+        mod_start = ++i;
+        while ((i < len) && (rec_at(r, i) != ':') && (rec_at(r, i) != ' ')) {
+            i++;
+        }
+        mod_end = i;
+
+        if ((i < len) && (rec_at(r, i) == ':') && rec_digit(r, i + 1, len)) {
+            i++;
+            while (rec_digit(r, i, len)) {
+                line = (line * 10) + (rec_at(r, i++) - '0');
+            }
+            if ((i < len) && (rec_at(r, i) == ':')) {
+                i++;
+                if ((i < len) && (rec_at(r, i) == ' ')) {
+                    i++;
+                }
+                msg_start = i;
+            }
+        }
+    }
+    if (msg_start == 0) {
+        // not from debug(), keep all of it
+        time = line = 0;
+        mod_start = mod_end = 0;
+    }
+
+    const char *level = "debug";
+    if (rec_starts(r, msg_start, len, "error")) {
+        level = "error";
+    } else if (rec_starts(r, msg_start, len, "warning")) {
+        level = "warning";
+    }
+
+    json_raw(o, first ? "[\n" : ",\n");
+    json_raw(o, "{\"seq\":");
+    json_raw_u(o, r->seq);
+    json_raw(o, ",\"time\":");
+    json_raw_u(o, time);
+    json_raw(o, ",\"level\":\"");
+    json_raw(o, level);
+    json_raw(o, "\",\"module\":\"");
+    out_escaped(o, r, mod_start, mod_end);
+    json_raw(o, "\",\"line\":");
+    json_raw_u(o, line);
+    json_raw(o, ",\"msg\":\"");
+    out_escaped(o, r, msg_start, len);
+    json_raw(o, "\"}");
+}
+
+/*
+ * Renders part seq of the document, records first, then the end.
+ * Returns < 0 if the record is gone after some of it was rendered.
+ */
+static int render_part(struct json_out *o, struct log_json *j, uint32_t seq) {
+    if (seq == j->end) {
+        json_raw(o, (j->begin == j->end) ? "[\n]\n" : "\n]\n");
+        return 0;
+    }
+
+    struct log_record r;
+    if (!j->lost && (log_record(seq, &r) == 0)) {
+        render_record(o, &r, seq == j->begin);
+        return 0;
+    } else if (!j->lost && (o->start > 0)) {
+        return -1;
+    }
+    j->lost = true;
+
+    // always shorter than the record was
+    json_raw(o, (seq == j->begin) ? "[\n" : ",\n");
+    json_raw(o, "{\"seq\":");
+    json_raw_u(o, seq);
+    json_raw(o, ",\"lost\":true}");
+    return 0;
+}
+
+int64_t log_json_since(const char *s) {
+    if ((s == NULL) || (*s < '0') || (*s > '9')) {
+        return -1;
+    }
+
+    // sequence numbers are 32bit
+    int64_t v = 0;
+    for (; *s; s++) {
+        if ((*s < '0') || (*s > '9') || (v > UINT32_MAX)) {
+            return -1;
+        }
+        v = (v * 10) + (*s - '0');
+    }
+    return (v > UINT32_MAX) ? -1 : v;
+}
+
+uint32_t log_json_open(struct log_json *j, int64_t since) {
+    uint32_t first = log_first_seq();
+    uint32_t next = log_next_seq();
+
+    j->begin = first;
+    if ((since >= 0) && (since < next) && ((since + 1) > first)) {
+        j->begin = since + 1;
+    }
+    // since from before a reboot is >= next, so it gets everything
+
+    j->end = next;
+    j->seq = j->begin;
+    j->off = 0;
+    j->lost = false;
+    j->pos = 0;
+
+    struct json_out o;
+    json_init(&o, NULL, 0, 0);
+    for (uint32_t seq = j->begin; seq <= j->end; seq++) {
+        render_part(&o, j, seq);
+    }
+    j->lost = false;
+    j->len = o.pos;
+    return j->len;
+}
+
+int log_json_read(struct log_json *j, char *buff, size_t len) {
+    size_t n = 0;
+    while ((n < len) && (j->seq <= j->end)) {
+        struct json_out o;
+        json_init(&o, buff + n, j->off, len - n);
+        if (render_part(&o, j, j->seq) < 0) {
+            debug("record %lu overwritten while sending", j->seq);
+            return -1;
+        }
+
+        if (json_full(&o)) {
+            // continue with this one next time
+            n = len;
+            j->off = o.end;
+        } else {
+            n += json_len(&o);
+            j->off = 0;
+            j->lost = false;
+            j->seq++;
+        }
+    }
+
+    // never more than promised, missing records are filled with whitespace
+    if ((j->pos + n) > j->len) {
+        n = j->len - j->pos;
+    }
+    while ((n < len) && ((j->pos + n) < j->len)) {
+        buff[n++] = ' ';
+    }
+    j->pos += n;
+    return n;
+}
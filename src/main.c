@@ -22,11 +22,14 @@
 #include "hardware/adc.h"
 
 #include "config.h"
+#include "influx.h"
+#include "spool.h"
 #include "util.h"
 #include "console.h"
 #include "log.h"
 #include "usb.h"
 #include "usb_msc.h"
+#include "usb_net.h"
 #include "debug_disk.h"
 #include "buttons.h"
 #include "ble.h"
@@ -39,6 +42,7 @@
 #include "workflow.h"
 #include "wifi.h"
 #include "http.h"
+#include "api.h"
 #include "cache.h"
 #include "main.h"
 
@@ -56,12 +60,26 @@ void main_loop_hw(void) {
     cache_run();
 }
 
+// listening on all interfaces, wifi and USB
+static void servers_init(void) {
+    static bool initialized = false;
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+
+    debug("http_init");
+    http_init();
+
+    debug("api_init");
+    api_init();
+}
+
 void networking_init(void) {
     debug("wifi_init");
     wifi_init();
 
-    debug("http_init");
-    http_init();
+    servers_init();
 }
 
 void networking_deinit(void) {
@@ -71,6 +89,11 @@ void networking_deinit(void) {
 
 void networking_run(void) {
     wifi_run();
+    api_run();
+
+#ifdef VOLCANO_INFLUX_DB
+    influx_run();
+#endif // VOLCANO_INFLUX_DB
 }
 
 int main(void) {
@@ -125,6 +148,11 @@ int main(void) {
     debug("cache_init");
     cache_init();
 
+#ifdef VOLCANO_INFLUX_DB
+    debug("spool_init");
+    spool_init();
+#endif // VOLCANO_INFLUX_DB
+
 #ifdef AUTO_MOUNT_MASS_STORAGE
     msc_set_medium_available(true);
 #endif // AUTO_MOUNT_MASS_STORAGE
@@ -147,6 +175,12 @@ int main(void) {
         debug("wifi not enabled");
     }
 
+#ifdef USB_NETWORK
+    debug("usb_net_init");
+    usb_net_init();
+    servers_init();
+#endif // USB_NETWORK
+
     debug("starting app");
     state_switch(STATE_SCAN);
 
@@ -157,6 +191,7 @@ int main(void) {
         battery_run();
         state_run();
         wf_run();
+        api_work();
     }
 
     return 0;
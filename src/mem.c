@@ -44,14 +44,73 @@ static const uint8_t *data_flash = (const uint8_t *)(XIP_BASE + EEPROM_FLASH_OFF
 static_assert(sizeof(struct mem_contents) < FLASH_SECTOR_SIZE,
               "Config needs to fit inside a flash sector");
 
-static uint32_t calc_checksum(const struct mem_contents *data) {
+static_assert(sizeof(struct wf_step) == 8,
+              "Steps need the version 1 layout for mem_migrate_v1()");
+
+/*
+ * Versions 1 and 2 did not remember the access point of each network.
+ * Everything else is the same, it just moved back.
+ */
+struct net_credentials_v2 {
+    char name[WIFI_MAX_NAME_LEN];
+    char pass[WIFI_MAX_PASS_LEN];
+};
+
+struct mem_contents_v2 {
+    uint8_t version;
+    uint32_t checksum;
+
+    struct {
+        uint16_t net_count;
+        struct net_credentials_v2 net[WIFI_MAX_NET_COUNT];
+
+        uint16_t backlight;
+        bool wf_auto_connect;
+        bool enable_wifi;
+
+        uint16_t known_count;
+        struct known_device known[MODELS_MAX_KNOWN];
+
+        uint16_t wf_count;
+        struct workflow wf[WF_MAX_FLOWS];
+    } data;
+};
+
+static_assert(offsetof(struct mem_contents_v2, checksum) == offsetof(struct mem_contents, checksum),
+              "Checksum needs to stay in place for old versions");
+
+/*
+ * Version 0 had no list of known devices either,
+ * the workflows directly followed the settings.
+ */
+struct mem_contents_v0 {
+    uint8_t version;
+    uint32_t checksum;
+
+    struct {
+        uint16_t net_count;
+        struct net_credentials_v2 net[WIFI_MAX_NET_COUNT];
+
+        uint16_t backlight;
+        bool wf_auto_connect;
+        bool enable_wifi;
+
+        uint16_t wf_count;
+        struct workflow wf[WF_MAX_FLOWS];
+    } data;
+};
+
+static_assert(offsetof(struct mem_contents_v0, checksum) == offsetof(struct mem_contents, checksum),
+              "Checksum needs to stay in place for old versions");
+
+static uint32_t calc_checksum(const void *data, size_t size) {
     uint32_t c = 0xFFFFFFFF;
     const uint8_t *d = (const uint8_t *)data;
 
     const size_t offset_checksum = offsetof(struct mem_contents, checksum);
-    const size_t size_checksum = sizeof(data->checksum);
+    const size_t size_checksum = sizeof(((const struct mem_contents *)data)->checksum);
 
-    for (size_t i = 0; i < sizeof(struct mem_contents); i++) {
+    for (size_t i = 0; i < size; i++) {
         if ((i >= offset_checksum) && (i < (offset_checksum + size_checksum))) {
             continue;
         }
@@ -85,6 +144,68 @@ void mem_load_defaults(void) {
 #endif
 }
 
+/*
+ * Version 1 had no step argument, its place was padding.
+ * Same layout otherwise, so the checksum still matches.
+ */
+static void mem_migrate_v1(void) {
+    debug("converting workflows from version 1");
+    for (uint16_t i = 0; (i < data_ram.data.wf_count) && (i < WF_MAX_FLOWS); i++) {
+        for (uint16_t j = 0; j < WF_MAX_STEPS; j++) {
+            data_ram.data.wf[i].steps[j].arg = 0;
+        }
+        wf_compact(&data_ram.data.wf[i]);
+    }
+    data_ram.version = MEM_VERSION;
+}
+
+static void mem_migrate_v0(const struct mem_contents_v0 *old) {
+    debug("converting settings from version %d", old->version);
+
+    data_ram.data.net_count = old->data.net_count;
+    for (uint16_t i = 0; i < WIFI_MAX_NET_COUNT; i++) {
+        memcpy(data_ram.data.net[i].name, old->data.net[i].name, WIFI_MAX_NAME_LEN);
+        memcpy(data_ram.data.net[i].pass, old->data.net[i].pass, WIFI_MAX_PASS_LEN);
+    }
+
+    data_ram.data.backlight = old->data.backlight;
+    data_ram.data.wf_auto_connect = old->data.wf_auto_connect;
+    data_ram.data.enable_wifi = old->data.enable_wifi;
+
+    data_ram.data.known_count = 0;
+
+    data_ram.data.wf_count = old->data.wf_count;
+    memcpy(data_ram.data.wf, old->data.wf, sizeof(data_ram.data.wf));
+
+    // steps had no argument yet, like in version 1
+    mem_migrate_v1();
+}
+
+static void mem_migrate_v2(const struct mem_contents_v2 *old) {
+    debug("converting networks from version %d", old->version);
+
+    data_ram.data.net_count = old->data.net_count;
+    for (uint16_t i = 0; i < WIFI_MAX_NET_COUNT; i++) {
+        memcpy(data_ram.data.net[i].name, old->data.net[i].name, WIFI_MAX_NAME_LEN);
+        memcpy(data_ram.data.net[i].pass, old->data.net[i].pass, WIFI_MAX_PASS_LEN);
+    }
+
+    data_ram.data.backlight = old->data.backlight;
+    data_ram.data.wf_auto_connect = old->data.wf_auto_connect;
+    data_ram.data.enable_wifi = old->data.enable_wifi;
+
+    data_ram.data.known_count = old->data.known_count;
+    memcpy(data_ram.data.known, old->data.known, sizeof(data_ram.data.known));
+
+    data_ram.data.wf_count = old->data.wf_count;
+    memcpy(data_ram.data.wf, old->data.wf, sizeof(data_ram.data.wf));
+
+    if (old->version == 1) {
+        mem_migrate_v1();
+    }
+    data_ram.version = MEM_VERSION;
+}
+
 void mem_load(void) {
     mem_load_defaults();
 
@@ -97,13 +218,35 @@ void mem_load(void) {
     if (flash_ptr->version == MEM_VERSION) {
         debug("found matching config (0x%02X)", flash_ptr->version);
 
-        uint32_t checksum = calc_checksum(flash_ptr);
+        uint32_t checksum = calc_checksum(flash_ptr, sizeof(struct mem_contents));
         if (checksum != flash_ptr->checksum) {
             debug("invalid checksum (0x%08lX != 0x%08lX)", flash_ptr->checksum, checksum);
         } else {
             debug("loading from flash (0x%08lX)", checksum);
             data_ram = *flash_ptr;
         }
+    } else if ((flash_ptr->version == 2) || (flash_ptr->version == 1)) {
+        debug("found old config (0x%02X)", flash_ptr->version);
+
+        const struct mem_contents_v2 *old = (const struct mem_contents_v2 *)data_flash;
+        uint32_t checksum = calc_checksum(old, sizeof(struct mem_contents_v2));
+        if (checksum != old->checksum) {
+            debug("invalid checksum (0x%08lX != 0x%08lX)", old->checksum, checksum);
+        } else {
+            debug("loading from flash (0x%08lX)", checksum);
+            mem_migrate_v2(old);
+        }
+    } else if (flash_ptr->version == 0) {
+        debug("found old config (0x%02X)", flash_ptr->version);
+
+        const struct mem_contents_v0 *old = (const struct mem_contents_v0 *)data_flash;
+        uint32_t checksum = calc_checksum(old, sizeof(struct mem_contents_v0));
+        if (checksum != old->checksum) {
+            debug("invalid checksum (0x%08lX != 0x%08lX)", old->checksum, checksum);
+        } else {
+            debug("loading from flash (0x%08lX)", checksum);
+            mem_migrate_v0(old);
+        }
     } else {
         debug("invalid config (0x%02X != 0x%02X)", flash_ptr->version, MEM_VERSION);
     }
@@ -143,7 +286,7 @@ void mem_write(void) {
         return;
     }
 
-    data_ram.checksum = calc_checksum(&data_ram);
+    data_ram.checksum = calc_checksum(&data_ram, sizeof(struct mem_contents));
 
     debug("writing new data (0x%08lX)", data_ram.checksum);
     int r = flash_safe_execute(mem_write_flash, &data_ram, FLASH_LOCK_TIMEOUT_MS);
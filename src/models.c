@@ -78,3 +78,43 @@ int8_t models_get_serial(enum known_devices dev, const char *name,
 
     return 0;
 }
+
+int models_known_find(const struct known_device *list, uint16_t count,
+                      const uint8_t *addr) {
+    if ((list == NULL) || (addr == NULL)) {
+        return -1;
+    }
+
+    for (uint16_t i = 0; i < count; i++) {
+        if (memcmp(list[i].addr, addr, sizeof(list[i].addr)) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void models_known_add(struct known_device *list, uint16_t *count,
+                      const uint8_t *addr, uint8_t type, enum known_devices dev) {
+    if ((list == NULL) || (count == NULL) || (addr == NULL)
+        || (dev == DEV_UNKNOWN)) {
+        return;
+    }
+
+    // most recently used device is kept at the front
+    int i = models_known_find(list, *count, addr);
+    if (i < 0) {
+        if (*count < MODELS_MAX_KNOWN) {
+            *count += 1;
+        }
+        i = *count - 1; // drops the oldest entry when full
+    }
+
+    for (; i > 0; i--) {
+        list[i] = list[i - 1];
+    }
+
+    memcpy(list[0].addr, addr, sizeof(list[0].addr));
+    list[0].type = type;
+    list[0].dev = dev;
+}
@@ -95,6 +95,7 @@ void rb_pop(struct ring_buffer *rb, void *buf) {
     }
 
     memcpy(buf, rb->buffer + rb->tail * rb->el_len, rb->el_len);
+    rb->full = false;
     rb->tail++;
     if (rb->tail >= rb->size) {
         rb->tail = 0;
@@ -0,0 +1,388 @@
+/*
+ * spool.c
+ *
+ * Flash sectors are used as a ring, each starting with a header with
+ * sequence number and base time. Records follow, each one a field tag,
+ * the time since the previous record and the change of the value
+ * against the previous value of the same field, in 1/100th units.
+ * Both are varints, the value change is zigzag encoded.
+ * Every sector can be decoded on its own. An erased tag means the
+ * rest of the page is unused, after a partially filled page was written.
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "pico/flash.h"
+
+#include "config.h"
+#include "log.h"
+#include "mem.h"
+#include "spool.h"
+
+#define SPOOL_MAGIC 0x314C5053 // "SPL1"
+#define SPOOL_SIZE (INFLUXDB_SPOOL_SECTORS * FLASH_SECTOR_SIZE)
+#define SPOOL_ERASED 0xFF
+#define SPOOL_MAX_RECORD (1u + 5u + 5u)
+
+// directly below the FAT disk, see cache.c and memmap_custom.ld
+#define SPOOL_FLASH_OFFSET (EEPROM_FLASH_OFFSET - (DISK_BLOCK_SIZE * DISK_BLOCK_COUNT) - SPOOL_SIZE)
+
+static_assert(INFLUXDB_SPOOL_SECTORS >= 2, "Spool needs at least two sectors for wraparound");
+static_assert(INFLUXDB_SPOOL_SECTORS == 4, "TODO size is hard-coded in linker script");
+
+struct spool_header {
+    uint32_t magic;
+    uint32_t seq;
+    int64_t base; // ms since epoch
+};
+
+struct spool_cursor {
+    int8_t sector; // < 0 if unused
+    uint16_t pos;
+    int64_t t;
+    int32_t prev[SPOOL_MAX_FIELDS];
+};
+
+struct spool_page {
+    uint32_t offset;
+    const uint8_t *data;
+};
+
+struct spool_stats {
+    uint32_t written;
+    uint32_t read;
+    uint32_t erases;
+    uint32_t overwritten; // sectors lost when the ring was full
+    uint32_t errors;
+};
+
+static const uint8_t *spool_flash = (const uint8_t *)(XIP_BASE + SPOOL_FLASH_OFFSET);
+
+static uint32_t seqs[INFLUXDB_SPOOL_SECTORS] = {0}; // 0 for unused sectors
+static uint32_t max_seq = 0;
+static int8_t next_sector = 0; // rotate through all of them, for wear leveling
+
+static struct spool_cursor w = { .sector = -1 };
+static uint16_t page_start = 0; // in sector, start of buffered page
+static uint8_t page[FLASH_PAGE_SIZE];
+
+static struct spool_cursor r = { .sector = -1 };
+
+static struct spool_stats stats = {0};
+
+static const uint8_t *sector_data(int8_t s) {
+    return spool_flash + (s * FLASH_SECTOR_SIZE);
+}
+
+static void spool_erase_flash(void *param) {
+    flash_range_erase(SPOOL_FLASH_OFFSET + ((uintptr_t)param * FLASH_SECTOR_SIZE),
+                      FLASH_SECTOR_SIZE);
+}
+
+static void spool_program_flash(void *param) {
+    const struct spool_page *p = param;
+    flash_range_program(SPOOL_FLASH_OFFSET + p->offset, p->data, FLASH_PAGE_SIZE);
+}
+
+static int8_t erase(int8_t s) {
+    stats.erases++;
+    seqs[s] = 0;
+    int ret = flash_safe_execute(spool_erase_flash, (void *)(uintptr_t)s, FLASH_LOCK_TIMEOUT_MS);
+    if (ret != PICO_OK) {
+        debug("error erasing spool sector %d: %d", s, ret);
+        stats.errors++;
+        return -1;
+    }
+    return 0;
+}
+
+static void program_page(void) {
+    struct spool_page p = {
+        .offset = (w.sector * FLASH_SECTOR_SIZE) + page_start,
+        .data = page,
+    };
+    int ret = flash_safe_execute(spool_program_flash, &p, FLASH_LOCK_TIMEOUT_MS);
+    if (ret != PICO_OK) {
+        debug("error writing spool page: %d", ret);
+        stats.errors++;
+    }
+
+    page_start += FLASH_PAGE_SIZE;
+    memset(page, SPOOL_ERASED, sizeof(page));
+}
+
+static void cursor_start(struct spool_cursor *c, int8_t s) {
+    const struct spool_header *h = (const struct spool_header *)sector_data(s);
+    if ((s == w.sector) && (page_start == 0)) {
+        // header not written yet
+        h = (const struct spool_header *)page;
+    }
+
+    c->sector = s;
+    c->pos = sizeof(struct spool_header);
+    c->t = h->base;
+    memset(c->prev, 0, sizeof(c->prev));
+}
+
+static bool get_varint(const uint8_t *d, uint16_t *pos, uint16_t limit, uint32_t *v) {
+    *v = 0;
+    for (uint8_t shift = 0; shift < 35; shift += 7) {
+        if (*pos >= limit) {
+            return false;
+        }
+        uint8_t b = d[(*pos)++];
+        *v |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint8_t put_varint(uint8_t *d, uint32_t v) {
+    uint8_t n = 0;
+    do {
+        d[n] = v & 0x7F;
+        v >>= 7;
+        if (v != 0) {
+            d[n] |= 0x80;
+        }
+        n++;
+    } while (v != 0);
+    return n;
+}
+
+// returns 1 for a record, 0 at limit, < 0 on corrupt data
+static int8_t cursor_next(struct spool_cursor *c, uint16_t limit,
+                          uint8_t *field, int32_t *value) {
+    const uint8_t *d = sector_data(c->sector);
+
+    while (c->pos < limit) {
+        uint8_t tag = d[c->pos];
+        if (tag == SPOOL_ERASED) {
+            // rest of this page was left empty
+            c->pos = ((c->pos / FLASH_PAGE_SIZE) + 1) * FLASH_PAGE_SIZE;
+            continue;
+        }
+        if (tag >= SPOOL_MAX_FIELDS) {
+            return -1;
+        }
+
+        uint16_t pos = c->pos + 1;
+        uint32_t dt, dv;
+        if (!get_varint(d, &pos, limit, &dt) || !get_varint(d, &pos, limit, &dv)) {
+            return -1;
+        }
+
+        c->pos = pos;
+        c->t += dt;
+        c->prev[tag] += (int32_t)((dv >> 1) ^ -(dv & 1));
+        *field = tag;
+        *value = c->prev[tag];
+        return 1;
+    }
+
+    return 0;
+}
+
+static uint16_t readable(int8_t s) {
+    return (s == w.sector) ? page_start : FLASH_SECTOR_SIZE;
+}
+
+void spool_init(void) {
+    int8_t first = -1;
+    for (int8_t s = 0; s < INFLUXDB_SPOOL_SECTORS; s++) {
+        const struct spool_header *h = (const struct spool_header *)sector_data(s);
+        seqs[s] = (h->magic == SPOOL_MAGIC) ? h->seq : 0;
+
+        if (seqs[s] > max_seq) {
+            max_seq = seqs[s];
+            w.sector = s;
+        }
+        if ((seqs[s] != 0) && ((first < 0) || (seqs[s] < seqs[first]))) {
+            first = s;
+        }
+    }
+
+    memset(page, SPOOL_ERASED, sizeof(page));
+    if (w.sector < 0) {
+        debug("spool empty");
+        return;
+    }
+
+    // first page always holds data, the first erased page ends it
+    const uint8_t *d = sector_data(w.sector);
+    page_start = FLASH_PAGE_SIZE;
+    while ((page_start < FLASH_SECTOR_SIZE) && (d[page_start] != SPOOL_ERASED)) {
+        page_start += FLASH_PAGE_SIZE;
+    }
+
+    // decode sector to continue deltas where they left off
+    struct spool_cursor c;
+    cursor_start(&c, w.sector);
+    uint8_t field;
+    int32_t value;
+    while (cursor_next(&c, page_start, &field, &value) == 1) {}
+    w = c;
+    w.pos = page_start;
+    next_sector = (w.sector + 1) % INFLUXDB_SPOOL_SECTORS;
+
+    cursor_start(&r, first);
+    debug("spool from sector %d to %d", first, w.sector);
+}
+
+static int8_t new_sector(int64_t t) {
+    spool_flush();
+
+    int8_t s = next_sector;
+    next_sector = (s + 1) % INFLUXDB_SPOOL_SECTORS;
+    if ((r.sector == s) && (s != w.sector)) {
+        // ring is full, oldest points are lost
+        stats.overwritten++;
+        r.sector = (s + 1) % INFLUXDB_SPOOL_SECTORS;
+        if (seqs[r.sector] != 0) {
+            cursor_start(&r, r.sector);
+        } else {
+            r.sector = -1;
+        }
+    }
+
+    if (erase(s) < 0) {
+        return -1;
+    }
+
+    struct spool_header h = {
+        .magic = SPOOL_MAGIC,
+        .seq = ++max_seq,
+        .base = t,
+    };
+    memcpy(page, &h, sizeof(h));
+    page_start = 0;
+    seqs[s] = h.seq;
+
+    w.sector = s;
+    w.pos = sizeof(h);
+    w.t = t;
+    memset(w.prev, 0, sizeof(w.prev));
+
+    if (r.sector < 0) {
+        r = w;
+    }
+    return 0;
+}
+
+int8_t spool_append(uint8_t field, int64_t t, float value) {
+    if (field >= SPOOL_MAX_FIELDS) {
+        return -1;
+    }
+
+    int32_t v = lroundf(value * 100.0f);
+
+    // time has to move forward, otherwise begin a new sector
+    if ((w.sector < 0) || (t < w.t) || ((t - w.t) > UINT32_MAX)
+            || ((w.pos + SPOOL_MAX_RECORD) > FLASH_SECTOR_SIZE)) {
+        if (new_sector(t) < 0) {
+            return -2;
+        }
+    }
+
+    int32_t dv = v - w.prev[field];
+    uint8_t rec[SPOOL_MAX_RECORD];
+    uint8_t len = 0;
+    rec[len++] = field;
+    len += put_varint(rec + len, t - w.t);
+    len += put_varint(rec + len, ((uint32_t)dv << 1) ^ (uint32_t)(dv >> 31));
+
+    for (uint8_t i = 0; i < len; i++) {
+        page[w.pos - page_start] = rec[i];
+        w.pos++;
+        if (w.pos >= (page_start + FLASH_PAGE_SIZE)) {
+            program_page();
+        }
+    }
+
+    w.t = t;
+    w.prev[field] = v;
+    stats.written++;
+    return 0;
+}
+
+void spool_flush(void) {
+    if ((w.sector >= 0) && (w.pos > page_start)) {
+        program_page();
+        w.pos = page_start;
+    }
+}
+
+bool spool_empty(void) {
+    return (r.sector < 0) || ((r.sector == w.sector) && (r.pos >= w.pos));
+}
+
+int8_t spool_read(uint8_t *field, int64_t *t, float *value) {
+    while (r.sector >= 0) {
+        int32_t v;
+        int8_t ret = cursor_next(&r, readable(r.sector), field, &v);
+        if (ret == 1) {
+            *t = r.t;
+            *value = v / 100.0f;
+            stats.read++;
+            return 1;
+        }
+
+        if (ret < 0) {
+            debug("corrupt spool sector %d at %u", r.sector, r.pos);
+            stats.errors++;
+            r.pos = readable(r.sector);
+        }
+
+        if (r.sector == w.sector) {
+            if (r.pos >= w.pos) {
+                // all read, don't send it again after a reboot
+                erase(w.sector);
+                w.sector = -1;
+                r.sector = -1;
+            }
+            return 0;
+        }
+
+        // sector done, start of the next one is still in flash
+        int8_t next = (r.sector + 1) % INFLUXDB_SPOOL_SECTORS;
+        erase(r.sector);
+        if (seqs[next] != 0) {
+            cursor_start(&r, next);
+        } else {
+            r.sector = -1;
+        }
+    }
+
+    return 0;
+}
+
+void spool_status(void) {
+    uint8_t used = 0;
+    for (int8_t s = 0; s < INFLUXDB_SPOOL_SECTORS; s++) {
+        if (seqs[s] != 0) {
+            used++;
+        }
+    }
+
+    println("Spool: %u / %u sectors, %s", used, INFLUXDB_SPOOL_SECTORS,
+            spool_empty() ? "empty" : "pending");
+    println("Written: %lu, read: %lu, erases: %lu, overwritten: %lu, errors: %lu",
+            stats.written, stats.read, stats.erases, stats.overwritten, stats.errors);
+}
@@ -18,6 +18,7 @@
 
 #include "config.h"
 #include "log.h"
+#include "ble.h"
 #include "state_scan.h"
 #include "state_workflow.h"
 #include "state_volcano_run.h"
@@ -31,6 +32,7 @@
 #include "state_wifi.h"
 #include "state_wifi_edit.h"
 #include "state_string.h"
+#include "api.h"
 #include "state.h"
 
 #define stringify(name) # name
@@ -40,6 +42,9 @@ struct state {
     void (*enter)(void);
     void (*exit)(void);
     void (*run)(void);
+    enum ble_profile ble_profile;
+    bool uses_link; // reads from the device on its own, with blocking calls
+    bool editor; // holds changes not saved yet
 };
 
 static const struct state states[STATE_INVALID + 1] = {
@@ -48,76 +53,99 @@ static const struct state states[STATE_INVALID + 1] = {
         .enter = NULL,
         .exit = NULL,
         .run = NULL,
+        .ble_profile = BLE_PROFILE_IDLE,
     }, {
         .name = stringify(STATE_SCAN),
         .enter = state_scan_enter,
         .exit = state_scan_exit,
         .run = state_scan_run,
+        .ble_profile = BLE_PROFILE_IDLE,
     }, {
         .name = stringify(STATE_WORKFLOW),
         .enter = state_wf_enter,
         .exit = state_wf_exit,
         .run = state_wf_run,
+        .ble_profile = BLE_PROFILE_INTERACTIVE,
     }, {
         .name = stringify(STATE_VOLCANO_RUN),
         .enter = state_volcano_run_enter,
         .exit = state_volcano_run_exit,
         .run = state_volcano_run_run,
+        .ble_profile = BLE_PROFILE_INTERACTIVE,
+        .uses_link = true,
     }, {
         .name = stringify(STATE_CRAFTY),
         .enter = state_crafty_enter,
         .exit = state_crafty_exit,
         .run = state_crafty_run,
+        .ble_profile = BLE_PROFILE_INTERACTIVE,
+        .uses_link = true,
     }, {
         .name = stringify(STATE_EDIT_WORKFLOW),
         .enter = state_edit_wf_enter,
         .exit = state_edit_wf_exit,
         .run = state_edit_wf_run,
+        .ble_profile = BLE_PROFILE_IDLE,
+        .editor = true,
     }, {
         .name = stringify(STATE_SETTINGS),
         .enter = state_settings_enter,
         .exit = state_settings_exit,
         .run = state_settings_run,
+        .ble_profile = BLE_PROFILE_IDLE,
     }, {
         .name = stringify(STATE_ABOUT),
         .enter = state_about_enter,
         .exit = state_about_exit,
         .run = state_about_run,
+        .ble_profile = BLE_PROFILE_IDLE,
     }, {
         .name = stringify(STATE_VALUE),
         .enter = state_value_enter,
         .exit = state_value_exit,
         .run = state_value_run,
+        .ble_profile = BLE_PROFILE_INTERACTIVE,
+        .editor = true,
     }, {
         .name = stringify(STATE_VOLCANO_CONF),
         .enter = state_volcano_conf_enter,
         .exit = state_volcano_conf_exit,
         .run = state_volcano_conf_run,
+        .ble_profile = BLE_PROFILE_INTERACTIVE,
+        .uses_link = true,
     }, {
         .name = stringify(STATE_VENTY),
         .enter = state_venty_enter,
         .exit = state_venty_exit,
         .run = state_venty_run,
+        .ble_profile = BLE_PROFILE_INTERACTIVE,
+        .uses_link = true,
     }, {
         .name = stringify(STATE_WIFI_NETS),
         .enter = state_wifi_enter,
         .exit = state_wifi_exit,
         .run = state_wifi_run,
+        .ble_profile = BLE_PROFILE_IDLE,
     }, {
         .name = stringify(STATE_WIFI_EDIT),
         .enter = state_wifi_edit_enter,
         .exit = state_wifi_edit_exit,
         .run = state_wifi_edit_run,
+        .ble_profile = BLE_PROFILE_IDLE,
+        .editor = true,
     }, {
         .name = stringify(STATE_STRING),
         .enter = state_string_enter,
         .exit = state_string_exit,
         .run = state_string_run,
+        .ble_profile = BLE_PROFILE_IDLE,
+        .editor = true,
     }, {
         .name = stringify(STATE_INVALID),
         .enter = NULL,
         .exit = NULL,
         .run = NULL,
+        .ble_profile = BLE_PROFILE_IDLE,
     }
 };
 
@@ -138,7 +166,15 @@ void state_switch(enum system_state next) {
         states[state].exit();
     }
 
+    // blocking reads of the screen fail while one of the API is in flight
+    if (states[next].uses_link) {
+        api_release_link();
+    }
+
     debug("entering %s", states[next].name);
+    // shorter connection interval only while a device screen is shown
+    ble_set_profile(states[next].ble_profile);
+
     if (states[next].enter) {
         states[next].enter();
     }
@@ -146,6 +182,14 @@ void state_switch(enum system_state next) {
     state = next;
 }
 
+bool state_uses_link(void) {
+    return states[state].uses_link;
+}
+
+bool state_is_editor(void) {
+    return states[state].editor;
+}
+
 void state_run(void) {
     if (state >= STATE_INVALID) {
         debug("invalid main state %d", state);
@@ -28,8 +28,6 @@
 
 #include "menu.h"
 
-#define CRAFTY_UPDATE_TIME_MS 3000
-
 static bd_addr_t ble_addr = {0};
 static bd_addr_type_t ble_type = 0;
 static bool wait_for_connect = false;
@@ -40,9 +38,15 @@ static int16_t target_temp = 0;
 static void crafty_buttons(enum buttons btn, bool state) {
     if (state && (btn == BTN_Y)) {
         if ((!wait_for_connect) && (!wait_for_disconnect)) {
+#ifdef BLE_KEEP_CONNECTIONS
+            // link stays up in the background, reconnecting is instant
+            debug("crafty leave");
+            state_switch(STATE_SCAN);
+#else
             debug("crafty disconnect");
             ble_disconnect();
             wait_for_disconnect = true;
+#endif
         } else {
             debug("invalid state for disconnect");
         }
@@ -94,15 +98,15 @@ static void draw(struct menu_state *menu) {
     } else if (wait_for_disconnect) {
         snprintf(menu->buff, MENU_MAX_LEN, "Disconnecting...");
     } else {
-        target_temp = crafty_get_target_temp();
-        int16_t ct = crafty_get_current_temp();
-        int8_t bs = crafty_get_battery_state();
+        // only uses cached values, polling happens in state_crafty_run()
+        struct crafty_state s = crafty_get_state();
+        target_temp = s.target_temp;
 
         snprintf(menu->buff, MENU_MAX_LEN,
                  "Target: %.1f C\n"
                  "Current: %.1f C\n"
                  "Battery: %d %%",
-                 target_temp / 10.0f, ct / 10.0f, bs);
+                 s.target_temp / 10.0f, s.current_temp / 10.0f, s.battery);
     }
 }
 
@@ -110,15 +114,15 @@ void state_crafty_run(void) {
     if (wait_for_connect && ble_is_connected()) {
         wait_for_connect = false;
         debug("crafty start");
+        crafty_poll_start();
     }
 
-    static uint32_t last = 0;
-    uint32_t now = to_ms_since_boot(get_absolute_time());
-    if (((now - last) >= CRAFTY_UPDATE_TIME_MS) || (last == 0)) {
-        menu_run(draw, true);
-        last = to_ms_since_boot(get_absolute_time());
+    if ((!wait_for_connect) && (!wait_for_disconnect)) {
+        crafty_poll_run();
     }
 
+    menu_run(draw, true);
+
     if (wait_for_disconnect && !ble_is_connected()) {
         wait_for_disconnect = false;
         debug("crafty done");
@@ -62,6 +62,34 @@ static void enter_cb(int selection) {
                             0, 60000, VAL_STEP_INCREMENT, 1000,
                             buff);
             break;
+
+        case OP_RAMP_TEMPERATURE:
+        case OP_WAIT_TEMP_TIMEOUT:
+            snprintf(buff, sizeof(buff),
+                     "%s Temp.",
+                     step->op == OP_RAMP_TEMPERATURE ? "Ramp" : "Wait");
+            state_value_set(&step->val,
+                            sizeof(step->val),
+                            400, 2300, VAL_STEP_INCREMENT, 10,
+                            buff);
+            break;
+
+        case OP_LOOP:
+            state_value_set(&step->val,
+                            sizeof(step->val),
+                            1, 20, VAL_STEP_INCREMENT, 1,
+                            "Repetitions");
+            break;
+
+        case OP_CALL:
+            state_value_set(&step->val,
+                            sizeof(step->val),
+                            0, wf_snippet_count - 1, VAL_STEP_INCREMENT, 1,
+                            "Snippet");
+            break;
+
+        default:
+            return;
         }
 
         state_value_return(STATE_EDIT_WORKFLOW);
@@ -22,6 +22,7 @@
 #include "pico/stdlib.h"
 
 #include "config.h"
+#include "log.h"
 #include "ble.h"
 #include "models.h"
 #include "mem.h"
@@ -38,19 +39,29 @@
 static struct ble_scan_result results[BLE_MAX_SCAN_RESULTS] = {0};
 static int result_count = 0;
 static uint32_t auto_connect_time = 0;
-static int auto_connect_idx = 0;
+static bd_addr_t auto_connect_addr = {0};
+static bd_addr_type_t auto_connect_type = 0;
+static bool known_started = false;
+
+static void remember(bd_addr_t addr, bd_addr_type_t type, enum known_devices dev) {
+    struct mem_data *mem = mem_data();
+    models_known_add(mem->known, &mem->known_count, addr, type, dev);
+    mem_write();
+}
 
 static void enter_cb(int selection) {
     int devs = 0;
     for (int i = 0; i < result_count; i++) {
-        enum known_devices dev = models_filter_name(results[i].name);
+        enum known_devices dev = results[i].dev;
         if (dev == DEV_UNKNOWN) {
             continue;
         }
 
         if (devs++ == selection) {
+            remember(results[i].addr, results[i].type, dev);
+
             if (dev == DEV_VOLCANO) {
-                state_volcano_run_target(results[i].addr, results[i].type);
+                state_volcano_run_target(results[i].addr, results[i].type, dev);
                 state_wf_edit(false);
                 state_switch(STATE_WORKFLOW);
             } else if (dev == DEV_CRAFTY) {
@@ -74,12 +85,14 @@ static void enter_cb(int selection) {
 static void edit_cb(int selection) {
     int devs = 0;
     for (int i = 0; i < result_count; i++) {
-        enum known_devices dev = models_filter_name(results[i].name);
+        enum known_devices dev = results[i].dev;
         if (dev == DEV_UNKNOWN) {
             continue;
         }
 
         if (devs++ == selection) {
+            remember(results[i].addr, results[i].type, dev);
+
             if (dev == DEV_VOLCANO) {
                 state_volcano_conf_target(results[i].addr, results[i].type);
                 state_switch(STATE_VOLCANO_CONF);
@@ -109,19 +122,71 @@ static void ota_cb(int selection) {
 void state_scan_enter(void) {
     menu_init(enter_cb, edit_cb, ota_cb, NULL);
     ble_scan(BLE_SCAN_ON);
+
+    // connect to previously used devices as soon as they advertise
+    if (!known_started) {
+        known_started = true;
+        if (mem_data()->known_count > 0) {
+            ble_connect_known(mem_data()->known, mem_data()->known_count);
+        }
+    }
 }
 
 void state_scan_exit(void) {
+    ble_connect_known_cancel();
     ble_scan(BLE_SCAN_OFF);
     menu_deinit();
 }
 
+static int selected_result(int selection) {
+    int devs = 0;
+    for (int i = 0; i < result_count; i++) {
+        if (results[i].dev == DEV_UNKNOWN) {
+            continue;
+        }
+
+        if (devs++ == selection) {
+            return i;
+        }
+    }
+    return -1;
+}
+
 static void draw(struct menu_state *menu) {
+    // results are sorted by signal strength, so remember which
+    // device was selected to keep the cursor on it after refreshing.
+    bd_addr_t sel_addr;
+    int sel = selected_result(menu->selection);
+    if (sel >= 0) {
+        memcpy(sel_addr, results[sel].addr, sizeof(bd_addr_t));
+    }
+
     result_count = ble_get_scan_results(results, BLE_MAX_SCAN_RESULTS);
 
+    if (sel >= 0) {
+        int devs = 0;
+        for (int i = 0; i < result_count; i++) {
+            if (results[i].dev == DEV_UNKNOWN) {
+                continue;
+            }
+
+            if (memcmp(results[i].addr, sel_addr, sizeof(bd_addr_t)) == 0) {
+                menu->selection = devs;
+                while (menu->selection < menu->off) {
+                    menu->off -= 1;
+                }
+                while (menu->selection >= (menu->off + menu->lines)) {
+                    menu->off += 1;
+                }
+                break;
+            }
+            devs++;
+        }
+    }
+
     int pos = 0, devs = 0;
     for (int i = 0; i < result_count; i++) {
-        enum known_devices dev = models_filter_name(results[i].name);
+        enum known_devices dev = results[i].dev;
         if (dev == DEV_UNKNOWN) {
             continue;
         }
@@ -142,7 +207,8 @@ static void draw(struct menu_state *menu) {
                 if (to_ms_since_boot(get_absolute_time()) <= VOLCANO_AUTO_CONNECT_WITHIN_MS) {
                     if (mem_data()->wf_auto_connect) {
                         auto_connect_time = to_ms_since_boot(get_absolute_time());
-                        auto_connect_idx = i;
+                        memcpy(auto_connect_addr, results[i].addr, sizeof(bd_addr_t));
+                        auto_connect_type = results[i].type;
                     }
                 }
             }
@@ -165,6 +231,9 @@ static void draw(struct menu_state *menu) {
             } else {
                 pos += snprintf(menu->buff + pos, MENU_MAX_LEN - pos, "> ");
             }
+        } else if (ble_is_connected_to(results[i].addr)) {
+            // still connected in the background
+            pos += snprintf(menu->buff + pos, MENU_MAX_LEN - pos, "* ");
         } else {
             pos += snprintf(menu->buff + pos, MENU_MAX_LEN - pos, "  ");
         }
@@ -181,7 +250,12 @@ static void draw(struct menu_state *menu) {
         if (models_get_serial(dev, results[i].name,
                               results[i].data, results[i].data_len,
                               info, sizeof(info)) < 0) {
-            strcpy(info, "-error-");
+            if (results[i].name[0] == '\0') {
+                // connected from the known devices list without advertisement
+                strcpy(info, bd_addr_to_str(results[i].addr) + 9);
+            } else {
+                strcpy(info, "-error-");
+            }
         }
         pos += snprintf(menu->buff + pos, MENU_MAX_LEN - pos, "%s\n", info);
     }
@@ -198,14 +272,48 @@ static void draw(struct menu_state *menu) {
     ADD_STATIC_ELEMENT("About");
 }
 
+static bool known_run(void) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if (now > VOLCANO_AUTO_CONNECT_WITHIN_MS) {
+        ble_connect_known_cancel();
+        return false;
+    }
+
+    if ((!mem_data()->wf_auto_connect) || menu_got_input) {
+        return false;
+    }
+
+    // no need to wait for the countdown when a known Volcano is already there
+    struct mem_data *mem = mem_data();
+    for (uint16_t i = 0; i < mem->known_count; i++) {
+        if ((mem->known[i].dev == DEV_VOLCANO)
+            && ble_is_connected_to(mem->known[i].addr)) {
+            debug("auto connect to known %s", bd_addr_to_str(mem->known[i].addr));
+            auto_connect_time = 0;
+            state_volcano_run_target(mem->known[i].addr, mem->known[i].type,
+                                     DEV_VOLCANO);
+            state_wf_edit(false);
+            state_switch(STATE_WORKFLOW);
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void state_scan_run(void) {
     menu_run(draw, false);
 
+    if (known_run()) {
+        return;
+    }
+
     if ((auto_connect_time != 0) && (!menu_got_input)) {
         uint32_t now = to_ms_since_boot(get_absolute_time());
         if ((now - auto_connect_time) >= VOLCANO_AUTO_CONNECT_TIMEOUT_MS) {
-            state_volcano_run_target(results[auto_connect_idx].addr,
-                                     results[auto_connect_idx].type);
+            remember(auto_connect_addr, auto_connect_type, DEV_VOLCANO);
+            state_volcano_run_target(auto_connect_addr, auto_connect_type,
+                                     DEV_VOLCANO);
             state_wf_edit(false);
             state_switch(STATE_WORKFLOW);
 
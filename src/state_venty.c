@@ -49,9 +49,16 @@ void state_venty_target(bd_addr_t addr, bd_addr_type_t type) {
 }
 
 static void exit_cb(void) {
+#ifdef BLE_KEEP_CONNECTIONS
+    // link stays up in the background, reconnecting is instant
+    debug("venty leave");
+    connected = false;
+    state_switch(STATE_SCAN);
+#else
     debug("venty disconnect");
     ble_disconnect();
     wait_for_disconnect = true;
+#endif
 }
 
 static void enter_cb(int selection) {
@@ -141,13 +148,18 @@ static void send_values(void) {
 }
 
 static void fetch_values(void) {
-    heater_state = venty_get_heater_state();
-    target_temp = venty_get_target_temp();
-    battery = venty_get_battery_state();
-    eco_current = venty_get_eco_current();
-    eco_voltage = venty_get_eco_voltage();
-    vibration = venty_get_vibration();
-    brightness = venty_get_brightness();
+    struct venty_state s;
+    if (venty_refresh(&s) < 0) {
+        return;
+    }
+
+    heater_state = s.heater;
+    target_temp = s.target_temp;
+    battery = s.battery;
+    eco_current = s.eco_current;
+    eco_voltage = s.eco_voltage;
+    vibration = s.vibration;
+    brightness = s.brightness;
 }
 
 void state_venty_enter(void) {
@@ -202,6 +214,9 @@ void state_venty_run(void) {
         connected = true;
         debug("venty start");
         fetch_values();
+    } else if (connected && !wait_for_disconnect) {
+        // battery level is also part of unsolicited frames
+        battery = venty_get_state().battery;
     }
 
     menu_run(draw, true);
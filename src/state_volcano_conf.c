@@ -117,17 +117,14 @@ static void send_values(void) {
 static void fetch_values(void) {
     volcano_discover_characteristics(false, true);
 
-    enum unit unit = volcano_get_unit();
-    val_celsius = (unit == UNIT_C);
-
-    int8_t r = volcano_get_vibration();
-    val_vibrate = (r == 1);
-
-    r = volcano_get_display_cooling();
-    val_disp_cool = (r == 1);
-
-    val_auto_shutoff = volcano_get_auto_shutoff();
-    val_brightness = volcano_get_brightness();
+    struct volcano_snapshot snap;
+    if (volcano_snapshot(&snap) == 0) {
+        val_celsius = (snap.unit == UNIT_C);
+        val_vibrate = snap.vibration;
+        val_disp_cool = snap.display_cooling;
+        val_auto_shutoff = snap.auto_shutoff;
+        val_brightness = snap.brightness;
+    }
 
     volcano_get_firmware(val_fw);
     val_fw[VOLCANO_FW_LEN] = '\0';
@@ -136,9 +133,16 @@ static void fetch_values(void) {
 }
 
 static void exit_cb(void) {
+#ifdef BLE_KEEP_CONNECTIONS
+    // link stays up in the background, reconnecting is instant
+    debug("volcano leave");
+    connected = false;
+    state_switch(STATE_SCAN);
+#else
     debug("volcano disconnect");
     ble_disconnect();
     wait_for_disconnect = true;
+#endif
 }
 
 void state_volcano_conf_enter(void) {
@@ -23,7 +23,6 @@
 #include "buttons.h"
 #include "log.h"
 #include "lcd.h"
-#include "volcano.h"
 #include "workflow.h"
 #include "util.h"
 #include "state.h"
@@ -35,28 +34,37 @@
 static uint16_t wf_index = 0;
 static bd_addr_t ble_addr = {0};
 static bd_addr_type_t ble_type = 0;
+static enum known_devices ble_dev = DEV_UNKNOWN;
 static bool wait_for_connect = false;
 static bool wait_for_disconnect = false;
+static bool wait_for_stop = false;
+static bool attached = false;
 
 void state_volcano_run_index(uint16_t index) {
     wf_index = index;
+    attached = false;
 }
 
-void state_volcano_run_target(bd_addr_t addr, bd_addr_type_t type) {
-    debug("%s %d", bd_addr_to_str(addr), type);
+void state_volcano_run_attach(uint16_t index) {
+    wf_index = index;
+    attached = true;
+}
+
+void state_volcano_run_target(bd_addr_t addr, bd_addr_type_t type,
+                              enum known_devices dev) {
+    debug("%s %d %d", bd_addr_to_str(addr), type, dev);
     memcpy(ble_addr, addr, sizeof(bd_addr_t));
     ble_type = type;
+    ble_dev = dev;
 }
 
 static void volcano_buttons(enum buttons btn, bool state) {
     if (state && (btn == BTN_Y)) {
-        if ((!wait_for_connect) && (!wait_for_disconnect)) {
+        if ((!wait_for_connect) && (!wait_for_disconnect) && (!wait_for_stop)) {
+            // pump and heater are turned off by wf_run()
             debug("workflow abort");
-            wf_reset();
-            volcano_set_pump_state(false);
-            volcano_set_heater_state(false);
-            ble_disconnect();
-            wait_for_disconnect = true;
+            wf_stop();
+            wait_for_stop = true;
         }
     }
 }
@@ -65,6 +73,16 @@ void state_volcano_run_enter(void) {
     menu_init(NULL, NULL, NULL, NULL);
     buttons_callback(volcano_buttons);
 
+    wait_for_stop = false;
+
+    // started elsewhere on the active connection, only shown here
+    if (attached) {
+        attached = false;
+        wait_for_connect = false;
+        wait_for_disconnect = false;
+        return;
+    }
+
     debug("workflow connect");
     ble_connect(ble_addr, ble_type);
     wait_for_connect = true;
@@ -87,7 +105,9 @@ static void draw(struct menu_state *menu) {
     struct wf_state state = wf_status();
 
     if ((state.step == prev_state.step)
-        && ((((state.step->op == OP_SET_TEMPERATURE) || (state.step->op == OP_WAIT_TEMPERATURE))
+        && (state.stopping == prev_state.stopping)
+        && ((((state.step->op == OP_SET_TEMPERATURE) || (state.step->op == OP_WAIT_TEMPERATURE)
+              || (state.step->op == OP_RAMP_TEMPERATURE) || (state.step->op == OP_WAIT_TEMP_TIMEOUT))
                && ((state.curr_val / 10) == (prev_state.curr_val / 10)))
             || (((state.step->op == OP_PUMP_TIME) || (state.step->op == OP_WAIT_TIME))
                && ((state.curr_val / 500) == (prev_state.curr_val / 500))))) {
@@ -114,6 +134,9 @@ static void draw(struct menu_state *menu) {
         } else if (wait_for_disconnect) {
             snprintf(menu->buff, MENU_MAX_LEN,
                      "\nDisconnecting");
+        } else if (state.error) {
+            snprintf(menu->buff, MENU_MAX_LEN,
+                     "\nError");
         } else {
             snprintf(menu->buff, MENU_MAX_LEN,
                      "\nDone");
@@ -121,13 +144,24 @@ static void draw(struct menu_state *menu) {
         return;
     }
 
+    if (state.stopping) {
+        snprintf(menu->buff, MENU_MAX_LEN,
+                 "\nStopping");
+        return;
+    }
+
     bar_graph(50, menu->y_off, 0, state.index + 1, state.count);
     bar_graph(50 + MENU_BOX_HEIGHT(3, 20, 2) + menu->y_off, menu->y_off,
               state.start_val, state.curr_val, state.step->val);
 
     int pos = 0;
     pos += snprintf(menu->buff + pos, MENU_MAX_LEN - pos,
-                    "step %d / %d\n", state.index, state.count);
+                    "step %d / %d", state.index, state.count);
+    if (state.eta > 0) {
+        pos += snprintf(menu->buff + pos, MENU_MAX_LEN - pos,
+                        ", %lds", (state.eta + 999) / 1000);
+    }
+    pos += snprintf(menu->buff + pos, MENU_MAX_LEN - pos, "\n");
 
     switch (state.step->op) {
     case OP_SET_TEMPERATURE:
@@ -136,6 +170,8 @@ static void draw(struct menu_state *menu) {
         break;
 
     case OP_WAIT_TEMPERATURE:
+    case OP_WAIT_TEMP_TIMEOUT:
+    case OP_RAMP_TEMPERATURE:
         pos += snprintf(menu->buff + pos, MENU_MAX_LEN - pos,
                         "%s\n", wf_step_str(state.step));
         pos += snprintf(menu->buff + pos, MENU_MAX_LEN - pos,
@@ -155,6 +191,9 @@ static void draw(struct menu_state *menu) {
                         state.curr_val / 1000.0f,
                         state.step->val / 1000.0f);
         break;
+
+    default:
+        break;
     }
 }
 
@@ -163,19 +202,34 @@ void state_volcano_run_run(void) {
     if (wait_for_connect && ble_is_connected()) {
         wait_for_connect = false;
         debug("workflow start");
-        wf_start(wf_index);
+        wf_start(wf_index, ble_dev);
     }
 
     // visualize workflow status
     menu_run(draw, true);
 
+    // disconnect once aborted workflow turned everything off
+    if (wait_for_stop && (wf_status().status == WF_IDLE)) {
+        wait_for_stop = false;
+        debug("workflow disconnect");
+        ble_disconnect();
+        wait_for_disconnect = true;
+    }
+
     // auto disconnect when end of workflow is reached
-    if ((!wait_for_connect) && (!wait_for_disconnect)) {
+    if ((!wait_for_connect) && (!wait_for_disconnect) && (!wait_for_stop)) {
         struct wf_state state = wf_status();
         if (state.status == WF_IDLE) {
+#ifdef BLE_KEEP_CONNECTIONS
+            // link stays up in the background, reconnecting is instant
+            debug("workflow leave");
+            state_switch(STATE_SCAN);
+            return;
+#else
             debug("workflow disconnect");
             ble_disconnect();
             wait_for_disconnect = true;
+#endif
         }
     }
 
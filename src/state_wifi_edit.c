@@ -18,6 +18,7 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "config.h"
 #include "menu.h"
@@ -27,6 +28,8 @@
 #include "state_wifi_edit.h"
 
 static uint16_t wifi_index = 0;
+static char old_name[WIFI_MAX_NAME_LEN] = {0};
+static bool editing_name = false;
 
 static void exit_cb(void) {
     state_switch(STATE_SETTINGS);
@@ -36,6 +39,8 @@ static void enter_cb(int selection) {
     switch (selection) {
     case 0:
         // SSID
+        memcpy(old_name, mem_data()->net[wifi_index].name, WIFI_MAX_NAME_LEN);
+        editing_name = true;
         state_string_set(mem_data()->net[wifi_index].name,
                          WIFI_MAX_NAME_LEN, "SSID");
         state_string_return(STATE_WIFI_EDIT);
@@ -61,6 +66,15 @@ void state_wifi_edit_index(uint16_t index) {
 }
 
 void state_wifi_edit_enter(void) {
+    if (editing_name) {
+        editing_name = false;
+
+        // cached access point belongs to the old SSID
+        if (strncmp(old_name, mem_data()->net[wifi_index].name, WIFI_MAX_NAME_LEN) != 0) {
+            mem_data()->net[wifi_index].channel = 0;
+        }
+    }
+
     menu_init(enter_cb, NULL, NULL, exit_cb);
 }
 
@@ -0,0 +1,156 @@
+/*
+ * thermal.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "thermal.h"
+
+#define THERMAL_FORGET 0.95f // weight of older samples, per new sample
+#define THERMAL_MIN_DT_MS 200 // shorter intervals are merged with the next one
+#define THERMAL_MIN_SAMPLES 4 // rate samples before giving an estimate
+#define THERMAL_MAX_ETA_MS (60 * 60 * 1000)
+
+#define THERMAL_HEAT_TAU_S 60.0f
+#define THERMAL_COOL_TAU_S 600.0f
+#define THERMAL_PUMP_DROP 30 // 1/10th degrees C, while air is flowing
+#define THERMAL_MIN_STEP_S 1.0f // slowest change near the goal, 0.1 C per second
+
+void thermal_init(struct thermal_est *e) {
+    memset(e, 0, sizeof(struct thermal_est));
+}
+
+void thermal_sample(struct thermal_est *e, uint32_t t, int16_t temp) {
+    if (e->samples == 0) {
+        e->samples = 1;
+        e->last_t = t;
+        e->last_temp = temp;
+        return;
+    }
+
+    uint32_t dt = t - e->last_t;
+    if (dt < THERMAL_MIN_DT_MS) {
+        return;
+    }
+
+    float x = (temp + e->last_temp) / 2.0f;
+    float y = (temp - e->last_temp) * 1000.0f / dt;
+
+    e->sw = e->sw * THERMAL_FORGET + 1.0f;
+    e->sx = e->sx * THERMAL_FORGET + x;
+    e->sy = e->sy * THERMAL_FORGET + y;
+    e->sxx = e->sxx * THERMAL_FORGET + x * x;
+    e->sxy = e->sxy * THERMAL_FORGET + x * y;
+
+    e->samples++;
+    e->last_t = t;
+    e->last_temp = temp;
+}
+
+// fit y = a + b * x, returns 0 on success
+static int fit(const struct thermal_est *e, float *a, float *b) {
+    if (e->samples <= THERMAL_MIN_SAMPLES) {
+        return -1;
+    }
+
+    float den = e->sw * e->sxx - e->sx * e->sx;
+    if (fabsf(den) < 1e-3f) {
+        // all samples at about the same temperature
+        *b = 0.0f;
+        *a = e->sy / e->sw;
+        return 0;
+    }
+
+    *b = (e->sw * e->sxy - e->sx * e->sy) / den;
+    *a = (e->sy - *b * e->sx) / e->sw;
+    return 0;
+}
+
+float thermal_rate(const struct thermal_est *e) {
+    float a, b;
+    if (fit(e, &a, &b) < 0) {
+        return 0.0f;
+    }
+    return a + b * e->last_temp;
+}
+
+int32_t thermal_eta(const struct thermal_est *e, int16_t target) {
+    if ((e->samples > 0) && (e->last_temp >= target)) {
+        return 0;
+    }
+
+    float a, b;
+    if (fit(e, &a, &b) < 0) {
+        return -1;
+    }
+
+    float eta_s = -1.0f;
+    if (b < 0.0f) {
+        // rate falls with temperature, approaching T_inf
+        float t_inf = -a / b;
+        float tau = -1.0f / b;
+        if (t_inf > target) {
+            eta_s = tau * logf((t_inf - e->last_temp) / (t_inf - target));
+        }
+    } else {
+        // not enough curvature seen yet, assume a constant rate
+        float rate = a + b * e->last_temp;
+        if (rate > 0.0f) {
+            eta_s = (target - e->last_temp) / rate;
+        }
+    }
+
+    if ((eta_s < 0.0f) || ((eta_s * 1000.0f) > THERMAL_MAX_ETA_MS)) {
+        return -1;
+    }
+    return eta_s * 1000.0f;
+}
+
+void thermal_model_init(struct thermal_model *m, uint32_t t) {
+    m->current = THERMAL_AMBIENT_TEMP;
+    m->target = 1850;
+    m->heater = false;
+    m->pump = false;
+    m->last_update = t;
+}
+
+void thermal_model_run(struct thermal_model *m, uint32_t t) {
+    float dt = (t - m->last_update) / 1000.0f;
+
+    int16_t goal = m->heater ? m->target : THERMAL_AMBIENT_TEMP;
+    if (m->pump) {
+        goal -= THERMAL_PUMP_DROP;
+    }
+
+    float tau = (goal > m->current) ? THERMAL_HEAT_TAU_S : THERMAL_COOL_TAU_S;
+    float f = 1.0f - expf(-dt / tau);
+    int16_t diff = (goal - m->current) * f;
+
+    if ((diff == 0) && (goal != m->current)) {
+        if (dt < THERMAL_MIN_STEP_S) {
+            // keep the time for later, so short intervals add up
+            return;
+        }
+
+        // always make some progress, so we actually arrive at the target
+        diff = (goal > m->current) ? 1 : -1;
+    }
+
+    m->last_update = t;
+    m->current += diff;
+}
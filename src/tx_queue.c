@@ -0,0 +1,68 @@
+/*
+ * tx_queue.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifdef USB_NETWORK
+
+#include <stddef.h>
+
+#include "tx_queue.h"
+
+err_t tx_queue_push(struct tx_queue *q, struct pbuf *p) {
+    if (q->count >= USB_NET_TX_QUEUE) {
+        return ERR_MEM;
+    }
+
+    // lwIP does not modify segments while they are referenced
+    pbuf_ref(p);
+    q->frames[(q->head + q->count) % USB_NET_TX_QUEUE] = p;
+    q->count++;
+    if (q->count > q->peak) {
+        q->peak = q->count;
+    }
+    return ERR_OK;
+}
+
+struct pbuf *tx_queue_peek(struct tx_queue *q) {
+    return (q->count > 0) ? q->frames[q->head] : NULL;
+}
+
+struct pbuf *tx_queue_pop(struct tx_queue *q) {
+    if (q->count == 0) {
+        return NULL;
+    }
+
+    struct pbuf *p = q->frames[q->head];
+    q->frames[q->head] = NULL;
+    q->head = (q->head + 1) % USB_NET_TX_QUEUE;
+    q->count--;
+    return p;
+}
+
+uint8_t tx_queue_drop(struct tx_queue *q) {
+    uint8_t n = 0;
+    struct pbuf *p;
+    while ((p = tx_queue_pop(q)) != NULL) {
+        pbuf_free(p);
+        n++;
+    }
+    return n;
+}
+
+#endif // USB_NETWORK
@@ -34,6 +34,7 @@
 #include "log.h"
 #include "usb_descriptors.h"
 #include "usb_cdc.h"
+#include "usb_net.h"
 #include "usb.h"
 
 void usb_init(void) {
@@ -45,6 +46,10 @@ void usb_init(void) {
 
 void usb_run(void) {
     tud_task();
+
+#ifdef USB_NETWORK
+    usb_net_run();
+#endif // USB_NETWORK
 }
 
 // Invoked when device is mounted
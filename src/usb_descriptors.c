@@ -41,11 +41,12 @@
  * then CDC (later) will possibly cause system error on PC.
  *
  * Auto ProductID layout's Bitmap:
- *   [MSB]         HID | MSC | CDC          [LSB]
+ *   [MSB]         NCM | VENDOR | MIDI | HID | MSC | CDC          [LSB]
  */
 #define _PID_MAP(itf, n) ((CFG_TUD_##itf) << (n))
 #define USB_PID (0x2300 | _PID_MAP(CDC, 0) | _PID_MAP(MSC, 1) \
-    | _PID_MAP(HID, 2) | _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4) )
+    | _PID_MAP(HID, 2) | _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4) \
+    | _PID_MAP(NCM, 5) )
 
 #define USB_VID   0xCafe
 #define USB_BCD   0x0200
@@ -96,16 +97,29 @@ enum {
     ITF_NUM_CDC = 0,
     ITF_NUM_CDC_DATA,
     ITF_NUM_MSC,
+#if CFG_TUD_NCM
+    ITF_NUM_NET,
+    ITF_NUM_NET_DATA,
+#endif
     ITF_NUM_TOTAL
 };
 
+#if CFG_TUD_NCM
+#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_MSC_DESC_LEN + TUD_CDC_NCM_DESC_LEN)
+#else
 #define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_MSC_DESC_LEN)
+#endif
 
 #define EPNUM_CDC_NOTIF 0x82
 #define EPNUM_CDC_OUT   0x02
 #define EPNUM_CDC_IN    0x83
 #define EPNUM_MSC_OUT   0x03
 #define EPNUM_MSC_IN    0x84
+#define EPNUM_NET_NOTIF 0x85
+#define EPNUM_NET_OUT   0x04
+#define EPNUM_NET_IN    0x86
+
+#define STRID_NET_MAC   7
 
 uint8_t const desc_configuration[] = {
     // Config number, interface count, string index, total length, attribute, power in mA
@@ -116,6 +130,13 @@ uint8_t const desc_configuration[] = {
 
     // Interface number, string index, EP Out & EP In address, EP size
     TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, 5, EPNUM_MSC_OUT, EPNUM_MSC_IN, 64),
+
+#if CFG_TUD_NCM
+    // Interface number, description string index, MAC address string index, EP notification address and size,
+    // EP data address (out, in), and size, max segment size.
+    TUD_CDC_NCM_DESCRIPTOR(ITF_NUM_NET, 6, STRID_NET_MAC, EPNUM_NET_NOTIF, 64,
+                           EPNUM_NET_OUT, EPNUM_NET_IN, CFG_TUD_NET_ENDPOINT_SIZE, CFG_TUD_NET_MTU),
+#endif
 };
 
 #if TUD_OPT_HIGH_SPEED
@@ -195,6 +216,8 @@ char const* string_desc_arr [] = {
     string_pico_serial,            // 3: Serials, should use chip ID
     "Debug Serial",                // 4: CDC Interface
     "Debug Memory",                // 5: MSC Interface
+    "Debug Network",               // 6: NCM Interface
+    NULL,                          // 7: NCM MAC address, from tud_network_mac_address
 };
 
 static uint16_t _desc_str[32];
@@ -209,6 +232,15 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
     if ( index == 0) {
         memcpy(&_desc_str[1], string_desc_arr[0], 2);
         chr_count = 1;
+#if CFG_TUD_NCM
+    } else if (index == STRID_NET_MAC) {
+        // Convert MAC address into hex digits in UTF-16
+        chr_count = 0;
+        for (uint8_t i = 0; i < sizeof(tud_network_mac_address); i++) {
+            _desc_str[1 + chr_count++] = "0123456789ABCDEF"[(tud_network_mac_address[i] >> 4) & 0x0F];
+            _desc_str[1 + chr_count++] = "0123456789ABCDEF"[tud_network_mac_address[i] & 0x0F];
+        }
+#endif
     } else {
         // Note: the 0xEE index string is a Microsoft OS 1.0 Descriptors.
         // https://docs.microsoft.com/en-us/windows-hardware/drivers/usbcon/microsoft-defined-usb-descriptors
@@ -216,6 +248,7 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
         if ( !(index < sizeof(string_desc_arr)/sizeof(string_desc_arr[0])) ) return NULL;
 
         const char* str = string_desc_arr[index];
+        if (str == NULL) return NULL;
 
         // Cap at max char
         chr_count = strlen(str);
@@ -0,0 +1,122 @@
+/*
+ * usb_dhcp.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifdef USB_NETWORK
+
+#include <string.h>
+
+#include "lwip/def.h"
+
+#include "usb_dhcp.h"
+
+static const uint8_t dhcp_magic[4] = { 0x63, 0x82, 0x53, 0x63 };
+
+const uint8_t *usb_dhcp_option(const uint8_t *msg, uint16_t len, uint8_t code, uint8_t min_len) {
+    uint16_t i = DHCP_OPTIONS;
+    while ((i < len) && (msg[i] != DHCP_OPT_END)) {
+        if (msg[i] == 0) {
+            i++; // padding
+            continue;
+        }
+
+        if (((i + 1) >= len) || ((i + 2 + msg[i + 1]) > len)) {
+            break;
+        }
+
+        if ((msg[i] == code) && (msg[i + 1] >= min_len)) {
+            return msg + i + 2;
+        }
+        i += 2 + msg[i + 1];
+    }
+    return NULL;
+}
+
+static uint8_t *put_option(uint8_t *o, uint8_t code, const void *data, uint8_t len) {
+    *o++ = code;
+    *o++ = len;
+    memcpy(o, data, len);
+    return o + len;
+}
+
+/*
+ * Only the host on the other end of the cable asks, so there is
+ * just one address to hand out. No router and no DNS server,
+ * the host should keep using its own for everything else.
+ */
+uint16_t usb_dhcp_reply(const struct usb_dhcp_link *link,
+                        const uint8_t *req, uint16_t len, uint8_t *reply) {
+    if ((len < DHCP_OPTIONS) || (req[0] != 1) || (req[1] != 1) || (req[2] != 6)
+            || (memcmp(req + 236, dhcp_magic, sizeof(dhcp_magic)) != 0)) {
+        return 0;
+    }
+
+    const uint8_t *type = usb_dhcp_option(req, len, DHCP_OPT_TYPE, 1);
+    if (type == NULL) {
+        return 0;
+    }
+
+    uint8_t answer;
+    if (*type == DHCP_DISCOVER) {
+        answer = DHCP_OFFER;
+    } else if (*type == DHCP_REQUEST) {
+        // selected another server
+        const uint8_t *server = usb_dhcp_option(req, len, DHCP_OPT_SERVER_ID, 4);
+        if ((server != NULL) && (memcmp(server, &link->server.addr, 4) != 0)) {
+            return 0;
+        }
+
+        // ciaddr when renewing
+        const uint8_t *requested = usb_dhcp_option(req, len, DHCP_OPT_REQUESTED_IP, 4);
+        if (requested == NULL) {
+            requested = req + 12;
+        }
+
+        answer = (memcmp(requested, &link->host.addr, 4) == 0) ? DHCP_ACK : DHCP_NAK;
+    } else {
+        return 0;
+    }
+
+    memset(reply, 0, DHCP_REPLY_LEN);
+    reply[0] = 2; // op: reply
+    reply[1] = 1; // htype: ethernet
+    reply[2] = 6; // hlen
+    memcpy(reply + 4, req + 4, 4); // xid
+    memcpy(reply + 10, req + 10, 2); // flags
+    if (answer != DHCP_NAK) {
+        memcpy(reply + 16, &link->host.addr, 4); // yiaddr
+        memcpy(reply + 20, &link->server.addr, 4); // siaddr
+    }
+    memcpy(reply + 28, req + 28, 16); // chaddr
+    memcpy(reply + 236, dhcp_magic, sizeof(dhcp_magic));
+
+    uint8_t *o = reply + DHCP_OPTIONS;
+    o = put_option(o, DHCP_OPT_TYPE, &answer, 1);
+    o = put_option(o, DHCP_OPT_SERVER_ID, &link->server.addr, 4);
+    if (answer != DHCP_NAK) {
+        uint32_t lease = lwip_htonl(USB_NET_LEASE_S);
+        o = put_option(o, DHCP_OPT_LEASE_TIME, &lease, 4);
+        o = put_option(o, DHCP_OPT_MASK, &link->mask.addr, 4);
+    }
+    *o = DHCP_OPT_END;
+
+    return DHCP_REPLY_LEN;
+}
+
+#endif // USB_NETWORK
@@ -36,6 +36,7 @@
 
 static bool medium_available = false;
 static bool medium_locked = false;
+static uint32_t write_count = 0;
 
 bool msc_is_medium_available(void) {
     return medium_available;
@@ -49,6 +50,10 @@ void msc_set_medium_available(bool state) {
     medium_available = state;
 }
 
+uint32_t msc_write_count(void) {
+    return write_count;
+}
+
 // Invoked when received SCSI_CMD_INQUIRY
 // Application fill vendor id, product id and revision
 // with string up to 8, 16, 4 characters respectively
@@ -145,6 +150,9 @@ int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba,
         return -1;
     }
 
+    // FatFS needs to mount again before using the disk
+    write_count++;
+
     return cache_write(buffer, (lba * DISK_BLOCK_SIZE) + offset, bufsize);
 }
 
@@ -0,0 +1,340 @@
+/*
+ * usb_net.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#ifdef USB_NETWORK
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "tusb.h"
+#include "lwip/etharp.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/ip4.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/udp.h"
+#include "lwip/raw.h"
+#include "netif/ethernet.h"
+
+#include "log.h"
+#include "tx_queue.h"
+#include "usb_dhcp.h"
+#include "usb_net.h"
+
+struct usb_net_stats {
+    uint32_t rx_frames, rx_bytes, rx_dropped;
+    uint32_t tx_frames, tx_bytes, tx_dropped;
+    uint32_t offers, acks, naks;
+    float rx_max, tx_max; // KiB/s, over one second
+};
+
+// host side of the link, the device uses it with the last bit flipped
+const uint8_t tud_network_mac_address[6] = { 0x02, 0x56, 0x52, 0x43, 0x00, 0x01 };
+
+static struct netif netif;
+static struct raw_pcb *dhcp_pcb = NULL;
+static struct usb_dhcp_link usb_link;
+static bool initialized = false;
+static bool leased = false;
+
+// one frame from USB at a time, the next one comes after tud_network_recv_renew()
+static struct pbuf *rx_frame = NULL;
+static bool rx_renew = false;
+
+static struct tx_queue tx_queue = {0};
+
+static struct usb_net_stats stats = {0};
+static uint32_t rate_t = 0, rate_rx = 0, rate_tx = 0;
+
+static uint32_t now_ms(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+// lwIP lock has to be held for all of these
+
+static void tx_flush(void) {
+    struct pbuf *p;
+    while (((p = tx_queue_peek(&tx_queue)) != NULL) && tud_network_can_xmit(p->tot_len)) {
+        tx_queue_pop(&tx_queue);
+
+        // copied into the transfer block by tud_network_xmit_cb()
+        tud_network_xmit(p, 0);
+
+        stats.tx_frames++;
+        stats.tx_bytes += p->tot_len;
+        pbuf_free(p);
+    }
+}
+
+static void tx_drop(void) {
+    stats.tx_dropped += tx_queue_drop(&tx_queue);
+}
+
+/*
+ * May be called from the lwIP background interrupt, eg. for TCP
+ * retransmissions, so TinyUSB is only used from usb_net_run().
+ */
+static err_t usb_net_output(struct netif *n, struct pbuf *p) {
+    (void)n;
+
+    if ((p->tot_len > CFG_TUD_NET_MTU) || (tx_queue_push(&tx_queue, p) != ERR_OK)) {
+        stats.tx_dropped++;
+        return ERR_MEM;
+    }
+    return ERR_OK;
+}
+
+static err_t usb_net_netif_init(struct netif *n) {
+    n->name[0] = 'u';
+    n->name[1] = 's';
+    n->mtu = CFG_TUD_NET_MTU - SIZEOF_ETH_HDR;
+    n->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_ETHERNET;
+
+    n->hwaddr_len = sizeof(tud_network_mac_address);
+    memcpy(n->hwaddr, tud_network_mac_address, sizeof(tud_network_mac_address));
+    n->hwaddr[5] ^= 0x01;
+
+    n->output = etharp_output;
+    n->linkoutput = usb_net_output;
+    return ERR_OK;
+}
+
+/*
+ * Raw pcb on this netif only, so the DHCP server of the wifi access
+ * point can keep UDP port 67 for itself. Gets the whole IP packet,
+ * everything but DHCP requests goes on to lwIP.
+ */
+static u8_t dhcp_recv(void *arg, struct raw_pcb *pcb, struct pbuf *p, const ip_addr_t *addr) {
+    (void)arg;
+    (void)addr;
+
+    uint16_t hlen = IPH_HL_BYTES((struct ip_hdr *)p->payload);
+    struct udp_hdr udp;
+    if ((pbuf_copy_partial(p, &udp, sizeof(udp), hlen) != sizeof(udp))
+            || (lwip_ntohs(udp.dest) != DHCP_SERVER_PORT)) {
+        return 0;
+    }
+
+    static uint8_t req[DHCP_MAX_LEN];
+    uint16_t len = pbuf_copy_partial(p, req, sizeof(req), hlen + sizeof(udp));
+    pbuf_free(p);
+
+    struct pbuf *r = pbuf_alloc(PBUF_IP, sizeof(udp) + DHCP_REPLY_LEN, PBUF_RAM);
+    if (r == NULL) {
+        return 1;
+    }
+
+    uint8_t *reply = (uint8_t *)r->payload + sizeof(udp);
+    uint16_t reply_len = usb_dhcp_reply(&usb_link, req, len, reply);
+    if (reply_len == 0) {
+        pbuf_free(r);
+        return 1;
+    }
+
+    uint8_t answer = *usb_dhcp_option(reply, reply_len, DHCP_OPT_TYPE, 1);
+    if (answer == DHCP_OFFER) {
+        stats.offers++;
+    } else if (answer == DHCP_ACK) {
+        stats.acks++;
+        leased = true;
+    } else {
+        stats.naks++;
+    }
+
+    // broadcast, the host has no address yet
+    struct udp_hdr *h = (struct udp_hdr *)r->payload;
+    h->src = lwip_htons(DHCP_SERVER_PORT);
+    h->dest = lwip_htons(DHCP_CLIENT_PORT);
+    h->len = lwip_htons(r->tot_len);
+    h->chksum = 0;
+    h->chksum = inet_chksum_pseudo(r, IP_PROTO_UDP, r->tot_len,
+                                   netif_ip4_addr(&netif), IP4_ADDR_BROADCAST);
+    if (h->chksum == 0) {
+        h->chksum = 0xFFFF;
+    }
+
+    raw_sendto_if_src(pcb, r, IP_ADDR_BROADCAST, &netif, netif_ip_addr4(&netif));
+    pbuf_free(r);
+    return 1;
+}
+
+// TinyUSB callbacks, from tud_task() in usb_run()
+
+void tud_network_init_cb(void) {
+    // new connection, anything still in flight is stale
+    if (!initialized) {
+        return;
+    }
+
+    cyw43_arch_lwip_begin();
+    if (rx_frame != NULL) {
+        pbuf_free(rx_frame);
+        rx_frame = NULL;
+    }
+    tx_drop();
+    cyw43_arch_lwip_end();
+
+    rx_renew = false;
+    leased = false;
+}
+
+bool tud_network_recv_cb(const uint8_t *src, uint16_t size) {
+    if (rx_frame != NULL) {
+        return false;
+    }
+    rx_renew = true;
+
+    if (!initialized || (size == 0)) {
+        return true;
+    }
+
+    cyw43_arch_lwip_begin();
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, size, PBUF_POOL);
+    if (p != NULL) {
+        pbuf_take(p, src, size);
+    }
+    cyw43_arch_lwip_end();
+
+    if (p == NULL) {
+        stats.rx_dropped++;
+    } else {
+        rx_frame = p;
+        stats.rx_frames++;
+        stats.rx_bytes += size;
+    }
+    return true;
+}
+
+uint16_t tud_network_xmit_cb(uint8_t *dst, void *ref, uint16_t arg) {
+    (void)arg;
+
+    struct pbuf *p = (struct pbuf *)ref;
+    return pbuf_copy_partial(p, dst, p->tot_len, 0);
+}
+
+void usb_net_init(void) {
+    ip4_addr_t gw;
+    ip4addr_aton(USB_NET_IP, &usb_link.server);
+    IP4_ADDR(&usb_link.mask, 255, 255, 255, 0);
+    ip4_addr_set_zero(&gw);
+    ip4_addr_set_u32(&usb_link.host, lwip_htonl(lwip_ntohl(ip4_addr_get_u32(&usb_link.server)) + 1));
+
+    cyw43_arch_lwip_begin();
+
+    // not the default, wifi keeps routing everything outside of the link
+    if (netif_add(&netif, &usb_link.server, &usb_link.mask, &gw, NULL, usb_net_netif_init, ethernet_input) == NULL) {
+        cyw43_arch_lwip_end();
+        debug("netif_add failed");
+        return;
+    }
+    netif_set_up(&netif);
+
+    dhcp_pcb = raw_new(IP_PROTO_UDP);
+    if (dhcp_pcb == NULL) {
+        debug("no raw pcb for dhcp");
+    } else {
+        raw_bind_netif(dhcp_pcb, &netif);
+        raw_recv(dhcp_pcb, dhcp_recv, NULL);
+    }
+
+    cyw43_arch_lwip_end();
+
+    rate_t = now_ms();
+    initialized = true;
+}
+
+void usb_net_run(void) {
+    if (!initialized) {
+        return;
+    }
+
+    bool renew = rx_renew;
+    rx_renew = false;
+
+    cyw43_arch_lwip_begin();
+
+    bool up = tud_ready();
+    if (up != netif_is_link_up(&netif)) {
+        debug("link %s", up ? "up" : "down");
+        if (up) {
+            netif_set_link_up(&netif);
+        } else {
+            netif_set_link_down(&netif);
+            tx_drop();
+            leased = false;
+        }
+    }
+
+    if (rx_frame != NULL) {
+        struct pbuf *p = rx_frame;
+        rx_frame = NULL;
+        if (netif.input(p, &netif) != ERR_OK) {
+            pbuf_free(p);
+        }
+    }
+
+    // also sends the replies to the frame from above right away
+    tx_flush();
+
+    cyw43_arch_lwip_end();
+
+    if (renew) {
+        tud_network_recv_renew();
+    }
+
+    uint32_t now = now_ms();
+    if ((now - rate_t) >= 1000) {
+        float rx = (stats.rx_bytes - rate_rx) / 1.024f / (now - rate_t);
+        float tx = (stats.tx_bytes - rate_tx) / 1.024f / (now - rate_t);
+        if (rx > stats.rx_max) {
+            stats.rx_max = rx;
+        }
+        if (tx > stats.tx_max) {
+            stats.tx_max = tx;
+        }
+        rate_t = now;
+        rate_rx = stats.rx_bytes;
+        rate_tx = stats.tx_bytes;
+    }
+}
+
+void usb_net_status(void) {
+    if (!initialized) {
+        println("USB network: not initialized");
+        return;
+    }
+
+    char ip[IP4ADDR_STRLEN_MAX], host[IP4ADDR_STRLEN_MAX];
+    ip4addr_ntoa_r(netif_ip4_addr(&netif), ip, sizeof(ip));
+    ip4addr_ntoa_r(&usb_link.host, host, sizeof(host));
+    println("USB network: link %s, %s, host %s%s",
+            netif_is_link_up(&netif) ? "up" : "down", ip, host,
+            leased ? "" : " (no lease)");
+
+    println("RX: %lu frames, %lu bytes, dropped %lu",
+            stats.rx_frames, stats.rx_bytes, stats.rx_dropped);
+    println("TX: %lu frames, %lu bytes, dropped %lu, queue peak %d / %d",
+            stats.tx_frames, stats.tx_bytes, stats.tx_dropped,
+            tx_queue.peak, USB_NET_TX_QUEUE);
+    println("Peak: RX %.1f KiB/s, TX %.1f KiB/s", stats.rx_max, stats.tx_max);
+    println("DHCP: %lu offers, %lu acks, %lu naks", stats.offers, stats.acks, stats.naks);
+}
+
+#endif // USB_NETWORK
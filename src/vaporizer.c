@@ -0,0 +1,121 @@
+/*
+ * vaporizer.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "log.h"
+#include "ble.h"
+#include "mem.h"
+#include "crafty.h"
+#include "venty.h"
+#include "volcano.h"
+#include "vaporizer.h"
+
+static int8_t volcano_discover(void) {
+    return volcano_discover_characteristics(true, false);
+}
+
+static const struct vaporizer_ops ops[] = {
+    {
+        .name = "Volcano",
+        .dev = DEV_VOLCANO,
+        .caps = VAP_CAP_PUMP | VAP_CAP_STATE,
+        .temp_resolution = 1,
+        .discover = volcano_discover,
+        .poll = NULL,
+        .get_current_temp = volcano_get_current_temp,
+        .get_target_temp = volcano_get_target_temp,
+        .set_target_temp = volcano_set_target_temp,
+        .set_heater = volcano_set_heater_state,
+        .set_pump = volcano_set_pump_state,
+        .read_start = volcano_read_start,
+        .read_poll = volcano_read_poll,
+        .get_cached = volcano_get_cached,
+        .write_start = volcano_write_start,
+        .write_poll = volcano_write_poll,
+    }, {
+        .name = "Crafty",
+        .dev = DEV_CRAFTY,
+        .caps = VAP_CAP_NONE,
+        .temp_resolution = 10,
+        .discover = crafty_discover,
+        .poll = NULL,
+        .get_current_temp = crafty_get_current_temp,
+        .get_target_temp = crafty_get_target_temp,
+        .set_target_temp = crafty_set_target_temp,
+        .set_heater = crafty_set_heater_state,
+        .set_pump = NULL,
+        .read_start = crafty_read_start,
+        .read_poll = crafty_read_poll,
+        .get_cached = crafty_get_cached,
+        .write_start = crafty_write_start,
+        .write_poll = crafty_write_poll,
+    }, {
+        .name = "Venty",
+        .dev = DEV_VENTY,
+        .caps = VAP_CAP_NOTIFY | VAP_CAP_STATE,
+        .temp_resolution = 10,
+        .discover = venty_discover,
+        .poll = venty_poll,
+        .get_current_temp = venty_get_current_temp,
+        .get_target_temp = venty_get_target_temp,
+        .set_target_temp = venty_set_target_temp,
+        .set_heater = venty_set_heater_state,
+        .set_pump = NULL,
+        .read_start = venty_read_start,
+        .read_poll = venty_read_poll,
+        .get_cached = venty_get_cached,
+        .write_start = venty_write_start,
+        .write_poll = venty_write_poll,
+    },
+};
+
+const struct vaporizer_ops *vaporizer_get(enum known_devices dev) {
+    for (uint i = 0; i < count_of(ops); i++) {
+        if (ops[i].dev == dev) {
+            return &ops[i];
+        }
+    }
+
+    debug("no driver for device %d", dev);
+    return NULL;
+}
+
+enum known_devices vaporizer_active(void) {
+    bd_addr_t addr;
+    if (ble_get_active_addr(addr) < 0) {
+        return DEV_UNKNOWN;
+    }
+
+    struct mem_data *mem = mem_data();
+    int i = models_known_find(mem->known, mem->known_count, addr);
+    if (i >= 0) {
+        return mem->known[i].dev;
+    }
+
+    static struct ble_scan_result results[BLE_MAX_SCAN_RESULTS];
+    int n = ble_get_scan_results(results, BLE_MAX_SCAN_RESULTS);
+    for (int j = 0; j < n; j++) {
+        if (memcmp(results[j].addr, addr, sizeof(bd_addr_t)) == 0) {
+            return results[j].dev;
+        }
+    }
+
+    return DEV_UNKNOWN;
+}
@@ -19,6 +19,7 @@
 #include "config.h"
 #include "log.h"
 #include "ble.h"
+#include "ble_chars.h"
 #include "main.h"
 #include "venty.h"
 
@@ -52,237 +53,428 @@ enum venty_interface {
     UI_VIBRATION  = 1 << 3,
 };
 
-// "00000000-5354-4f52-5a26-4249434b454c"
-static uint8_t uuid_service[16] = {
-    0x00, 0x00, 0x00, 0x00, 0x53, 0x54, 0x4f, 0x52,
-    0x5a, 0x26, 0x42, 0x49, 0x43, 0x4b, 0x45, 0x4c,
-};
+#define VENTY_SERVICE ble_chars[CHAR_VENTY_CMD].service
+#define VENTY_CHARACTERISTIC ble_chars[CHAR_VENTY_CMD].uuid
 
-// "00000001-5354-4f52-5a26-4249434b454c"
-static uint8_t uuid_characteristic[16] = {
-    0x00, 0x00, 0x00, 0x01, 0x53, 0x54, 0x4f, 0x52,
-    0x5a, 0x26, 0x42, 0x49, 0x43, 0x4b, 0x45, 0x4c,
-};
+#define SETTINGS_FRAME_LEN 20
+#define INTERFACE_FRAME_LEN 6
+
+static struct venty_state state = {0};
+static uint32_t session = 0; // ble_get_connection_id() we subscribed on
+static uint32_t async_count = 0; // settings_count when venty_read_start() was called
+static uint32_t async_start = 0;
+static bool async_sending = false; // query of venty_read_start() not confirmed yet
+
+// notifications stay enabled for as long as the link is up
+static int8_t venty_session(void) {
+    uint32_t id = ble_get_connection_id();
+    if (id == 0) {
+        return -1;
+    }
 
-static int8_t venty_cmd(uint8_t *rx, size_t rx_len,
-                        const uint8_t *tx, size_t tx_len) {
-    int8_t r = ble_notification_enable(uuid_service, uuid_characteristic);
+    if (id == session) {
+        return 0;
+    }
+
+    memset(&state, 0, sizeof(state));
+    int8_t r = ble_notification_enable(VENTY_SERVICE, VENTY_CHARACTERISTIC);
     if (r < 0) {
         debug("ble_notification_enable failed: %d", r);
-        ble_notification_disable(uuid_service, uuid_characteristic);
         return r;
     }
 
-    r = ble_write(uuid_service, uuid_characteristic,
-                         tx, tx_len);
+    session = id;
+    return 0;
+}
+
+int8_t venty_parse(const uint8_t *frame, uint16_t len, struct venty_state *s) {
+    if ((frame == NULL) || (s == NULL) || (len < 1)) {
+        return -1;
+    }
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    if ((frame[0] == CMD_SETTINGS) && (len >= SETTINGS_FRAME_LEN)) {
+        s->current_temp = (int16_t)(frame[2] | (frame[3] << 8));
+        s->target_temp = (int16_t)(frame[4] | (frame[5] << 8));
+        s->battery = frame[8];
+        s->heater = frame[11] ? true : false;
+        s->eco_current = (frame[14] & SETTING_ECOMODE_CHARGE) ? true : false;
+        s->eco_voltage = (frame[14] & SETTING_ECOMODE_VOLTAGE) ? true : false;
+        s->settings_time = now;
+        s->settings_count++;
+        return CMD_SETTINGS;
+    } else if ((frame[0] == CMD_INTERFACE) && (len >= INTERFACE_FRAME_LEN)) {
+        s->brightness = frame[2];
+        s->vibration = frame[5] ? true : false;
+        s->interface_time = now;
+        s->interface_count++;
+        return CMD_INTERFACE;
+    }
+
+    debug("unexpected frame 0x%02X with %d bytes", frame[0], len);
+    return -2;
+}
+
+void venty_poll(void) {
+    if (ble_get_connection_id() != session) {
+        return;
+    }
+
+    while (ble_notification_ready()) {
+        uint8_t buff[BLE_MAX_VALUE_LEN];
+        uint8_t uuid[16] = {0};
+        uint16_t len = ble_notification_get(buff, sizeof(buff), uuid);
+        if ((int16_t)len <= 0) {
+            break;
+        }
+
+        if (ble_char_find(uuid) != CHAR_VENTY_CMD) {
+            debug("got notification for unexpected uuid");
+            continue;
+        }
+
+        venty_parse(buff, len, &state);
+    }
+}
+
+static int8_t venty_send(const uint8_t *tx, size_t tx_len) {
+    int8_t r = venty_session();
+    if (r < 0) {
+        return r;
+    }
+
+    r = ble_char_write_raw(CHAR_VENTY_CMD, tx, tx_len);
     if (r < 0) {
         debug("ble_write failed: %d", r);
-        ble_notification_disable(uuid_service, uuid_characteristic);
+    }
+    return r;
+}
+
+// send query for one frame type and wait until its reply got parsed
+static int8_t venty_query(enum venty_commands cmd_id) {
+    uint8_t cmd[SETTINGS_FRAME_LEN] = {0};
+    size_t len = (cmd_id == CMD_SETTINGS) ? SETTINGS_FRAME_LEN : INTERFACE_FRAME_LEN;
+    cmd[0] = cmd_id;
+
+    venty_poll();
+    uint32_t *count = (cmd_id == CMD_SETTINGS) ? &state.settings_count : &state.interface_count;
+    uint32_t prev = *count;
+
+    int8_t r = venty_send(cmd, len);
+    if (r < 0) {
         return r;
     }
 
     uint32_t start_time = to_ms_since_boot(get_absolute_time());
-    while (!ble_notification_ready()) {
-        sleep_ms(1);
-        main_loop_hw();
+    while (1) {
+        venty_poll();
+        if (*count != prev) {
+            return 0;
+        }
 
         uint32_t now = to_ms_since_boot(get_absolute_time());
         if ((now - start_time) >= VENTY_READ_TIMEOUT_MS) {
             debug("timeout waiting for notification");
-            ble_notification_disable(uuid_service, uuid_characteristic);
             return -1;
         }
+
+        sleep_ms(1);
+        main_loop_hw();
     }
+}
 
-    uint8_t uuid[16] = {0};
-    uint16_t len = ble_notification_get(rx, rx_len, uuid);
+static int8_t venty_fresh(enum venty_commands cmd_id) {
+    venty_poll();
 
-    if (memcmp(uuid, uuid_characteristic, 16) != 0) {
-        debug("got notification for unexpected uuid");
-        len = 0;
+    uint32_t count = (cmd_id == CMD_SETTINGS) ? state.settings_count : state.interface_count;
+    uint32_t time = (cmd_id == CMD_SETTINGS) ? state.settings_time : state.interface_time;
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if ((session == ble_get_connection_id()) && (count > 0)
+        && ((now - time) < VENTY_CACHE_TTL_MS)) {
+        return 0;
     }
 
-    ble_notification_disable(uuid_service, uuid_characteristic);
-    return (len <= 0) ? -1 : 0;
+    return venty_query(cmd_id);
 }
 
-int16_t venty_get_target_temp(void) {
-    uint8_t cmd[20] = {0};
-    uint8_t buff[20] = {0};
+static void venty_stale(enum venty_commands cmd_id) {
+    // reply to the write will update the state again
+    if (cmd_id == CMD_SETTINGS) {
+        state.settings_time = to_ms_since_boot(get_absolute_time()) - VENTY_CACHE_TTL_MS;
+    } else {
+        state.interface_time = to_ms_since_boot(get_absolute_time()) - VENTY_CACHE_TTL_MS;
+    }
+}
 
-    cmd[0] = CMD_SETTINGS;
+struct venty_state venty_get_state(void) {
+    venty_poll();
+    return state;
+}
+
+int8_t venty_refresh(struct venty_state *s) {
+    int8_t r = venty_query(CMD_SETTINGS);
+    if (r < 0) {
+        return r;
+    }
 
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
+    r = venty_query(CMD_INTERFACE);
     if (r < 0) {
         return r;
     }
 
-    int16_t *val = (int16_t *)(buff + 4);
-    return *val;
+    if (s != NULL) {
+        *s = state;
+    }
+    return 0;
 }
 
-int8_t venty_set_target_temp(uint16_t value) {
-    uint8_t cmd[20] = {0};
-    uint8_t buff[20] = {0};
+int8_t venty_discover(void) {
+    return venty_session();
+}
 
-    cmd[0] = CMD_SETTINGS;
-    cmd[1] = MASK_SET_TEMPERATURE;
-    uint16_t *val = (uint16_t *)(cmd + 4);
-    *val = value;
+// subscribing would have to wait for the device, see venty_discover()
+static int8_t venty_send_start(const uint8_t *tx, size_t tx_len) {
+    if ((session == 0) || (ble_get_connection_id() != session)) {
+        debug("not subscribed to notifications");
+        return -1;
+    }
 
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
+    int8_t r = ble_char_write_raw_start(CHAR_VENTY_CMD, tx, tx_len);
+    if (r < 0) {
+        debug("ble_write_start failed: %d", r);
+    }
     return r;
 }
 
-int8_t venty_get_heater_state(void) {
-    uint8_t cmd[20] = {0};
-    uint8_t buff[20] = {0};
+int8_t venty_read_start(enum vaporizer_value v) {
+    if (v == VAP_PUMP) {
+        return -1;
+    }
 
+    uint8_t cmd[SETTINGS_FRAME_LEN] = {0};
     cmd[0] = CMD_SETTINGS;
 
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
+    venty_poll();
+    async_count = state.settings_count;
+    async_start = to_ms_since_boot(get_absolute_time());
+    int8_t r = venty_send_start(cmd, sizeof(cmd));
+    async_sending = (r == 0);
+    return r;
+}
+
+int8_t venty_read_poll(enum vaporizer_value v, int16_t *value) {
+    if ((v == VAP_PUMP) || (value == NULL)) {
+        return -1;
+    }
+
+    if (async_sending) {
+        int8_t r = ble_char_write_poll();
+        if (r == 0) {
+            return 0;
+        }
+        async_sending = false;
+        if (r < 0) {
+            return r;
+        }
+    }
+
+    venty_poll();
+    if (state.settings_count == async_count) {
+        uint32_t now = to_ms_since_boot(get_absolute_time());
+        if ((now - async_start) >= VENTY_READ_TIMEOUT_MS) {
+            debug("timeout waiting for notification");
+            return -2;
+        }
+        return 0;
+    }
+
+    if (v == VAP_CURRENT_TEMP) {
+        *value = state.current_temp;
+    } else if (v == VAP_TARGET_TEMP) {
+        *value = state.target_temp;
+    } else {
+        *value = state.heater ? 1 : 0;
+    }
+    return 1;
+}
+
+// from the last settings frame, notifications are handled but never sent
+int8_t venty_get_cached(enum vaporizer_value v, int16_t *value) {
+    if ((v == VAP_PUMP) || (value == NULL)) {
+        return -1;
+    }
+
+    venty_poll();
+    if (state.settings_count == 0) {
+        return -2;
+    }
+
+    if (v == VAP_CURRENT_TEMP) {
+        *value = state.current_temp;
+    } else if (v == VAP_TARGET_TEMP) {
+        *value = state.target_temp;
+    } else {
+        *value = state.heater ? 1 : 0;
+    }
+    return 0;
+}
+
+int16_t venty_get_current_temp(void) {
+    int8_t r = venty_fresh(CMD_SETTINGS);
     if (r < 0) {
         return r;
     }
+    return state.current_temp;
+}
 
-    int8_t *val = (int8_t *)(buff + 11);
-    return *val;
+int16_t venty_get_target_temp(void) {
+    int8_t r = venty_fresh(CMD_SETTINGS);
+    if (r < 0) {
+        return r;
+    }
+    return state.target_temp;
 }
 
-int8_t venty_set_heater_state(bool value) {
-    uint8_t cmd[20] = {0};
-    uint8_t buff[20] = {0};
+static void cmd_target_temp(uint8_t *cmd, uint16_t value) {
+    memset(cmd, 0, SETTINGS_FRAME_LEN);
+    cmd[0] = CMD_SETTINGS;
+    cmd[1] = MASK_SET_TEMPERATURE;
+    cmd[4] = value & 0xFF;
+    cmd[5] = value >> 8;
+}
 
+static void cmd_heater(uint8_t *cmd, bool value) {
+    memset(cmd, 0, SETTINGS_FRAME_LEN);
     cmd[0] = CMD_SETTINGS;
     cmd[1] = MASK_HEATER;
     cmd[11] = value ? 1 : 0;
-
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
-    return r;
 }
 
-int8_t venty_get_battery_state(void) {
-    uint8_t cmd[20] = {0};
-    uint8_t buff[20] = {0};
+int8_t venty_set_target_temp(uint16_t value) {
+    uint8_t cmd[SETTINGS_FRAME_LEN];
+    cmd_target_temp(cmd, value);
 
-    cmd[0] = CMD_SETTINGS;
+    venty_stale(CMD_SETTINGS);
+    return venty_send(cmd, sizeof(cmd));
+}
 
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
+int8_t venty_get_heater_state(void) {
+    int8_t r = venty_fresh(CMD_SETTINGS);
     if (r < 0) {
         return r;
     }
+    return state.heater;
+}
 
-    int8_t *val = (int8_t *)(buff + 8);
-    return *val;
+int8_t venty_set_heater_state(bool value) {
+    uint8_t cmd[SETTINGS_FRAME_LEN];
+    cmd_heater(cmd, value);
+
+    venty_stale(CMD_SETTINGS);
+    return venty_send(cmd, sizeof(cmd));
 }
 
-int8_t venty_get_eco_current(void) {
-    uint8_t cmd[20] = {0};
-    uint8_t buff[20] = {0};
+int8_t venty_write_start(enum vaporizer_value v, uint16_t value) {
+    uint8_t cmd[SETTINGS_FRAME_LEN];
+    if (v == VAP_TARGET_TEMP) {
+        cmd_target_temp(cmd, value);
+    } else if (v == VAP_HEATER) {
+        cmd_heater(cmd, value);
+    } else {
+        return -1;
+    }
 
-    cmd[0] = CMD_SETTINGS;
+    venty_stale(CMD_SETTINGS);
+    return venty_send_start(cmd, sizeof(cmd));
+}
 
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
+int8_t venty_write_poll(void) {
+    return ble_char_write_poll();
+}
+
+int8_t venty_get_battery_state(void) {
+    int8_t r = venty_fresh(CMD_SETTINGS);
     if (r < 0) {
         return r;
     }
+    return state.battery;
+}
 
-    int8_t *val = (int8_t *)(buff + 14);
-    return (*val & SETTING_ECOMODE_CHARGE) ? 1 : 0;
-
+int8_t venty_get_eco_current(void) {
+    int8_t r = venty_fresh(CMD_SETTINGS);
+    if (r < 0) {
+        return r;
+    }
+    return state.eco_current;
 }
 
 int8_t venty_get_eco_voltage(void) {
-    uint8_t cmd[20] = {0};
-    uint8_t buff[20] = {0};
-
-    cmd[0] = CMD_SETTINGS;
-
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
+    int8_t r = venty_fresh(CMD_SETTINGS);
     if (r < 0) {
         return r;
     }
-
-    int8_t *val = (int8_t *)(buff + 14);
-    return (*val & SETTING_ECOMODE_VOLTAGE) ? 1 : 0;
+    return state.eco_voltage;
 }
 
 int8_t venty_set_eco_current(bool value) {
-    uint8_t cmd[20] = {0};
-    uint8_t buff[20] = {0};
+    uint8_t cmd[SETTINGS_FRAME_LEN] = {0};
 
     cmd[0] = CMD_SETTINGS;
     cmd[1] = MASK_SETTINGS;
     cmd[14] = value ? SETTING_ECOMODE_CHARGE : 0;
     cmd[15] = SETTING_ECOMODE_CHARGE;
 
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
-    return r;
+    venty_stale(CMD_SETTINGS);
+    return venty_send(cmd, sizeof(cmd));
 }
 
 int8_t venty_set_eco_voltage(bool value) {
-    uint8_t cmd[20] = {0};
-    uint8_t buff[20] = {0};
+    uint8_t cmd[SETTINGS_FRAME_LEN] = {0};
 
     cmd[0] = CMD_SETTINGS;
     cmd[1] = MASK_SETTINGS;
     cmd[14] = value ? SETTING_ECOMODE_VOLTAGE : 0;
     cmd[15] = SETTING_ECOMODE_VOLTAGE;
 
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
-    return r;
+    venty_stale(CMD_SETTINGS);
+    return venty_send(cmd, sizeof(cmd));
 }
 
 int8_t venty_get_vibration(void) {
-    uint8_t cmd[6] = {0};
-    uint8_t buff[6] = {0};
-
-    cmd[0] = CMD_INTERFACE;
-
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
+    int8_t r = venty_fresh(CMD_INTERFACE);
     if (r < 0) {
         return r;
     }
-
-    int8_t *val = (int8_t *)(buff + 5);
-    return *val;
+    return state.vibration;
 }
 
 int8_t venty_get_brightness(void) {
-    uint8_t cmd[6] = {0};
-    uint8_t buff[6] = {0};
-
-    cmd[0] = CMD_INTERFACE;
-
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
+    int8_t r = venty_fresh(CMD_INTERFACE);
     if (r < 0) {
         return r;
     }
-
-    int8_t *val = (int8_t *)(buff + 2);
-    return *val;
+    return state.brightness;
 }
 
 int8_t venty_set_vibration(bool value) {
-    uint8_t cmd[6] = {0};
-    uint8_t buff[6] = {0};
+    uint8_t cmd[INTERFACE_FRAME_LEN] = {0};
 
     cmd[0] = CMD_INTERFACE;
     cmd[1] = UI_VIBRATION;
     cmd[5] = value ? 1 : 0;
 
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
-    return r;
+    venty_stale(CMD_INTERFACE);
+    return venty_send(cmd, sizeof(cmd));
 }
 
 int8_t venty_set_brightness(uint8_t value) {
-    uint8_t cmd[6] = {0};
-    uint8_t buff[6] = {0};
+    uint8_t cmd[INTERFACE_FRAME_LEN] = {0};
 
     cmd[0] = CMD_INTERFACE;
     cmd[1] = UI_BRIGHTNESS;
     cmd[2] = MIN(MAX(value, 1), 9);
 
-    int8_t r = venty_cmd(buff, sizeof(buff), cmd, sizeof(cmd));
-    return r;
+    venty_stale(CMD_INTERFACE);
+    return venty_send(cmd, sizeof(cmd));
 }
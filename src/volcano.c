@@ -16,30 +16,14 @@
  * See <http://www.gnu.org/licenses/>.
  */
 
+#include "pico/stdlib.h"
+
 #include "config.h"
 #include "log.h"
 #include "ble.h"
+#include "ble_chars.h"
 #include "volcano.h"
 
-#define UUID_SRVC_1       0x10
-#define UUID_FIRMWARE     0x03
-#define UUID_PRJSTAT1     0x0C
-#define UUID_PRJSTAT2     0x0D
-#define UUID_PRJSTAT3     0x0E
-
-#define UUID_SRVC_2       0x11
-#define UUID_WRITE_SRVC   0x00
-#define UUID_CURRENT_TEMP 0x01
-#define UUID_TARGET_TEMP  0x03
-#define UUID_BRIGHTNESS   0x05
-#define UUID_SHUTOFF_TIME 0x0D
-#define UUID_HEATER_ON    0x0F
-#define UUID_HEATER_OFF   0x10
-#define UUID_PUMP_ON      0x13
-#define UUID_PUMP_OFF     0x14
-#define UUID_HEAT_HOURS   0x15
-#define UUID_HEAT_MINUTES 0x16
-
 #define MASK_PRJSTAT1_HEIZUNG_ENA        0x0020
 #define MASK_PRJSTAT1_AUTOBLESHUTDOWN    0x0200
 #define MASK_PRJSTAT1_PUMPE_FET_ENABLE   0x2000
@@ -49,78 +33,171 @@
 
 #define MASK_PRJSTAT3_VIBRATION          0x0400
 
-// "10xx00xx-5354-4f52-5a26-4249434b454c"
-static uint8_t uuid_base[16] = {
-    0x10, 0xFF, 0x00, 0xFF, 0x53, 0x54, 0x4f, 0x52,
-    0x5a, 0x26, 0x42, 0x49, 0x43, 0x4b, 0x45, 0x4c,
+// PRJSTAT writes set the masked bits when this is set, otherwise clear them
+#define MASK_PRJSTAT_SET                 0x10000
+
+enum volcano_field {
+    FIELD_PRJSTAT1 = 0,
+    FIELD_PRJSTAT2,
+    FIELD_PRJSTAT3,
+    FIELD_CURRENT_TEMP,
+    FIELD_TARGET_TEMP,
+    FIELD_SHUTOFF_TIME,
+    FIELD_BRIGHTNESS,
+
+    FIELD_COUNT
 };
-static uint8_t uuid_base2[16] = {
-    0x10, 0xFF, 0x00, 0xFF, 0x53, 0x54, 0x4f, 0x52,
-    0x5a, 0x26, 0x42, 0x49, 0x43, 0x4b, 0x45, 0x4c,
+
+struct field_desc {
+    enum ble_char_id id;
+    uint16_t ttl; // ms
 };
 
-int8_t volcano_discover_characteristics(bool wf, bool conf) {
-    if (wf) {
-        uuid_base[1] = UUID_SRVC_2;
-        uuid_base2[1] = UUID_SRVC_2;
+static const struct field_desc fields[FIELD_COUNT] = {
+    [FIELD_PRJSTAT1]     = { CHAR_VOLCANO_PRJSTAT1,     VOLCANO_CACHE_TTL_MS },
+    [FIELD_PRJSTAT2]     = { CHAR_VOLCANO_PRJSTAT2,     VOLCANO_CACHE_TTL_MS },
+    [FIELD_PRJSTAT3]     = { CHAR_VOLCANO_PRJSTAT3,     VOLCANO_CACHE_TTL_MS },
+    [FIELD_CURRENT_TEMP] = { CHAR_VOLCANO_CURRENT_TEMP, VOLCANO_CACHE_TEMP_TTL_MS },
+    [FIELD_TARGET_TEMP]  = { CHAR_VOLCANO_TARGET_TEMP,  VOLCANO_CACHE_TTL_MS },
+    [FIELD_SHUTOFF_TIME] = { CHAR_VOLCANO_SHUTOFF_TIME, VOLCANO_CACHE_TTL_MS },
+    [FIELD_BRIGHTNESS]   = { CHAR_VOLCANO_BRIGHTNESS,   VOLCANO_CACHE_TTL_MS },
+};
 
-        uuid_base[3] = UUID_WRITE_SRVC;
-        int8_t r;
+struct field_cache {
+    bool valid;
+    uint32_t time;
+    uint32_t value;
+};
 
-        uuid_base2[3] = UUID_TARGET_TEMP;
-        r = ble_discover(uuid_base, uuid_base2);
-        if (r < 0) {
-            return r;
-        }
+// values of the currently active device, see cache_owner
+static struct field_cache cache[FIELD_COUNT] = {0};
+static bd_addr_t cache_owner = {0};
+static uint32_t cache_hits = 0;
+static uint32_t cache_misses = 0;
 
-        uuid_base2[3] = UUID_HEATER_ON;
-        r = ble_discover(uuid_base, uuid_base2);
-        if (r < 0) {
-            return r;
-        }
+// read_start served from the cache, see volcano_read_poll
+static enum volcano_field cached_read = FIELD_COUNT;
 
-        uuid_base2[3] = UUID_HEATER_OFF;
-        r = ble_discover(uuid_base, uuid_base2);
-        if (r < 0) {
-            return r;
-        }
+static void cache_check_owner(void) {
+    bd_addr_t addr;
+    if (ble_get_active_addr(addr) < 0) {
+        memset(addr, 0, sizeof(bd_addr_t));
+    }
 
-        uuid_base2[3] = UUID_PUMP_ON;
-        r = ble_discover(uuid_base, uuid_base2);
-        if (r < 0) {
-            return r;
-        }
+    if (memcmp(addr, cache_owner, sizeof(bd_addr_t)) != 0) {
+        volcano_invalidate();
+        memcpy(cache_owner, addr, sizeof(bd_addr_t));
+    }
+}
 
-        uuid_base2[3] = UUID_PUMP_OFF;
-        r = ble_discover(uuid_base, uuid_base2);
-        if (r < 0) {
-            return r;
-        }
+static void cache_invalidate(enum volcano_field f) {
+    cache[f].valid = false;
+}
+
+static int8_t read_field(enum volcano_field f, uint32_t *value) {
+    cache_check_owner();
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if (cache[f].valid && ((now - cache[f].time) < fields[f].ttl)) {
+        cache_hits++;
+        *value = cache[f].value;
+        return 0;
     }
+    cache_misses++;
 
-    if (conf) {
-        uuid_base[1] = UUID_SRVC_1;
-        uuid_base2[1] = UUID_SRVC_1;
+    uint32_t v;
+    if (ble_char_read(fields[f].id, &v) < 0) {
+        cache_invalidate(f);
+        return -1;
+    }
 
-        uuid_base[3] = UUID_WRITE_SRVC;
-        int8_t r;
+    cache[f].valid = true;
+    cache[f].time = to_ms_since_boot(get_absolute_time());
+    cache[f].value = v;
 
-        uuid_base2[3] = UUID_PRJSTAT1;
-        r = ble_discover(uuid_base, uuid_base2);
-        if (r < 0) {
-            return r;
+    *value = v;
+    return 0;
+}
+
+static enum volcano_state decode_state(uint32_t prjstat1) {
+    uint32_t heater = (prjstat1 & MASK_PRJSTAT1_HEIZUNG_ENA);
+    uint32_t pump = (prjstat1 & MASK_PRJSTAT1_PUMPE_FET_ENABLE);
+    return (heater ? VOLCANO_STATE_HEATER : 0) | (pump ? VOLCANO_STATE_PUMP : 0);
+}
+
+void volcano_invalidate(void) {
+    for (uint i = 0; i < FIELD_COUNT; i++) {
+        cache_invalidate(i);
+    }
+}
+
+int8_t volcano_snapshot(struct volcano_snapshot *snap) {
+    if (snap == NULL) {
+        return -1;
+    }
+
+    // refresh everything stale back to back, then decode
+    uint32_t v[FIELD_COUNT];
+    for (uint i = 0; i < FIELD_COUNT; i++) {
+        if (read_field(i, &v[i]) < 0) {
+            return -2;
         }
+    }
 
-        uuid_base2[3] = UUID_PRJSTAT2;
-        r = ble_discover(uuid_base, uuid_base2);
-        if (r < 0) {
-            return r;
+    snap->current_temp = v[FIELD_CURRENT_TEMP];
+    snap->target_temp = v[FIELD_TARGET_TEMP];
+    snap->state = decode_state(v[FIELD_PRJSTAT1]);
+    snap->unit = (v[FIELD_PRJSTAT2] & MASK_PRJSTAT2_FAHRENHEIT_ENA) ? UNIT_F : UNIT_C;
+    snap->display_cooling = (v[FIELD_PRJSTAT2] & MASK_PRJSTAT2_DISPLAY_ON_COOLING) ? false : true;
+    snap->vibration = (v[FIELD_PRJSTAT3] & MASK_PRJSTAT3_VIBRATION) ? false : true;
+    snap->auto_shutoff = v[FIELD_SHUTOFF_TIME];
+    snap->brightness = v[FIELD_BRIGHTNESS];
+    return 0;
+}
+
+void volcano_cache_status(void) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    println("Volcano cache: %lu hits, %lu misses", cache_hits, cache_misses);
+    for (uint i = 0; i < FIELD_COUNT; i++) {
+        if (cache[i].valid) {
+            println("  %s: 0x%08lX (%lums old)", ble_chars[fields[i].id].name,
+                    cache[i].value, now - cache[i].time);
+        } else {
+            println("  %s: invalid", ble_chars[fields[i].id].name);
         }
+    }
+}
 
-        uuid_base2[3] = UUID_PRJSTAT3;
-        r = ble_discover(uuid_base, uuid_base2);
-        if (r < 0) {
-            return r;
+static const enum ble_char_id discover_wf[] = {
+    CHAR_VOLCANO_TARGET_TEMP,
+    CHAR_VOLCANO_HEATER_ON,
+    CHAR_VOLCANO_HEATER_OFF,
+    CHAR_VOLCANO_PUMP_ON,
+    CHAR_VOLCANO_PUMP_OFF,
+};
+
+static const enum ble_char_id discover_conf[] = {
+    CHAR_VOLCANO_PRJSTAT1,
+    CHAR_VOLCANO_PRJSTAT2,
+    CHAR_VOLCANO_PRJSTAT3,
+};
+
+int8_t volcano_discover_characteristics(bool wf, bool conf) {
+    if (wf) {
+        for (uint i = 0; i < count_of(discover_wf); i++) {
+            int8_t r = ble_char_discover(discover_wf[i]);
+            if (r < 0) {
+                return r;
+            }
+        }
+    }
+
+    if (conf) {
+        for (uint i = 0; i < count_of(discover_conf); i++) {
+            int8_t r = ble_char_discover(discover_conf[i]);
+            if (r < 0) {
+                return r;
+            }
         }
     }
 
@@ -128,261 +205,237 @@ int8_t volcano_discover_characteristics(bool wf, bool conf) {
 }
 
 int16_t volcano_get_current_temp(void) {
-    uuid_base[1] = UUID_SRVC_2;
-    uuid_base[3] = UUID_CURRENT_TEMP;
-
-    uint8_t buff[4];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read unexpected value %ld", r);
+    uint32_t v;
+    if (read_field(FIELD_CURRENT_TEMP, &v) < 0) {
         return -1;
     }
-
-    uint32_t *v = (uint32_t *)buff;
-    return *v;
+    return v;
 }
 
 int16_t volcano_get_target_temp(void) {
-    uuid_base[3] = UUID_TARGET_TEMP;
-
-    uint8_t buff[4];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read unexpected value %ld", r);
+    uint32_t v;
+    if (read_field(FIELD_TARGET_TEMP, &v) < 0) {
         return -1;
     }
-
-    uint32_t *v = (uint32_t *)buff;
-    return *v;
+    return v;
 }
 
-int8_t volcano_set_target_temp(uint16_t value) {
-    uuid_base[1] = UUID_SRVC_2;
-    uuid_base2[1] = UUID_SRVC_2;
-    uuid_base[3] = UUID_WRITE_SRVC;
-    uuid_base2[3] = UUID_TARGET_TEMP;
+static enum volcano_field value_field(enum vaporizer_value v) {
+    switch (v) {
+    case VAP_CURRENT_TEMP:
+        return FIELD_CURRENT_TEMP;
 
-    uint8_t buff[4];
-    uint32_t *v = (uint32_t *)buff;
-    *v = value;
+    case VAP_TARGET_TEMP:
+        return FIELD_TARGET_TEMP;
 
-    int8_t r = ble_write(uuid_base, uuid_base2, buff, sizeof(buff));
-    if (r != 0) {
-        debug("ble_write unexpected value %d", r);
+    case VAP_HEATER:
+    case VAP_PUMP:
+        return FIELD_PRJSTAT1;
     }
-    return r;
+
+    return FIELD_COUNT;
 }
 
-int8_t volcano_set_heater_state(bool value) {
-    uuid_base[1] = UUID_SRVC_2;
-    uuid_base2[1] = UUID_SRVC_2;
-    uuid_base[3] = UUID_WRITE_SRVC;
+int8_t volcano_read_start(enum vaporizer_value v) {
+    enum volcano_field f = value_field(v);
+    if (f >= FIELD_COUNT) {
+        return -1;
+    }
 
-    if (value) {
-        uuid_base2[3] = UUID_HEATER_ON;
-    } else {
-        uuid_base2[3] = UUID_HEATER_OFF;
+    cache_check_owner();
+
+    // still fresh from a getter or snapshot, read_poll answers right away
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if (cache[f].valid && ((now - cache[f].time) < fields[f].ttl)) {
+        cache_hits++;
+        cached_read = f;
+        return 0;
     }
+    cache_misses++;
 
-    uint8_t d = 0;
-    int8_t r = ble_write(uuid_base, uuid_base2, &d, sizeof(d));
-    if (r != 0) {
-        debug("ble_write unexpected value %d", r);
+    cached_read = FIELD_COUNT;
+    return ble_char_read_start(fields[f].id);
+}
+
+static int16_t decode_value(enum vaporizer_value v, uint32_t raw) {
+    if (v == VAP_HEATER) {
+        return (decode_state(raw) & VOLCANO_STATE_HEATER) ? 1 : 0;
+    } else if (v == VAP_PUMP) {
+        return (decode_state(raw) & VOLCANO_STATE_PUMP) ? 1 : 0;
     }
-    return r;
+    return raw;
 }
 
-int8_t volcano_set_pump_state(bool value) {
-    uuid_base[1] = UUID_SRVC_2;
-    uuid_base2[1] = UUID_SRVC_2;
-    uuid_base[3] = UUID_WRITE_SRVC;
+int8_t volcano_read_poll(enum vaporizer_value v, int16_t *value) {
+    enum volcano_field f = value_field(v);
+    if ((f >= FIELD_COUNT) || (value == NULL)) {
+        return -1;
+    }
 
-    if (value) {
-        uuid_base2[3] = UUID_PUMP_ON;
+    uint32_t raw;
+    if (cached_read == f) {
+        cached_read = FIELD_COUNT;
+        raw = cache[f].value;
     } else {
-        uuid_base2[3] = UUID_PUMP_OFF;
+        int8_t r = ble_char_read_poll(fields[f].id, &raw);
+        if (r < 0) {
+            cache_invalidate(f);
+            return r;
+        } else if (r == 0) {
+            return 0;
+        }
+
+        cache[f].valid = true;
+        cache[f].time = to_ms_since_boot(get_absolute_time());
+        cache[f].value = raw;
+    }
+
+    *value = decode_value(v, raw);
+    return 1;
+}
+
+// whatever the screens or the workflow engine read last, even when expired
+int8_t volcano_get_cached(enum vaporizer_value v, int16_t *value) {
+    enum volcano_field f = value_field(v);
+    if ((f >= FIELD_COUNT) || (value == NULL)) {
+        return -1;
     }
 
-    uint8_t d = 0;
-    int8_t r = ble_write(uuid_base, uuid_base2, &d, sizeof(d));
-    if (r != 0) {
-        debug("ble_write unexpected value %d", r);
+    cache_check_owner();
+    if (!cache[f].valid) {
+        return -2;
     }
-    return r;
+
+    *value = decode_value(v, cache[f].value);
+    return 0;
 }
 
-enum unit volcano_get_unit(void) {
-    uuid_base[1] = UUID_SRVC_1;
-    uuid_base[3] = UUID_PRJSTAT2;
+int8_t volcano_write_start(enum vaporizer_value v, uint16_t value) {
+    switch (v) {
+    case VAP_TARGET_TEMP:
+        cache_invalidate(FIELD_TARGET_TEMP);
+        return ble_char_write_start(CHAR_VOLCANO_TARGET_TEMP, value);
 
-    uint8_t buff[4];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read unexpected value %ld", r);
-        return UNIT_INVALID;
+    case VAP_HEATER:
+        cache_invalidate(FIELD_PRJSTAT1);
+        return ble_char_write_start(value ? CHAR_VOLCANO_HEATER_ON : CHAR_VOLCANO_HEATER_OFF, 0);
+
+    case VAP_PUMP:
+        cache_invalidate(FIELD_PRJSTAT1);
+        return ble_char_write_start(value ? CHAR_VOLCANO_PUMP_ON : CHAR_VOLCANO_PUMP_OFF, 0);
+
+    case VAP_CURRENT_TEMP:
+        break;
     }
 
-    uint32_t *v = (uint32_t *)buff;
-    return (*v & MASK_PRJSTAT2_FAHRENHEIT_ENA) ? UNIT_F : UNIT_C;
+    return -1;
 }
 
-enum volcano_state volcano_get_state(void) {
-    uuid_base[1] = UUID_SRVC_1;
-    uuid_base[3] = UUID_PRJSTAT1;
+int8_t volcano_write_poll(void) {
+    return ble_char_write_poll();
+}
 
-    uint8_t buff[4];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read unexpected value %ld", r);
-        return VOLCANO_STATE_INVALID;
+int8_t volcano_set_target_temp(uint16_t value) {
+    cache_invalidate(FIELD_TARGET_TEMP);
+    return ble_char_write(CHAR_VOLCANO_TARGET_TEMP, value);
+}
+
+int8_t volcano_set_heater_state(bool value) {
+    cache_invalidate(FIELD_PRJSTAT1);
+    return ble_char_write(value ? CHAR_VOLCANO_HEATER_ON : CHAR_VOLCANO_HEATER_OFF, 0);
+}
+
+int8_t volcano_set_pump_state(bool value) {
+    cache_invalidate(FIELD_PRJSTAT1);
+    return ble_char_write(value ? CHAR_VOLCANO_PUMP_ON : CHAR_VOLCANO_PUMP_OFF, 0);
+}
+
+enum unit volcano_get_unit(void) {
+    uint32_t v;
+    if (read_field(FIELD_PRJSTAT2, &v) < 0) {
+        return UNIT_INVALID;
     }
+    return (v & MASK_PRJSTAT2_FAHRENHEIT_ENA) ? UNIT_F : UNIT_C;
+}
 
-    uint32_t *v = (uint32_t *)buff;
-    uint32_t heater = (*v & MASK_PRJSTAT1_HEIZUNG_ENA);
-    uint32_t pump = (*v & MASK_PRJSTAT1_PUMPE_FET_ENABLE);
-    return (heater ? VOLCANO_STATE_HEATER : 0) | (pump ? VOLCANO_STATE_PUMP : 0);
+enum volcano_state volcano_get_state(void) {
+    uint32_t v;
+    if (read_field(FIELD_PRJSTAT1, &v) < 0) {
+        return VOLCANO_STATE_INVALID;
+    }
+    return decode_state(v);
 }
 
 int8_t volcano_set_unit(enum unit unit) {
-    uuid_base[1] = UUID_SRVC_1;
-    uuid_base2[1] = UUID_SRVC_1;
-    uuid_base[3] = UUID_WRITE_SRVC;
-    uuid_base2[3] = UUID_PRJSTAT2;
-
     uint32_t v = MASK_PRJSTAT2_FAHRENHEIT_ENA;
     if (unit == UNIT_F) {
-        v |= 0x10000;
+        v |= MASK_PRJSTAT_SET;
     }
 
-    int8_t r = ble_write(uuid_base, uuid_base2, (uint8_t *)&v, sizeof(v));
-    if (r != 0) {
-        debug("ble_write unexpected value %d", r);
-    }
-    return r;
+    cache_invalidate(FIELD_PRJSTAT2);
+    return ble_char_write(CHAR_VOLCANO_PRJSTAT2, v);
 }
 
 int8_t volcano_set_vibration(bool value) {
-    uuid_base[1] = UUID_SRVC_1;
-    uuid_base2[1] = UUID_SRVC_1;
-    uuid_base[3] = UUID_WRITE_SRVC;
-    uuid_base2[3] = UUID_PRJSTAT3;
-
     uint32_t v = MASK_PRJSTAT3_VIBRATION;
     if (!value) {
-        v |= 0x10000;
+        v |= MASK_PRJSTAT_SET;
     }
 
-    int8_t r = ble_write(uuid_base, uuid_base2, (uint8_t *)&v, sizeof(v));
-    if (r != 0) {
-        debug("ble_write unexpected value %d", r);
-    }
-    return r;
+    cache_invalidate(FIELD_PRJSTAT3);
+    return ble_char_write(CHAR_VOLCANO_PRJSTAT3, v);
 }
 
 int8_t volcano_get_vibration(void) {
-    uuid_base[1] = UUID_SRVC_1;
-    uuid_base[3] = UUID_PRJSTAT3;
-
-    uint8_t buff[4];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read unexpected value %ld", r);
+    uint32_t v;
+    if (read_field(FIELD_PRJSTAT3, &v) < 0) {
         return -1;
     }
-
-    uint32_t *v = (uint32_t *)buff;
-    return (*v & MASK_PRJSTAT3_VIBRATION) ? 0 : 1;
+    return (v & MASK_PRJSTAT3_VIBRATION) ? 0 : 1;
 }
 
 int8_t volcano_set_display_cooling(bool value) {
-    uuid_base[1] = UUID_SRVC_1;
-    uuid_base2[1] = UUID_SRVC_1;
-    uuid_base[3] = UUID_WRITE_SRVC;
-    uuid_base2[3] = UUID_PRJSTAT2;
-
     uint32_t v = MASK_PRJSTAT2_DISPLAY_ON_COOLING;
     if (!value) {
-        v |= 0x10000;
+        v |= MASK_PRJSTAT_SET;
     }
 
-    int8_t r = ble_write(uuid_base, uuid_base2, (uint8_t *)&v, sizeof(v));
-    if (r != 0) {
-        debug("ble_write unexpected value %d", r);
-    }
-    return r;
+    cache_invalidate(FIELD_PRJSTAT2);
+    return ble_char_write(CHAR_VOLCANO_PRJSTAT2, v);
 }
 
 int8_t volcano_get_display_cooling(void) {
-    uuid_base[1] = UUID_SRVC_1;
-    uuid_base[3] = UUID_PRJSTAT2;
-
-    uint8_t buff[4];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read unexpected value %ld", r);
+    uint32_t v;
+    if (read_field(FIELD_PRJSTAT2, &v) < 0) {
         return -1;
     }
-
-    uint32_t *v = (uint32_t *)buff;
-    return (*v & MASK_PRJSTAT2_DISPLAY_ON_COOLING) ? 0 : 1;
+    return (v & MASK_PRJSTAT2_DISPLAY_ON_COOLING) ? 0 : 1;
 }
 
 int16_t volcano_get_auto_shutoff(void) {
-    uuid_base[1] = UUID_SRVC_2;
-    uuid_base[3] = UUID_SHUTOFF_TIME;
-
-    uint8_t buff[2];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read unexpected value %ld", r);
+    uint32_t v;
+    if (read_field(FIELD_SHUTOFF_TIME, &v) < 0) {
         return -1;
     }
-
-    uint16_t *v = (uint16_t *)buff;
-    return *v;
-
+    return v;
 }
 
 int8_t volcano_set_auto_shutoff(uint16_t v) {
-    uuid_base[1] = UUID_SRVC_2;
-    uuid_base2[1] = UUID_SRVC_2;
-    uuid_base[3] = UUID_WRITE_SRVC;
-    uuid_base2[3] = UUID_SHUTOFF_TIME;
-
-    int8_t r = ble_write(uuid_base, uuid_base2, (uint8_t *)&v, sizeof(v));
-    if (r != 0) {
-        debug("ble_write unexpected value %d", r);
-    }
-    return r;
+    cache_invalidate(FIELD_SHUTOFF_TIME);
+    return ble_char_write(CHAR_VOLCANO_SHUTOFF_TIME, v);
 }
 
 int8_t volcano_get_brightness(void) {
-    uuid_base[1] = UUID_SRVC_2;
-    uuid_base[3] = UUID_BRIGHTNESS;
-
-    uint8_t buff[2];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read unexpected value %ld", r);
+    uint32_t v;
+    if (read_field(FIELD_BRIGHTNESS, &v) < 0) {
         return -1;
     }
-
-    uint16_t *v = (uint16_t *)buff;
-    return *v;
+    return v;
 }
 
 int8_t volcano_set_brightness(uint8_t val) {
-    uuid_base[1] = UUID_SRVC_2;
-    uuid_base2[1] = UUID_SRVC_2;
-    uuid_base[3] = UUID_WRITE_SRVC;
-    uuid_base2[3] = UUID_BRIGHTNESS;
-
-    uint16_t v = val;
-    int8_t r = ble_write(uuid_base, uuid_base2, (uint8_t *)&v, sizeof(v));
-    if (r != 0) {
-        debug("ble_write unexpected value %d", r);
-    }
-    return r;
+    cache_invalidate(FIELD_BRIGHTNESS);
+    return ble_char_write(CHAR_VOLCANO_BRIGHTNESS, val);
 }
 
 int8_t volcano_get_firmware(char *val) {
@@ -390,11 +443,8 @@ int8_t volcano_get_firmware(char *val) {
         return -1;
     }
 
-    uuid_base[1] = UUID_SRVC_1;
-    uuid_base[3] = UUID_FIRMWARE;
-
     uint8_t buff[VOLCANO_FW_LEN];
-    int32_t r = ble_read(uuid_base, buff, sizeof(buff));
+    int32_t r = ble_char_read_raw(CHAR_VOLCANO_FIRMWARE, buff, sizeof(buff));
     if (r != sizeof(buff)) {
         debug("ble_read unexpected value %ld", r);
         return -1;
@@ -405,28 +455,12 @@ int8_t volcano_get_firmware(char *val) {
 }
 
 int32_t volcano_get_runtime(void) {
-    int32_t val = 0;
-
-    uuid_base[1] = UUID_SRVC_2;
-    uuid_base[3] = UUID_HEAT_HOURS;
-
-    uint32_t buff;
-    int32_t r = ble_read(uuid_base, (uint8_t *)&buff, sizeof(buff));
-    if (r != sizeof(buff)) {
-        debug("ble_read 1 unexpected value %ld", r);
+    uint32_t hours, minutes;
+    if (ble_char_read(CHAR_VOLCANO_HEAT_HOURS, &hours) < 0) {
         return -1;
     }
-
-    val = buff * 60;
-    uuid_base[3] = UUID_HEAT_MINUTES;
-
-    uint16_t buff2;
-    r = ble_read(uuid_base, (uint8_t *)&buff2, sizeof(buff2));
-    if (r != sizeof(buff2)) {
-        debug("ble_read 2 unexpected value %ld", r);
+    if (ble_char_read(CHAR_VOLCANO_HEAT_MINUTES, &minutes) < 0) {
         return -1;
     }
-
-    val += buff2;
-    return val;
+    return hours * 60 + minutes;
 }
@@ -0,0 +1,238 @@
+/*
+ * wf_sim.c
+ *
+ * Fast-forward simulation of workflows, using the real engine from
+ * workflow.c with a fake Volcano driver and the thermal model from
+ * thermal.c, all running on a virtual clock.
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "config.h"
+#include "log.h"
+#include "main.h"
+#include "thermal.h"
+#include "vaporizer.h"
+#include "workflow.h"
+#include "wf_sim.h"
+
+#define WF_SIM_TICK_MS 10 // virtual time between wf_run() calls
+#define WF_SIM_ROW_MS 1000 // timeline interval, when nothing changes
+#define WF_SIM_MAX_MS (2UL * 60UL * 60UL * 1000UL)
+#define WF_SIM_HW_TICKS 1000 // keep usb and watchdog alive
+
+static uint32_t sim_t = 0;
+static struct thermal_model model;
+static struct wf_sim_result *res = NULL;
+
+static uint32_t sim_clock(void) {
+    return sim_t;
+}
+
+static int16_t sim_value(enum vaporizer_value v) {
+    thermal_model_run(&model, sim_t);
+
+    switch (v) {
+    case VAP_CURRENT_TEMP:
+        return model.current;
+
+    case VAP_TARGET_TEMP:
+        return model.target;
+
+    case VAP_HEATER:
+        return model.heater;
+
+    case VAP_PUMP:
+        return model.pump;
+    }
+
+    return -1;
+}
+
+static int16_t sim_get_current_temp(void) {
+    res->reads++;
+    return sim_value(VAP_CURRENT_TEMP);
+}
+
+static int16_t sim_get_target_temp(void) {
+    res->reads++;
+    return sim_value(VAP_TARGET_TEMP);
+}
+
+static int8_t sim_set_target_temp(uint16_t v) {
+    thermal_model_run(&model, sim_t);
+    res->target_writes++;
+    model.target = v;
+    return 0;
+}
+
+static int8_t sim_set_heater(bool value) {
+    thermal_model_run(&model, sim_t);
+    res->heater_writes++;
+    model.heater = value;
+    return 0;
+}
+
+static int8_t sim_set_pump(bool value) {
+    thermal_model_run(&model, sim_t);
+    res->pump_writes++;
+    model.pump = value;
+    return 0;
+}
+
+static int8_t sim_read_start(enum vaporizer_value v) {
+    (void)v;
+    res->reads++;
+    return 0;
+}
+
+static int8_t sim_read_poll(enum vaporizer_value v, int16_t *value) {
+    // answer arrives on the next tick, like a fast link would
+    *value = sim_value(v);
+    return 1;
+}
+
+static int8_t sim_write_start(enum vaporizer_value v, uint16_t value) {
+    switch (v) {
+    case VAP_TARGET_TEMP:
+        return sim_set_target_temp(value);
+
+    case VAP_HEATER:
+        return sim_set_heater(value);
+
+    case VAP_PUMP:
+        return sim_set_pump(value);
+
+    case VAP_CURRENT_TEMP:
+        break;
+    }
+
+    return -1;
+}
+
+static int8_t sim_write_poll(void) {
+    // confirmed on the next tick
+    return 1;
+}
+
+static const struct vaporizer_ops sim_ops = {
+    .name = "Simulated Volcano",
+    .dev = DEV_VOLCANO,
+    .caps = VAP_CAP_PUMP | VAP_CAP_STATE,
+    .temp_resolution = 1,
+
+    .discover = NULL,
+    .poll = NULL,
+
+    .get_current_temp = sim_get_current_temp,
+    .get_target_temp = sim_get_target_temp,
+    .set_target_temp = sim_set_target_temp,
+    .set_heater = sim_set_heater,
+    .set_pump = sim_set_pump,
+
+    .read_start = sim_read_start,
+    .read_poll = sim_read_poll,
+    .write_start = sim_write_start,
+    .write_poll = sim_write_poll,
+};
+
+static void print_row(uint16_t step) {
+    println("%lu.%03lu,%u,%.1f,%.1f,%d,%d",
+            sim_t / 1000, sim_t % 1000, step,
+            model.target / 10.0f, model.current / 10.0f,
+            model.heater ? 1 : 0, model.pump ? 1 : 0);
+}
+
+int8_t wf_sim_run(uint16_t index, bool csv, struct wf_sim_result *r) {
+    // a request of the real device would never finish on the virtual clock
+    struct wf_state busy = wf_status();
+    if ((busy.status != WF_IDLE) || busy.io_pending) {
+        debug("workflow engine busy");
+        return -1;
+    }
+    if (index >= wf_count()) {
+        debug("invalid index %d", index);
+        return -2;
+    }
+
+    memset(r, 0, sizeof(struct wf_sim_result));
+    res = r;
+    sim_t = 0;
+    thermal_model_init(&model, sim_t);
+    r->max_temp = model.current;
+
+    wf_set_clock(sim_clock);
+    wf_start_ops(index, &sim_ops);
+
+    if (csv) {
+        println("time,step,setpoint,temperature,heater,pump");
+    }
+
+    struct thermal_model last = model;
+    uint16_t last_step = 0;
+    uint32_t last_row = 0;
+    uint32_t ticks = 0;
+
+    struct wf_state s = wf_status();
+    while ((s.status != WF_IDLE) && (sim_t < WF_SIM_MAX_MS)) {
+        wf_run();
+
+        sim_t += WF_SIM_TICK_MS;
+        thermal_model_run(&model, sim_t);
+        s = wf_status();
+
+        r->max_temp = MAX(r->max_temp, model.current);
+        if (model.pump) {
+            r->pump_ms += WF_SIM_TICK_MS;
+        }
+
+        if (csv && ((s.index != last_step) || (model.target != last.target)
+                    || (model.heater != last.heater) || (model.pump != last.pump)
+                    || ((sim_t - last_row) >= WF_SIM_ROW_MS))) {
+            print_row(s.index);
+            last = model;
+            last_step = s.index;
+            last_row = sim_t;
+        }
+
+        if ((++ticks % WF_SIM_HW_TICKS) == 0) {
+            main_loop_hw();
+        }
+    }
+
+    if (s.status != WF_IDLE) {
+        debug("workflow did not finish in %lus", WF_SIM_MAX_MS / 1000);
+        wf_reset();
+        r->error = true;
+    } else {
+        r->error = s.error;
+    }
+
+    r->duration_ms = sim_t;
+    wf_set_clock(NULL);
+    res = NULL;
+    return 0;
+}
+
+void wf_sim_print(const struct wf_sim_result *r) {
+    println("Duration: %lu.%03lus%s", r->duration_ms / 1000, r->duration_ms % 1000,
+            r->error ? " (failed)" : "");
+    println("Pump: %lu.%03lus, max. temperature: %.1f C",
+            r->pump_ms / 1000, r->pump_ms % 1000, r->max_temp / 10.0f);
+    println("Writes: %lu target, %lu heater, %lu pump, reads: %lu",
+            r->target_writes, r->heater_writes, r->pump_writes, r->reads);
+}
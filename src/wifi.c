@@ -16,10 +16,11 @@
  * See <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "pico/cyw43_arch.h"
 #include "lwip/netif.h"
 #include "lwip/ip4_addr.h"
-#include "lwip/tcp.h"
 #include "dhcpserver.h"
 
 #include "config.h"
@@ -29,6 +30,7 @@
 #include "wifi.h"
 
 #define CONNECT_TIMEOUT_MS (8UL * 1000UL)
+#define FAST_JOIN_TIMEOUT_MS (5UL * 1000UL) // cached access point, no scan
 #define SCAN_AP_TIMEOUT_MS (20UL * 1000UL)
 
 #define WIFI_AP_SSID_PREFIX "Volcano-"
@@ -54,17 +56,28 @@ static bool enabled_ap = false;
 static char curr_ssid[WIFI_MAX_NAME_LEN + 1] = {0};
 static char curr_pass[WIFI_MAX_PASS_LEN + 1] = {0};
 
-struct wifi_tcp_cache {
-    bool in_use;
-    bool clear; // TODO
-    ip4_addr_t ip;
-    uint16_t port;
-    struct tcp_pcb *tpcb;
-    char data[512];
-    unsigned int len;
+// network and access point of the current join attempt
+struct wifi_join {
+    int8_t index; // in mem_data()->net, < 0 when unknown
+    bool fast; // straight to cached access point
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t auth;
+};
+
+struct wifi_join_stats {
+    uint32_t init_time;
+    uint32_t ready_time; // 0 until the first IP this boot
+    bool ready_fast;
+    uint32_t fast_joins;
+    uint32_t fast_fails;
+    uint32_t scans;
 };
 
-static struct wifi_tcp_cache cache[4] = {0};
+static struct wifi_join join = { .index = -1 };
+static uint16_t fast_failed = 0; // networks with stale cache, this boot
+static bool hint_changed = false;
+static struct wifi_join_stats join_stats = {0};
 
 static void wifi_ap(void) {
     cyw43_thread_enter();
@@ -104,31 +117,63 @@ static void wifi_ap(void) {
     cyw43_thread_exit();
 }
 
-static void wifi_connect(const char *ssid, const char *pw, uint32_t auth) {
-    cyw43_thread_enter();
+static uint32_t wifi_auth(uint8_t scan_auth) {
+    // https://github.com/raspberrypi/pico-sdk/issues/1413
+    if (scan_auth & 4) {
+        return CYW43_AUTH_WPA2_AES_PSK;
+    } else if (scan_auth & 2) {
+        return CYW43_AUTH_WPA_TKIP_PSK;
+    }
+    return 0;
+}
 
-    debug("connecting to '%s'", ssid);
+static int wifi_connect(const char *ssid, const char *pw) {
+    debug("connecting to '%s'%s", ssid, join.fast ? " (cached)" : "");
     strncpy(curr_ssid, ssid, WIFI_MAX_NAME_LEN);
     strncpy(curr_pass, pw, WIFI_MAX_PASS_LEN);
 
-    // https://github.com/raspberrypi/pico-sdk/issues/1413
-    uint32_t a = 0;
-    if (auth & 4) {
-        a = CYW43_AUTH_WPA2_AES_PSK;
-    } else if (auth & 2) {
-        a = CYW43_AUTH_WPA_TKIP_PSK;
-    }
-
-    int r = cyw43_arch_wifi_connect_async(ssid, pw, a);
+    // same as cyw43_arch_wifi_connect_async(), but can skip the scan
+    int r = cyw43_wifi_join(&cyw43_state, strlen(ssid), (const uint8_t *)ssid,
+                            strlen(pw), (const uint8_t *)pw, join.auth,
+                            join.fast ? join.bssid : NULL,
+                            join.fast ? join.channel : CYW43_CHANNEL_NONE);
     if (r != 0) {
         debug("failed to connect %d", r);
-        state = WS_SCAN;
     } else {
         start_connect_time = to_ms_since_boot(get_absolute_time());
         state = WS_CONNECT;
     }
+    return r;
+}
 
-    cyw43_thread_exit();
+// next network with a cached access point that was not tried yet
+static int fast_join_next(void) {
+    for (int i = 0; i < mem_data()->net_count; i++) {
+        if ((mem_data()->net[i].channel != 0) && !(fast_failed & (1 << i))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool fast_join(void) {
+    int i;
+    while ((i = fast_join_next()) >= 0) {
+        const struct net_credentials *net = &mem_data()->net[i];
+        join.index = i;
+        join.fast = true;
+        memcpy(join.bssid, net->bssid, sizeof(join.bssid));
+        join.channel = net->channel;
+        join.auth = net->auth;
+        join_stats.fast_joins++;
+
+        if (wifi_connect(net->name, net->pass) == 0) {
+            return true;
+        }
+        fast_failed |= 1 << i;
+        join_stats.fast_fails++;
+    }
+    return false;
 }
 
 static int scan_result(void *env, const cyw43_ev_scan_result_t *result) {
@@ -139,9 +184,16 @@ static int scan_result(void *env, const cyw43_ev_scan_result_t *result) {
         for (int i = 0; i < mem_data()->net_count; i++) {
             if ((strlen(mem_data()->net[i].name) == result->ssid_len)
                  && (memcmp(mem_data()->net[i].name, result->ssid, result->ssid_len) == 0)) {
-                wifi_connect(mem_data()->net[i].name,
-                             mem_data()->net[i].pass,
-                             result->auth_mode);
+                join.index = i;
+                join.fast = false;
+                memcpy(join.bssid, result->bssid, sizeof(join.bssid));
+                join.channel = result->channel;
+                join.auth = wifi_auth(result->auth_mode);
+
+                if (wifi_connect(mem_data()->net[i].name,
+                                 mem_data()->net[i].pass) != 0) {
+                    state = WS_SCAN;
+                }
                 break;
             }
         }
@@ -154,6 +206,7 @@ static int scan_result(void *env, const cyw43_ev_scan_result_t *result) {
 static void wifi_scan(void) {
     debug("starting scan");
     state = WS_SCAN;
+    join_stats.scans++;
 
     cyw43_wifi_scan_options_t scan_options = {0};
     int err = cyw43_wifi_scan(&cyw43_state, &scan_options, NULL, scan_result);
@@ -162,6 +215,51 @@ static void wifi_scan(void) {
     }
 }
 
+// join attempt failed, try next cached access point or fall back to scanning
+static void wifi_retry(void) {
+    if (join.fast) {
+        debug("cached access point for '%s' failed", curr_ssid);
+        fast_failed |= 1 << join.index;
+        join_stats.fast_fails++;
+        join.fast = false;
+
+        if (fast_join()) {
+            return;
+        }
+
+        // give the scan its full time before opening the AP
+        start_scan_time = to_ms_since_boot(get_absolute_time());
+    }
+
+    wifi_scan();
+}
+
+// remember access point that gave us an IP for the next boot
+static void wifi_joined(void) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if (join_stats.ready_time == 0) {
+        join_stats.ready_time = now - join_stats.init_time;
+        join_stats.ready_fast = join.fast;
+        debug("time to IP %lums (%s)", join_stats.ready_time,
+              join.fast ? "cached" : "scan");
+    }
+
+    if ((join.index < 0) || (join.index >= mem_data()->net_count)
+            || (strcmp(mem_data()->net[join.index].name, curr_ssid) != 0)) {
+        return;
+    }
+
+    struct net_credentials *net = &mem_data()->net[join.index];
+    if ((memcmp(net->bssid, join.bssid, sizeof(net->bssid)) != 0)
+            || (net->channel != join.channel) || (net->auth != join.auth)) {
+        memcpy(net->bssid, join.bssid, sizeof(net->bssid));
+        net->channel = join.channel;
+        net->auth = join.auth;
+        hint_changed = true;
+    }
+    fast_failed &= ~(1 << join.index);
+}
+
 void wifi_init(void) {
     if (state != WS_IDLE) {
         debug("invalid state %d", state);
@@ -172,8 +270,13 @@ void wifi_init(void) {
 
     cyw43_arch_enable_sta_mode();
 
-    wifi_scan();
-    start_scan_time = to_ms_since_boot(get_absolute_time());
+    join_stats.init_time = to_ms_since_boot(get_absolute_time());
+    start_scan_time = join_stats.init_time;
+    join.index = -1;
+    join.fast = false;
+    if (!fast_join()) {
+        wifi_scan();
+    }
 
     cyw43_thread_exit();
 }
@@ -237,99 +340,27 @@ const char *wifi_state(void) {
     return NULL;
 }
 
-static err_t wifi_tcp_connect(void *arg, struct tcp_pcb *tpcb, err_t err) {
-    (void)err;
-    int c = (int)arg;
-
-    err_t e = tcp_write(tpcb, cache[c].data, cache[c].len, TCP_WRITE_FLAG_COPY);
-    if (e) {
-        debug("tcp_write error %d", e);
-        cache[c].clear = true;
-        return ERR_OK;
-    }
-
-    e = tcp_output(tpcb);
-    if (e) {
-        debug("tcp_output error %d", e);
-        cache[c].clear = true;
-        return ERR_OK;
+void wifi_status(void) {
+    println("WiFi: %s", (state == WS_READY) ? (enabled_ap ? "Access Point" : "Connected")
+                                              : wifi_state());
+    if (join_stats.ready_time != 0) {
+        println("Time to IP: %.2fs (%s)", join_stats.ready_time / 1000.0f,
+                join_stats.ready_fast ? "cached access point" : "scan");
     }
+    println("Cached joins: %lu, failed: %lu, scans: %lu",
+            join_stats.fast_joins, join_stats.fast_fails, join_stats.scans);
 
-    return ERR_OK;
-}
-
-static void wifi_tcp_error(void *arg, err_t err) {
-    int c = (int)arg;
-    debug("tcp err %d", err);
-    cache[c].in_use = false; // lwip already freed the tpcb
-}
-
-static err_t wifi_tcp_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) {
-    (void)tpcb;
-    (void)err;
-    int c = (int)arg;
-    if (p == NULL) {
-        debug("remote closed conn");
-        cache[c].clear = true;
-    } else {
-        debug("tcp rx %d: %s", pbuf_clen(p), (char *)p->payload);
-        cache[c].clear = true;
-    }
-    return ERR_OK;
-}
-
-static err_t wifi_tcp_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
-    (void)tpcb;
-    int c = (int)arg;
-    if (len == cache[c].len) {
-        debug("tcp tx success");
-        cache[c].clear = true;
-    }
-    return ERR_OK;
-}
-
-void wifi_tcp_send(const char *ip, uint16_t port, const char *packet, unsigned int len) {
-    cyw43_arch_lwip_begin();
-
-    ip4_addr_t val;
-    if (!ip4addr_aton(ip, &val)) {
-        debug("invalid IP: %s", ip);
-        cyw43_arch_lwip_end();
-        return;
-    }
-
-    int c = -1;
-    for (unsigned int i = 0; i < (sizeof(cache) / sizeof(cache[0])); i++) {
-        if (!cache[i].in_use) {
-            c = i;
+    for (uint16_t i = 0; i < mem_data()->net_count; i++) {
+        const struct net_credentials *net = &mem_data()->net[i];
+        if (net->channel == 0) {
+            println("'%s': no cached access point", net->name);
+        } else {
+            println("'%s': %02X:%02X:%02X:%02X:%02X:%02X ch %d%s", net->name,
+                    net->bssid[0], net->bssid[1], net->bssid[2],
+                    net->bssid[3], net->bssid[4], net->bssid[5],
+                    net->channel, (fast_failed & (1 << i)) ? " (stale)" : "");
         }
     }
-    if (c < 0) {
-        debug("no space in cache");
-        cyw43_arch_lwip_end();
-        return;
-    }
-
-    cache[c].in_use = true;
-    cache[c].clear = false;
-    cache[c].ip = val;
-    cache[c].port = port;
-    cache[c].tpcb = tcp_new();
-
-    if (len > sizeof(cache[c].data)) {
-        len = sizeof(cache[c].data);
-    }
-
-    cache[c].len = len;
-    memcpy(cache[c].data, packet, len);
-
-    tcp_arg(cache[c].tpcb, (void *)c);
-    tcp_err(cache[c].tpcb, wifi_tcp_error);
-    tcp_recv(cache[c].tpcb, wifi_tcp_recv);
-    tcp_sent(cache[c].tpcb, wifi_tcp_sent);
-    tcp_connect(cache[c].tpcb, &val, port, wifi_tcp_connect);
-
-    cyw43_arch_lwip_end();
 }
 
 void wifi_run(void) {
@@ -361,26 +392,26 @@ void wifi_run(void) {
             state = WS_WAIT_FOR_IP;
         } else if (link < CYW43_LINK_DOWN) {
             debug("net connection failed. retry.");
-            wifi_scan();
-        }
-
-        uint32_t now = to_ms_since_boot(get_absolute_time());
-        if ((now - start_connect_time) >= CONNECT_TIMEOUT_MS) {
-            debug("net connection timeout. retry.");
-            wifi_scan();
+            wifi_retry();
+        } else {
+            uint32_t now = to_ms_since_boot(get_absolute_time());
+            uint32_t timeout = join.fast ? FAST_JOIN_TIMEOUT_MS : CONNECT_TIMEOUT_MS;
+            if ((now - start_connect_time) >= timeout) {
+                debug("net connection timeout. retry.");
+                wifi_retry();
+            }
         }
     } else if (state == WS_WAIT_FOR_IP) {
         cyw43_arch_lwip_begin();
         const ip4_addr_t *ip = netif_ip4_addr(netif_default);
         cyw43_arch_lwip_end();
 
+        uint32_t now = to_ms_since_boot(get_absolute_time());
         if (ip4_addr_get_u32(ip) != 0) {
             state = WS_READY;
             debug("got IP '%s'", ip4addr_ntoa(ip));
-        }
-
-        uint32_t now = to_ms_since_boot(get_absolute_time());
-        if ((now - start_ip_time) >= CONNECT_TIMEOUT_MS) {
+            wifi_joined();
+        } else if ((now - start_ip_time) >= CONNECT_TIMEOUT_MS) {
             debug("net dhcp timeout. retry.");
 
             //cyw43_arch_lwip_begin();
@@ -388,16 +419,14 @@ void wifi_run(void) {
             //cyw43_arch_lwip_end();
 
             // DHCP renew does not seem to help, only a full reconnect
-            wifi_scan();
-        }
-    }
-
-    for (unsigned int c = 0; c < (sizeof(cache) / sizeof(cache[0])); c++) {
-        if (cache[c].in_use && cache[c].clear) {
-            tcp_close(cache[c].tpcb);
-            cache[c].in_use = false;
+            wifi_retry();
         }
     }
 
     cyw43_thread_exit();
+
+    if (hint_changed) {
+        hint_changed = false;
+        mem_write();
+    }
 }
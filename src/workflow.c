@@ -16,100 +16,802 @@
  * See <http://www.gnu.org/licenses/>.
  */
 
-#define WF_CONFIRM_WRITES
-
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "api.h"
 #include "config.h"
+#include "influx.h"
 #include "log.h"
 #include "mem.h"
-#include "volcano.h"
+#include "thermal.h"
+#include "vaporizer.h"
 #include "workflow.h"
 
-#if defined(INFLUXDB_HOST) && defined(INFLUXDB_PORT) && defined(INFLUXDB_DATABASE)
-#include "usb_descriptors.h"
-#include "wifi.h"
-#define VOLCANO_INFLUX_DB
-#endif
-
-#ifdef WF_CONFIRM_WRITES
-#define DO_WHILE(x, y) \
-    do {               \
-        x;             \
-    } while (y)
-#else // WF_CONFIRM_WRITES
-#define DO_WHILE(x, y) x
-#endif // WF_CONFIRM_WRITES
+
+#define WF_MAX_ACTIONS 4
+#define WF_MAX_TRACE 1024 // steps compared by wf_compact()
+#define WF_MIN_TEMP 400
+#define WF_MAX_TEMP 2300
+
+struct wf_frame {
+    const struct wf_step *steps;
+    uint16_t count;
+    uint16_t pc; // next step to fetch
+};
+
+struct wf_loop {
+    uint8_t frame;
+    uint16_t pc; // of the OP_LOOP step
+    uint16_t left;
+};
+
+// control flow state, steps of loops and calls are followed by ctx_next()
+struct wf_ctx {
+    struct wf_frame frames[1 + WF_MAX_CALLS];
+    uint8_t depth;
+    struct wf_loop loops[WF_MAX_LOOPS];
+    uint8_t loop_count;
+};
+
+// a write, which is read back before the workflow continues
+struct wf_action {
+    enum vaporizer_value what;
+    uint16_t val;
+};
+
+enum wf_phase {
+    PHASE_WRITE = 0, // first queued action has to be written
+    PHASE_READ, // written, read back has to be started
+    PHASE_VERIFY, // read back of first action in flight
+    PHASE_BACKOFF, // write or read back failed, wait before retrying
+    PHASE_STEP, // nothing queued, current step is running
+};
+
+struct wf_stats {
+    uint32_t writes;
+    uint32_t retries;
+    uint32_t failures;
+    uint32_t temp_reads;
+    uint32_t temp_errors;
+    uint32_t prerolls; // temperature steps cut short by the model
+    uint32_t max_run_us; // longest single wf_run() call
+    uint32_t stops;
+    uint32_t max_stop_ms; // wf_stop() until heater and pump confirmed off
+};
 
 static enum wf_status status = WF_IDLE;
 static uint16_t wf_i = 0;
-static uint16_t step = 0;
+static struct wf_ctx ctx;
+static const struct wf_step idle_step = { .op = OP_WAIT_TIME };
+static const struct wf_step *cur = &idle_step;
+static uint16_t setpoint = 0; // last confirmed target temperature
+static uint16_t ramp_from = 0;
 static uint32_t start_t = 0;
 static uint16_t start_val = 0;
 static uint16_t curr_val = 0;
+static bool error = false;
+static const struct vaporizer_ops *dev = NULL;
+
+static struct wf_action actions[WF_MAX_ACTIONS];
+static uint8_t action_count = 0;
+static uint8_t attempt = 0;
+static enum wf_phase phase = PHASE_STEP;
+static uint32_t phase_t = 0;
+static uint32_t backoff = 0;
+
+static bool step_started = false;
+static bool finishing = false;
+static bool stopping = false;
+static uint32_t stop_t = 0;
+static uint32_t temp_t = 0;
+static bool temp_fresh = false;
+static struct thermal_est est;
+
+// only one read or write can be in flight, see struct vaporizer_ops
+static bool reading = false;
+static bool writing = false;
+static enum vaporizer_value reading_what = VAP_CURRENT_TEMP;
+static bool discard = false;
+static const struct vaporizer_ops *io_dev = NULL; // driver that started it
+static bool discovering = false;
+
+static struct wf_stats stats = {0};
+
+// virtual time source for wf_sim.c, NULL for the system clock
+static uint32_t (*wf_clock)(void) = NULL;
+
+static uint32_t now_ms(void) {
+    if (wf_clock != NULL) {
+        return wf_clock();
+    }
+    return to_ms_since_boot(get_absolute_time());
+}
 
 #ifdef VOLCANO_INFLUX_DB
-static void influxdb_send(const char *name, double value) {
-    if (!wifi_ready()) {
-        debug("skip influx, no wifi (\"%s\" %.2lf)", name, value);
+static void influxdb_send(const char *name, float value) {
+    if (wf_clock != NULL) {
+        return; // simulated run
+    }
+    influx_point(name, value);
+}
+#endif // VOLCANO_INFLUX_DB
+
+// last known values for the web API
+static void api_send(enum vaporizer_value what, int16_t value) {
+    if (wf_clock != NULL) {
+        return; // simulated run
+    }
+    api_value(what, value);
+}
+
+static void ctx_init(struct wf_ctx *c, const struct workflow *wf) {
+    memset(c, 0, sizeof(struct wf_ctx));
+    c->frames[0].steps = wf->steps;
+    c->frames[0].count = wf->count;
+    c->depth = 1;
+}
+
+// index of the step running in the workflow itself, not in a snippet
+static uint16_t ctx_index(const struct wf_ctx *c) {
+    return (c->frames[0].pc > 0) ? (c->frames[0].pc - 1) : 0;
+}
+
+// next step that does something, or NULL at the end
+static const struct wf_step *ctx_next(struct wf_ctx *c) {
+    // validated workflows never jump around this often in a row
+    for (uint guard = 0; guard < (WF_MAX_STEPS * 4); guard++) {
+        if (c->depth == 0) {
+            return NULL;
+        }
+
+        struct wf_frame *f = &c->frames[c->depth - 1];
+        if (f->pc >= f->count) {
+            // return from snippet
+            c->depth--;
+            continue;
+        }
+
+        const struct wf_step *s = &f->steps[f->pc];
+        if (s->op == OP_LOOP) {
+            struct wf_loop *l = (c->loop_count > 0) ? &c->loops[c->loop_count - 1] : NULL;
+            if ((l != NULL) && (l->frame == (c->depth - 1)) && (l->pc == f->pc)) {
+                l->left--;
+                if (l->left == 0) {
+                    c->loop_count--;
+                    f->pc++;
+                } else {
+                    f->pc -= s->arg;
+                }
+            } else if ((s->val <= 1) || (c->loop_count >= WF_MAX_LOOPS)) {
+                f->pc++;
+            } else {
+                l = &c->loops[c->loop_count++];
+                l->frame = c->depth - 1;
+                l->pc = f->pc;
+                l->left = s->val - 1;
+                f->pc -= s->arg;
+            }
+        } else if (s->op == OP_CALL) {
+            f->pc++;
+            if ((c->depth <= WF_MAX_CALLS) && (s->val < wf_snippet_count)) {
+                f = &c->frames[c->depth++];
+                f->steps = wf_snippet_data[s->val].steps;
+                f->count = wf_snippet_data[s->val].count;
+                f->pc = 0;
+            }
+        } else {
+            f->pc++;
+            return s;
+        }
+    }
+
+    debug("no step found, invalid workflow?");
+    return NULL;
+}
+
+static const char *value_name(enum vaporizer_value what) {
+    switch (what) {
+    case VAP_CURRENT_TEMP:
+        return "current";
+
+    case VAP_TARGET_TEMP:
+        return "target";
+
+    case VAP_HEATER:
+        return "heater";
+
+    case VAP_PUMP:
+        return "pump";
+    }
+
+    return "unknown";
+}
+
+static void push(enum vaporizer_value what, uint16_t val) {
+    if (action_count >= WF_MAX_ACTIONS) {
+        debug("action queue full, dropping %s", value_name(what));
         return;
     }
 
-    char payload[128] = {0};
-    size_t len = 0;
-    len = snprintf(payload, sizeof(payload) - 1,
-                   "volcano,device=%s %s=%lf",
-                   string_pico_serial, name, value);
+    actions[action_count].what = what;
+    actions[action_count].val = val;
+    action_count++;
 
+    if (action_count == 1) {
+        phase = PHASE_WRITE;
+        attempt = 0;
+        backoff = WF_WRITE_BACKOFF_MS;
+    }
+}
 
-    char packet[256] = {0};
-    size_t n = 0;
-    n = snprintf(packet, sizeof(packet) - 1,
-                  "POST /write?db=%s HTTP/1.0\r\n"
-                  "Host: %s\r\n"
-                  "Content-Length: %d\r\n"
-                  "\r\n"
-                  "%s",
-                  INFLUXDB_DATABASE, INFLUXDB_HOST,
-                 len, payload);
+static void pop(void) {
+    for (uint i = 1; i < action_count; i++) {
+        actions[i - 1] = actions[i];
+    }
+    action_count--;
 
-    debug("write influx \"%s\": %.2lf", name, value);
-    wifi_tcp_send(INFLUXDB_HOST, INFLUXDB_PORT, packet, n);
+    phase = (action_count > 0) ? PHASE_WRITE : PHASE_STEP;
+    attempt = 0;
+    backoff = WF_WRITE_BACKOFF_MS;
 }
-#endif // VOLCANO_INFLUX_DB
 
-static void do_step(void) {
-    switch (mem_data()->wf[wf_i].steps[step].op) {
-    case OP_SET_TEMPERATURE:
-    case OP_WAIT_TEMPERATURE:
-        debug("workflow temp %.1f C", mem_data()->wf[wf_i].steps[step].val / 10.0);
-        start_val = volcano_get_current_temp();
-        DO_WHILE(volcano_set_target_temp(mem_data()->wf[wf_i].steps[step].val),
-                 volcano_get_target_temp() != mem_data()->wf[wf_i].steps[step].val);
+// queue pump and heater off, replacing everything not yet written
+static void stop(bool failed) {
+    stopping = true;
+    if (failed) {
+        error = true;
+    }
+
+    // response to a write or read back is of no interest anymore
+    if ((reading && (phase == PHASE_VERIFY)) || writing) {
+        discard = true;
+    }
+
+    // heater first, pump only after it is confirmed off
+    action_count = 0;
+    push(VAP_HEATER, false);
+    if (dev->set_pump != NULL) {
+        push(VAP_PUMP, false);
+    }
+}
+
+static void wf_abort(void) {
+    debug("workflow failed in step %d", ctx_index(&ctx));
+    stop(true);
+}
+
+static bool can_verify(enum vaporizer_value what) {
+    if (what == VAP_TARGET_TEMP) {
+        return true;
+    }
+    return (dev->caps & VAP_CAP_STATE) ? true : false;
+}
+
+static void action_done(void) {
+    if (actions[0].what == VAP_TARGET_TEMP) {
+        setpoint = actions[0].val;
+    }
+
 #ifdef VOLCANO_INFLUX_DB
-        influxdb_send("target", mem_data()->wf[wf_i].steps[step].val);
+    influxdb_send(value_name(actions[0].what), actions[0].val);
 #endif // VOLCANO_INFLUX_DB
+
+    api_send(actions[0].what, actions[0].val);
+    pop();
+}
+
+static void action_failed(uint32_t now) {
+    if ((attempt + 1) < WF_WRITE_ATTEMPTS) {
+        attempt++;
+        stats.retries++;
+        debug("retry %s (%d)", value_name(actions[0].what), attempt);
+        phase = PHASE_BACKOFF;
+        phase_t = now;
+        return;
+    }
+
+    debug("giving up on %s", value_name(actions[0].what));
+    stats.failures++;
+
+    if (stopping) {
+        // best effort, still try the remaining ones
+        error = true;
+        pop();
+    } else {
+        wf_abort();
+    }
+}
+
+static void write_done(int8_t r, uint32_t now) {
+    if (discard) {
+        discard = false;
+        return;
+    }
+
+    if (can_verify(actions[0].what)) {
+        phase = PHASE_READ;
+    } else if (r < 0) {
+        action_failed(now);
+    } else {
+        action_done();
+    }
+}
+
+/*
+ * The Volcano does not notify us about these values,
+ * so every write is followed by exactly one verify read.
+ * A failed write is verified as well, the response may
+ * just have been lost while the value got set anyway.
+ */
+static void run_actions(uint32_t now) {
+    struct wf_action *a = &actions[0];
+
+    switch (phase) {
+    case PHASE_BACKOFF:
+        if ((now - phase_t) < backoff) {
+            break;
+        }
+        backoff *= 2;
+        // fall-through
+
+    case PHASE_WRITE: {
+        if (attempt == 0) {
+            stats.writes++;
+        }
+
+        if ((a->what == VAP_PUMP) && (dev->set_pump == NULL)) {
+            write_done(0, now);
+        } else if (dev->write_start(a->what, a->val) < 0) {
+            write_done(-1, now);
+        } else {
+            writing = true;
+            io_dev = dev;
+        }
         break;
+    }
+
+    case PHASE_READ:
+        if (dev->read_start(a->what) < 0) {
+            action_failed(now);
+        } else {
+            reading = true;
+            reading_what = a->what;
+            io_dev = dev;
+            phase = PHASE_VERIFY;
+        }
+        break;
+
+    case PHASE_VERIFY:
+    case PHASE_STEP:
+        break;
+    }
+}
+
+static void read_done(int8_t r, int16_t v, uint32_t now) {
+    if (discard) {
+        discard = false;
+        return;
+    }
+
+    if (phase == PHASE_VERIFY) {
+        if ((r > 0) && (v == (int16_t)actions[0].val)) {
+            action_done();
+        } else {
+            action_failed(now);
+        }
+        return;
+    }
+
+    // periodic temperature reading
+    if (r < 0) {
+        stats.temp_errors++;
+        return;
+    }
 
-    case OP_PUMP_TIME:
-        DO_WHILE(volcano_set_pump_state(true),
-                 !(volcano_get_state() & VOLCANO_STATE_PUMP));
-        start_t = to_ms_since_boot(get_absolute_time());
-        start_val = 0;
-        debug("workflow pump %.3f s", mem_data()->wf[wf_i].steps[step].val / 1000.0);
 #ifdef VOLCANO_INFLUX_DB
-        influxdb_send("pump", 1);
+    if (curr_val != v) {
+        influxdb_send("current", v);
+    }
 #endif // VOLCANO_INFLUX_DB
+
+    api_send(VAP_CURRENT_TEMP, v);
+
+    // volcano does not provide a temperature when cold
+    if (start_val == 0) {
+        start_val = v;
+    }
+
+    curr_val = v;
+    temp_fresh = true;
+    thermal_sample(&est, now, v);
+}
+
+static void start_step(void) {
+    const struct wf_step *s = cur;
+    step_started = false;
+    temp_fresh = false;
+    start_val = 0;
+    curr_val = 0;
+
+    switch (s->op) {
+    case OP_SET_TEMPERATURE:
+    case OP_WAIT_TEMPERATURE:
+        debug("workflow temp %.1f C", s->val / 10.0);
+        thermal_init(&est);
+        push(VAP_TARGET_TEMP, s->val);
+        break;
+
+    case OP_RAMP_TEMPERATURE:
+        // without a previous setpoint there is nothing to ramp from
+        ramp_from = (setpoint != 0) ? setpoint : s->val;
+        start_val = ramp_from;
+        debug("workflow ramp %.1f to %.1f C in %d s", ramp_from / 10.0, s->val / 10.0, s->arg);
+        break;
+
+    case OP_WAIT_TEMP_TIMEOUT:
+        debug("workflow wait %.1f C, at most %d s", s->val / 10.0, s->arg);
+        thermal_init(&est);
+        break;
+
+    case OP_PUMP_TIME:
+        if (dev->set_pump == NULL) {
+#ifdef WF_PUMP_AS_WAIT
+            // user inhales manually for the same time
+            debug("workflow no pump, wait %.3f s", s->val / 1000.0);
+#else // WF_PUMP_AS_WAIT
+            debug("workflow no pump, skip step");
+#endif // WF_PUMP_AS_WAIT
+            break;
+        }
+
+        debug("workflow pump %.3f s", s->val / 1000.0);
+        push(VAP_PUMP, true);
         break;
 
     case OP_WAIT_TIME:
-        start_t = to_ms_since_boot(get_absolute_time());
-        start_val = 0;
-        debug("workflow time %.3f s", mem_data()->wf[wf_i].steps[step].val / 1000.0);
+        debug("workflow time %.3f s", s->val / 1000.0);
+        break;
+
+    case OP_LOOP:
+    case OP_CALL:
+    case OP_COUNT:
+        // never returned by ctx_next()
+        break;
+    }
+}
+
+// returns true when the step is done
+static bool run_step(uint32_t now) {
+    const struct wf_step *s = cur;
+
+    if (!step_started) {
+        // timers start when all writes of this step got confirmed
+        step_started = true;
+        start_t = now;
+        temp_t = now - WF_TEMP_POLL_MS;
+    }
+
+    switch (s->op) {
+    case OP_SET_TEMPERATURE:
+        return true;
+
+    case OP_RAMP_TEMPERATURE: {
+        uint32_t total = s->arg * 1000;
+        uint32_t diff = now - start_t;
+        uint16_t sp = s->val;
+        if (diff < total) {
+            sp = ramp_from + ((int32_t)s->val - ramp_from) * (int32_t)diff / (int32_t)total;
+        }
+        curr_val = sp;
+
+        if ((diff >= total) && (setpoint == s->val)) {
+            return true;
+        }
+
+        // setpoint changes are limited by interval and device resolution
+        if ((sp != setpoint) && ((diff >= total)
+                || (((now - temp_t) >= WF_RAMP_INTERVAL_MS)
+                    && (abs(sp - setpoint) >= dev->temp_resolution)))) {
+            temp_t = now;
+            push(VAP_TARGET_TEMP, sp);
+        }
+        return false;
+    }
+
+    case OP_WAIT_TEMP_TIMEOUT:
+        if ((now - start_t) >= (s->arg * 1000UL)) {
+            debug("workflow timeout waiting for %.1f C", s->val / 10.0);
+            return true;
+        }
+        // fall-through
+
+    case OP_WAIT_TEMPERATURE:
+        if (temp_fresh) {
+            temp_fresh = false;
+            uint8_t tolerance = MAX(5, dev->temp_resolution);
+            if (curr_val >= (s->val - tolerance)) {
+                return true;
+            }
+
+#ifdef WF_PREROLL_MS
+            /*
+             * When a wait follows, its countdown can start before the
+             * temperature is there, as long as it will be reached in time.
+             */
+            struct wf_ctx peek = ctx;
+            const struct wf_step *next = ctx_next(&peek);
+            if (next != NULL) {
+                int32_t eta = thermal_eta(&est, s->val - tolerance);
+                if ((next->op == OP_WAIT_TIME) && (eta >= 0)
+                    && (eta <= MIN(WF_PREROLL_MS, next->val))) {
+                    debug("workflow pre-roll, %.1fs to target", eta / 1000.0f);
+                    stats.prerolls++;
+                    return true;
+                }
+            }
+#endif // WF_PREROLL_MS
+        }
+
+        if ((now - temp_t) >= WF_TEMP_POLL_MS) {
+            temp_t = now;
+            if (dev->read_start(VAP_CURRENT_TEMP) < 0) {
+                stats.temp_errors++;
+            } else {
+                stats.temp_reads++;
+                reading = true;
+                reading_what = VAP_CURRENT_TEMP;
+                io_dev = dev;
+            }
+        }
+        return false;
+
+    case OP_PUMP_TIME:
+#ifndef WF_PUMP_AS_WAIT
+        if (dev->set_pump == NULL) {
+            return true;
+        }
+#endif // WF_PUMP_AS_WAIT
+        // fall-through
+
+    case OP_WAIT_TIME: {
+        uint32_t diff = now - start_t;
+        curr_val = diff;
+        return (diff >= s->val);
+    }
+
+    case OP_LOOP:
+    case OP_CALL:
+    case OP_COUNT:
         break;
     }
 
-    curr_val = start_val;
+    return true;
+}
+
+static void next_step(void) {
+    if ((cur->op == OP_PUMP_TIME) && (dev->set_pump != NULL)) {
+        push(VAP_PUMP, false);
+    }
+
+    const struct wf_step *next = ctx_next(&ctx);
+    if (next == NULL) {
+        finishing = true;
+        push(VAP_HEATER, false);
+    } else {
+        cur = next;
+        start_step();
+    }
+}
+
+static bool same_trace(const struct workflow *a, const struct workflow *b) {
+    struct wf_ctx ca, cb;
+    ctx_init(&ca, a);
+    ctx_init(&cb, b);
+
+    for (uint i = 0; i < WF_MAX_TRACE; i++) {
+        const struct wf_step *sa = ctx_next(&ca);
+        const struct wf_step *sb = ctx_next(&cb);
+        if ((sa == NULL) || (sb == NULL)) {
+            return (sa == sb);
+        }
+
+        if ((sa->op != sb->op) || (sa->val != sb->val) || (sa->arg != sb->arg)) {
+            return false;
+        }
+    }
+
+    debug("trace too long to compare");
+    return false;
+}
+
+static bool plain_steps(const struct wf_step *steps, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        if ((steps[i].op == OP_LOOP) || (steps[i].op == OP_CALL)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// returns true if a repetition starting at i was folded
+static bool fold(struct workflow *wf, uint16_t i, uint16_t len) {
+    if (!plain_steps(&wf->steps[i], len)) {
+        return false;
+    }
+
+    uint16_t reps = 1;
+    while (((i + (reps + 1) * len) <= wf->count)
+           && (memcmp(&wf->steps[i], &wf->steps[i + reps * len],
+                      len * sizeof(struct wf_step)) == 0)) {
+        reps++;
+    }
+
+    // loop step only pays off for more than one spare copy
+    if ((reps < 2) || ((reps * len) <= (len + 1))) {
+        return false;
+    }
+
+    uint16_t end = i + reps * len;
+    wf->steps[i + len].op = OP_LOOP;
+    wf->steps[i + len].val = reps;
+    wf->steps[i + len].arg = len;
+    memmove(&wf->steps[i + len + 1], &wf->steps[end],
+            (wf->count - end) * sizeof(struct wf_step));
+    wf->count -= end - (i + len + 1);
+    return true;
+}
+
+void wf_compact(struct workflow *wf) {
+    struct workflow orig = *wf;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint16_t len = 1; ((len * 2) <= wf->count) && !changed; len++) {
+            for (uint16_t i = 0; ((i + len * 2) <= wf->count) && !changed; i++) {
+                changed = fold(wf, i, len);
+            }
+        }
+    }
+
+    if (wf->count == orig.count) {
+        return;
+    }
+
+    if ((wf_validate(wf, false) < 0) || !same_trace(&orig, wf)) {
+        debug("can not compact '%s'", orig.name);
+        *wf = orig;
+        return;
+    }
+
+    debug("compacted '%s' from %d to %d steps", wf->name, orig.count, wf->count);
+}
+
+static bool is_action(const struct wf_step *s) {
+    return (s->op != OP_LOOP) && (s->op != OP_CALL);
+}
+
+// true if running these steps talks to the device at least once
+static bool has_action(const struct wf_step *steps, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        if (is_action(&steps[i])) {
+            return true;
+        }
+        if ((steps[i].op == OP_CALL) && (steps[i].val < wf_snippet_count)) {
+            const struct workflow *sn = &wf_snippet_data[steps[i].val];
+            if (has_action(sn->steps, sn->count)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// loops around step i, that is with a body containing it
+static uint16_t loops_around(const struct workflow *wf, uint16_t i) {
+    uint16_t depth = 0;
+    for (uint16_t j = i + 1; j < wf->count; j++) {
+        if ((wf->steps[j].op == OP_LOOP) && ((j - wf->steps[j].arg) <= i)) {
+            depth++;
+        }
+    }
+    return depth;
+}
+
+// deepest nesting of loops in a workflow
+static uint16_t loop_depth(const struct workflow *wf) {
+    uint16_t depth = 0;
+    for (uint16_t i = 0; i < wf->count; i++) {
+        if (wf->steps[i].op == OP_LOOP) {
+            depth = MAX(depth, loops_around(wf, i) + 1);
+        }
+    }
+    return depth;
+}
+
+int8_t wf_validate(const struct workflow *wf, bool snippet) {
+    if (wf->count > WF_MAX_STEPS) {
+        debug("'%s' has too many steps (%d)", wf->name, wf->count);
+        return -1;
+    }
+
+    for (uint16_t i = 0; i < wf->count; i++) {
+        const struct wf_step *s = &wf->steps[i];
+        switch (s->op) {
+        case OP_RAMP_TEMPERATURE:
+        case OP_WAIT_TEMP_TIMEOUT:
+            if (s->arg == 0) {
+                debug("'%s' step %d needs a duration", wf->name, i);
+                return -2;
+            }
+            // fall-through
+
+        case OP_SET_TEMPERATURE:
+        case OP_WAIT_TEMPERATURE:
+            if ((s->val < WF_MIN_TEMP) || (s->val > WF_MAX_TEMP)) {
+                debug("'%s' step %d invalid temperature %d", wf->name, i, s->val);
+                return -3;
+            }
+            break;
+
+        case OP_WAIT_TIME:
+        case OP_PUMP_TIME:
+            break;
+
+        case OP_LOOP: {
+            if ((s->val == 0) || (s->arg == 0) || (s->arg > i)) {
+                debug("'%s' step %d invalid loop", wf->name, i);
+                return -4;
+            }
+
+            // loops inside the body have to end inside it as well
+            for (uint16_t j = i - s->arg; j < i; j++) {
+                if ((wf->steps[j].op == OP_LOOP)
+                    && ((j - wf->steps[j].arg) < (i - s->arg))) {
+                    debug("'%s' step %d overlaps loop in step %d", wf->name, i, j);
+                    return -5;
+                }
+            }
+
+            // ctx_next() would skip what does not fit on the loop stack
+            if ((loops_around(wf, i) + 1) > WF_MAX_LOOPS) {
+                debug("'%s' step %d nested too deep", wf->name, i);
+                return -6;
+            }
+
+            // or give up on a body that never returns a step
+            if (!has_action(&wf->steps[i - s->arg], s->arg)) {
+                debug("'%s' step %d loop without action", wf->name, i);
+                return -10;
+            }
+            break;
+        }
+
+        case OP_CALL:
+            if (snippet || (s->val >= wf_snippet_count)) {
+                debug("'%s' step %d invalid call", wf->name, i);
+                return -7;
+            }
+            if (wf_validate(&wf_snippet_data[s->val], true) < 0) {
+                return -8;
+            }
+
+            // loops of the snippet go on top of the ones around the call
+            if ((loops_around(wf, i) + loop_depth(&wf_snippet_data[s->val])) > WF_MAX_LOOPS) {
+                debug("'%s' step %d call nested too deep", wf->name, i);
+                return -6;
+            }
+            break;
+
+        default:
+            debug("'%s' step %d unknown op %d", wf->name, i, s->op);
+            return -9;
+        }
+    }
+
+    return 0;
 }
 
 uint16_t wf_count(void) {
@@ -184,7 +886,7 @@ struct wf_step *wf_get_step(uint16_t index, uint16_t step_i) {
     return &mem_data()->wf[index].steps[step_i];
 }
 
-const char *wf_step_str(struct wf_step *step_p) {
+const char *wf_step_str(const struct wf_step *step_p) {
     static char buff[20];
 
     switch (step_p->op) {
@@ -205,6 +907,31 @@ const char *wf_step_str(struct wf_step *step_p) {
                  (step_p->op == OP_WAIT_TIME) ? "wait" : "pump",
                  step_p->val / 1000.0f);
         break;
+
+    case OP_RAMP_TEMPERATURE:
+        snprintf(buff, sizeof(buff),
+                 "ramp %.1f C %ds", step_p->val / 10.0f, step_p->arg);
+        break;
+
+    case OP_WAIT_TEMP_TIMEOUT:
+        snprintf(buff, sizeof(buff),
+                 "wait %.1f C <%ds", step_p->val / 10.0f, step_p->arg);
+        break;
+
+    case OP_LOOP:
+        snprintf(buff, sizeof(buff),
+                 "loop %dx last %d", step_p->val, step_p->arg);
+        break;
+
+    case OP_CALL:
+        snprintf(buff, sizeof(buff),
+                 "call %s", (step_p->val < wf_snippet_count)
+                 ? wf_snippet_data[step_p->val].name : "?");
+        break;
+
+    default:
+        snprintf(buff, sizeof(buff), "invalid");
+        break;
     }
 
     return buff;
@@ -229,16 +956,36 @@ const char *wf_author(uint16_t index) {
 struct wf_state wf_status(void) {
     struct wf_state s = {
         .status = status,
-        .index = step,
+        .flow = wf_i,
+        .index = ctx_index(&ctx),
         .count = mem_data()->wf[wf_i].count,
-        .step = &mem_data()->wf[wf_i].steps[step],
+        .step = cur,
         .start_val = start_val,
         .curr_val = curr_val,
+        .error = error,
+        .stopping = stopping,
+        .io_pending = reading || writing,
+        .eta = -1,
     };
+
+    if ((status != WF_IDLE) && ((s.step->op == OP_WAIT_TEMPERATURE)
+                                || (s.step->op == OP_WAIT_TEMP_TIMEOUT))) {
+        s.eta = thermal_eta(&est, s.step->val);
+    }
     return s;
 }
 
-void wf_start(uint16_t index) {
+void wf_start(uint16_t index, enum known_devices device) {
+    const struct vaporizer_ops *ops = vaporizer_get(device);
+    if (ops == NULL) {
+        debug("no driver for device %d", device);
+        error = true;
+        return;
+    }
+    wf_start_ops(index, ops);
+}
+
+void wf_start_ops(uint16_t index, const struct vaporizer_ops *ops) {
     if (status != WF_IDLE) {
         debug("workflow already running");
         return;
@@ -248,94 +995,133 @@ void wf_start(uint16_t index) {
         return;
     }
 
+    if (wf_validate(&mem_data()->wf[index], false) < 0) {
+        error = true;
+        return;
+    }
+
+    debug("workflow on %s", ops->name);
+    dev = ops;
     status = WF_RUNNING;
     wf_i = index;
-    step = 0;
+    ctx_init(&ctx, &mem_data()->wf[wf_i]);
+    cur = &idle_step;
+    setpoint = 0;
+    error = false;
+    stopping = false;
+    finishing = false;
+    action_count = 0;
 
-    /*
-     * first turn on heater, then do discovery, to save some time.
-     * this means we heat for some seconds before changing the setpoint.
-     * should not be a problem in practice.
-     */
-    DO_WHILE(volcano_set_heater_state(true),
-             !(volcano_get_state() & VOLCANO_STATE_HEATER));
-    volcano_discover_characteristics(true, false);
+    // blocking, so only once a request left over by wf_reset() is done
+    discovering = (dev->discover != NULL);
 
-#ifdef VOLCANO_INFLUX_DB
-    influxdb_send("heater", 1);
-#endif // VOLCANO_INFLUX_DB
+    push(VAP_HEATER, true);
 
-    do_step();
-}
-
-void wf_reset(void) {
-    status = WF_IDLE;
+    const struct wf_step *first = ctx_next(&ctx);
+    if (first == NULL) {
+        finishing = true;
+        push(VAP_HEATER, false);
+    } else {
+        cur = first;
+        start_step();
+    }
 }
 
-void wf_run(void) {
-    if (status == WF_IDLE) {
+void wf_stop(void) {
+    if ((status == WF_IDLE) || stopping) {
         return;
     }
 
-    bool done = false;
+    debug("workflow stop in step %d", ctx_index(&ctx));
+    stats.stops++;
+    stop_t = now_ms();
+    stop(false);
+}
 
-    switch (mem_data()->wf[wf_i].steps[step].op) {
-    case OP_SET_TEMPERATURE:
-        done = true;
-        break;
+void wf_reset(void) {
+    // a request still in flight is drained by wf_run()
+    if (reading || writing) {
+        discard = true;
+    }
 
-    case OP_WAIT_TEMPERATURE: {
-        uint16_t temp = volcano_get_current_temp();
+    status = WF_IDLE;
+}
 
-#ifdef VOLCANO_INFLUX_DB
-        static uint16_t last_temp = 0;
-        if (last_temp != temp) {
-            influxdb_send("current", temp);
-            last_temp = temp;
+// returns false when nothing is in flight
+static bool poll_io(uint32_t now) {
+    if (reading) {
+        int16_t v = 0;
+        int8_t r = io_dev->read_poll(reading_what, &v);
+        if (r != 0) {
+            reading = false;
+            read_done(r, v, now);
         }
-#endif // VOLCANO_INFLUX_DB
+        return true;
+    }
 
-        // volcano does not provide a temperature when cold
-        if (start_val == 0) {
-            start_val = temp;
+    if (writing) {
+        int8_t r = io_dev->write_poll();
+        if (r != 0) {
+            writing = false;
+            write_done(r, now);
         }
-
-        curr_val = temp;
-        done = (temp >= (mem_data()->wf[wf_i].steps[step].val - 5));
-        break;
+        return true;
     }
 
-    case OP_PUMP_TIME:
-    case OP_WAIT_TIME: {
-        uint32_t now = to_ms_since_boot(get_absolute_time());
-        uint32_t diff = now - start_t;
-        curr_val = diff;
-        done = (diff >= mem_data()->wf[wf_i].steps[step].val);
-        break;
-    }
+    return false;
+}
+
+void wf_run(void) {
+    if ((status == WF_IDLE) && !reading && !writing) {
+        return;
     }
 
-    if (done) {
-        if (mem_data()->wf[wf_i].steps[step].op == OP_PUMP_TIME) {
-            DO_WHILE(volcano_set_pump_state(false),
-                     volcano_get_state() & VOLCANO_STATE_PUMP);
-#ifdef VOLCANO_INFLUX_DB
-            influxdb_send("pump", 0);
-#endif // VOLCANO_INFLUX_DB
-        }
+    uint32_t start_us = to_us_since_boot(get_absolute_time());
+    uint32_t now = now_ms();
+
+    if (status == WF_IDLE) {
+        poll_io(now);
+        return;
+    }
 
-        step++;
-        if (step >= mem_data()->wf[wf_i].count) {
-            status = WF_IDLE;
-            DO_WHILE(volcano_set_heater_state(false),
-                     volcano_get_state() & VOLCANO_STATE_HEATER);
-            debug("workflow finished");
+    if (dev->poll != NULL) {
+        dev->poll();
+    }
 
-#ifdef VOLCANO_INFLUX_DB
-            influxdb_send("heater", 0);
-#endif // VOLCANO_INFLUX_DB
+    if (poll_io(now)) {
+        // one request at a time
+    } else if (discovering) {
+        discovering = false;
+        dev->discover();
+    } else if (action_count > 0) {
+        run_actions(now);
+    } else if (stopping || finishing) {
+        status = WF_IDLE;
+        if (stopping && (stop_t != 0)) {
+            uint32_t t = now - stop_t;
+            stats.max_stop_ms = MAX(stats.max_stop_ms, t);
+            debug("workflow stopped after %lums", t);
+            stop_t = 0;
         } else {
-            do_step();
+            debug("workflow %s", error ? "failed" : "finished");
         }
+    } else if (run_step(now)) {
+        next_step();
     }
+
+    uint32_t t = to_us_since_boot(get_absolute_time()) - start_us;
+    stats.max_run_us = MAX(stats.max_run_us, t);
+}
+
+void wf_set_clock(uint32_t (*clock)(void)) {
+    wf_clock = clock;
+}
+
+void wf_stats(void) {
+    println("Workflow writes: %lu, retries: %lu, failed: %lu",
+            stats.writes, stats.retries, stats.failures);
+    println("Temperature reads: %lu, errors: %lu, pre-rolls: %lu",
+            stats.temp_reads, stats.temp_errors, stats.prerolls);
+    println("Longest wf_run(): %.1fms", stats.max_run_us / 1000.0f);
+    println("Stops: %lu, slowest: %lums", stats.stops, stats.max_stop_ms);
 }
@@ -19,12 +19,28 @@
 #include "config.h"
 #include "workflow.h"
 
-#define NOTIFY \
-    { .op = OP_WAIT_TIME, .val = 1000 }, \
-    { .op = OP_PUMP_TIME, .val = 1000 }
+enum wf_snippets {
+    SNIPPET_NOTIFY = 0,
+};
+
+// two short pump pulses, to signal the end of a session
+#define NOTIFICATIONS { .op = OP_CALL, .val = SNIPPET_NOTIFY }
+#define NOTIFICATIONS_LENGTH 1
 
-#define NOTIFICATIONS NOTIFY, NOTIFY
-#define NOTIFICATIONS_LENGTH (2 * 2)
+const uint16_t wf_snippet_count = 1;
+
+const struct workflow wf_snippet_data[] = {
+    [SNIPPET_NOTIFY] = {
+        .name = "Notify",
+        .author = "xythobuz",
+        .steps = {
+            { .op = OP_WAIT_TIME, .val = 1000 },
+            { .op = OP_PUMP_TIME, .val = 1000 },
+            { .op = OP_LOOP, .val = 2, .arg = 2 },
+        },
+        .count = 3,
+    },
+};
 
 const uint16_t wf_default_count = 5;
 
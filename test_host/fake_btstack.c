@@ -0,0 +1,771 @@
+/*
+ * fake_btstack.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "ble_chars.h"
+#include "ble_sim.h"
+#include "fake_btstack.h"
+
+#define FAKE_QUEUE_LEN 64
+#define FAKE_HANDLE_BASE 0x0040
+#define FAKE_VALUE_HANDLE_BASE 0x0201 // two handles per characteristic
+#define FAKE_MTU 247
+#define FAKE_DISCONNECT_MS 10
+#define FAKE_CANCEL_MS 2
+#define FAKE_SUPERVISION_MS 100
+#define FAKE_WHITELIST_LEN 8
+
+enum fake_action {
+    ACT_NONE = 0,
+    ACT_DISCONNECTED, // link is gone
+    ACT_GATT_DONE, // request finished, next one can be sent
+    ACT_GATT_LOST, // same, but without delivering the event
+    ACT_CANCELLED, // controller can connect again
+};
+
+struct fake_queued {
+    uint64_t due; // us
+    int periph;
+    enum fake_action action;
+    struct fake_event e;
+};
+
+struct fake_periph {
+    bool used;
+    bool present;
+    struct fake_peripheral p;
+    uint64_t next_adv; // us
+
+    bool connected;
+    hci_con_handle_t handle;
+    bool gatt_busy;
+    uint32_t notify; // bit per ble_char_id
+    struct fake_conn_params params;
+
+    enum fake_write_mode write_mode;
+    uint32_t write_delay; // ms
+};
+
+static btstack_packet_handler_t handler = NULL;
+static bool powered = false;
+static bool scanning = false;
+
+static struct fake_periph periph[FAKE_BT_MAX_PERIPHERALS];
+static hci_con_handle_t next_handle = FAKE_HANDLE_BASE;
+
+static bool pending_direct = false;
+static bool pending_whitelist = false;
+static bool pending_cancel = false;
+static bd_addr_t pending_addr;
+static bd_addr_t whitelist[FAKE_WHITELIST_LEN];
+static uint whitelist_len = 0;
+
+static struct fake_queued queue[FAKE_QUEUE_LEN];
+static uint queue_len = 0;
+
+static struct fake_bt_stats stats;
+static struct fake_gatt_access last_access;
+static struct fake_conn_params initial;
+
+static uint64_t now_us(void) {
+    return get_absolute_time();
+}
+
+static void deliver(struct fake_event *e) {
+    if (handler == NULL) {
+        return;
+    }
+
+    // BTstack runs in the async context, with its lock held
+    cyw43_thread_enter();
+    handler(HCI_EVENT_PACKET, 0, (uint8_t *)e, sizeof(struct fake_event));
+    cyw43_thread_exit();
+}
+
+static void enqueue(uint32_t delay_ms, int p, enum fake_action action, const struct fake_event *e) {
+    if (queue_len >= FAKE_QUEUE_LEN) {
+        printf("fake_btstack: event queue full\n");
+        return;
+    }
+
+    // stays sorted by due time, events with the same time keep their order
+    uint64_t due = now_us() + (delay_ms * 1000ULL);
+    uint i = queue_len;
+    while ((i > 0) && (queue[i - 1].due > due)) {
+        queue[i] = queue[i - 1];
+        i--;
+    }
+    queue[i].due = due;
+    queue[i].periph = p;
+    queue[i].action = action;
+    queue[i].e = *e;
+    queue_len++;
+}
+
+static int periph_by_handle(hci_con_handle_t handle) {
+    for (int i = 0; i < FAKE_BT_MAX_PERIPHERALS; i++) {
+        if (periph[i].used && periph[i].connected && (periph[i].handle == handle)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool whitelisted(const bd_addr_t addr) {
+    for (uint i = 0; i < whitelist_len; i++) {
+        if (memcmp(whitelist[i], addr, sizeof(bd_addr_t)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void connection_complete(const bd_addr_t addr, bd_addr_type_t type,
+                                uint8_t status, hci_con_handle_t handle,
+                                uint32_t delay_ms, enum fake_action action) {
+    struct fake_event e = {0};
+    e.type = HCI_EVENT_LE_META;
+    e.subevent = HCI_SUBEVENT_LE_CONNECTION_COMPLETE;
+    e.status = status;
+    e.handle = handle;
+    e.interval = initial.interval_max;
+    memcpy(e.addr, addr, sizeof(bd_addr_t));
+    e.addr_type = type;
+    enqueue(delay_ms, -1, action, &e);
+}
+
+static void connect(int i) {
+    struct fake_periph *f = &periph[i];
+    f->connected = true;
+    f->handle = next_handle++;
+    f->gatt_busy = false;
+    f->notify = 0;
+    f->params = initial;
+    f->params.updates = 0;
+    pending_direct = false;
+    pending_whitelist = false;
+    connection_complete(f->p.addr, f->p.type, ERROR_CODE_SUCCESS, f->handle, 0, ACT_NONE);
+}
+
+static void advertise(int i) {
+    struct fake_periph *f = &periph[i];
+
+    // the controller connects on the first advertisement it sees
+    if (pending_direct && (memcmp(pending_addr, f->p.addr, sizeof(bd_addr_t)) == 0)) {
+        connect(i);
+        return;
+    }
+    if (pending_whitelist && whitelisted(f->p.addr)) {
+        connect(i);
+        return;
+    }
+
+    if (scanning) {
+        fake_bt_report(f->p.addr, f->p.type, f->p.rssi, f->p.name, f->p.data, f->p.data_len);
+    }
+}
+
+void fake_bt_run(void) {
+    uint64_t now = now_us();
+
+    for (int i = 0; i < FAKE_BT_MAX_PERIPHERALS; i++) {
+        struct fake_periph *f = &periph[i];
+        if (!powered || !f->used || !f->present || !f->p.advertising || f->connected) {
+            continue;
+        }
+        if (now >= f->next_adv) {
+            f->next_adv = now + (f->p.adv_interval_ms * 1000ULL);
+            advertise(i);
+        }
+    }
+
+    while ((queue_len > 0) && (queue[0].due <= now)) {
+        struct fake_queued q = queue[0];
+        queue_len--;
+        memmove(queue, queue + 1, queue_len * sizeof(struct fake_queued));
+
+        if (q.periph >= 0) {
+            struct fake_periph *f = &periph[q.periph];
+            if (q.action == ACT_DISCONNECTED) {
+                f->connected = false;
+                f->gatt_busy = false;
+                f->next_adv = now + (f->p.adv_interval_ms * 1000ULL);
+            } else if ((q.action == ACT_GATT_DONE) || (q.action == ACT_GATT_LOST)) {
+                f->gatt_busy = false;
+            }
+        }
+        if (q.action == ACT_CANCELLED) {
+            pending_cancel = false;
+        }
+
+        if (q.action != ACT_GATT_LOST) {
+            deliver(&q.e);
+        }
+    }
+}
+
+void fake_bt_reset(void) {
+    handler = NULL;
+    powered = false;
+    scanning = false;
+    memset(periph, 0, sizeof(periph));
+    pending_direct = false;
+    pending_whitelist = false;
+    pending_cancel = false;
+    whitelist_len = 0;
+    queue_len = 0;
+    memset(&stats, 0, sizeof(stats));
+    memset(&last_access, 0, sizeof(last_access));
+    memset(&initial, 0, sizeof(initial));
+    ble_sim_init();
+}
+
+int fake_bt_add(const struct fake_peripheral *p) {
+    for (int i = 0; i < FAKE_BT_MAX_PERIPHERALS; i++) {
+        if (!periph[i].used) {
+            memset(&periph[i], 0, sizeof(struct fake_periph));
+            periph[i].used = true;
+            periph[i].present = true;
+            periph[i].p = *p;
+            if (periph[i].p.adv_interval_ms == 0) {
+                periph[i].p.adv_interval_ms = 100;
+            }
+            periph[i].next_adv = now_us() + (periph[i].p.adv_interval_ms * 1000ULL);
+            return i;
+        }
+    }
+    return -1;
+}
+
+void fake_bt_advertise(int i, bool on) {
+    periph[i].p.advertising = on;
+    periph[i].present = true;
+    periph[i].next_adv = now_us() + (periph[i].p.adv_interval_ms * 1000ULL);
+}
+
+void fake_bt_drop(int i) {
+    periph[i].present = false;
+    if (periph[i].connected) {
+        struct fake_event e = {0};
+        e.type = HCI_EVENT_DISCONNECTION_COMPLETE;
+        e.handle = periph[i].handle;
+        e.status = ERROR_CODE_CONNECTION_TIMEOUT;
+        enqueue(FAKE_SUPERVISION_MS, i, ACT_DISCONNECTED, &e);
+    }
+}
+
+hci_con_handle_t fake_bt_handle(int i) {
+    return periph[i].connected ? periph[i].handle : HCI_CON_HANDLE_INVALID;
+}
+
+bool fake_bt_connected(int i) {
+    return periph[i].connected;
+}
+
+bool fake_bt_scanning(void) {
+    return scanning;
+}
+
+void fake_bt_report(const bd_addr_t addr, bd_addr_type_t type, int8_t rssi,
+                    const char *name, const uint8_t *data, uint8_t data_len) {
+    if (!powered || !scanning) {
+        return;
+    }
+
+    struct fake_event e = {0};
+    e.type = GAP_EVENT_ADVERTISING_REPORT;
+    memcpy(e.addr, addr, sizeof(bd_addr_t));
+    e.addr_type = type;
+    e.rssi = rssi;
+
+    uint8_t pos = 0;
+    if (name != NULL) {
+        uint8_t l = MIN(strlen(name), 29);
+        e.data[pos++] = l + 1;
+        e.data[pos++] = BLUETOOTH_DATA_TYPE_COMPLETE_LOCAL_NAME;
+        memcpy(e.data + pos, name, l);
+        pos += l;
+    }
+    if ((data != NULL) && (data_len > 0)) {
+        uint8_t l = MIN(data_len, FAKE_EVENT_MAX_DATA - pos - 2);
+        e.data[pos++] = l + 1;
+        e.data[pos++] = BLUETOOTH_DATA_TYPE_MANUFACTURER_SPECIFIC_DATA;
+        memcpy(e.data + pos, data, l);
+        pos += l;
+    }
+    e.len = pos;
+
+    stats.scan_reports++;
+    deliver(&e);
+}
+
+void fake_bt_notify(int i, int id, const uint8_t *data, uint8_t len) {
+    if (!periph[i].connected || !(periph[i].notify & (1UL << id))) {
+        return;
+    }
+
+    struct fake_event n = {0};
+    n.type = GATT_EVENT_NOTIFICATION;
+    n.handle = periph[i].handle;
+    n.value_handle = FAKE_VALUE_HANDLE_BASE + (2 * id);
+    n.len = MIN(len, sizeof(n.data));
+    memcpy(n.data, data, n.len);
+    enqueue(ble_sim_latency(), -1, ACT_NONE, &n);
+}
+
+void fake_bt_write_mode(int i, enum fake_write_mode mode, uint32_t delay_ms) {
+    if ((i < 0) || (i >= FAKE_BT_MAX_PERIPHERALS)) {
+        return;
+    }
+    periph[i].write_mode = mode;
+    periph[i].write_delay = delay_ms;
+}
+
+const struct fake_bt_stats *fake_bt_stats(void) {
+    return &stats;
+}
+
+const struct fake_gatt_access *fake_bt_last_access(void) {
+    return &last_access;
+}
+
+const struct fake_conn_params *fake_bt_initial_params(void) {
+    return &initial;
+}
+
+const struct fake_conn_params *fake_bt_conn_params(int i) {
+    return &periph[i].params;
+}
+
+char *bd_addr_to_str(const bd_addr_t addr) {
+    static char buff[18];
+    snprintf(buff, sizeof(buff), "%02X:%02X:%02X:%02X:%02X:%02X",
+             addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+    return buff;
+}
+
+char *uuid128_to_str(const uint8_t *uuid) {
+    static char buff[37];
+    char *p = buff;
+    for (uint i = 0; i < 16; i++) {
+        p += sprintf(p, "%02X", uuid[i]);
+        if ((i == 3) || (i == 5) || (i == 7) || (i == 9)) {
+            *p++ = '-';
+        }
+    }
+    return buff;
+}
+
+void l2cap_init(void) { }
+void sm_init(void) { }
+void sm_set_io_capabilities(int io_capability) { (void)io_capability; }
+void gatt_client_init(void) { }
+void gatt_client_mtu_enable_auto_negotiation(uint8_t enabled) { (void)enabled; }
+
+void hci_add_event_handler(btstack_packet_callback_registration_t *callback_handler) {
+    handler = callback_handler->callback;
+}
+
+int hci_power_control(int mode) {
+    powered = (mode == HCI_POWER_ON);
+
+    struct fake_event e = {0};
+    e.type = BTSTACK_EVENT_STATE;
+    e.state = powered ? HCI_STATE_WORKING : HCI_STATE_OFF;
+    enqueue(1, -1, ACT_NONE, &e);
+    return 0;
+}
+
+void gap_local_bd_addr(bd_addr_t address_buffer) {
+    static const bd_addr_t local = { 0x28, 0xCD, 0xC1, 0x00, 0x00, 0x01 };
+    memcpy(address_buffer, local, sizeof(bd_addr_t));
+}
+
+void gap_set_scan_parameters(uint8_t scan_type, uint16_t scan_interval, uint16_t scan_window) {
+    (void)scan_type;
+    (void)scan_interval;
+    (void)scan_window;
+}
+
+void gap_start_scan(void) {
+    scanning = true;
+}
+
+void gap_stop_scan(void) {
+    scanning = false;
+}
+
+void gap_set_connection_parameters(uint16_t conn_scan_interval, uint16_t conn_scan_window,
+                                   uint16_t conn_interval_min, uint16_t conn_interval_max,
+                                   uint16_t conn_latency, uint16_t supervision_timeout,
+                                   uint16_t min_ce_length, uint16_t max_ce_length) {
+    (void)conn_scan_interval;
+    (void)conn_scan_window;
+    (void)min_ce_length;
+    (void)max_ce_length;
+
+    initial.interval_min = conn_interval_min;
+    initial.interval_max = conn_interval_max;
+    initial.latency = conn_latency;
+    initial.timeout = supervision_timeout;
+}
+
+int gap_update_connection_parameters(hci_con_handle_t con_handle, uint16_t conn_interval_min,
+                                     uint16_t conn_interval_max, uint16_t conn_latency,
+                                     uint16_t supervision_timeout) {
+    int i = periph_by_handle(con_handle);
+    if (i < 0) {
+        return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    }
+
+    // takes effect after a few events with the old interval
+    struct fake_conn_params *p = &periph[i].params;
+    uint32_t delay_ms = 2 * p->interval_max * 5 / 4;
+    p->interval_min = conn_interval_min;
+    p->interval_max = conn_interval_max;
+    p->latency = conn_latency;
+    p->timeout = supervision_timeout;
+    p->updates++;
+
+    struct fake_event e = {0};
+    e.type = HCI_EVENT_LE_META;
+    e.subevent = HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE;
+    e.handle = con_handle;
+    e.interval = conn_interval_max;
+    enqueue(delay_ms, -1, ACT_NONE, &e);
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_connect(const bd_addr_t addr, bd_addr_type_t addr_type) {
+    (void)addr_type;
+
+    if (!powered) {
+        return ERROR_CODE_COMMAND_DISALLOWED;
+    }
+    if (pending_direct || pending_whitelist || pending_cancel) {
+        stats.connect_rejected++;
+        return ERROR_CODE_COMMAND_DISALLOWED;
+    }
+
+    stats.gap_connects++;
+    pending_direct = true;
+    memcpy(pending_addr, addr, sizeof(bd_addr_t));
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_connect_with_whitelist(void) {
+    if (!powered) {
+        return ERROR_CODE_COMMAND_DISALLOWED;
+    }
+    if (pending_direct || pending_whitelist || pending_cancel) {
+        stats.connect_rejected++;
+        return ERROR_CODE_COMMAND_DISALLOWED;
+    }
+
+    stats.whitelist_connects++;
+    pending_whitelist = true;
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_connect_cancel(void) {
+    if (!pending_direct && !pending_whitelist) {
+        return ERROR_CODE_COMMAND_DISALLOWED;
+    }
+
+    // the controller reports the cancelled attempt as failed connection,
+    // until then it does not take a new one
+    bd_addr_t addr = {0};
+    if (pending_direct) {
+        memcpy(addr, pending_addr, sizeof(bd_addr_t));
+    }
+    pending_direct = false;
+    pending_whitelist = false;
+    pending_cancel = true;
+
+    stats.connect_cancels++;
+    connection_complete(addr, 0, ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER, HCI_CON_HANDLE_INVALID,
+                        FAKE_CANCEL_MS, ACT_CANCELLED);
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_disconnect(hci_con_handle_t handle) {
+    int i = periph_by_handle(handle);
+    if (i < 0) {
+        return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    }
+
+    stats.disconnects++;
+    struct fake_event e = {0};
+    e.type = HCI_EVENT_DISCONNECTION_COMPLETE;
+    e.handle = handle;
+    enqueue(FAKE_DISCONNECT_MS, i, ACT_DISCONNECTED, &e);
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_whitelist_clear(void) {
+    whitelist_len = 0;
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gap_whitelist_add(bd_addr_type_t address_type, const bd_addr_t address) {
+    (void)address_type;
+
+    if (whitelist_len >= FAKE_WHITELIST_LEN) {
+        return ERROR_CODE_COMMAND_DISALLOWED;
+    }
+    memcpy(whitelist[whitelist_len++], address, sizeof(bd_addr_t));
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gatt_client_send_mtu_negotiation(btstack_packet_handler_t callback, hci_con_handle_t con_handle) {
+    (void)callback;
+
+    int i = periph_by_handle(con_handle);
+    if (i < 0) {
+        return ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    }
+
+    struct fake_event e = {0};
+    e.type = GATT_EVENT_MTU;
+    e.handle = con_handle;
+    e.mtu = (periph[i].p.mtu != 0) ? periph[i].p.mtu : FAKE_MTU;
+    enqueue(ble_sim_latency(), -1, ACT_NONE, &e);
+    return ERROR_CODE_SUCCESS;
+}
+
+// returns peripheral index, or < 0 with the BTstack error code negated
+static int gatt_begin(hci_con_handle_t con_handle) {
+    int i = periph_by_handle(con_handle);
+    if (i < 0) {
+        return -ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER;
+    }
+    if (periph[i].gatt_busy) {
+        stats.gatt_rejected++;
+        return -GATT_CLIENT_IN_WRONG_STATE;
+    }
+
+    stats.gatt_requests++;
+    periph[i].gatt_busy = true;
+    return i;
+}
+
+// results go out together with the completion, after the link latency
+static void gatt_end_delayed(int i, const struct fake_event *results, uint count,
+                             uint8_t att_status, uint32_t extra_ms, bool lost) {
+    bool ok = ble_sim_link() && !lost;
+    uint32_t delay = ble_sim_latency() + extra_ms;
+
+    for (uint n = 0; ok && (n < count); n++) {
+        enqueue(delay, -1, ACT_NONE, &results[n]);
+    }
+
+    struct fake_event e = {0};
+    e.type = GATT_EVENT_QUERY_COMPLETE;
+    e.handle = periph[i].handle;
+    e.status = att_status;
+    if (!ok) {
+        stats.gatt_lost++;
+    }
+    enqueue(delay, i, ok ? ACT_GATT_DONE : ACT_GATT_LOST, &e);
+}
+
+static void gatt_end(int i, const struct fake_event *results, uint count, uint8_t att_status) {
+    gatt_end_delayed(i, results, count, att_status, 0, false);
+}
+
+static enum ble_char_id char_by_value_handle(uint16_t value_handle) {
+    uint16_t id = (value_handle - FAKE_VALUE_HANDLE_BASE) / 2;
+    if ((value_handle < FAKE_VALUE_HANDLE_BASE) || (id >= CHAR_COUNT)) {
+        return CHAR_INVALID;
+    }
+    return id;
+}
+
+uint8_t gatt_client_read_value_of_characteristics_by_uuid128(btstack_packet_handler_t callback,
+                                                             hci_con_handle_t con_handle,
+                                                             uint16_t start_handle, uint16_t end_handle,
+                                                             const uint8_t *uuid128) {
+    (void)callback;
+    (void)start_handle;
+    (void)end_handle;
+
+    int i = gatt_begin(con_handle);
+    if (i < 0) {
+        return -i;
+    }
+
+    memset(&last_access, 0, sizeof(last_access));
+    memcpy(last_access.uuid, uuid128, 16);
+
+    struct fake_event e = {0};
+    e.type = GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT;
+    e.handle = con_handle;
+    int32_t r = ble_sim_read(periph[i].p.model, uuid128, e.data, sizeof(e.data));
+    if (r < 0) {
+        gatt_end(i, NULL, 0, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+        return ERROR_CODE_SUCCESS;
+    }
+    e.len = r;
+    gatt_end(i, &e, 1, ATT_ERROR_SUCCESS);
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gatt_client_discover_primary_services_by_uuid128(btstack_packet_handler_t callback,
+                                                         hci_con_handle_t con_handle,
+                                                         const uint8_t *uuid128) {
+    (void)callback;
+
+    int i = gatt_begin(con_handle);
+    if (i < 0) {
+        return -i;
+    }
+
+    for (uint id = 0; id < CHAR_COUNT; id++) {
+        if (memcmp(ble_chars[id].service, uuid128, 16) == 0) {
+            struct fake_event e = {0};
+            e.type = GATT_EVENT_SERVICE_QUERY_RESULT;
+            e.handle = con_handle;
+            e.service.start_group_handle = FAKE_VALUE_HANDLE_BASE - 1;
+            e.service.end_group_handle = FAKE_VALUE_HANDLE_BASE + (2 * CHAR_COUNT);
+            memcpy(e.service.uuid128, uuid128, 16);
+            gatt_end(i, &e, 1, ATT_ERROR_SUCCESS);
+            return ERROR_CODE_SUCCESS;
+        }
+    }
+
+    gatt_end(i, NULL, 0, ATT_ERROR_SUCCESS);
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gatt_client_discover_characteristics_for_service_by_uuid128(btstack_packet_handler_t callback,
+                                                                    hci_con_handle_t con_handle,
+                                                                    gatt_client_service_t *service,
+                                                                    const uint8_t *uuid128) {
+    (void)callback;
+
+    int i = gatt_begin(con_handle);
+    if (i < 0) {
+        return -i;
+    }
+
+    enum ble_char_id id = ble_char_find(uuid128);
+    if ((id == CHAR_INVALID) || (memcmp(ble_chars[id].service, service->uuid128, 16) != 0)) {
+        gatt_end(i, NULL, 0, ATT_ERROR_SUCCESS);
+        return ERROR_CODE_SUCCESS;
+    }
+
+    struct fake_event e = {0};
+    e.type = GATT_EVENT_CHARACTERISTIC_QUERY_RESULT;
+    e.handle = con_handle;
+    e.characteristic.start_handle = FAKE_VALUE_HANDLE_BASE + (2 * id) - 1;
+    e.characteristic.value_handle = FAKE_VALUE_HANDLE_BASE + (2 * id);
+    e.characteristic.end_handle = FAKE_VALUE_HANDLE_BASE + (2 * id) + 1;
+    memcpy(e.characteristic.uuid128, uuid128, 16);
+    gatt_end(i, &e, 1, ATT_ERROR_SUCCESS);
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gatt_client_write_value_of_characteristic(btstack_packet_handler_t callback,
+                                                  hci_con_handle_t con_handle,
+                                                  uint16_t value_handle,
+                                                  uint16_t value_length, uint8_t *value) {
+    (void)callback;
+
+    int i = gatt_begin(con_handle);
+    if (i < 0) {
+        return -i;
+    }
+
+    enum ble_char_id id = char_by_value_handle(value_handle);
+    if (id == CHAR_INVALID) {
+        gatt_end(i, NULL, 0, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+        return ERROR_CODE_SUCCESS;
+    }
+
+    stats.gatt_writes++;
+    last_access.write = true;
+    memcpy(last_access.uuid, ble_chars[id].uuid, 16);
+    last_access.len = MIN(value_length, sizeof(last_access.data));
+    memcpy(last_access.data, value, last_access.len);
+    enum fake_write_mode mode = periph[i].write_mode;
+    if (mode == FAKE_WRITE_LOSE) {
+        gatt_end_delayed(i, NULL, 0, ATT_ERROR_SUCCESS, 0, true);
+        return ERROR_CODE_SUCCESS;
+    }
+
+    struct fake_event n = {0};
+    int32_t r = ble_sim_write(periph[i].p.model, ble_chars[id].uuid, value, value_length,
+                              n.data, sizeof(n.data));
+    gatt_end_delayed(i, NULL, 0, (r < 0) ? ATT_ERROR_ATTRIBUTE_NOT_FOUND : ATT_ERROR_SUCCESS,
+                     (mode == FAKE_WRITE_DELAY) ? periph[i].write_delay : 0,
+                     mode == FAKE_WRITE_LOSE_RESPONSE);
+
+    // answer of the peripheral, eg. Venty, only while notifications are on
+    if ((r > 0) && (periph[i].notify & (1UL << id))) {
+        n.type = GATT_EVENT_NOTIFICATION;
+        n.handle = con_handle;
+        n.value_handle = value_handle;
+        n.len = r;
+        enqueue(ble_sim_latency() + 1, -1, ACT_NONE, &n);
+    }
+    return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gatt_client_write_client_characteristic_configuration(btstack_packet_handler_t callback,
+                                                              hci_con_handle_t con_handle,
+                                                              gatt_client_characteristic_t *characteristic,
+                                                              uint16_t configuration) {
+    (void)callback;
+
+    int i = gatt_begin(con_handle);
+    if (i < 0) {
+        return -i;
+    }
+
+    enum ble_char_id id = char_by_value_handle(characteristic->value_handle);
+    if (id == CHAR_INVALID) {
+        gatt_end(i, NULL, 0, ATT_ERROR_ATTRIBUTE_NOT_FOUND);
+        return ERROR_CODE_SUCCESS;
+    }
+
+    if (configuration & GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION) {
+        periph[i].notify |= 1UL << id;
+    } else {
+        periph[i].notify &= ~(1UL << id);
+    }
+    gatt_end(i, NULL, 0, ATT_ERROR_SUCCESS);
+    return ERROR_CODE_SUCCESS;
+}
+
+void gatt_client_listen_for_characteristic_value_updates(gatt_client_notification_t *notification,
+                                                         btstack_packet_handler_t callback,
+                                                         hci_con_handle_t con_handle,
+                                                         gatt_client_characteristic_t *characteristic) {
+    notification->callback = callback;
+    notification->con_handle = con_handle;
+    notification->attribute_handle = characteristic->value_handle;
+}
+
+void gatt_client_stop_listening_for_characteristic_value_updates(gatt_client_notification_t *notification) {
+    notification->callback = NULL;
+}
@@ -0,0 +1,134 @@
+/*
+ * fake_btstack.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FAKE_BTSTACK_H__
+#define __FAKE_BTSTACK_H__
+
+/*
+ * In-process replacement of the BTstack GAP and GATT client used by ble.c.
+ * Responses are queued and delivered from sleep_ms() on the virtual clock,
+ * like the background interrupt of the real cyw43 driver would.
+ * GATT values come from the Volcano, Crafty and Venty models in ble_sim.c,
+ * including their link latency and loss, see ble_sim_set_link().
+ * Like BTstack there is only one outgoing connection attempt at a time,
+ * also while a cancelled one is not reported yet, and one GATT request
+ * per connection.
+ */
+
+#include "btstack.h"
+
+#define FAKE_BT_MAX_PERIPHERALS 8
+
+// GATT models, see enum sim_devices in ble_sim.c
+#define FAKE_MODEL_VOLCANO 0
+#define FAKE_MODEL_CRAFTY 1
+#define FAKE_MODEL_VENTY 2
+
+struct fake_peripheral {
+    bd_addr_t addr;
+    bd_addr_type_t type;
+    int8_t rssi;
+    const char *name;
+    const uint8_t *data; // manufacturer data
+    uint8_t data_len;
+    int model; // ble_sim device for GATT values, < 0 for none
+
+    uint32_t adv_interval_ms;
+    bool advertising; // stops while connected
+    uint16_t mtu; // answer to the MTU exchange, 0 for the default
+};
+
+// as requested by the central, in 1.25ms and 10ms units
+struct fake_conn_params {
+    uint16_t interval_min, interval_max;
+    uint16_t latency;
+    uint16_t timeout;
+    uint32_t updates; // gap_update_connection_parameters() calls
+};
+
+// how a peripheral answers GATT writes, see fake_bt_write_mode()
+enum fake_write_mode {
+    FAKE_WRITE_NORMAL = 0,
+    FAKE_WRITE_DELAY, // response arrives delay_ms late
+    FAKE_WRITE_LOSE_RESPONSE, // value is set, response never arrives
+    FAKE_WRITE_LOSE, // request never arrives, neither does the response
+};
+
+struct fake_bt_stats {
+    uint32_t scan_reports;
+    uint32_t gap_connects;
+    uint32_t whitelist_connects;
+    uint32_t connect_cancels;
+    uint32_t connect_rejected; // a connection attempt was already pending
+    uint32_t disconnects;
+    uint32_t gatt_requests;
+    uint32_t gatt_rejected; // a request was already pending on the link
+    uint32_t gatt_lost;
+    uint32_t gatt_writes; // accepted write requests, also lost ones
+};
+
+// last characteristic value the central read or wrote
+struct fake_gatt_access {
+    bool write;
+    uint8_t uuid[16];
+    uint8_t len; // of a write
+    uint8_t data[FAKE_EVENT_MAX_DATA];
+};
+
+// forget all peripherals and pending events, BTstack is powered off
+void fake_bt_reset(void);
+
+// returns index, or < 0 when full
+int fake_bt_add(const struct fake_peripheral *p);
+
+// also brings a dropped peripheral back in range
+void fake_bt_advertise(int i, bool on);
+
+// peripheral goes out of range, its link times out
+void fake_bt_drop(int i);
+
+hci_con_handle_t fake_bt_handle(int i);
+bool fake_bt_connected(int i);
+bool fake_bt_scanning(void);
+
+// deliver one advertising report right away, if scanning
+void fake_bt_report(const bd_addr_t addr, bd_addr_type_t type, int8_t rssi,
+                    const char *name, const uint8_t *data, uint8_t data_len);
+
+// unsolicited notification of a ble_char_id, if enabled by the central
+void fake_bt_notify(int i, int id, const uint8_t *data, uint8_t len);
+
+/*
+ * Applies to the following writes of peripheral i, until changed.
+ * The link is free again once a response would have been due.
+ */
+void fake_bt_write_mode(int i, enum fake_write_mode mode, uint32_t delay_ms);
+
+// deliver all events that are due, called from sleep_ms()
+void fake_bt_run(void);
+
+const struct fake_bt_stats *fake_bt_stats(void);
+const struct fake_gatt_access *fake_bt_last_access(void);
+
+// for new connections, from gap_set_connection_parameters()
+const struct fake_conn_params *fake_bt_initial_params(void);
+
+// of the link to peripheral i, initial ones until they are updated
+const struct fake_conn_params *fake_bt_conn_params(int i);
+
+#endif // __FAKE_BTSTACK_H__
@@ -0,0 +1,225 @@
+/*
+ * fake_cyw43.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <string.h>
+
+#include "dhcpserver.h"
+#include "fake_cyw43.h"
+
+cyw43_t cyw43_state;
+
+static struct netif netif = {0};
+struct netif *netif_default = &netif;
+
+static struct fake_ap aps[FAKE_WIFI_MAX_APS];
+static uint8_t ap_count = 0;
+static bool sta_mode = false;
+static bool ap_mode = false;
+
+static int link = CYW43_LINK_DOWN;
+static bool joining = false; // decided on the next fake_wifi_run()
+static bool dhcp = false; // address on the next fake_wifi_run()
+static struct fake_join last_join = {0};
+
+static bool scanning = false;
+static void *scan_env = NULL;
+static int (*scan_cb)(void *, const cyw43_ev_scan_result_t *) = NULL;
+
+static struct fake_wifi_stats stats = {0};
+
+static void link_down(void) {
+    link = CYW43_LINK_DOWN;
+    joining = false;
+    dhcp = false;
+    scanning = false;
+    netif.ip_addr.addr = 0;
+}
+
+void fake_wifi_reset(void) {
+    memset(aps, 0, sizeof(aps));
+    ap_count = 0;
+    sta_mode = false;
+    ap_mode = false;
+    link_down();
+    memset(&last_join, 0, sizeof(last_join));
+    memset(&stats, 0, sizeof(stats));
+}
+
+int fake_wifi_add(const struct fake_ap *ap) {
+    if (ap_count >= FAKE_WIFI_MAX_APS) {
+        return -1;
+    }
+    aps[ap_count] = *ap;
+    return ap_count++;
+}
+
+void fake_wifi_set(int i, bool present, uint8_t channel) {
+    aps[i].present = present;
+    aps[i].channel = channel;
+}
+
+bool fake_wifi_ap_mode(void) {
+    return ap_mode;
+}
+
+const struct fake_join *fake_wifi_last_join(void) {
+    return &last_join;
+}
+
+const struct fake_wifi_stats *fake_wifi_stats(void) {
+    return &stats;
+}
+
+static int join_result(void) {
+    for (uint8_t i = 0; i < ap_count; i++) {
+        const struct fake_ap *ap = &aps[i];
+        if (last_join.fast && (memcmp(ap->bssid, last_join.bssid, sizeof(ap->bssid)) != 0)) {
+            continue;
+        }
+        if (strcmp(ap->ssid, last_join.ssid) != 0) {
+            continue;
+        }
+
+        if (!last_join.fast) {
+            if (ap->present) {
+                return CYW43_LINK_JOIN;
+            }
+        } else if (ap->present && (ap->channel == last_join.channel)) {
+            return CYW43_LINK_JOIN;
+        } else {
+            // no beacon on that channel, the driver keeps trying
+            return CYW43_LINK_DOWN;
+        }
+    }
+    return CYW43_LINK_NONET;
+}
+
+void fake_wifi_run(void) {
+    if (dhcp) {
+        dhcp = false;
+        IP4_ADDR(&netif.ip_addr, 192, 168, 1, 100);
+        link = CYW43_LINK_UP;
+    }
+
+    if (joining) {
+        joining = false;
+        link = join_result();
+        dhcp = (link == CYW43_LINK_JOIN);
+    }
+
+    if (scanning) {
+        scanning = false;
+        for (uint8_t i = 0; i < ap_count; i++) {
+            if (!aps[i].present) {
+                continue;
+            }
+
+            cyw43_ev_scan_result_t r = {0};
+            memcpy(r.bssid, aps[i].bssid, sizeof(r.bssid));
+            r.ssid_len = strlen(aps[i].ssid);
+            memcpy(r.ssid, aps[i].ssid, r.ssid_len);
+            r.channel = aps[i].channel;
+            r.auth_mode = aps[i].auth_mode;
+            stats.scan_results++;
+            scan_cb(scan_env, &r);
+        }
+    }
+}
+
+void cyw43_arch_enable_sta_mode(void) {
+    sta_mode = true;
+}
+
+void cyw43_arch_disable_sta_mode(void) {
+    sta_mode = false;
+    link_down();
+}
+
+void cyw43_arch_enable_ap_mode(const char *ssid, const char *password, uint32_t auth) {
+    (void)ssid;
+    (void)password;
+    (void)auth;
+    ap_mode = true;
+}
+
+void cyw43_arch_disable_ap_mode(void) {
+    ap_mode = false;
+}
+
+int cyw43_wifi_join(cyw43_t *self, size_t ssid_len, const uint8_t *ssid, size_t key_len,
+                    const uint8_t *key, uint32_t auth_type, const uint8_t *bssid,
+                    uint32_t channel) {
+    (void)self;
+    (void)key_len;
+    (void)key;
+    if (!sta_mode || (ssid_len >= sizeof(last_join.ssid))) {
+        return -1;
+    }
+
+    link_down();
+    memset(&last_join, 0, sizeof(last_join));
+    memcpy(last_join.ssid, ssid, ssid_len);
+    last_join.fast = (bssid != NULL);
+    if (bssid != NULL) {
+        memcpy(last_join.bssid, bssid, sizeof(last_join.bssid));
+    }
+    last_join.channel = channel;
+    last_join.auth = auth_type;
+
+    stats.joins++;
+    if (last_join.fast) {
+        stats.fast_joins++;
+    }
+    joining = true;
+    return 0;
+}
+
+int cyw43_wifi_scan(cyw43_t *self, cyw43_wifi_scan_options_t *opts, void *env,
+                    int (*result_cb)(void *, const cyw43_ev_scan_result_t *)) {
+    (void)self;
+    (void)opts;
+    if (!sta_mode || scanning) {
+        return -1;
+    }
+
+    scanning = true;
+    scan_env = env;
+    scan_cb = result_cb;
+    stats.scans++;
+    return 0;
+}
+
+bool cyw43_wifi_scan_active(cyw43_t *self) {
+    (void)self;
+    return scanning;
+}
+
+int cyw43_wifi_link_status(cyw43_t *self, int itf) {
+    (void)self;
+    return (itf == CYW43_ITF_STA) ? link : CYW43_LINK_DOWN;
+}
+
+void dhcp_server_init(dhcp_server_t *d, ip4_addr_t *ip, ip4_addr_t *nm) {
+    d->ip = *ip;
+    d->nm = *nm;
+}
+
+void dhcp_server_deinit(dhcp_server_t *d) {
+    (void)d;
+}
@@ -0,0 +1,77 @@
+/*
+ * fake_cyw43.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __FAKE_CYW43_H__
+#define __FAKE_CYW43_H__
+
+/*
+ * In-process replacement of the wifi station of the cyw43 driver, with
+ * the access points set up by the test. fake_wifi_run() plays the chip
+ * in the background: it delivers scan results, finishes join attempts
+ * and hands out an address once joined.
+ *
+ * A join to a given BSSID only goes through if that access point is in
+ * range on the given channel. One that is out of range never answers,
+ * the link stays down. Any other BSSID or SSID fails with no network.
+ */
+
+#include "pico/cyw43_arch.h"
+#include "lwip/netif.h"
+
+#define FAKE_WIFI_MAX_APS 4
+
+struct fake_ap {
+    const char *ssid;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t auth_mode; // as in scan results
+    bool present;
+};
+
+struct fake_join {
+    char ssid[33];
+    bool fast; // to a given access point, without scanning
+    uint8_t bssid[6];
+    uint32_t channel;
+    uint32_t auth;
+};
+
+struct fake_wifi_stats {
+    uint32_t joins;
+    uint32_t fast_joins;
+    uint32_t scans;
+    uint32_t scan_results;
+};
+
+// no access points, station and access point mode off
+void fake_wifi_reset(void);
+
+// returns index, or < 0 when full
+int fake_wifi_add(const struct fake_ap *ap);
+
+// in range or not, also moves it to another channel
+void fake_wifi_set(int i, bool present, uint8_t channel);
+
+bool fake_wifi_ap_mode(void);
+const struct fake_join *fake_wifi_last_join(void);
+const struct fake_wifi_stats *fake_wifi_stats(void);
+
+void fake_wifi_run(void);
+
+#endif // __FAKE_CYW43_H__
@@ -0,0 +1,293 @@
+/*
+ * fake_fatfs.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stddef.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "usb_msc.h"
+#include "fake_fatfs.h"
+
+#define FIRST_SECTOR 2 // clusters start at 2, sect 0 is no sector
+
+struct entry {
+    bool used;
+    char name[FAKE_FS_NAME_LEN];
+    DWORD sclust;
+    uint32_t sectors;
+    FSIZE_t size;
+    WORD fdate, ftime;
+};
+
+static BYTE disk[FAKE_FS_SECTORS * FF_MAX_SS];
+static struct entry entries[FAKE_FS_FILES];
+static LBA_t next_free = FIRST_SECTOR;
+static FATFS *volume = NULL;
+static WORD mount_id = 0;
+static uint32_t host_writes = 0;
+static WORD stamp = 0;
+static struct fake_fs_stats stats = {0};
+
+static struct entry *find(const TCHAR *path) {
+    while (*path == '/') {
+        path++;
+    }
+    for (int i = 0; i < FAKE_FS_FILES; i++) {
+        if (entries[i].used && (strcmp(entries[i].name, path) == 0)) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static struct entry *create(const TCHAR *path) {
+    while (*path == '/') {
+        path++;
+    }
+    if (strlen(path) >= FAKE_FS_NAME_LEN) {
+        return NULL;
+    }
+    for (int i = 0; i < FAKE_FS_FILES; i++) {
+        if (!entries[i].used) {
+            memset(&entries[i], 0, sizeof(struct entry));
+            entries[i].used = true;
+            strcpy(entries[i].name, path);
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+static void touch(struct entry *e) {
+    stamp++;
+    e->fdate = ((2023 - 1980) << 9) | (1 << 5) | 1;
+    e->ftime = stamp;
+}
+
+static FRESULT validate(const FIL *fp) {
+    if ((fp == NULL) || (fp->obj.fs == NULL) || (fp->obj.fs != volume)
+            || (fp->obj.id != volume->id)) {
+        return FR_INVALID_OBJECT;
+    }
+    return FR_OK;
+}
+
+void fake_fs_reset(void) {
+    memset(disk, 0, sizeof(disk));
+    memset(entries, 0, sizeof(entries));
+    memset(&stats, 0, sizeof(stats));
+    next_free = FIRST_SECTOR;
+    host_writes++;
+}
+
+bool fake_fs_write(const char *name, const void *data, uint32_t len) {
+    struct entry *e = find(name);
+    if (e == NULL) {
+        e = create(name);
+        if (e == NULL) {
+            return false;
+        }
+    }
+
+    uint32_t need = (len + FF_MAX_SS - 1) / FF_MAX_SS;
+    if (need > e->sectors) {
+        if ((next_free + need) > FAKE_FS_SECTORS) {
+            return false;
+        }
+        e->sclust = next_free;
+        e->sectors = need;
+        next_free += need;
+    }
+
+    memcpy(disk + (e->sclust * FF_MAX_SS), data, len);
+    e->size = len;
+    touch(e);
+    host_writes++;
+    return true;
+}
+
+const struct fake_fs_stats *fake_fs_stats(void) {
+    return &stats;
+}
+
+uint32_t msc_write_count(void) {
+    return host_writes;
+}
+
+FRESULT f_mount(FATFS *fs, const TCHAR *path, BYTE opt) {
+    (void)path;
+    (void)opt;
+
+    // everything opened before is invalid now
+    volume = fs;
+    stats.open = 0;
+    if (fs != NULL) {
+        fs->id = ++mount_id;
+        stats.mounts++;
+    }
+    return FR_OK;
+}
+
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode) {
+    memset(fp, 0, offsetof(FIL, buf));
+    if (volume == NULL) {
+        return FR_NOT_READY;
+    }
+
+    struct entry *e = find(path);
+    if (mode & FA_CREATE_ALWAYS) {
+        if (e == NULL) {
+            e = create(path);
+            if (e == NULL) {
+                return FR_DENIED;
+            }
+        }
+
+        // grows at the end of the disk while written
+        e->sclust = next_free;
+        e->sectors = 0;
+        e->size = 0;
+        touch(e);
+    } else if (e == NULL) {
+        return FR_NO_FILE;
+    }
+
+    fp->obj.fs = volume;
+    fp->obj.id = volume->id;
+    fp->obj.sclust = e->sclust;
+    fp->obj.objsize = e->size;
+    fp->flag = mode;
+    stats.opens++;
+    stats.open++;
+    return FR_OK;
+}
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br) {
+    *br = 0;
+    FRESULT r = validate(fp);
+    if (r != FR_OK) {
+        return r;
+    }
+    if (!(fp->flag & FA_READ)) {
+        return FR_DENIED;
+    }
+
+    BYTE *rbuff = buff;
+    btr = MIN(btr, fp->obj.objsize - fp->fptr);
+    while (btr > 0) {
+        UINT rcnt;
+        if ((fp->fptr % FF_MAX_SS) == 0) {
+            LBA_t sect = fp->obj.sclust + (fp->fptr / FF_MAX_SS);
+
+            // whole sectors bypass the buffer
+            UINT cc = btr / FF_MAX_SS;
+            if (cc > 0) {
+                memcpy(rbuff, disk + (sect * FF_MAX_SS), cc * FF_MAX_SS);
+                stats.direct_reads += cc;
+                rcnt = cc * FF_MAX_SS;
+                rbuff += rcnt;
+                fp->fptr += rcnt;
+                *br += rcnt;
+                btr -= rcnt;
+                continue;
+            }
+
+            if (fp->sect != sect) {
+                memcpy(fp->buf, disk + (sect * FF_MAX_SS), FF_MAX_SS);
+                stats.sector_reads++;
+            }
+            fp->sect = sect;
+        }
+
+        rcnt = MIN(FF_MAX_SS - (fp->fptr % FF_MAX_SS), btr);
+        memcpy(rbuff, fp->buf + (fp->fptr % FF_MAX_SS), rcnt);
+        rbuff += rcnt;
+        fp->fptr += rcnt;
+        *br += rcnt;
+        btr -= rcnt;
+    }
+    return FR_OK;
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw) {
+    *bw = 0;
+    FRESULT r = validate(fp);
+    if (r != FR_OK) {
+        return r;
+    }
+    if (!(fp->flag & FA_WRITE)) {
+        return FR_DENIED;
+    }
+
+    struct entry *e = NULL;
+    for (int i = 0; i < FAKE_FS_FILES; i++) {
+        if (entries[i].used && (entries[i].sclust == fp->obj.sclust)) {
+            e = &entries[i];
+        }
+    }
+
+    uint32_t need = (fp->fptr + btw + FF_MAX_SS - 1) / FF_MAX_SS;
+    if ((e == NULL) || ((need > e->sectors) && ((e->sclust + e->sectors) != next_free))
+            || ((e->sclust + need) > FAKE_FS_SECTORS)) {
+        return FR_DENIED;
+    }
+    if (need > e->sectors) {
+        next_free = e->sclust + need;
+        e->sectors = need;
+    }
+
+    memcpy(disk + (e->sclust * FF_MAX_SS) + fp->fptr, buff, btw);
+    fp->fptr += btw;
+    fp->obj.objsize = MAX(fp->obj.objsize, fp->fptr);
+    e->size = fp->obj.objsize;
+    *bw = btw;
+    return FR_OK;
+}
+
+FRESULT f_close(FIL *fp) {
+    FRESULT r = validate(fp);
+    if (r != FR_OK) {
+        return r;
+    }
+
+    fp->obj.fs = NULL;
+    stats.closes++;
+    stats.open--;
+    return FR_OK;
+}
+
+FRESULT f_stat(const TCHAR *path, FILINFO *fno) {
+    if (volume == NULL) {
+        return FR_NOT_READY;
+    }
+
+    struct entry *e = find(path);
+    if (e == NULL) {
+        return FR_NO_FILE;
+    }
+
+    memset(fno, 0, sizeof(FILINFO));
+    fno->fsize = e->size;
+    fno->fdate = e->fdate;
+    fno->ftime = e->ftime;
+    fno->fattrib = 0x20; // AM_ARC
+    strncpy(fno->fname, e->name, sizeof(fno->fname) - 1);
+    return FR_OK;
+}
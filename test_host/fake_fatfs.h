@@ -0,0 +1,60 @@
+/*
+ * fake_fatfs.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __FAKE_FATFS_H__
+#define __FAKE_FATFS_H__
+
+/*
+ * RAM disk behind the FatFS calls of the firmware, which is also the
+ * medium the USB host sees. The test writes files as the host would,
+ * FatFS state of the firmware is outdated by that until it mounts again,
+ * see debug_disk.c.
+ *
+ * Clusters are one sector and files are contiguous. f_read() goes
+ * through the sector buffer of the FIL like FatFS does, so a FIL copied
+ * without its buffer reads the same as the original.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "ff.h"
+
+#define FAKE_FS_SECTORS 256
+#define FAKE_FS_FILES 16
+#define FAKE_FS_NAME_LEN 64
+
+struct fake_fs_stats {
+    uint32_t mounts;
+    uint32_t opens;
+    uint32_t closes;
+    uint32_t open; // FIL objects open on the current mount
+    uint32_t sector_reads; // into the buffer of a FIL
+    uint32_t direct_reads; // straight into the buffer of the caller
+};
+
+// empty medium, counts as written by the host
+void fake_fs_reset(void);
+
+// written by the host, in place when it fits, false when the disk is full
+bool fake_fs_write(const char *name, const void *data, uint32_t len);
+
+const struct fake_fs_stats *fake_fs_stats(void);
+
+#endif // __FAKE_FATFS_H__
@@ -0,0 +1,373 @@
+/*
+ * fake_lwip.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "fake_lwip.h"
+#include "host.h"
+
+static struct tcp_pcb pcbs[FAKE_TCP_MAX_PCBS];
+static struct tcp_pcb *last = NULL;
+static u16_t sndbuf = FAKE_TCP_SNDBUF;
+static struct fake_tcp_stats stats = {0};
+
+void fake_lwip_reset(void) {
+    memset(pcbs, 0, sizeof(pcbs));
+    last = NULL;
+    sndbuf = FAKE_TCP_SNDBUF;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void fake_tcp_set_sndbuf(uint16_t len) {
+    sndbuf = len;
+}
+
+const struct fake_tcp_stats *fake_tcp_stats(void) {
+    return &stats;
+}
+
+struct tcp_pcb *fake_tcp_last(void) {
+    return ((last != NULL) && last->used) ? last : NULL;
+}
+
+bool fake_tcp_is_open(const struct tcp_pcb *pcb) {
+    return (pcb != NULL) && pcb->used;
+}
+
+bool fake_tcp_connected_to(const struct tcp_pcb *pcb, const char *ip, uint16_t port) {
+    ip4_addr_t addr;
+    if (!fake_tcp_is_open(pcb) || !ip4addr_aton(ip, &addr)) {
+        return false;
+    }
+    return (pcb->connecting || pcb->established)
+           && ip4_addr_cmp(&pcb->ip, &addr) && (pcb->port == port);
+}
+
+static bool check_pcb(const struct tcp_pcb *pcb, const char *func) {
+    if (!fake_tcp_is_open(pcb)) {
+        printf("%s() on a pcb that is gone\n", func);
+        host_failures++;
+        return false;
+    }
+    return true;
+}
+
+static void release(struct tcp_pcb *pcb) {
+    pcb->used = false;
+    stats.open--;
+}
+
+void fake_tcp_accept(struct tcp_pcb *pcb) {
+    if (!check_pcb(pcb, __func__) || !pcb->connecting) {
+        return;
+    }
+
+    pcb->connecting = false;
+    pcb->established = true;
+    if (pcb->connected != NULL) {
+        pcb->connected(pcb->arg, pcb, ERR_OK);
+    }
+}
+
+size_t fake_tcp_take(struct tcp_pcb *pcb, char *buff, size_t len) {
+    if (!check_pcb(pcb, __func__)) {
+        return 0;
+    }
+
+    size_t n = MIN(len, pcb->out);
+    memcpy(buff, pcb->tx, n);
+    if (n < len) {
+        buff[n] = '\0';
+    }
+
+    memmove(pcb->tx, pcb->tx + n, pcb->queued + pcb->out - n);
+    pcb->out -= n;
+    pcb->unacked -= n;
+    if ((n > 0) && (pcb->sent != NULL)) {
+        pcb->sent(pcb->arg, pcb, n);
+    }
+    return n;
+}
+
+struct pbuf *fake_pbuf_alloc(const char *data, uint16_t len, uint16_t chunk) {
+    chunk = (chunk == 0) ? len : chunk;
+
+    struct pbuf *head = NULL, **tail = &head;
+    for (uint16_t off = 0; off < len; off += chunk) {
+        uint16_t n = MIN(chunk, len - off);
+        struct pbuf *p = malloc(sizeof(struct pbuf) + n);
+        p->next = NULL;
+        p->payload = p + 1;
+        p->len = n;
+        p->tot_len = len - off;
+        p->ref = 1;
+        memcpy(p->payload, data + off, n);
+        *tail = p;
+        tail = &p->next;
+    }
+
+    if (head != NULL) {
+        stats.pbufs++;
+    }
+    return head;
+}
+
+void fake_tcp_reply(struct tcp_pcb *pcb, const char *data, uint16_t len, uint16_t chunk) {
+    if (!check_pcb(pcb, __func__) || (len == 0)) {
+        return;
+    }
+
+    struct pbuf *head = fake_pbuf_alloc(data, len, chunk);
+    if ((pcb->recv == NULL) || (pcb->recv(pcb->arg, pcb, head, ERR_OK) != ERR_OK)) {
+        pbuf_free(head);
+    }
+}
+
+void fake_tcp_remote_close(struct tcp_pcb *pcb) {
+    if (!check_pcb(pcb, __func__)) {
+        return;
+    }
+
+    if (pcb->recv != NULL) {
+        pcb->recv(pcb->arg, pcb, NULL, ERR_OK);
+    }
+}
+
+void fake_tcp_fail(struct tcp_pcb *pcb, err_t err) {
+    if (!check_pcb(pcb, __func__)) {
+        return;
+    }
+
+    release(pcb);
+    if (pcb->err != NULL) {
+        pcb->err(pcb->arg, err);
+    }
+}
+
+void pbuf_ref(struct pbuf *p) {
+    if (p != NULL) {
+        p->ref++;
+    }
+}
+
+// like lwIP, only the part of the chain nobody else references
+u8_t pbuf_free(struct pbuf *p) {
+    u8_t n = 0;
+    if ((p != NULL) && (p->ref == 1)) {
+        stats.pbufs--;
+    }
+    while ((p != NULL) && (--p->ref == 0)) {
+        struct pbuf *next = p->next;
+        free(p);
+        p = next;
+        n++;
+    }
+    return n;
+}
+
+static bool pbuf_at(const struct pbuf *p, u16_t off, u8_t *c) {
+    while ((p != NULL) && (off >= p->len)) {
+        off -= p->len;
+        p = p->next;
+    }
+    if (p == NULL) {
+        return false;
+    }
+    *c = ((const u8_t *)p->payload)[off];
+    return true;
+}
+
+u16_t pbuf_memcmp(const struct pbuf *p, u16_t offset, const void *s2, u16_t n) {
+    for (u16_t i = 0; i < n; i++) {
+        u8_t c;
+        if (!pbuf_at(p, offset + i, &c) || (c != ((const u8_t *)s2)[i])) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+u16_t pbuf_memfind(const struct pbuf *p, const void *mem, u16_t mem_len, u16_t start_offset) {
+    if (p->tot_len < mem_len) {
+        return 0xFFFF;
+    }
+    for (u16_t i = start_offset; i <= (p->tot_len - mem_len); i++) {
+        if (pbuf_memcmp(p, i, mem, mem_len) == 0) {
+            return i;
+        }
+    }
+    return 0xFFFF;
+}
+
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len, u16_t offset) {
+    u16_t n = 0;
+    u8_t c;
+    while ((n < len) && pbuf_at(p, offset + n, &c)) {
+        ((u8_t *)dataptr)[n++] = c;
+    }
+    return n;
+}
+
+void http_set_cgi_handlers(const tCGI *pCGIs, int num_handlers) {
+    (void)pCGIs;
+    (void)num_handlers;
+}
+
+void httpd_init(void) {
+}
+
+int ip4addr_aton(const char *cp, ip4_addr_t *addr) {
+    unsigned a, b, c, d;
+    char end;
+    if ((sscanf(cp, "%u.%u.%u.%u%c", &a, &b, &c, &d, &end) != 4)
+            || (a > 255) || (b > 255) || (c > 255) || (d > 255)) {
+        return 0;
+    }
+    IP4_ADDR(addr, a, b, c, d);
+    return 1;
+}
+
+char *ip4addr_ntoa(const ip4_addr_t *addr) {
+    static char buff[16];
+    u32_t a = addr->addr;
+    snprintf(buff, sizeof(buff), "%lu.%lu.%lu.%lu",
+             a & 0xFF, (a >> 8) & 0xFF, (a >> 16) & 0xFF, (a >> 24) & 0xFF);
+    return buff;
+}
+
+struct tcp_pcb *tcp_new(void) {
+    for (uint i = 0; i < FAKE_TCP_MAX_PCBS; i++) {
+        if (!pcbs[i].used) {
+            memset(&pcbs[i], 0, sizeof(struct tcp_pcb));
+            pcbs[i].used = true;
+            pcbs[i].sndbuf = sndbuf;
+            last = &pcbs[i];
+            stats.pcbs++;
+            stats.open++;
+            return last;
+        }
+    }
+    return NULL;
+}
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg) {
+    if (check_pcb(pcb, __func__)) {
+        pcb->arg = arg;
+    }
+}
+
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv) {
+    if (check_pcb(pcb, __func__)) {
+        pcb->recv = recv;
+    }
+}
+
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent) {
+    if (check_pcb(pcb, __func__)) {
+        pcb->sent = sent;
+    }
+}
+
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err) {
+    if (check_pcb(pcb, __func__)) {
+        pcb->err = err;
+    }
+}
+
+err_t tcp_connect(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port,
+                  tcp_connected_fn connected) {
+    if (!check_pcb(pcb, __func__)) {
+        return ERR_ARG;
+    }
+    if (pcb->connecting || pcb->established) {
+        return ERR_ISCONN;
+    }
+
+    pcb->ip = *ipaddr;
+    pcb->port = port;
+    pcb->connected = connected;
+    pcb->connecting = true;
+    stats.connects++;
+    return ERR_OK;
+}
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags) {
+    (void)apiflags;
+    if (!check_pcb(pcb, __func__)) {
+        return ERR_ARG;
+    }
+    if (!pcb->established) {
+        return ERR_CONN;
+    }
+    if ((len > tcp_sndbuf(pcb)) || ((pcb->out + pcb->queued + len) > FAKE_TCP_TX_LEN)) {
+        return ERR_MEM;
+    }
+
+    memcpy(pcb->tx + pcb->out + pcb->queued, dataptr, len);
+    pcb->queued += len;
+    pcb->unacked += len;
+    stats.writes++;
+    stats.bytes += len;
+    return ERR_OK;
+}
+
+err_t tcp_output(struct tcp_pcb *pcb) {
+    if (!check_pcb(pcb, __func__)) {
+        return ERR_ARG;
+    }
+
+    pcb->out += pcb->queued;
+    pcb->queued = 0;
+    return ERR_OK;
+}
+
+void tcp_recved(struct tcp_pcb *pcb, u16_t len) {
+    (void)len;
+    check_pcb(pcb, __func__);
+}
+
+u16_t tcp_sndbuf(const struct tcp_pcb *pcb) {
+    return pcb->sndbuf - pcb->unacked;
+}
+
+err_t tcp_close(struct tcp_pcb *pcb) {
+    if (!check_pcb(pcb, __func__)) {
+        return ERR_ARG;
+    }
+
+    release(pcb);
+    stats.closes++;
+    return ERR_OK;
+}
+
+void tcp_abort(struct tcp_pcb *pcb) {
+    if (!check_pcb(pcb, __func__)) {
+        return;
+    }
+
+    release(pcb);
+    stats.aborts++;
+    if (pcb->err != NULL) {
+        pcb->err(pcb->arg, ERR_ABRT);
+    }
+}
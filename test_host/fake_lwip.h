@@ -0,0 +1,86 @@
+/*
+ * fake_lwip.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __FAKE_LWIP_H__
+#define __FAKE_LWIP_H__
+
+/*
+ * In-process replacement of the lwIP raw TCP API, for the firmware
+ * modules talking to servers on the network. Nothing happens on its own,
+ * the test plays the remote end: it accepts connections, takes what was
+ * sent, answers and closes or resets them. Callbacks run right from these
+ * calls, like they would from the lwIP context on the real hardware.
+ */
+
+#include <stddef.h>
+
+#include "lwip/tcp.h"
+#include "lwip/apps/httpd.h"
+
+#define FAKE_TCP_MAX_PCBS 8
+#define FAKE_TCP_SNDBUF 2920 // two segments, TCP_SND_BUF of lwipopts.h
+
+struct fake_tcp_stats {
+    uint32_t pcbs; // tcp_new() calls
+    uint32_t open; // pcbs not closed, aborted or reset yet
+    uint32_t connects;
+    uint32_t closes;
+    uint32_t aborts;
+    uint32_t writes;
+    uint32_t bytes;
+    uint32_t pbufs; // handed to a recv callback and not freed yet
+};
+
+// forget all connections, without calling any callbacks
+void fake_lwip_reset(void);
+
+// free space of the send buffer of new connections
+void fake_tcp_set_sndbuf(uint16_t len);
+
+const struct fake_tcp_stats *fake_tcp_stats(void);
+
+// most recently created pcb, NULL once it is gone
+struct tcp_pcb *fake_tcp_last(void);
+
+bool fake_tcp_is_open(const struct tcp_pcb *pcb);
+bool fake_tcp_connected_to(const struct tcp_pcb *pcb, const char *ip, uint16_t port);
+
+// remote end accepts the connection attempt
+void fake_tcp_accept(struct tcp_pcb *pcb);
+
+/*
+ * Copies what was passed to tcp_output() since the last call, up to len
+ * bytes, and acknowledges it towards the sent callback. Returns the
+ * length, the data is terminated when there is space left.
+ */
+size_t fake_tcp_take(struct tcp_pcb *pcb, char *buff, size_t len);
+
+// chain of chunk bytes each, counted in pbufs until it is freed
+struct pbuf *fake_pbuf_alloc(const char *data, uint16_t len, uint16_t chunk);
+
+// data from the remote end, split into a pbuf chain of chunk bytes each
+void fake_tcp_reply(struct tcp_pcb *pcb, const char *data, uint16_t len, uint16_t chunk);
+
+// remote end closes the connection, recv callback gets NULL
+void fake_tcp_remote_close(struct tcp_pcb *pcb);
+
+// connection is reset, lwIP frees the pcb before the err callback
+void fake_tcp_fail(struct tcp_pcb *pcb, err_t err);
+
+#endif // __FAKE_LWIP_H__
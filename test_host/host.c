@@ -0,0 +1,193 @@
+/*
+ * host.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "pico/flash.h"
+#include "pico/bootrom.h"
+#include "picowota/reboot.h"
+#include "hardware/flash.h"
+
+#include "api.h"
+#include "influx.h"
+#include "main.h"
+#include "usb_cdc.h"
+#include "serial.h"
+#include "vaporizer.h"
+#include "fake_btstack.h"
+#include "host.h"
+
+int host_failures = 0;
+void (*host_loop_hook)(void) = NULL;
+void (*host_output_hook)(const char *line, size_t len) = NULL;
+uint8_t host_flash[HOST_FLASH_SIZE];
+
+static uint64_t time_us = 0;
+static int lock_depth = 0;
+static bool verbose = false;
+
+int host_result(const char *name) {
+    if (lock_depth != 0) {
+        printf("%s: lock still held (%d)\n", name, lock_depth);
+        host_failures++;
+    }
+
+    printf("%s: %s (%d failed checks)\n", name, (host_failures == 0) ? "ok" : "FAILED", host_failures);
+    return (host_failures == 0) ? 0 : 1;
+}
+
+void host_init(void) {
+    verbose = (getenv("HOST_VERBOSE") != NULL);
+    host_flash_reset();
+}
+
+void host_flash_reset(void) {
+    memset(host_flash, 0xFF, sizeof(host_flash));
+}
+
+uint64_t host_time_us(void) {
+    return time_us;
+}
+
+void host_time_set_ms(uint32_t ms) {
+    time_us = ms * 1000ULL;
+}
+
+absolute_time_t get_absolute_time(void) {
+    return time_us;
+}
+
+void sleep_us(uint64_t us) {
+    // events arrive in 1ms steps, like the background interrupt would run
+    while (us > 0) {
+        uint64_t step = MIN(us, 1000);
+        time_us += step;
+        us -= step;
+
+        if (lock_depth == 0) {
+            fake_bt_run();
+        }
+    }
+}
+
+void sleep_ms(uint32_t ms) {
+    sleep_us(ms * 1000ULL);
+}
+
+void cyw43_thread_enter(void) {
+    lock_depth++;
+}
+
+void cyw43_thread_exit(void) {
+    if (lock_depth <= 0) {
+        printf("cyw43_thread_exit() without lock\n");
+        host_failures++;
+        return;
+    }
+    lock_depth--;
+}
+
+int cyw43_thread_depth(void) {
+    return lock_depth;
+}
+
+void main_loop_hw(void) {
+    if (host_loop_hook != NULL) {
+        host_loop_hook();
+    }
+}
+
+// NOR flash, programming can only clear bits
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    if (((flash_offs % FLASH_SECTOR_SIZE) != 0) || ((count % FLASH_SECTOR_SIZE) != 0)
+        || ((flash_offs + count) > HOST_FLASH_SIZE)) {
+        printf("invalid flash erase 0x%X %zu\n", flash_offs, count);
+        abort();
+    }
+    memset(host_flash + flash_offs, 0xFF, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count) {
+    if (((flash_offs % FLASH_PAGE_SIZE) != 0) || ((count % FLASH_PAGE_SIZE) != 0)
+        || ((flash_offs + count) > HOST_FLASH_SIZE)) {
+        printf("invalid flash program 0x%X %zu\n", flash_offs, count);
+        abort();
+    }
+    for (size_t i = 0; i < count; i++) {
+        host_flash[flash_offs + i] &= data[i];
+    }
+}
+
+bool flash_safe_execute_core_init(void) {
+    return true;
+}
+
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms) {
+    (void)enter_exit_timeout_ms;
+    func(param);
+    return PICO_OK;
+}
+
+void usb_cdc_write(const void *buf, size_t count) {
+    if (host_output_hook != NULL) {
+        host_output_hook(buf, count);
+    }
+    if (verbose) {
+        fwrite(buf, 1, count, stdout);
+    }
+}
+
+void usb_cdc_set_reroute(bool reroute) {
+    (void)reroute;
+}
+
+void serial_write(const void *buf, size_t count) {
+    (void)buf;
+    (void)count;
+}
+
+void serial_set_reroute(bool reroute) {
+    (void)reroute;
+}
+
+void reset_usb_boot(uint32_t gpio_mask, uint32_t disable_interface_mask) {
+    (void)gpio_mask;
+    (void)disable_interface_mask;
+    abort();
+}
+
+void picowota_reboot(bool to_bootloader) {
+    (void)to_bootloader;
+    abort();
+}
+
+// telemetry of the workflow engine, see influx.c and api.c
+// weak, test_influx links the real one
+__attribute__((weak)) void influx_point(const char *name, float value) {
+    (void)name;
+    (void)value;
+}
+
+void api_value(enum vaporizer_value what, int16_t value) {
+    (void)what;
+    (void)value;
+}
@@ -0,0 +1,68 @@
+/*
+ * host.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOST_H__
+#define __HOST_H__
+
+/*
+ * Host side of the firmware modules under test, see host.c.
+ * Every test is its own executable, returning non-zero on failure.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+extern int host_failures;
+
+#define CHECK(c) do {                                                   \
+    if (!(c)) {                                                         \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #c);    \
+        host_failures++;                                                \
+    }                                                                   \
+} while (0)
+
+#define CHECK_EQ(a, b) do {                                             \
+    long long _a = (a), _b = (b);                                       \
+    if (_a != _b) {                                                     \
+        printf("%s:%d: check failed: %s == %s (%lld != %lld)\n",        \
+               __FILE__, __LINE__, #a, #b, _a, _b);                     \
+        host_failures++;                                                \
+    }                                                                   \
+} while (0)
+
+// prints the result, use as return value of main()
+int host_result(const char *name);
+
+// debug() output goes to stdout when HOST_VERBOSE is set in the environment
+void host_init(void);
+
+// virtual clock, also delivers fake BTstack events
+uint64_t host_time_us(void);
+void host_time_set_ms(uint32_t ms);
+
+// called by main_loop_hw(), NULL by default
+extern void (*host_loop_hook)(void);
+
+// gets every line of debug() and println() output, NULL by default
+extern void (*host_output_hook)(const char *line, size_t len);
+
+// erase the emulated flash
+void host_flash_reset(void);
+
+#endif // __HOST_H__
@@ -0,0 +1,231 @@
+/*
+ * btstack.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOST_BTSTACK_H__
+#define __HOST_BTSTACK_H__
+
+/*
+ * The BTstack API used by ble.c, implemented by fake_btstack.c.
+ * Events are not HCI packets, but a struct fake_event, so the getters
+ * are plain field accesses. Everything else keeps the BTstack names.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define UNUSED(x) (void)(x)
+
+typedef uint8_t bd_addr_t[6];
+typedef uint8_t bd_addr_type_t;
+typedef uint16_t hci_con_handle_t;
+
+#define HCI_CON_HANDLE_INVALID 0xFFFF
+#define ATT_DEFAULT_MTU 23
+
+#define ERROR_CODE_SUCCESS 0x00
+#define ERROR_CODE_UNKNOWN_CONNECTION_IDENTIFIER 0x02
+#define ERROR_CODE_COMMAND_DISALLOWED 0x0C
+#define ERROR_CODE_CONNECTION_TIMEOUT 0x08
+#define GATT_CLIENT_IN_WRONG_STATE 0x91
+#define ATT_ERROR_SUCCESS 0x00
+#define ATT_ERROR_ATTRIBUTE_NOT_FOUND 0x0A
+
+#define HCI_EVENT_PACKET 0x04
+#define HCI_POWER_ON 1
+#define HCI_STATE_OFF 0
+#define HCI_STATE_WORKING 2
+#define IO_CAPABILITY_NO_INPUT_NO_OUTPUT 3
+#define GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION 1
+
+#define BTSTACK_EVENT_STATE 0x60
+#define GAP_EVENT_ADVERTISING_REPORT 0xDA
+#define HCI_EVENT_LE_META 0x3E
+#define HCI_SUBEVENT_LE_CONNECTION_COMPLETE 0x01
+#define HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE 0x03
+#define HCI_EVENT_DISCONNECTION_COMPLETE 0x05
+#define GATT_EVENT_QUERY_COMPLETE 0xA0
+#define GATT_EVENT_SERVICE_QUERY_RESULT 0xA1
+#define GATT_EVENT_CHARACTERISTIC_QUERY_RESULT 0xA2
+#define GATT_EVENT_CHARACTERISTIC_VALUE_QUERY_RESULT 0xA5
+#define GATT_EVENT_NOTIFICATION 0xA7
+#define GATT_EVENT_MTU 0xAB
+
+#define BLUETOOTH_DATA_TYPE_SHORTENED_LOCAL_NAME 0x08
+#define BLUETOOTH_DATA_TYPE_COMPLETE_LOCAL_NAME 0x09
+#define BLUETOOTH_DATA_TYPE_SERVICE_DATA 0x16
+#define BLUETOOTH_DATA_TYPE_MANUFACTURER_SPECIFIC_DATA 0xFF
+
+typedef void (*btstack_packet_handler_t)(uint8_t packet_type, uint16_t channel,
+                                         uint8_t *packet, uint16_t size);
+
+typedef struct {
+    void *next;
+    btstack_packet_handler_t callback;
+} btstack_packet_callback_registration_t;
+
+typedef struct {
+    uint16_t start_group_handle;
+    uint16_t end_group_handle;
+    uint16_t uuid16;
+    uint8_t uuid128[16];
+} gatt_client_service_t;
+
+typedef struct {
+    uint16_t start_handle;
+    uint16_t value_handle;
+    uint16_t end_handle;
+    uint16_t properties;
+    uint16_t uuid16;
+    uint8_t uuid128[16];
+} gatt_client_characteristic_t;
+
+typedef struct {
+    void *next;
+    btstack_packet_handler_t callback;
+    hci_con_handle_t con_handle;
+    uint16_t attribute_handle;
+} gatt_client_notification_t;
+
+typedef struct {
+    const uint8_t *data;
+    uint8_t size;
+    uint8_t offset;
+} ad_context_t;
+
+#define FAKE_EVENT_MAX_DATA 64
+
+struct fake_event {
+    uint8_t type;
+    uint8_t subevent;
+    uint8_t state; // BTSTACK_EVENT_STATE
+    uint8_t status; // HCI or ATT status
+    hci_con_handle_t handle;
+    bd_addr_t addr;
+    bd_addr_type_t addr_type;
+    int8_t rssi;
+    uint16_t interval;
+    uint16_t mtu;
+    uint16_t value_handle;
+    gatt_client_service_t service;
+    gatt_client_characteristic_t characteristic;
+    uint8_t len;
+    uint8_t data[FAKE_EVENT_MAX_DATA];
+};
+
+#define FAKE_EVENT(p) ((const struct fake_event *)(p))
+
+static inline uint8_t hci_event_packet_get_type(const uint8_t *p) { return FAKE_EVENT(p)->type; }
+static inline uint8_t hci_event_le_meta_get_subevent_code(const uint8_t *p) { return FAKE_EVENT(p)->subevent; }
+static inline uint8_t btstack_event_state_get_state(const uint8_t *p) { return FAKE_EVENT(p)->state; }
+
+static inline void gap_event_advertising_report_get_address(const uint8_t *p, bd_addr_t a) { memcpy(a, FAKE_EVENT(p)->addr, 6); }
+static inline bd_addr_type_t gap_event_advertising_report_get_address_type(const uint8_t *p) { return FAKE_EVENT(p)->addr_type; }
+static inline uint8_t gap_event_advertising_report_get_rssi(const uint8_t *p) { return (uint8_t)FAKE_EVENT(p)->rssi; }
+static inline const uint8_t *gap_event_advertising_report_get_data(const uint8_t *p) { return FAKE_EVENT(p)->data; }
+static inline uint8_t gap_event_advertising_report_get_data_length(const uint8_t *p) { return FAKE_EVENT(p)->len; }
+
+static inline void hci_subevent_le_connection_complete_get_peer_address(const uint8_t *p, bd_addr_t a) { memcpy(a, FAKE_EVENT(p)->addr, 6); }
+static inline bd_addr_type_t hci_subevent_le_connection_complete_get_peer_address_type(const uint8_t *p) { return FAKE_EVENT(p)->addr_type; }
+static inline uint8_t hci_subevent_le_connection_complete_get_status(const uint8_t *p) { return FAKE_EVENT(p)->status; }
+static inline hci_con_handle_t hci_subevent_le_connection_complete_get_connection_handle(const uint8_t *p) { return FAKE_EVENT(p)->handle; }
+static inline uint16_t hci_subevent_le_connection_complete_get_conn_interval(const uint8_t *p) { return FAKE_EVENT(p)->interval; }
+static inline hci_con_handle_t hci_subevent_le_connection_update_complete_get_connection_handle(const uint8_t *p) { return FAKE_EVENT(p)->handle; }
+static inline uint16_t hci_subevent_le_connection_update_complete_get_conn_interval(const uint8_t *p) { return FAKE_EVENT(p)->interval; }
+static inline hci_con_handle_t hci_event_disconnection_complete_get_connection_handle(const uint8_t *p) { return FAKE_EVENT(p)->handle; }
+
+static inline hci_con_handle_t gatt_event_query_complete_get_handle(const uint8_t *p) { return FAKE_EVENT(p)->handle; }
+static inline uint8_t gatt_event_query_complete_get_att_status(const uint8_t *p) { return FAKE_EVENT(p)->status; }
+static inline hci_con_handle_t gatt_event_service_query_result_get_handle(const uint8_t *p) { return FAKE_EVENT(p)->handle; }
+static inline void gatt_event_service_query_result_get_service(const uint8_t *p, gatt_client_service_t *s) { *s = FAKE_EVENT(p)->service; }
+static inline hci_con_handle_t gatt_event_characteristic_query_result_get_handle(const uint8_t *p) { return FAKE_EVENT(p)->handle; }
+static inline void gatt_event_characteristic_query_result_get_characteristic(const uint8_t *p, gatt_client_characteristic_t *c) { *c = FAKE_EVENT(p)->characteristic; }
+static inline hci_con_handle_t gatt_event_characteristic_value_query_result_get_handle(const uint8_t *p) { return FAKE_EVENT(p)->handle; }
+static inline uint16_t gatt_event_characteristic_value_query_result_get_value_length(const uint8_t *p) { return FAKE_EVENT(p)->len; }
+static inline const uint8_t *gatt_event_characteristic_value_query_result_get_value(const uint8_t *p) { return FAKE_EVENT(p)->data; }
+static inline hci_con_handle_t gatt_event_notification_get_handle(const uint8_t *p) { return FAKE_EVENT(p)->handle; }
+static inline uint16_t gatt_event_notification_get_value_handle(const uint8_t *p) { return FAKE_EVENT(p)->value_handle; }
+static inline uint16_t gatt_event_notification_get_value_length(const uint8_t *p) { return FAKE_EVENT(p)->len; }
+static inline const uint8_t *gatt_event_notification_get_value(const uint8_t *p) { return FAKE_EVENT(p)->data; }
+static inline hci_con_handle_t gatt_event_mtu_get_handle(const uint8_t *p) { return FAKE_EVENT(p)->handle; }
+static inline uint16_t gatt_event_mtu_get_MTU(const uint8_t *p) { return FAKE_EVENT(p)->mtu; }
+
+// advertising data is in the usual length, type, value format
+static inline void ad_iterator_init(ad_context_t *c, uint8_t size, const uint8_t *data) { c->data = data; c->size = size; c->offset = 0; }
+static inline bool ad_iterator_has_more(const ad_context_t *c) { return (c->offset + 1) < c->size; }
+static inline void ad_iterator_next(ad_context_t *c) { c->offset += 1 + c->data[c->offset]; }
+static inline uint8_t ad_iterator_get_data_len(const ad_context_t *c) { return c->data[c->offset] - 1; }
+static inline uint8_t ad_iterator_get_data_type(const ad_context_t *c) { return c->data[c->offset + 1]; }
+static inline const uint8_t *ad_iterator_get_data(const ad_context_t *c) { return c->data + c->offset + 2; }
+
+char *bd_addr_to_str(const bd_addr_t addr);
+char *uuid128_to_str(const uint8_t *uuid);
+
+void l2cap_init(void);
+void sm_init(void);
+void sm_set_io_capabilities(int io_capability);
+void hci_add_event_handler(btstack_packet_callback_registration_t *callback_handler);
+int hci_power_control(int mode);
+
+void gap_local_bd_addr(bd_addr_t address_buffer);
+void gap_set_scan_parameters(uint8_t scan_type, uint16_t scan_interval, uint16_t scan_window);
+void gap_start_scan(void);
+void gap_stop_scan(void);
+void gap_set_connection_parameters(uint16_t conn_scan_interval, uint16_t conn_scan_window,
+                                   uint16_t conn_interval_min, uint16_t conn_interval_max,
+                                   uint16_t conn_latency, uint16_t supervision_timeout,
+                                   uint16_t min_ce_length, uint16_t max_ce_length);
+int gap_update_connection_parameters(hci_con_handle_t con_handle, uint16_t conn_interval_min,
+                                     uint16_t conn_interval_max, uint16_t conn_latency,
+                                     uint16_t supervision_timeout);
+uint8_t gap_connect(const bd_addr_t addr, bd_addr_type_t addr_type);
+uint8_t gap_connect_cancel(void);
+uint8_t gap_disconnect(hci_con_handle_t handle);
+uint8_t gap_whitelist_clear(void);
+uint8_t gap_whitelist_add(bd_addr_type_t address_type, const bd_addr_t address);
+uint8_t gap_connect_with_whitelist(void);
+
+void gatt_client_init(void);
+void gatt_client_mtu_enable_auto_negotiation(uint8_t enabled);
+uint8_t gatt_client_send_mtu_negotiation(btstack_packet_handler_t callback, hci_con_handle_t con_handle);
+uint8_t gatt_client_read_value_of_characteristics_by_uuid128(btstack_packet_handler_t callback,
+                                                             hci_con_handle_t con_handle,
+                                                             uint16_t start_handle, uint16_t end_handle,
+                                                             const uint8_t *uuid128);
+uint8_t gatt_client_discover_primary_services_by_uuid128(btstack_packet_handler_t callback,
+                                                         hci_con_handle_t con_handle,
+                                                         const uint8_t *uuid128);
+uint8_t gatt_client_discover_characteristics_for_service_by_uuid128(btstack_packet_handler_t callback,
+                                                                    hci_con_handle_t con_handle,
+                                                                    gatt_client_service_t *service,
+                                                                    const uint8_t *uuid128);
+uint8_t gatt_client_write_value_of_characteristic(btstack_packet_handler_t callback,
+                                                  hci_con_handle_t con_handle,
+                                                  uint16_t value_handle,
+                                                  uint16_t value_length, uint8_t *value);
+uint8_t gatt_client_write_client_characteristic_configuration(btstack_packet_handler_t callback,
+                                                              hci_con_handle_t con_handle,
+                                                              gatt_client_characteristic_t *characteristic,
+                                                              uint16_t configuration);
+void gatt_client_listen_for_characteristic_value_updates(gatt_client_notification_t *notification,
+                                                         btstack_packet_handler_t callback,
+                                                         hci_con_handle_t con_handle,
+                                                         gatt_client_characteristic_t *characteristic);
+void gatt_client_stop_listening_for_characteristic_value_updates(gatt_client_notification_t *notification);
+
+#endif // __HOST_BTSTACK_H__
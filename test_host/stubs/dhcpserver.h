@@ -0,0 +1,33 @@
+/*
+ * dhcpserver.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __HOST_DHCPSERVER_H__
+#define __HOST_DHCPSERVER_H__
+
+#include "lwip/ip4_addr.h"
+
+typedef struct _dhcp_server_t {
+    ip4_addr_t ip;
+    ip4_addr_t nm;
+} dhcp_server_t;
+
+void dhcp_server_init(dhcp_server_t *d, ip4_addr_t *ip, ip4_addr_t *nm);
+void dhcp_server_deinit(dhcp_server_t *d);
+
+#endif // __HOST_DHCPSERVER_H__
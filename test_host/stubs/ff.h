@@ -0,0 +1,103 @@
+/*
+ * ff.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOST_FF_H__
+#define __HOST_FF_H__
+
+/*
+ * The parts of FatFS the firmware uses, on the RAM disk of fake_fatfs.c.
+ * Objects are laid out like in ff.h of FatFS R0.15 with ffconf.h of the
+ * firmware, so copies of a FIL behave the same as on the hardware.
+ */
+
+#include <stdint.h>
+
+#define FF_MAX_SS 512 // conf/ffconf.h
+
+typedef unsigned int UINT;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef uint32_t FSIZE_t;
+typedef uint32_t LBA_t;
+typedef char TCHAR;
+
+typedef struct {
+    WORD id; // changes with every mount
+} FATFS;
+
+typedef struct {
+    FATFS *fs;
+    WORD id; // of the mount it was opened on
+    BYTE attr;
+    BYTE stat;
+    DWORD sclust; // first cluster
+    FSIZE_t objsize;
+} FFOBJID;
+
+typedef struct {
+    FFOBJID obj;
+    BYTE flag;
+    BYTE err;
+    FSIZE_t fptr;
+    DWORD clust;
+    LBA_t sect; // sector held in buf, 0 when none
+    LBA_t dir_sect;
+    BYTE *dir_ptr;
+    BYTE buf[FF_MAX_SS];
+} FIL;
+
+typedef struct {
+    FSIZE_t fsize;
+    WORD fdate;
+    WORD ftime;
+    BYTE fattrib;
+    TCHAR fname[13];
+} FILINFO;
+
+typedef enum {
+    FR_OK = 0,
+    FR_DISK_ERR,
+    FR_INT_ERR,
+    FR_NOT_READY,
+    FR_NO_FILE,
+    FR_NO_PATH,
+    FR_INVALID_NAME,
+    FR_DENIED,
+    FR_EXIST,
+    FR_INVALID_OBJECT,
+    FR_WRITE_PROTECTED,
+    FR_INVALID_DRIVE,
+    FR_NOT_ENABLED,
+    FR_NO_FILESYSTEM,
+} FRESULT;
+
+#define FA_READ 0x01
+#define FA_WRITE 0x02
+#define FA_CREATE_ALWAYS 0x08
+
+#define f_size(fp) ((fp)->obj.objsize)
+
+FRESULT f_mount(FATFS *fs, const TCHAR *path, BYTE opt);
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode);
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br);
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw);
+FRESULT f_close(FIL *fp);
+FRESULT f_stat(const TCHAR *path, FILINFO *fno);
+
+#endif // __HOST_FF_H__
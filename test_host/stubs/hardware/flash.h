@@ -0,0 +1,36 @@
+/*
+ * flash.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOST_HARDWARE_FLASH_H__
+#define __HOST_HARDWARE_FLASH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+// only the end of the flash is emulated, see host.c
+#define HOST_FLASH_SIZE (64u * FLASH_SECTOR_SIZE)
+extern uint8_t host_flash[HOST_FLASH_SIZE];
+#define XIP_BASE ((uintptr_t)host_flash)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#endif // __HOST_HARDWARE_FLASH_H__
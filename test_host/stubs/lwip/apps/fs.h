@@ -0,0 +1,42 @@
+/*
+ * fs.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __HOST_LWIP_FS_H__
+#define __HOST_LWIP_FS_H__
+
+// file interface of httpd, with LWIP_HTTPD_CUSTOM_FILES and dynamic headers
+
+#define FS_READ_EOF -1
+
+#define FS_FILE_FLAGS_HEADER_INCLUDED 0x01
+#define FS_FILE_FLAGS_HEADER_PERSISTENT 0x02
+
+struct fs_file {
+    const char *data;
+    int len;
+    int index;
+    void *pextension;
+    unsigned char flags;
+};
+
+int fs_open_custom(struct fs_file *file, const char *name);
+int fs_read_custom(struct fs_file *file, char *buffer, int count);
+void fs_close_custom(struct fs_file *file);
+
+#endif // __HOST_LWIP_FS_H__
@@ -0,0 +1,50 @@
+/*
+ * httpd.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __HOST_LWIP_HTTPD_H__
+#define __HOST_LWIP_HTTPD_H__
+
+/*
+ * httpd itself is not part of the host build, the tests call the
+ * callbacks of http.c the way it would.
+ */
+
+#include "lwip/arch.h"
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+
+#define HTTPD_SERVER_PORT 80
+
+typedef const char *(*tCGIHandler)(int iIndex, int iNumParams, char *pcParam[], char *pcValue[]);
+
+typedef struct {
+    const char *pcCGIName;
+    tCGIHandler pfnCGIHandler;
+} tCGI;
+
+void http_set_cgi_handlers(const tCGI *pCGIs, int num_handlers);
+void httpd_init(void);
+
+err_t httpd_post_begin(void *connection, const char *uri, const char *http_request,
+                       u16_t http_request_len, int content_len, char *response_uri,
+                       u16_t response_uri_len, u8_t *post_auto_wnd);
+err_t httpd_post_receive_data(void *connection, struct pbuf *p);
+void httpd_post_finished(void *connection, char *response_uri, u16_t response_uri_len);
+
+#endif // __HOST_LWIP_HTTPD_H__
@@ -0,0 +1,42 @@
+/*
+ * ip4_addr.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __HOST_LWIP_IP4_ADDR_H__
+#define __HOST_LWIP_IP4_ADDR_H__
+
+#include "lwip/arch.h"
+
+// network byte order, like lwIP on the little endian RP2040
+typedef struct ip4_addr {
+    u32_t addr;
+} ip4_addr_t;
+
+// IPv4 only, as in lwipopts.h
+typedef ip4_addr_t ip_addr_t;
+
+#define IP4_ADDR(ipaddr, a, b, c, d) \
+    (ipaddr)->addr = ((u32_t)(a) | ((u32_t)(b) << 8) | ((u32_t)(c) << 16) | ((u32_t)(d) << 24))
+
+#define ip4_addr_cmp(a, b) ((a)->addr == (b)->addr)
+#define ip4_addr_get_u32(a) ((a)->addr)
+
+int ip4addr_aton(const char *cp, ip4_addr_t *addr);
+char *ip4addr_ntoa(const ip4_addr_t *addr);
+
+#endif // __HOST_LWIP_IP4_ADDR_H__
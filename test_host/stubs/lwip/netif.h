@@ -0,0 +1,34 @@
+/*
+ * netif.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __HOST_LWIP_NETIF_H__
+#define __HOST_LWIP_NETIF_H__
+
+#include "lwip/ip4_addr.h"
+
+struct netif {
+    ip4_addr_t ip_addr;
+};
+
+// address is set by fake_cyw43.c once a join went through
+extern struct netif *netif_default;
+
+#define netif_ip4_addr(netif) ((const ip4_addr_t *)&((netif)->ip_addr))
+
+#endif // __HOST_LWIP_NETIF_H__
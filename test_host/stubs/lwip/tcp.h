@@ -0,0 +1,87 @@
+/*
+ * tcp.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __HOST_LWIP_TCP_H__
+#define __HOST_LWIP_TCP_H__
+
+/*
+ * Raw TCP API of lwIP, as far as the firmware uses it.
+ * Implemented by fake_lwip.c, the remote end is driven by the tests.
+ */
+
+#include <stdbool.h>
+
+#include "lwip/arch.h"
+#include "lwip/def.h"
+#include "lwip/err.h"
+#include "lwip/ip4_addr.h"
+#include "lwip/pbuf.h"
+
+#define TCP_WRITE_FLAG_COPY 0x01
+#define TCP_WRITE_FLAG_MORE 0x02
+
+struct tcp_pcb;
+
+typedef err_t (*tcp_connected_fn)(void *arg, struct tcp_pcb *tpcb, err_t err);
+typedef err_t (*tcp_recv_fn)(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
+typedef err_t (*tcp_sent_fn)(void *arg, struct tcp_pcb *tpcb, u16_t len);
+typedef void (*tcp_err_fn)(void *arg, err_t err);
+
+#define FAKE_TCP_TX_LEN 8192 // sent, but not taken by the test yet
+
+// the firmware only reads local_port, the rest is state of fake_lwip.c
+struct tcp_pcb {
+    u16_t local_port;
+
+    bool used;
+    void *arg;
+    tcp_recv_fn recv;
+    tcp_sent_fn sent;
+    tcp_err_fn err;
+    tcp_connected_fn connected;
+
+    ip_addr_t ip;
+    u16_t port;
+    bool connecting;
+    bool established;
+
+    u16_t sndbuf;
+    u16_t unacked;
+    uint16_t queued; // written, but not output yet
+    uint16_t out; // output, but not taken by the test yet
+    char tx[FAKE_TCP_TX_LEN];
+};
+
+struct tcp_pcb *tcp_new(void);
+void tcp_arg(struct tcp_pcb *pcb, void *arg);
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv);
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent);
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err);
+
+err_t tcp_connect(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port,
+                  tcp_connected_fn connected);
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len, u8_t apiflags);
+err_t tcp_output(struct tcp_pcb *pcb);
+void tcp_recved(struct tcp_pcb *pcb, u16_t len);
+u16_t tcp_sndbuf(const struct tcp_pcb *pcb);
+
+err_t tcp_close(struct tcp_pcb *pcb);
+void tcp_abort(struct tcp_pcb *pcb);
+
+#endif // __HOST_LWIP_TCP_H__
@@ -0,0 +1,26 @@
+/*
+ * bootrom.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOST_PICO_BOOTROM_H__
+#define __HOST_PICO_BOOTROM_H__
+
+#include <stdint.h>
+
+void reset_usb_boot(uint32_t gpio_mask, uint32_t disable_interface_mask);
+
+#endif // __HOST_PICO_BOOTROM_H__
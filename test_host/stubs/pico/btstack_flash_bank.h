@@ -0,0 +1,27 @@
+/*
+ * btstack_flash_bank.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOST_PICO_BTSTACK_FLASH_BANK_H__
+#define __HOST_PICO_BTSTACK_FLASH_BANK_H__
+
+#include "hardware/flash.h"
+
+#define PICO_FLASH_BANK_TOTAL_SIZE (FLASH_SECTOR_SIZE * 2u)
+#define PICO_FLASH_BANK_STORAGE_OFFSET (HOST_FLASH_SIZE - PICO_FLASH_BANK_TOTAL_SIZE)
+
+#endif // __HOST_PICO_BTSTACK_FLASH_BANK_H__
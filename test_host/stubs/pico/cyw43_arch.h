@@ -0,0 +1,40 @@
+/*
+ * cyw43_arch.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOST_PICO_CYW43_ARCH_H__
+#define __HOST_PICO_CYW43_ARCH_H__
+
+#include "pico/stdlib.h"
+#include "cyw43.h"
+
+// recursive like the async_context lock, tests check it is balanced
+void cyw43_thread_enter(void);
+void cyw43_thread_exit(void);
+int cyw43_thread_depth(void);
+
+// same lock as in the SDK, lwIP runs in its context
+#define cyw43_arch_lwip_begin cyw43_thread_enter
+#define cyw43_arch_lwip_end cyw43_thread_exit
+
+// see fake_cyw43.c
+void cyw43_arch_enable_sta_mode(void);
+void cyw43_arch_disable_sta_mode(void);
+void cyw43_arch_enable_ap_mode(const char *ssid, const char *password, uint32_t auth);
+void cyw43_arch_disable_ap_mode(void);
+
+#endif // __HOST_PICO_CYW43_ARCH_H__
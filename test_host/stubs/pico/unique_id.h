@@ -0,0 +1,25 @@
+/*
+ * unique_id.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __HOST_PICO_UNIQUE_ID_H__
+#define __HOST_PICO_UNIQUE_ID_H__
+
+#define PICO_UNIQUE_BOARD_ID_SIZE_BYTES 8
+
+#endif // __HOST_PICO_UNIQUE_ID_H__
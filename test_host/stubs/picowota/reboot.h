@@ -0,0 +1,26 @@
+/*
+ * reboot.h
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __HOST_PICOWOTA_REBOOT_H__
+#define __HOST_PICOWOTA_REBOOT_H__
+
+#include <stdbool.h>
+
+void picowota_reboot(bool to_bootloader);
+
+#endif // __HOST_PICOWOTA_REBOOT_H__
@@ -0,0 +1,243 @@
+/*
+ * test_bench.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Protocol benchmark against the simulated devices of ble_sim.c, over
+ * the fake BTstack. Reports GATT round trips, simulated time and host
+ * time for discovery, the Volcano config page and every workflow on
+ * every device, with an ideal link and with a slow and lossy one.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "ble.h"
+#include "ble_sim.h"
+#include "config.h"
+#include "main.h"
+#include "mem.h"
+#include "vaporizer.h"
+#include "volcano.h"
+#include "workflow.h"
+#include "fake_btstack.h"
+#include "host.h"
+
+// simulated time a default workflow may take, with heat-up
+#define WF_MAX_MS (20 * 60 * 1000)
+
+static const uint8_t sb_data[] = { 0x00, 0x00, 'T', 'E', 'S', 'T', '0', '0', '0', '1' };
+
+static const struct fake_peripheral devices[] = {
+    {
+        .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x01 },
+        .name = "S&B VOLCANO H",
+        .data = sb_data,
+        .data_len = sizeof(sb_data),
+        .model = FAKE_MODEL_VOLCANO,
+        .adv_interval_ms = 100,
+        .advertising = true,
+    }, {
+        .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x02 },
+        .name = "STORZ&BICKEL",
+        .data = sb_data,
+        .data_len = sizeof(sb_data),
+        .model = FAKE_MODEL_CRAFTY,
+        .adv_interval_ms = 100,
+        .advertising = true,
+    }, {
+        .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x03 },
+        .name = "S&B VY000003",
+        .model = FAKE_MODEL_VENTY,
+        .adv_interval_ms = 100,
+        .advertising = true,
+    },
+};
+
+struct bench {
+    uint64_t sim_us;
+    uint64_t host_ns;
+    uint32_t ops;
+};
+
+static uint64_t host_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_start(struct bench *b) {
+    b->sim_us = host_time_us();
+    b->host_ns = host_ns();
+    b->ops = ble_round_trips();
+}
+
+static uint32_t bench_print(const struct bench *b, const char *name) {
+    uint32_t ops = ble_round_trips() - b->ops;
+    uint32_t sim_ms = (host_time_us() - b->sim_us) / 1000;
+    printf("  %-12s %5u round trips %8u ms simulated %8.2f ms host\n", name,
+           ops, sim_ms, (host_ns() - b->host_ns) / 1000000.0);
+    return ops;
+}
+
+static bool connect(const struct fake_peripheral *p) {
+    fake_bt_reset();
+    fake_bt_add(p);
+    ble_init();
+    sleep_ms(10);
+
+    bd_addr_t addr;
+    memcpy(addr, p->addr, sizeof(bd_addr_t));
+    ble_connect(addr, p->type);
+    for (uint t = 0; t < 1000; t++) {
+        if (ble_is_connected()) {
+            return true;
+        }
+        sleep_ms(1);
+        main_loop_hw();
+    }
+    return false;
+}
+
+static void bench_volcano(bool ideal) {
+    struct bench b;
+
+    CHECK(connect(&devices[0]));
+
+    bench_start(&b);
+    int8_t r = volcano_discover_characteristics(true, true);
+    uint32_t ops = bench_print(&b, "Discovery");
+    if (ideal) {
+        CHECK_EQ(r, 0);
+        CHECK(ops > 0);
+    }
+
+    // same requests as the Volcano config page
+    bench_start(&b);
+    char fw[VOLCANO_FW_LEN + 1];
+    struct volcano_snapshot snap;
+    volcano_invalidate();
+    int8_t r1 = volcano_snapshot(&snap);
+    int8_t r2 = volcano_get_firmware(fw);
+    int32_t r3 = volcano_get_runtime();
+    bench_print(&b, "Config page");
+    if (ideal) {
+        CHECK_EQ(r1, 0);
+        CHECK_EQ(r2, 0);
+        CHECK(r3 >= 0);
+    }
+
+    ble_disconnect();
+    sleep_ms(100);
+}
+
+static void bench_workflow(const struct fake_peripheral *p, uint16_t index, bool ideal) {
+    enum known_devices dev = models_filter_name(p->name);
+    const struct vaporizer_ops *ops = vaporizer_get(dev);
+    CHECK(ops != NULL);
+
+    CHECK(connect(p));
+    if (ops->discover) {
+        int8_t r = ops->discover();
+        if (ideal) {
+            CHECK(r >= 0);
+        }
+    }
+
+    struct bench b;
+    bench_start(&b);
+    wf_start(index, dev);
+    CHECK_EQ(wf_status().status, WF_RUNNING);
+    while ((wf_status().status != WF_IDLE)
+           && ((host_time_us() - b.sim_us) < (WF_MAX_MS * 1000ULL))) {
+        sleep_ms(1);
+        main_loop_hw();
+        wf_run();
+    }
+    printf("  %s, %s:\n", ops->name, wf_name(index));
+    bench_print(&b, "Workflow");
+
+    // ended after its last step, not stopped by an error or in time
+    CHECK_EQ(wf_status().status, WF_IDLE);
+    CHECK(!wf_status().error);
+    CHECK_EQ(wf_status().index, wf_steps(index) - 1);
+
+    ble_disconnect();
+    sleep_ms(100);
+}
+
+// wf_reset() must not wait for the request in flight, wf_run() drops it
+static void check_reset(const struct fake_peripheral *p) {
+    enum known_devices dev = models_filter_name(p->name);
+    CHECK(connect(p));
+
+    wf_start(0, dev);
+    for (uint t = 0; t < 200; t++) {
+        sleep_ms(1);
+        main_loop_hw();
+        wf_run();
+    }
+    CHECK_EQ(wf_status().status, WF_RUNNING);
+
+    uint64_t t = host_time_us();
+    wf_reset();
+    CHECK_EQ(host_time_us(), t);
+    CHECK_EQ(wf_status().status, WF_IDLE);
+
+    for (uint i = 0; i < 500; i++) {
+        sleep_ms(1);
+        main_loop_hw();
+        wf_run();
+    }
+    CHECK(volcano_get_runtime() >= 0);
+
+    ble_disconnect();
+    sleep_ms(100);
+}
+
+static void run(uint16_t latency, uint8_t loss) {
+    bool ideal = (loss == 0);
+    printf("Link: %u ms latency, %u %% loss\n", latency, loss);
+    ble_sim_set_link(latency, loss);
+
+    bench_volcano(ideal);
+
+    printf("Running all workflows on all devices\n");
+    for (uint i = 0; i < count_of(devices); i++) {
+        for (uint16_t wf = 0; wf < wf_count(); wf++) {
+            bench_workflow(&devices[i], wf, ideal);
+        }
+    }
+}
+
+int main(void) {
+    host_init();
+    mem_load_defaults();
+    CHECK(wf_count() > 0);
+
+    run(BLE_SIM_LATENCY_MS, 0);
+    check_reset(&devices[0]);
+
+    run(50, 5);
+
+    CHECK_EQ(fake_bt_stats()->gatt_rejected, 0);
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_bench");
+}
@@ -0,0 +1,220 @@
+/*
+ * test_ble_chars.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Goes through the whole ble_chars table with ble_char_read() and
+ * ble_char_write() on the fake devices, and checks the UUID each access
+ * arrives at against the ones listed below, written out independently
+ * of the UUID macros in ble_chars.c. Also the width and byte order of
+ * written values, and that disallowed accesses never go out.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "ble.h"
+#include "ble_chars.h"
+#include "ble_sim.h"
+#include "config.h"
+#include "main.h"
+#include "fake_btstack.h"
+#include "host.h"
+
+#define VOLCANO_UUID(x) x "-5354-4F52-5A26-4249434B454C"
+#define CRAFTY_UUID(x) x "-4C45-4B43-4942-265A524F5453"
+
+struct expected {
+    const char *uuid;
+    int model;
+    uint8_t width;
+    uint8_t access;
+};
+
+static const struct expected expected[CHAR_COUNT] = {
+    [CHAR_VOLCANO_FIRMWARE]     = { VOLCANO_UUID("10100003"), FAKE_MODEL_VOLCANO, 0, CHAR_READ },
+    [CHAR_VOLCANO_PRJSTAT1]     = { VOLCANO_UUID("1010000C"), FAKE_MODEL_VOLCANO, 4, CHAR_READ | CHAR_WRITE },
+    [CHAR_VOLCANO_PRJSTAT2]     = { VOLCANO_UUID("1010000D"), FAKE_MODEL_VOLCANO, 4, CHAR_READ | CHAR_WRITE },
+    [CHAR_VOLCANO_PRJSTAT3]     = { VOLCANO_UUID("1010000E"), FAKE_MODEL_VOLCANO, 4, CHAR_READ | CHAR_WRITE },
+    [CHAR_VOLCANO_CURRENT_TEMP] = { VOLCANO_UUID("10110001"), FAKE_MODEL_VOLCANO, 4, CHAR_READ },
+    [CHAR_VOLCANO_TARGET_TEMP]  = { VOLCANO_UUID("10110003"), FAKE_MODEL_VOLCANO, 4, CHAR_READ | CHAR_WRITE },
+    [CHAR_VOLCANO_BRIGHTNESS]   = { VOLCANO_UUID("10110005"), FAKE_MODEL_VOLCANO, 2, CHAR_READ | CHAR_WRITE },
+    [CHAR_VOLCANO_SHUTOFF_TIME] = { VOLCANO_UUID("1011000D"), FAKE_MODEL_VOLCANO, 2, CHAR_READ | CHAR_WRITE },
+    [CHAR_VOLCANO_HEATER_ON]    = { VOLCANO_UUID("1011000F"), FAKE_MODEL_VOLCANO, 1, CHAR_WRITE },
+    [CHAR_VOLCANO_HEATER_OFF]   = { VOLCANO_UUID("10110010"), FAKE_MODEL_VOLCANO, 1, CHAR_WRITE },
+    [CHAR_VOLCANO_PUMP_ON]      = { VOLCANO_UUID("10110013"), FAKE_MODEL_VOLCANO, 1, CHAR_WRITE },
+    [CHAR_VOLCANO_PUMP_OFF]     = { VOLCANO_UUID("10110014"), FAKE_MODEL_VOLCANO, 1, CHAR_WRITE },
+    [CHAR_VOLCANO_HEAT_HOURS]   = { VOLCANO_UUID("10110015"), FAKE_MODEL_VOLCANO, 4, CHAR_READ },
+    [CHAR_VOLCANO_HEAT_MINUTES] = { VOLCANO_UUID("10110016"), FAKE_MODEL_VOLCANO, 2, CHAR_READ },
+
+    [CHAR_CRAFTY_CURRENT_TEMP]  = { CRAFTY_UUID("00000011"), FAKE_MODEL_CRAFTY, 2, CHAR_READ },
+    [CHAR_CRAFTY_TARGET_TEMP]   = { CRAFTY_UUID("00000021"), FAKE_MODEL_CRAFTY, 2, CHAR_READ | CHAR_WRITE },
+    [CHAR_CRAFTY_BATTERY]       = { CRAFTY_UUID("00000041"), FAKE_MODEL_CRAFTY, 2, CHAR_READ },
+    [CHAR_CRAFTY_HEATER_ON]     = { CRAFTY_UUID("00000081"), FAKE_MODEL_CRAFTY, 2, CHAR_WRITE },
+    [CHAR_CRAFTY_HEATER_OFF]    = { CRAFTY_UUID("00000091"), FAKE_MODEL_CRAFTY, 2, CHAR_WRITE },
+
+    [CHAR_VENTY_CMD]            = { VOLCANO_UUID("00000001"), FAKE_MODEL_VENTY, 0, CHAR_WRITE | CHAR_NOTIFY },
+};
+
+static const struct fake_peripheral devices[] = {
+    [FAKE_MODEL_VOLCANO] = {
+        .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x01 },
+        .name = "S&B VOLCANO H",
+        .model = FAKE_MODEL_VOLCANO,
+        .advertising = true,
+    },
+    [FAKE_MODEL_CRAFTY] = {
+        .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x02 },
+        .name = "STORZ&BICKEL",
+        .model = FAKE_MODEL_CRAFTY,
+        .advertising = true,
+    },
+    [FAKE_MODEL_VENTY] = {
+        .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x03 },
+        .name = "S&B VY000003",
+        .model = FAKE_MODEL_VENTY,
+        .advertising = true,
+    },
+};
+
+static bool connect(int model) {
+    fake_bt_reset();
+    ble_sim_set_link(BLE_SIM_LATENCY_MS, 0);
+    fake_bt_add(&devices[model]);
+    ble_init();
+    sleep_ms(10);
+
+    bd_addr_t addr;
+    memcpy(addr, devices[model].addr, sizeof(bd_addr_t));
+    ble_connect(addr, devices[model].type);
+    for (uint t = 0; t < 1000; t++) {
+        if (ble_is_connected()) {
+            return true;
+        }
+        sleep_ms(1);
+        main_loop_hw();
+    }
+    return false;
+}
+
+static bool arrived(enum ble_char_id id, bool write) {
+    const struct fake_gatt_access *a = fake_bt_last_access();
+    const char *uuid = uuid128_to_str(a->uuid);
+    if ((a->write != write) || (strcmp(uuid, expected[id].uuid) != 0)) {
+        printf("%s %s arrived as %s %s\n", ble_chars[id].name, write ? "write" : "read",
+               a->write ? "write" : "read", uuid);
+        return false;
+    }
+    return true;
+}
+
+static void check_read(enum ble_char_id id) {
+    uint32_t requests = fake_bt_stats()->gatt_requests;
+
+    int32_t r;
+    if (expected[id].width == 0) {
+        uint8_t buff[32];
+        r = ble_char_read_raw(id, buff, sizeof(buff));
+    } else {
+        uint32_t v;
+        r = ble_char_read(id, &v);
+    }
+
+    if (expected[id].access & CHAR_READ) {
+        CHECK(r >= 0);
+        CHECK(arrived(id, false));
+    } else {
+        CHECK(r < 0);
+        CHECK_EQ(fake_bt_stats()->gatt_requests, requests);
+    }
+}
+
+static void check_write(enum ble_char_id id) {
+    uint32_t requests = fake_bt_stats()->gatt_requests;
+
+    // wider than any value, to see the truncation and byte order
+    int8_t r;
+    uint8_t raw[20] = { 6 }; // Venty interface command, changing nothing
+    if (expected[id].width == 0) {
+        r = ble_char_write_raw(id, raw, sizeof(raw));
+    } else {
+        r = ble_char_write(id, 0x04030201);
+    }
+
+    if (!(expected[id].access & CHAR_WRITE)) {
+        CHECK(r < 0);
+        CHECK_EQ(fake_bt_stats()->gatt_requests, requests);
+        return;
+    }
+
+    CHECK_EQ(r, 0);
+    CHECK(arrived(id, true));
+
+    const struct fake_gatt_access *a = fake_bt_last_access();
+    if (expected[id].width == 0) {
+        CHECK_EQ(a->len, sizeof(raw));
+        CHECK(memcmp(a->data, raw, sizeof(raw)) == 0);
+    } else {
+        CHECK_EQ(a->len, expected[id].width);
+        for (uint i = 0; i < a->len; i++) {
+            CHECK_EQ(a->data[i], i + 1);
+        }
+    }
+}
+
+static void test_table(void) {
+    for (uint id = 0; id < CHAR_COUNT; id++) {
+        CHECK(expected[id].uuid != NULL);
+        CHECK(ble_chars[id].name != NULL);
+        CHECK_EQ(ble_chars[id].width, expected[id].width);
+        CHECK_EQ(ble_chars[id].access, expected[id].access);
+        CHECK(ble_chars[id].big_endian == false);
+
+        // UUIDs are unique, so the fake can tell them apart
+        CHECK_EQ(ble_char_find(ble_chars[id].uuid), id);
+    }
+    CHECK_EQ(ble_char_find(ble_chars[CHAR_VENTY_CMD].service), CHAR_INVALID);
+}
+
+static void test_model(int model) {
+    CHECK(connect(model));
+
+    for (uint id = 0; id < CHAR_COUNT; id++) {
+        if (expected[id].model != model) {
+            continue;
+        }
+        check_read(id);
+        check_write(id);
+    }
+
+    ble_disconnect();
+    sleep_ms(100);
+}
+
+int main(void) {
+    host_init();
+
+    test_table();
+    test_model(FAKE_MODEL_VOLCANO);
+    test_model(FAKE_MODEL_CRAFTY);
+    test_model(FAKE_MODEL_VENTY);
+
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_ble_chars");
+}
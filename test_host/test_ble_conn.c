@@ -0,0 +1,365 @@
+/*
+ * test_ble_conn.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per-connection bookkeeping of ble.c, driven by the fake HCI event
+ * stream of fake_btstack.c: several links at once, switching between
+ * them, eviction, and links that go away while a request is waiting.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "ble.h"
+#include "ble_chars.h"
+#include "ble_sim.h"
+#include "config.h"
+#include "main.h"
+#include "fake_btstack.h"
+#include "host.h"
+
+static const uint8_t sb_data[] = { 0x00, 0x00, 'T', 'E', 'S', 'T', '0', '0', '0', '1' };
+
+static const struct fake_peripheral volcano = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x01 },
+    .rssi = -40,
+    .name = "S&B VOLCANO H",
+    .data = sb_data,
+    .data_len = sizeof(sb_data),
+    .model = FAKE_MODEL_VOLCANO,
+    .adv_interval_ms = 100,
+    .advertising = true,
+};
+
+static const struct fake_peripheral crafty = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x02 },
+    .rssi = -50,
+    .name = "STORZ&BICKEL",
+    .data = sb_data,
+    .data_len = sizeof(sb_data),
+    .model = FAKE_MODEL_CRAFTY,
+    .adv_interval_ms = 150,
+    .advertising = true,
+};
+
+static const struct fake_peripheral venty = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x03 },
+    .rssi = -60,
+    .name = "S&B VY000003",
+    .model = FAKE_MODEL_VENTY,
+    .adv_interval_ms = 200,
+    .advertising = true,
+};
+
+static const struct fake_peripheral volcano2 = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x04 },
+    .rssi = -70,
+    .name = "S&B VOLCANO H",
+    .data = sb_data,
+    .data_len = sizeof(sb_data),
+    .model = FAKE_MODEL_VOLCANO,
+    .adv_interval_ms = 100,
+    .advertising = true,
+};
+
+static int dev_volcano, dev_crafty, dev_venty, dev_volcano2;
+
+static void setup(void) {
+    // never more than one GATT request per link
+    CHECK_EQ(fake_bt_stats()->gatt_rejected, 0);
+
+    fake_bt_reset();
+    ble_sim_set_link(BLE_SIM_LATENCY_MS, 0);
+    host_loop_hook = NULL;
+
+    dev_volcano = fake_bt_add(&volcano);
+    dev_crafty = fake_bt_add(&crafty);
+    dev_venty = fake_bt_add(&venty);
+    dev_volcano2 = fake_bt_add(&volcano2);
+
+    ble_init();
+    sleep_ms(10);
+    CHECK(ble_is_ready());
+}
+
+static bool connect(const struct fake_peripheral *p, uint32_t timeout_ms) {
+    bd_addr_t addr;
+    memcpy(addr, p->addr, sizeof(bd_addr_t));
+    ble_connect(addr, p->type);
+
+    for (uint32_t t = 0; t < timeout_ms; t++) {
+        if (ble_is_connected() && ble_is_connected_to(addr)) {
+            return true;
+        }
+        sleep_ms(1);
+        main_loop_hw();
+    }
+    return false;
+}
+
+static int32_t read_char(enum ble_char_id id, uint8_t *buff, uint16_t len) {
+    return ble_read(ble_chars[id].uuid, buff, len);
+}
+
+static void test_switch(void) {
+    setup();
+
+    CHECK(connect(&volcano, 1000));
+    uint32_t id_volcano = ble_get_connection_id();
+    CHECK(id_volcano != 0);
+
+    uint8_t buff[BLE_MAX_VALUE_LEN];
+    CHECK_EQ(read_char(CHAR_VOLCANO_CURRENT_TEMP, buff, sizeof(buff)), 4);
+
+    // second link, first one stays up in the background
+    CHECK(connect(&crafty, 1000));
+    uint32_t id_crafty = ble_get_connection_id();
+    CHECK(id_crafty != id_volcano);
+    CHECK(fake_bt_connected(dev_volcano));
+    CHECK(fake_bt_connected(dev_crafty));
+    CHECK_EQ(read_char(CHAR_CRAFTY_CURRENT_TEMP, buff, sizeof(buff)), 2);
+
+    // requests go to the active link only
+    CHECK(read_char(CHAR_VOLCANO_CURRENT_TEMP, buff, sizeof(buff)) < 0);
+
+    // switching back is instant, no new connection
+    uint32_t connects = fake_bt_stats()->gap_connects;
+    CHECK(connect(&volcano, 1));
+    CHECK_EQ(fake_bt_stats()->gap_connects, connects);
+    CHECK_EQ(ble_get_connection_id(), id_volcano);
+    CHECK_EQ(read_char(CHAR_VOLCANO_CURRENT_TEMP, buff, sizeof(buff)), 4);
+}
+
+static void test_evict(void) {
+    setup();
+
+    CHECK(connect(&volcano, 1000));
+    sleep_ms(10);
+    CHECK(connect(&crafty, 1000));
+    sleep_ms(10);
+    CHECK(connect(&venty, 1000));
+    sleep_ms(10);
+
+    // volcano was used most recently, crafty is dropped
+    CHECK(connect(&volcano, 1));
+    sleep_ms(10);
+    CHECK(connect(&volcano2, 1000));
+    sleep_ms(100);
+
+    CHECK_EQ(fake_bt_stats()->disconnects, 1);
+    CHECK(!fake_bt_connected(dev_crafty));
+    CHECK(fake_bt_connected(dev_volcano));
+    CHECK(fake_bt_connected(dev_venty));
+    CHECK(fake_bt_connected(dev_volcano2));
+
+    bd_addr_t addr;
+    memcpy(addr, crafty.addr, sizeof(bd_addr_t));
+    CHECK(!ble_is_connected_to(addr));
+}
+
+static void test_background_loss(void) {
+    setup();
+
+    CHECK(connect(&volcano, 1000));
+    CHECK(connect(&crafty, 1000));
+
+    // background link times out, active one is not affected
+    fake_bt_drop(dev_volcano);
+    sleep_ms(500);
+
+    bd_addr_t addr;
+    memcpy(addr, volcano.addr, sizeof(bd_addr_t));
+    CHECK(!ble_is_connected_to(addr));
+    CHECK(ble_is_connected());
+
+    uint8_t buff[BLE_MAX_VALUE_LEN];
+    CHECK_EQ(read_char(CHAR_CRAFTY_CURRENT_TEMP, buff, sizeof(buff)), 2);
+}
+
+static void test_poll_after_switch(void) {
+    setup();
+
+    CHECK(connect(&volcano, 1000));
+    CHECK(connect(&crafty, 1000));
+    CHECK(connect(&volcano, 1));
+
+    // answer belongs to the link the read was started on
+    CHECK_EQ(ble_read_start(ble_chars[CHAR_VOLCANO_CURRENT_TEMP].uuid), 0);
+    CHECK(connect(&crafty, 1));
+
+    uint8_t buff[BLE_MAX_VALUE_LEN];
+    int32_t r = 0;
+    for (uint t = 0; (t < 2000) && (r == 0); t++) {
+        sleep_ms(1);
+        r = ble_read_poll(buff, sizeof(buff));
+    }
+    CHECK_EQ(r, 4);
+
+    // and the new active link is still usable
+    CHECK_EQ(read_char(CHAR_CRAFTY_CURRENT_TEMP, buff, sizeof(buff)), 2);
+}
+
+static uint64_t hook_start = 0;
+static bool hook_dropped = false;
+static bool hook_reconnected = false;
+
+// link to the Volcano goes away while ble_read() waits, its slot is re-used
+static void hook_reuse(void) {
+    uint64_t t = host_time_us() - hook_start;
+
+    if (!hook_dropped && (t >= 100000)) {
+        hook_dropped = true;
+        fake_bt_drop(dev_volcano);
+    }
+
+    bd_addr_t addr;
+    memcpy(addr, volcano.addr, sizeof(bd_addr_t));
+    if (hook_dropped && !hook_reconnected && !ble_is_connected_to(addr) && !fake_bt_connected(dev_volcano)) {
+        hook_reconnected = true;
+        memcpy(addr, crafty.addr, sizeof(bd_addr_t));
+        ble_connect(addr, crafty.type);
+    }
+}
+
+static void test_timeout_reused_slot(void) {
+    setup();
+
+    // slow to connect, so the attempt is still pending after the read timeout
+    fake_bt_advertise(dev_crafty, false);
+
+    CHECK(connect(&volcano, 1000));
+
+    // response would arrive after the read timeout
+    ble_sim_set_link(3000, 0);
+    hook_start = host_time_us();
+    hook_dropped = false;
+    hook_reconnected = false;
+    host_loop_hook = hook_reuse;
+
+    uint8_t buff[BLE_MAX_VALUE_LEN];
+    CHECK(read_char(CHAR_VOLCANO_CURRENT_TEMP, buff, sizeof(buff)) < 0);
+    CHECK(hook_reconnected);
+
+    // gave up when the link was gone, not after the timeout
+    CHECK((host_time_us() - hook_start) < 1000000);
+
+    host_loop_hook = NULL;
+    ble_sim_set_link(BLE_SIM_LATENCY_MS, 0);
+    sleep_ms(2000);
+    fake_bt_advertise(dev_crafty, true);
+
+    // the new link in the same slot was left alone, so it connects
+    bool connected = false;
+    for (uint t = 0; (t < 1000) && !connected; t++) {
+        sleep_ms(1);
+        connected = ble_is_connected();
+    }
+    CHECK(connected);
+    CHECK(fake_bt_connected(dev_crafty));
+    CHECK_EQ(read_char(CHAR_CRAFTY_CURRENT_TEMP, buff, sizeof(buff)), 2);
+}
+
+static void test_cancel_then_connect(void) {
+    setup();
+
+    // never connects, so the attempt is still pending
+    fake_bt_advertise(dev_crafty, false);
+    bd_addr_t addr;
+    memcpy(addr, crafty.addr, sizeof(bd_addr_t));
+    ble_connect(addr, crafty.type);
+    sleep_ms(50);
+    CHECK(!ble_is_connected());
+    CHECK_EQ(fake_bt_stats()->gap_connects, 1);
+
+    // cancelled first, the new attempt waits for its connection complete
+    CHECK(connect(&volcano, 1000));
+    CHECK_EQ(fake_bt_stats()->connect_cancels, 1);
+    CHECK_EQ(fake_bt_stats()->gap_connects, 2);
+    CHECK_EQ(fake_bt_stats()->connect_rejected, 0);
+    CHECK(!ble_is_connected_to(addr));
+
+    // switching again while the cancel is pending replaces the waiting one
+    fake_bt_advertise(dev_venty, false);
+    memcpy(addr, venty.addr, sizeof(bd_addr_t));
+    ble_connect(addr, venty.type);
+    CHECK_EQ(fake_bt_stats()->gap_connects, 3);
+    memcpy(addr, crafty.addr, sizeof(bd_addr_t));
+    ble_connect(addr, crafty.type);
+    memcpy(addr, volcano2.addr, sizeof(bd_addr_t));
+    ble_connect(addr, volcano2.type);
+    CHECK_EQ(fake_bt_stats()->connect_cancels, 2);
+
+    bool connected = false;
+    for (uint t = 0; (t < 1000) && !connected; t++) {
+        sleep_ms(1);
+        connected = ble_is_connected() && ble_is_connected_to(addr);
+    }
+    CHECK(connected);
+    CHECK_EQ(fake_bt_stats()->gap_connects, 4);
+    CHECK_EQ(fake_bt_stats()->connect_rejected, 0);
+    CHECK(!fake_bt_connected(dev_venty));
+
+    // and known devices after a cancelled attempt
+    fake_bt_advertise(dev_crafty, false);
+    memcpy(addr, crafty.addr, sizeof(bd_addr_t));
+    ble_connect(addr, crafty.type);
+    ble_disconnect();
+    CHECK(!ble_is_connected());
+    struct known_device known_list[1] = {0};
+    memcpy(known_list[0].addr, crafty.addr, sizeof(bd_addr_t));
+    known_list[0].dev = DEV_CRAFTY;
+    CHECK(ble_connect_known(known_list, 1) < 0);
+    sleep_ms(10);
+    CHECK_EQ(ble_connect_known(known_list, 1), 0);
+    CHECK_EQ(fake_bt_stats()->connect_rejected, 0);
+}
+
+static void test_timeout(void) {
+    setup();
+
+    CHECK(connect(&volcano, 1000));
+
+    // lost responses time out, link stays usable
+    ble_sim_set_link(BLE_SIM_LATENCY_MS, 100);
+    uint8_t buff[BLE_MAX_VALUE_LEN];
+    CHECK(read_char(CHAR_VOLCANO_CURRENT_TEMP, buff, sizeof(buff)) < 0);
+    CHECK_EQ(ble_write(ble_chars[CHAR_VOLCANO_HEATER_ON].service,
+                       ble_chars[CHAR_VOLCANO_HEATER_ON].uuid, buff, 1), -3);
+
+    ble_sim_set_link(BLE_SIM_LATENCY_MS, 0);
+    CHECK(ble_is_connected());
+    CHECK_EQ(read_char(CHAR_VOLCANO_CURRENT_TEMP, buff, sizeof(buff)), 4);
+}
+
+int main(void) {
+    host_init();
+
+    test_switch();
+    test_evict();
+    test_background_loss();
+    test_poll_after_switch();
+    test_timeout_reused_slot();
+    test_cancel_then_connect();
+    test_timeout();
+
+    CHECK_EQ(fake_bt_stats()->gatt_rejected, 0);
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_ble_conn");
+}
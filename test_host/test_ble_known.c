@@ -0,0 +1,234 @@
+/*
+ * test_ble_known.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reconnecting to previously used devices through the accept list,
+ * and how that interacts with connections started by the user.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "ble.h"
+#include "ble_chars.h"
+#include "ble_sim.h"
+#include "config.h"
+#include "main.h"
+#include "models.h"
+#include "fake_btstack.h"
+#include "host.h"
+
+static const uint8_t sb_data[] = { 0x00, 0x00, 'T', 'E', 'S', 'T', '0', '0', '0', '1' };
+
+static const struct fake_peripheral volcano = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x01 },
+    .rssi = -40,
+    .name = "S&B VOLCANO H",
+    .data = sb_data,
+    .data_len = sizeof(sb_data),
+    .model = FAKE_MODEL_VOLCANO,
+    .adv_interval_ms = 100,
+    .advertising = false,
+};
+
+static const struct fake_peripheral crafty = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x02 },
+    .rssi = -50,
+    .name = "STORZ&BICKEL",
+    .data = sb_data,
+    .data_len = sizeof(sb_data),
+    .model = FAKE_MODEL_CRAFTY,
+    .adv_interval_ms = 150,
+    .advertising = false,
+};
+
+static int dev_volcano, dev_crafty;
+static struct known_device known[2];
+
+static void setup(void) {
+    CHECK_EQ(fake_bt_stats()->gatt_rejected, 0);
+    CHECK_EQ(fake_bt_stats()->connect_rejected, 0);
+
+    fake_bt_reset();
+    ble_sim_set_link(BLE_SIM_LATENCY_MS, 0);
+
+    dev_volcano = fake_bt_add(&volcano);
+    dev_crafty = fake_bt_add(&crafty);
+
+    // most recent first
+    memcpy(known[0].addr, crafty.addr, sizeof(bd_addr_t));
+    known[0].type = crafty.type;
+    known[0].dev = DEV_CRAFTY;
+    memcpy(known[1].addr, volcano.addr, sizeof(bd_addr_t));
+    known[1].type = volcano.type;
+    known[1].dev = DEV_VOLCANO;
+
+    ble_init();
+    sleep_ms(10);
+    CHECK(ble_is_ready());
+}
+
+static bool wait_connected(const struct fake_peripheral *p, uint32_t timeout_ms) {
+    bd_addr_t addr;
+    memcpy(addr, p->addr, sizeof(bd_addr_t));
+    for (uint32_t t = 0; t < timeout_ms; t++) {
+        if (ble_is_connected() && ble_is_connected_to(addr)) {
+            return true;
+        }
+        sleep_ms(1);
+        main_loop_hw();
+    }
+    return false;
+}
+
+static bool is_active(const struct fake_peripheral *p) {
+    bd_addr_t addr;
+    if (ble_get_active_addr(addr) < 0) {
+        return false;
+    }
+    return memcmp(addr, p->addr, sizeof(bd_addr_t)) == 0;
+}
+
+static void test_first_advertiser(void) {
+    setup();
+
+    ble_scan(BLE_SCAN_ON);
+    CHECK_EQ(ble_connect_known(known, 2), 0);
+    CHECK_EQ(fake_bt_stats()->whitelist_connects, 1);
+    CHECK_EQ(fake_bt_stats()->gap_connects, 0);
+
+    // a second attempt while one is pending is refused
+    CHECK(ble_connect_known(known, 2) < 0);
+
+    // nobody around yet
+    sleep_ms(1000);
+    CHECK(!ble_is_connected());
+
+    // whoever shows up first wins, not the first in the list
+    fake_bt_advertise(dev_volcano, true);
+    CHECK(wait_connected(&volcano, 1000));
+    CHECK(is_active(&volcano));
+    CHECK_EQ(fake_bt_stats()->gap_connects, 0);
+
+    // listed with the model from the known list, it never advertised to us
+    struct ble_scan_result results[BLE_MAX_SCAN_RESULTS];
+    int32_t n = ble_get_scan_results(results, BLE_MAX_SCAN_RESULTS);
+    bool found = false;
+    for (int32_t i = 0; i < n; i++) {
+        if (memcmp(results[i].addr, volcano.addr, sizeof(bd_addr_t)) == 0) {
+            found = true;
+            CHECK_EQ(results[i].dev, DEV_VOLCANO);
+        }
+    }
+    CHECK(found);
+
+    uint8_t buff[BLE_MAX_VALUE_LEN];
+    CHECK_EQ(ble_read(ble_chars[CHAR_VOLCANO_CURRENT_TEMP].uuid, buff, sizeof(buff)), 4);
+
+    // connected devices are left out of the accept list
+    CHECK_EQ(ble_connect_known(known + 1, 1), -4);
+    ble_scan(BLE_SCAN_OFF);
+}
+
+static void test_cancel(void) {
+    setup();
+
+    CHECK_EQ(ble_connect_known(known, 2), 0);
+    ble_connect_known_cancel();
+    CHECK_EQ(fake_bt_stats()->connect_cancels, 1);
+    sleep_ms(10);
+
+    // cancelled attempt does not connect anymore
+    fake_bt_advertise(dev_crafty, true);
+    sleep_ms(1000);
+    CHECK(!ble_is_connected());
+    CHECK(!fake_bt_connected(dev_crafty));
+
+    // and can be started again afterwards
+    CHECK_EQ(ble_connect_known(known, 2), 0);
+    CHECK(wait_connected(&crafty, 1000));
+}
+
+static void test_user_connect(void) {
+    setup();
+
+    // user picks a device while known devices are still pending
+    CHECK_EQ(ble_connect_known(known, 2), 0);
+    fake_bt_advertise(dev_volcano, true);
+
+    bd_addr_t addr;
+    memcpy(addr, volcano.addr, sizeof(bd_addr_t));
+    ble_connect(addr, volcano.type);
+    CHECK_EQ(fake_bt_stats()->connect_cancels, 1);
+
+    // only once the controller reported the cancelled attempt
+    CHECK_EQ(fake_bt_stats()->gap_connects, 0);
+    CHECK(wait_connected(&volcano, 1000));
+    CHECK_EQ(fake_bt_stats()->gap_connects, 1);
+    sleep_ms(100);
+    CHECK(is_active(&volcano));
+    CHECK_EQ(fake_bt_stats()->connect_rejected, 0);
+
+    // known device showing up later is not connected behind our back
+    fake_bt_advertise(dev_crafty, true);
+    sleep_ms(1000);
+    CHECK(!fake_bt_connected(dev_crafty));
+    CHECK(is_active(&volcano));
+}
+
+static void test_reconnect(void) {
+    setup();
+
+    fake_bt_advertise(dev_crafty, true);
+    CHECK_EQ(ble_connect_known(known, 2), 0);
+    CHECK(wait_connected(&crafty, 1000));
+    uint32_t id = ble_get_connection_id();
+
+    // link times out
+    fake_bt_drop(dev_crafty);
+    sleep_ms(500);
+    CHECK(!ble_is_connected());
+    CHECK(!fake_bt_connected(dev_crafty));
+
+    // peripheral comes back in range later
+    fake_bt_advertise(dev_crafty, true);
+
+    CHECK_EQ(ble_connect_known(known, 2), 0);
+    CHECK(wait_connected(&crafty, 1000));
+    CHECK(ble_get_connection_id() != id);
+    CHECK_EQ(fake_bt_stats()->whitelist_connects, 2);
+
+    uint8_t buff[BLE_MAX_VALUE_LEN];
+    CHECK_EQ(ble_read(ble_chars[CHAR_CRAFTY_CURRENT_TEMP].uuid, buff, sizeof(buff)), 2);
+}
+
+int main(void) {
+    host_init();
+
+    test_first_advertiser();
+    test_cancel();
+    test_user_connect();
+    test_reconnect();
+
+    CHECK_EQ(fake_bt_stats()->gatt_rejected, 0);
+    CHECK_EQ(fake_bt_stats()->connect_rejected, 0);
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_ble_known");
+}
@@ -0,0 +1,195 @@
+/*
+ * test_ble_profile.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Connection parameters ble.c asks the controller for, per profile and
+ * for links in the background, and the MTU it keeps after the exchange
+ * started right when a link comes up.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "ble.h"
+#include "ble_sim.h"
+#include "config.h"
+#include "main.h"
+#include "fake_btstack.h"
+#include "host.h"
+
+static const struct fake_peripheral volcano = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x01 },
+    .rssi = -40,
+    .name = "S&B VOLCANO H",
+    .model = FAKE_MODEL_VOLCANO,
+    .adv_interval_ms = 100,
+    .advertising = true,
+};
+
+static const struct fake_peripheral crafty = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x02 },
+    .rssi = -50,
+    .name = "STORZ&BICKEL",
+    .model = FAKE_MODEL_CRAFTY,
+    .adv_interval_ms = 100,
+    .advertising = true,
+    .mtu = 185,
+};
+
+static int dev_volcano, dev_crafty;
+
+// 1.25ms and 10ms units, see profiles[] in ble.c
+static const struct fake_conn_params idle = { 80, 160, 4, 600, 0 };
+static const struct fake_conn_params interactive = { 6, 24, 0, 200, 0 };
+
+static bool same(const struct fake_conn_params *a, const struct fake_conn_params *b) {
+    if ((a->interval_min != b->interval_min) || (a->interval_max != b->interval_max)
+            || (a->latency != b->latency) || (a->timeout != b->timeout)) {
+        printf("params %u-%u %u %u, expected %u-%u %u %u\n",
+               a->interval_min, a->interval_max, a->latency, a->timeout,
+               b->interval_min, b->interval_max, b->latency, b->timeout);
+        return false;
+    }
+    return true;
+}
+
+static void setup(void) {
+    fake_bt_reset();
+    ble_sim_set_link(BLE_SIM_LATENCY_MS, 0);
+
+    dev_volcano = fake_bt_add(&volcano);
+    dev_crafty = fake_bt_add(&crafty);
+
+    ble_init();
+    sleep_ms(10);
+    CHECK(ble_is_ready());
+}
+
+static bool connect(const struct fake_peripheral *p) {
+    bd_addr_t addr;
+    memcpy(addr, p->addr, sizeof(bd_addr_t));
+    ble_connect(addr, p->type);
+
+    for (uint32_t t = 0; t < 1000; t++) {
+        if (ble_is_connected() && ble_is_connected_to(addr)) {
+            return true;
+        }
+        sleep_ms(1);
+        main_loop_hw();
+    }
+    return false;
+}
+
+static void test_initial(void) {
+    setup();
+
+    // new links always start out interactive
+    CHECK(same(fake_bt_initial_params(), &interactive));
+
+    ble_set_profile(BLE_PROFILE_INTERACTIVE);
+    CHECK(connect(&volcano));
+    CHECK(same(fake_bt_conn_params(dev_volcano), &interactive));
+    sleep_ms(1000);
+    CHECK_EQ(fake_bt_conn_params(dev_volcano)->updates, 0);
+}
+
+static void test_switch_profile(void) {
+    setup();
+
+    // menus only need an idle link
+    ble_set_profile(BLE_PROFILE_IDLE);
+    CHECK(connect(&volcano));
+    sleep_ms(10);
+    CHECK(same(fake_bt_conn_params(dev_volcano), &idle));
+    CHECK_EQ(fake_bt_conn_params(dev_volcano)->updates, 1);
+
+    // device screen
+    ble_set_profile(BLE_PROFILE_INTERACTIVE);
+    CHECK(same(fake_bt_conn_params(dev_volcano), &interactive));
+    CHECK_EQ(fake_bt_conn_params(dev_volcano)->updates, 2);
+
+    // same profile again is not sent to the controller
+    ble_set_profile(BLE_PROFILE_INTERACTIVE);
+    CHECK_EQ(fake_bt_conn_params(dev_volcano)->updates, 2);
+
+    ble_set_profile(BLE_PROFILE_IDLE);
+    CHECK(same(fake_bt_conn_params(dev_volcano), &idle));
+    CHECK_EQ(fake_bt_conn_params(dev_volcano)->updates, 3);
+
+    // invalid ones are ignored
+    ble_set_profile(BLE_PROFILE_COUNT);
+    CHECK_EQ(fake_bt_conn_params(dev_volcano)->updates, 3);
+}
+
+static void test_background(void) {
+    setup();
+
+    ble_set_profile(BLE_PROFILE_INTERACTIVE);
+    CHECK(connect(&volcano));
+    sleep_ms(100);
+    CHECK(same(fake_bt_conn_params(dev_volcano), &interactive));
+
+    // link left in the background goes idle, the new one is interactive
+    CHECK(connect(&crafty));
+    sleep_ms(100);
+    CHECK(same(fake_bt_conn_params(dev_volcano), &idle));
+    CHECK(same(fake_bt_conn_params(dev_crafty), &interactive));
+
+    // and back
+    CHECK(connect(&volcano));
+    CHECK(same(fake_bt_conn_params(dev_volcano), &interactive));
+    CHECK(same(fake_bt_conn_params(dev_crafty), &idle));
+}
+
+static void test_mtu(void) {
+    setup();
+
+    CHECK_EQ(ble_get_mtu(), 0);
+
+    // default until the exchange started on connect is answered
+    CHECK(connect(&volcano));
+    CHECK_EQ(ble_get_mtu(), ATT_DEFAULT_MTU);
+    sleep_ms(BLE_SIM_LATENCY_MS + 10);
+    CHECK_EQ(ble_get_mtu(), 247);
+
+    // per link
+    CHECK(connect(&crafty));
+    sleep_ms(BLE_SIM_LATENCY_MS + 10);
+    CHECK_EQ(ble_get_mtu(), 185);
+    CHECK(connect(&volcano));
+    CHECK_EQ(ble_get_mtu(), 247);
+
+    // gone with the link
+    ble_disconnect();
+    sleep_ms(100);
+    CHECK_EQ(ble_get_mtu(), 0);
+}
+
+int main(void) {
+    host_init();
+
+    test_initial();
+    test_switch_profile();
+    test_background();
+    test_mtu();
+
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_ble_profile");
+}
@@ -0,0 +1,238 @@
+/*
+ * test_crafty_poll.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Schedule of the Crafty background poll. The scheduler runs on its own
+ * virtual clock, stepped by the test, while the reads it starts go to
+ * the fake Crafty on the host clock. Checks the staggered start, the
+ * gap between reads, the rate of each value over a longer run, and that
+ * crafty_poll_run() itself never waits for the link.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "ble.h"
+#include "ble_chars.h"
+#include "ble_sim.h"
+#include "config.h"
+#include "crafty.h"
+#include "main.h"
+#include "fake_btstack.h"
+#include "host.h"
+
+#define RUN_MS (5 * 60 * 1000)
+#define STEP_MS 10
+
+static const struct fake_peripheral crafty = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x02 },
+    .name = "STORZ&BICKEL",
+    .model = FAKE_MODEL_CRAFTY,
+    .adv_interval_ms = 100,
+    .advertising = true,
+};
+
+static uint32_t virt = 0;
+
+static uint32_t virt_clock(void) {
+    return virt;
+}
+
+// started reads per characteristic, and when
+static uint32_t reads[CHAR_COUNT];
+static uint32_t last_read_t = 0;
+static uint32_t min_gap = UINT32_MAX;
+static uint32_t requests = 0;
+
+static void count_reads(void) {
+    uint32_t n = fake_bt_stats()->gatt_requests;
+    if (n == requests) {
+        return;
+    }
+    CHECK_EQ(n - requests, 1);
+    requests = n;
+
+    enum ble_char_id id = ble_char_find(fake_bt_last_access()->uuid);
+    CHECK(id < CHAR_COUNT);
+    if (id < CHAR_COUNT) {
+        reads[id]++;
+    }
+
+    uint32_t total = reads[CHAR_CRAFTY_CURRENT_TEMP] + reads[CHAR_CRAFTY_TARGET_TEMP]
+                     + reads[CHAR_CRAFTY_BATTERY];
+    if (total > 1) {
+        min_gap = MIN(min_gap, virt - last_read_t);
+    }
+    last_read_t = virt;
+}
+
+// one scheduler call, then the link catches up on the host clock
+static void poll(void) {
+    uint64_t t = host_time_us();
+    crafty_poll_run();
+    CHECK_EQ(host_time_us(), t);
+    count_reads();
+
+    sleep_ms(BLE_SIM_LATENCY_MS + 1);
+    main_loop_hw();
+}
+
+static void setup(void) {
+    fake_bt_reset();
+    ble_sim_set_link(BLE_SIM_LATENCY_MS, 0);
+    fake_bt_add(&crafty);
+    ble_init();
+    sleep_ms(10);
+
+    bd_addr_t addr;
+    memcpy(addr, crafty.addr, sizeof(bd_addr_t));
+    ble_connect(addr, crafty.type);
+    for (uint t = 0; (t < 1000) && !ble_is_connected(); t++) {
+        sleep_ms(1);
+        main_loop_hw();
+    }
+    CHECK(ble_is_connected());
+    CHECK_EQ(crafty_discover(), 0);
+
+    memset(reads, 0, sizeof(reads));
+    min_gap = UINT32_MAX;
+    requests = fake_bt_stats()->gatt_requests;
+
+    virt = 100000;
+    crafty_poll_set_clock(virt_clock);
+    crafty_poll_start();
+}
+
+static void teardown(void) {
+    crafty_poll_set_clock(NULL);
+    ble_disconnect();
+    sleep_ms(100);
+}
+
+static void test_start(void) {
+    setup();
+
+    // temperature right away, completed by the next call
+    int16_t v;
+    poll();
+    CHECK_EQ(reads[CHAR_CRAFTY_CURRENT_TEMP], 1);
+    CHECK_EQ(crafty_get_state().updates, 0);
+    CHECK(crafty_get_cached(VAP_CURRENT_TEMP, &v) < 0);
+    poll();
+    CHECK_EQ(crafty_get_state().updates, 1);
+    CHECK(crafty_get_state().current_temp > 0);
+    CHECK_EQ(crafty_get_cached(VAP_CURRENT_TEMP, &v), 0);
+    CHECK_EQ(v, crafty_get_state().current_temp);
+    CHECK(crafty_get_cached(VAP_TARGET_TEMP, &v) < 0);
+
+    // nothing else until the gap is over
+    for (uint i = 0; i < 10; i++) {
+        poll();
+    }
+    virt += CRAFTY_POLL_GAP_MS - 1;
+    poll();
+    CHECK_EQ(requests, fake_bt_stats()->gatt_requests);
+    CHECK_EQ(reads[CHAR_CRAFTY_TARGET_TEMP], 0);
+
+    // then the others, one gap apart
+    virt += 1;
+    poll();
+    poll();
+    CHECK_EQ(reads[CHAR_CRAFTY_TARGET_TEMP], 1);
+    virt += CRAFTY_POLL_GAP_MS;
+    poll();
+    poll();
+    CHECK_EQ(reads[CHAR_CRAFTY_BATTERY], 1);
+    CHECK_EQ(crafty_get_state().updates, 3);
+    CHECK_EQ(crafty_get_state().errors, 0);
+
+    teardown();
+}
+
+static void test_rates(void) {
+    setup();
+
+    uint32_t end = virt + RUN_MS;
+    while (virt < end) {
+        poll();
+        virt += STEP_MS;
+    }
+
+    printf("  %lu temperature, %lu target, %lu battery reads, %lu ms apart at least\n",
+           reads[CHAR_CRAFTY_CURRENT_TEMP], reads[CHAR_CRAFTY_TARGET_TEMP],
+           reads[CHAR_CRAFTY_BATTERY], min_gap);
+
+    // never in a burst
+    CHECK(min_gap >= CRAFTY_POLL_GAP_MS);
+
+    // each at its own rate, a little slower as the interval starts after the read
+    uint32_t max_temp = RUN_MS / CRAFTY_POLL_TEMP_MS;
+    CHECK(reads[CHAR_CRAFTY_CURRENT_TEMP] <= max_temp);
+    CHECK(reads[CHAR_CRAFTY_CURRENT_TEMP] >= (max_temp * 9 / 10));
+
+    uint32_t max_target = RUN_MS / CRAFTY_POLL_TARGET_MS;
+    CHECK(reads[CHAR_CRAFTY_TARGET_TEMP] <= max_target);
+    CHECK(reads[CHAR_CRAFTY_TARGET_TEMP] >= (max_target * 9 / 10));
+
+    uint32_t max_battery = RUN_MS / CRAFTY_POLL_BATTERY_MS;
+    CHECK(reads[CHAR_CRAFTY_BATTERY] <= max_battery);
+    CHECK(reads[CHAR_CRAFTY_BATTERY] >= (max_battery - 1));
+
+    CHECK_EQ(crafty_get_state().errors, 0);
+    CHECK_EQ(fake_bt_stats()->gatt_rejected, 0);
+
+    teardown();
+}
+
+static void test_busy(void) {
+    setup();
+
+    // link is busy with a request of someone else
+    CHECK_EQ(ble_char_read_start(CHAR_CRAFTY_BATTERY), 0);
+    crafty_poll_run();
+    CHECK_EQ(crafty_get_state().errors, 1);
+
+    uint32_t v;
+    while (ble_char_read_poll(CHAR_CRAFTY_BATTERY, &v) == 0) {
+        sleep_ms(1);
+        main_loop_hw();
+    }
+
+    // same entry again, after the gap
+    uint32_t r = reads[CHAR_CRAFTY_CURRENT_TEMP];
+    poll();
+    CHECK_EQ(reads[CHAR_CRAFTY_CURRENT_TEMP], r);
+    virt += CRAFTY_POLL_GAP_MS;
+    poll();
+    CHECK_EQ(reads[CHAR_CRAFTY_CURRENT_TEMP], r + 1);
+
+    teardown();
+}
+
+int main(void) {
+    host_init();
+
+    test_start();
+    test_rates();
+    test_busy();
+
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_crafty_poll");
+}
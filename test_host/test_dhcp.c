@@ -0,0 +1,359 @@
+/*
+ * test_dhcp.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * DHCP responder and frame queue of the USB network interface, without
+ * TinyUSB. Requests are built byte by byte like a host would send them:
+ * the offer and acknowledge of a lease, a NAK for an address that is not
+ * handed out, requests meant for another server, and messages with
+ * options cut off by the end of the packet. The queue is filled past its
+ * end and checked to keep order and references of the frames it holds.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "lwip/def.h"
+#include "config.h"
+#include "tx_queue.h"
+#include "usb_dhcp.h"
+#include "fake_lwip.h"
+#include "host.h"
+
+static const uint8_t chaddr[6] = { 0x02, 0x56, 0x52, 0x43, 0x00, 0x01 };
+static const uint8_t magic[4] = { 0x63, 0x82, 0x53, 0x63 };
+
+static struct usb_dhcp_link usb_link;
+
+static uint8_t req[DHCP_MAX_LEN];
+static uint16_t req_len;
+static uint8_t reply[DHCP_REPLY_LEN];
+
+// fixed part of a request from the host, options follow with option()
+static void request(uint8_t type) {
+    memset(req, 0, sizeof(req));
+    req[0] = 1; // op: request
+    req[1] = 1; // htype: ethernet
+    req[2] = 6; // hlen
+    req[4] = 0xDE; // xid
+    req[5] = 0xAD;
+    req[6] = 0xBE;
+    req[7] = 0xEF;
+    req[10] = 0x80; // broadcast flag
+    memcpy(req + 28, chaddr, sizeof(chaddr));
+    memcpy(req + 236, magic, sizeof(magic));
+    req_len = DHCP_OPTIONS;
+
+    req[req_len++] = DHCP_OPT_TYPE;
+    req[req_len++] = 1;
+    req[req_len++] = type;
+}
+
+static void option(uint8_t code, const void *data, uint8_t len) {
+    req[req_len++] = code;
+    req[req_len++] = len;
+    memcpy(req + req_len, data, len);
+    req_len += len;
+}
+
+static void end(void) {
+    req[req_len++] = DHCP_OPT_END;
+}
+
+// type of the reply, 0 if there is none
+static uint8_t answer(void) {
+    memset(reply, 0xAA, sizeof(reply));
+    uint16_t len = usb_dhcp_reply(&usb_link, req, req_len, reply);
+    if (len == 0) {
+        return 0;
+    }
+    CHECK_EQ(len, DHCP_REPLY_LEN);
+
+    const uint8_t *type = usb_dhcp_option(reply, len, DHCP_OPT_TYPE, 1);
+    CHECK(type != NULL);
+    return (type != NULL) ? *type : 0;
+}
+
+static bool reply_has(uint8_t code, const void *data, uint8_t len) {
+    const uint8_t *o = usb_dhcp_option(reply, sizeof(reply), code, len);
+    return (o != NULL) && (o[-1] == len) && (memcmp(o, data, len) == 0);
+}
+
+static void check_header(bool lease) {
+    CHECK_EQ(reply[0], 2);
+    CHECK_EQ(reply[1], 1);
+    CHECK_EQ(reply[2], 6);
+    CHECK(memcmp(reply + 4, req + 4, 4) == 0);
+    CHECK_EQ(reply[10], 0x80);
+    CHECK(memcmp(reply + 28, chaddr, sizeof(chaddr)) == 0);
+    CHECK(memcmp(reply + 236, magic, sizeof(magic)) == 0);
+    CHECK(reply_has(DHCP_OPT_SERVER_ID, &usb_link.server.addr, 4));
+
+    ip4_addr_t zero = { 0 };
+    CHECK(memcmp(reply + 16, lease ? &usb_link.host.addr : &zero.addr, 4) == 0);
+    CHECK(memcmp(reply + 20, lease ? &usb_link.server.addr : &zero.addr, 4) == 0);
+
+    uint32_t time = lwip_htonl(USB_NET_LEASE_S);
+    CHECK_EQ(reply_has(DHCP_OPT_LEASE_TIME, &time, 4), lease);
+    CHECK_EQ(reply_has(DHCP_OPT_MASK, &usb_link.mask.addr, 4), lease);
+}
+
+static void test_lease(void) {
+    request(DHCP_DISCOVER);
+    end();
+    CHECK_EQ(answer(), DHCP_OFFER);
+    check_header(true);
+
+    // selecting the offer
+    request(DHCP_REQUEST);
+    option(DHCP_OPT_SERVER_ID, &usb_link.server.addr, 4);
+    option(DHCP_OPT_REQUESTED_IP, &usb_link.host.addr, 4);
+    end();
+    CHECK_EQ(answer(), DHCP_ACK);
+    check_header(true);
+
+    // renewing, from ciaddr
+    request(DHCP_REQUEST);
+    memcpy(req + 12, &usb_link.host.addr, 4);
+    end();
+    CHECK_EQ(answer(), DHCP_ACK);
+
+    // padding in between
+    request(DHCP_REQUEST);
+    req[req_len++] = 0;
+    req[req_len++] = 0;
+    option(DHCP_OPT_REQUESTED_IP, &usb_link.host.addr, 4);
+    end();
+    CHECK_EQ(answer(), DHCP_ACK);
+
+    // no other messages are answered
+    request(4); // DECLINE
+    end();
+    CHECK_EQ(answer(), 0);
+    request(7); // RELEASE
+    end();
+    CHECK_EQ(answer(), 0);
+}
+
+static void test_nak(void) {
+    // still remembers an address from somewhere else
+    ip4_addr_t other;
+    IP4_ADDR(&other, 192, 168, 0, 23);
+    request(DHCP_REQUEST);
+    option(DHCP_OPT_REQUESTED_IP, &other.addr, 4);
+    end();
+    CHECK_EQ(answer(), DHCP_NAK);
+    check_header(false);
+
+    request(DHCP_REQUEST);
+    memcpy(req + 12, &other.addr, 4);
+    end();
+    CHECK_EQ(answer(), DHCP_NAK);
+
+    // neither option nor ciaddr
+    request(DHCP_REQUEST);
+    end();
+    CHECK_EQ(answer(), DHCP_NAK);
+
+    // option wins over ciaddr
+    request(DHCP_REQUEST);
+    memcpy(req + 12, &usb_link.host.addr, 4);
+    option(DHCP_OPT_REQUESTED_IP, &other.addr, 4);
+    end();
+    CHECK_EQ(answer(), DHCP_NAK);
+}
+
+static void test_foreign_server(void) {
+    // host selected the offer of the wifi access point, or another one
+    ip4_addr_t other;
+    IP4_ADDR(&other, 192, 168, 4, 1);
+    request(DHCP_REQUEST);
+    option(DHCP_OPT_SERVER_ID, &other.addr, 4);
+    option(DHCP_OPT_REQUESTED_IP, &usb_link.host.addr, 4);
+    end();
+    CHECK_EQ(answer(), 0);
+
+    // not even a NAK for an address that is not ours
+    request(DHCP_REQUEST);
+    option(DHCP_OPT_SERVER_ID, &other.addr, 4);
+    option(DHCP_OPT_REQUESTED_IP, &other.addr, 4);
+    end();
+    CHECK_EQ(answer(), 0);
+
+    // too short to be an address
+    request(DHCP_REQUEST);
+    option(DHCP_OPT_SERVER_ID, &other.addr, 2);
+    option(DHCP_OPT_REQUESTED_IP, &usb_link.host.addr, 4);
+    end();
+    CHECK_EQ(answer(), DHCP_ACK);
+}
+
+static void test_truncated(void) {
+    // not even the fixed part
+    request(DHCP_DISCOVER);
+    end();
+    uint16_t full = req_len;
+    req_len = DHCP_OPTIONS - 1;
+    CHECK_EQ(answer(), 0);
+
+    // no options at all
+    req_len = DHCP_OPTIONS;
+    CHECK_EQ(answer(), 0);
+
+    // type without its value
+    req_len = DHCP_OPTIONS + 1;
+    CHECK_EQ(answer(), 0);
+    req_len = DHCP_OPTIONS + 2;
+    CHECK_EQ(answer(), 0);
+
+    // without end option is fine
+    req_len = full - 1;
+    CHECK_EQ(answer(), DHCP_OFFER);
+
+    // type behind an option running past the end
+    request(DHCP_DISCOVER);
+    req_len = DHCP_OPTIONS;
+    req[req_len++] = 12; // host name
+    req[req_len++] = 200;
+    req[req_len++] = 'x';
+    req[req_len++] = DHCP_OPT_TYPE;
+    req[req_len++] = 1;
+    req[req_len++] = DHCP_DISCOVER;
+    CHECK_EQ(answer(), 0);
+
+    // requested address cut off, so the empty ciaddr is used
+    request(DHCP_REQUEST);
+    option(DHCP_OPT_REQUESTED_IP, &usb_link.host.addr, 4);
+    req_len -= 2;
+    CHECK_EQ(answer(), DHCP_NAK);
+
+    // and too short to be one
+    request(DHCP_REQUEST);
+    memcpy(req + 12, &usb_link.host.addr, 4);
+    option(DHCP_OPT_REQUESTED_IP, &usb_link.host.addr, 3);
+    end();
+    CHECK_EQ(answer(), DHCP_ACK);
+
+    // nothing read past the length, the rest of req is still valid
+    request(DHCP_DISCOVER);
+    req_len = DHCP_OPTIONS;
+    req[req_len++] = 0;
+    CHECK(usb_dhcp_option(req, req_len, DHCP_OPT_TYPE, 1) == NULL);
+    CHECK_EQ(answer(), 0);
+
+    // not a BOOTP request
+    request(DHCP_DISCOVER);
+    end();
+    req[0] = 2;
+    CHECK_EQ(answer(), 0);
+    request(DHCP_DISCOVER);
+    end();
+    req[239] = 0;
+    CHECK_EQ(answer(), 0);
+}
+
+static struct pbuf *frame(uint8_t n) {
+    char data[64];
+    memset(data, n, sizeof(data));
+    return fake_pbuf_alloc(data, sizeof(data), 0);
+}
+
+static void test_queue(void) {
+    static struct tx_queue q = {0};
+    uint32_t pbufs = fake_tcp_stats()->pbufs;
+
+    struct pbuf *frames[USB_NET_TX_QUEUE + 1];
+    for (uint i = 0; i < count_of(frames); i++) {
+        frames[i] = frame(i);
+    }
+    CHECK(tx_queue_peek(&q) == NULL);
+    CHECK(tx_queue_pop(&q) == NULL);
+
+    for (uint i = 0; i < USB_NET_TX_QUEUE; i++) {
+        CHECK_EQ(tx_queue_push(&q, frames[i]), ERR_OK);
+    }
+    CHECK_EQ(q.count, USB_NET_TX_QUEUE);
+    CHECK_EQ(q.peak, USB_NET_TX_QUEUE);
+
+    // full, the frame stays with lwIP
+    CHECK_EQ(tx_queue_push(&q, frames[USB_NET_TX_QUEUE]), ERR_MEM);
+    CHECK_EQ(frames[USB_NET_TX_QUEUE]->ref, 1);
+    CHECK_EQ(q.count, USB_NET_TX_QUEUE);
+
+    // queue keeps them after lwIP let go
+    for (uint i = 0; i < count_of(frames); i++) {
+        pbuf_free(frames[i]);
+    }
+    CHECK_EQ(fake_tcp_stats()->pbufs - pbufs, USB_NET_TX_QUEUE);
+
+    // in order, also after wrapping around
+    for (uint i = 0; i < (USB_NET_TX_QUEUE / 2); i++) {
+        struct pbuf *p = tx_queue_pop(&q);
+        CHECK(p == frames[i]);
+        pbuf_free(p);
+    }
+    for (uint i = 0; i < (USB_NET_TX_QUEUE / 2); i++) {
+        struct pbuf *p = frame(100 + i);
+        CHECK_EQ(tx_queue_push(&q, p), ERR_OK);
+        pbuf_free(p);
+    }
+    CHECK(tx_queue_push(&q, frames[0]) == ERR_MEM);
+    CHECK_EQ(q.peak, USB_NET_TX_QUEUE);
+
+    for (uint i = 0; i < USB_NET_TX_QUEUE; i++) {
+        struct pbuf *p = tx_queue_peek(&q);
+        CHECK(p == tx_queue_pop(&q));
+        uint8_t n = ((const uint8_t *)p->payload)[0];
+        CHECK_EQ(n, (i < (USB_NET_TX_QUEUE / 2)) ? (i + (USB_NET_TX_QUEUE / 2))
+                                                 : (100 + i - (USB_NET_TX_QUEUE / 2)));
+        pbuf_free(p);
+    }
+    CHECK_EQ(q.count, 0);
+    CHECK_EQ(fake_tcp_stats()->pbufs, pbufs);
+
+    // link down with frames left
+    for (uint i = 0; i < 3; i++) {
+        struct pbuf *p = frame(i);
+        CHECK_EQ(tx_queue_push(&q, p), ERR_OK);
+        pbuf_free(p);
+    }
+    CHECK_EQ(tx_queue_drop(&q), 3);
+    CHECK_EQ(tx_queue_drop(&q), 0);
+    CHECK(tx_queue_peek(&q) == NULL);
+    CHECK_EQ(fake_tcp_stats()->pbufs, pbufs);
+}
+
+int main(void) {
+    host_init();
+
+    // same as usb_net_init()
+    ip4addr_aton(USB_NET_IP, &usb_link.server);
+    IP4_ADDR(&usb_link.mask, 255, 255, 255, 0);
+    usb_link.host.addr = lwip_htonl(lwip_ntohl(usb_link.server.addr) + 1);
+
+    test_lease();
+    test_nak();
+    test_foreign_server();
+    test_truncated();
+    test_queue();
+
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_dhcp");
+}
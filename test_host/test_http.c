@@ -0,0 +1,521 @@
+/*
+ * test_http.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Files of the debug disk served by http.c, from the RAM disk of
+ * fake_fatfs.c through the callbacks httpd would call. Checks how reads
+ * are cut to sector boundaries, at the start of a file, with buffers of
+ * exactly one sector, one byte more, and the end of a file in the middle
+ * of a buffer. Also the cache of open files: copies of a cached FIL,
+ * without its sector buffer, read what the host wrote after a remount,
+ * and evicted handles are closed. Then the headers: ETags, weak ones of
+ * files on the disk and strong ones of the embedded files, If-None-Match
+ * lists and 304 Not Modified responses.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "lwip/apps/fs.h"
+#include "lwip/apps/httpd.h"
+#include "lwip/tcp.h"
+#include "lwip_hooks.h"
+#include "api.h"
+#include "config.h"
+#include "debug_disk.h"
+#include "http.h"
+#include "fake_fatfs.h"
+#include "fake_lwip.h"
+#include "host.h"
+
+#define SECTOR FF_MAX_SS
+
+const struct http_etag http_fsdata_etags[] = {
+    { "/index.html", 0x1234ABCD },
+    { NULL, 0 },
+};
+
+// the API has its own tests, nothing of it is found here
+bool api_open(struct api_doc *d, const char *name) {
+    (void)d;
+    (void)name;
+    return false;
+}
+
+int api_read(struct api_doc *d, char *buff, size_t len) {
+    (void)d;
+    (void)buff;
+    (void)len;
+    return 0;
+}
+
+bool api_post_begin(const char *uri) {
+    (void)uri;
+    return false;
+}
+
+void api_post_data(const char *data, size_t len) {
+    (void)data;
+    (void)len;
+}
+
+const char *api_post_end(void) {
+    return API_START_FILE;
+}
+
+struct response {
+    char data[4 * SECTOR];
+    int len;
+    int header_len; // -1 until it is complete
+
+    // lengths returned by fs_read_custom() for the body
+    int reads[16];
+    int count;
+};
+
+static struct response res;
+static struct tcp_pcb server = { .local_port = HTTPD_SERVER_PORT };
+
+static void fill(char *buff, uint32_t len, char seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        buff[i] = seed + (i % 23);
+    }
+}
+
+// segment with the request, seen by the lwip hook before httpd gets it
+static void request(const char *req) {
+    struct pbuf *p = fake_pbuf_alloc(req, strlen(req), 16);
+    CHECK_EQ(http_tcp_in(&server, p), ERR_OK);
+    pbuf_free(p);
+}
+
+// like httpd, reads of count bytes until the end
+static bool serve_request(const char *name, int count, const char *req) {
+    memset(&res, 0, sizeof(res));
+    request(req);
+
+    struct fs_file file;
+    if (fs_open_custom(&file, name) == 0) {
+        return false;
+    }
+    res.header_len = (file.flags & FS_FILE_FLAGS_HEADER_INCLUDED) ? -1 : 0;
+
+    int n;
+    while ((n = fs_read_custom(&file, res.data + res.len, count)) != FS_READ_EOF) {
+        CHECK(n > 0);
+        CHECK(n <= count);
+        CHECK((res.len + n) < (int)sizeof(res.data));
+        if ((res.header_len >= 0) && (res.count < (int)count_of(res.reads))) {
+            res.reads[res.count++] = n;
+        }
+        res.len += n;
+
+        const char *end = strstr(res.data, "\r\n\r\n");
+        if ((res.header_len < 0) && (end != NULL)) {
+            res.header_len = end + 4 - res.data;
+            CHECK_EQ(res.header_len, res.len);
+        }
+    }
+    CHECK(res.header_len >= 0);
+    CHECK_EQ(res.len, file.len);
+    fs_close_custom(&file);
+    return true;
+}
+
+static bool serve(const char *name, int count) {
+    char req[128];
+    snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: pico\r\n\r\n", name);
+    return serve_request(name, count, req);
+}
+
+// request with If-None-Match
+static bool serve_match(const char *name, const char *match) {
+    char req[192];
+    snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: pico\r\nIf-None-Match: %s\r\n\r\n",
+             name, match);
+    return serve_request(name, SECTOR, req);
+}
+
+static bool status_is(const char *status) {
+    return strncmp(res.data, status, strlen(status)) == 0;
+}
+
+static uint32_t etag(void) {
+    const char *s = strstr(res.data, "ETag: ");
+    CHECK(s != NULL);
+    s = (s != NULL) ? strchr(s, '"') : NULL;
+    return (s != NULL) ? strtoul(s + 1, NULL, 16) : 0;
+}
+
+static bool body_is(const char *data, int len) {
+    return ((res.len - res.header_len) == len)
+           && (memcmp(res.data + res.header_len, data, len) == 0);
+}
+
+static void test_chunk_len(void) {
+    // nothing left
+    CHECK_EQ(http_chunk_len(0, 0, SECTOR), 0);
+    CHECK_EQ(http_chunk_len(3 * SECTOR, 0, SECTOR), 0);
+
+    // exactly one buffer, with and without more to come
+    CHECK_EQ(http_chunk_len(0, SECTOR, SECTOR), SECTOR);
+    CHECK_EQ(http_chunk_len(0, 4 * SECTOR, SECTOR), SECTOR);
+    CHECK_EQ(http_chunk_len(SECTOR, 4 * SECTOR, SECTOR), SECTOR);
+
+    // one byte more than a sector, the rest is read the next time
+    CHECK_EQ(http_chunk_len(0, 4 * SECTOR, SECTOR + 1), SECTOR);
+    CHECK_EQ(http_chunk_len(0, SECTOR + 1, SECTOR + 1), SECTOR + 1);
+    CHECK_EQ(http_chunk_len(SECTOR, 4 * SECTOR, (2 * SECTOR) + 1), 2 * SECTOR);
+
+    // unaligned position, up to the next boundary
+    CHECK_EQ(http_chunk_len(100, 4 * SECTOR, SECTOR), SECTOR - 100);
+    CHECK_EQ(http_chunk_len(100, 4 * SECTOR, SECTOR + 1), SECTOR - 100);
+    CHECK_EQ(http_chunk_len(100, 4 * SECTOR, (2 * SECTOR) - 100), (2 * SECTOR) - 100);
+
+    // buffer too small to reach one, taken as it is
+    CHECK_EQ(http_chunk_len(100, 4 * SECTOR, 300), 300);
+    CHECK_EQ(http_chunk_len(0, 4 * SECTOR, SECTOR - 1), SECTOR - 1);
+
+    // end of the file in the middle of the buffer
+    CHECK_EQ(http_chunk_len(0, 700, 2 * SECTOR), 700);
+    CHECK_EQ(http_chunk_len(2 * SECTOR, 10, SECTOR), 10);
+    CHECK_EQ(http_chunk_len(100, SECTOR - 50, SECTOR), SECTOR - 50);
+}
+
+static void test_stream(void) {
+    static char data[(2 * SECTOR) + 276];
+    fill(data, sizeof(data), 'A');
+    fake_fs_reset();
+    CHECK(fake_fs_write("stream.bin", data, sizeof(data)));
+
+    // one byte more than a sector, whole sectors go straight to the buffer
+    CHECK(serve("/stream.bin", SECTOR + 1));
+    CHECK(body_is(data, sizeof(data)));
+    CHECK_EQ(res.count, 3);
+    CHECK_EQ(res.reads[0], SECTOR);
+    CHECK_EQ(res.reads[1], SECTOR);
+    CHECK_EQ(res.reads[2], 276);
+    CHECK_EQ(fake_fs_stats()->direct_reads, 2);
+    CHECK_EQ(fake_fs_stats()->sector_reads, 1);
+
+    // exactly one sector
+    CHECK(serve("/stream.bin", SECTOR));
+    CHECK(body_is(data, sizeof(data)));
+    CHECK_EQ(res.count, 3);
+    CHECK_EQ(res.reads[2], 276);
+    CHECK_EQ(fake_fs_stats()->direct_reads, 4);
+    CHECK_EQ(fake_fs_stats()->sector_reads, 2);
+
+    // smaller, cut at each boundary, every sector once through the FIL buffer
+    CHECK(serve("/stream.bin", 200));
+    CHECK(body_is(data, sizeof(data)));
+    CHECK_EQ(res.count, 8);
+    CHECK_EQ(res.reads[2], SECTOR - 400);
+    CHECK_EQ(res.reads[5], SECTOR - 400);
+    CHECK_EQ(res.reads[7], 276 - 200);
+    CHECK_EQ(fake_fs_stats()->direct_reads, 4);
+    CHECK_EQ(fake_fs_stats()->sector_reads, 2 + 3);
+
+    // ends where the buffer does
+    static char even[2 * SECTOR];
+    fill(even, sizeof(even), 'a');
+    CHECK(fake_fs_write("even.bin", even, sizeof(even)));
+    CHECK(serve("/even.bin", SECTOR));
+    CHECK(body_is(even, sizeof(even)));
+    CHECK_EQ(res.count, 2);
+
+    // empty, only the header
+    CHECK(fake_fs_write("empty.txt", "", 0));
+    CHECK(serve("/empty.txt", SECTOR));
+    CHECK(body_is("", 0));
+    CHECK_EQ(res.count, 0);
+}
+
+static void test_remount(void) {
+    static char v1[700], v2[(2 * SECTOR) + 100], v3[900], other[SECTOR];
+    fill(v1, sizeof(v1), '1');
+    fill(v2, sizeof(v2), '2');
+    fill(v3, sizeof(v3), '3');
+    fill(other, sizeof(other), 'o');
+
+    fake_fs_reset();
+    CHECK(fake_fs_write("a.txt", v1, sizeof(v1)));
+    CHECK(fake_fs_write("b.txt", other, sizeof(other)));
+
+    CHECK(serve("/a.txt", SECTOR));
+    CHECK(body_is(v1, sizeof(v1)));
+    uint32_t tag = etag();
+    CHECK_EQ(fake_fs_stats()->mounts, 1);
+    CHECK_EQ(fake_fs_stats()->opens, 1);
+
+    // copy of the cached FIL, the sector buffer still holds b.txt
+    CHECK(serve("/b.txt", SECTOR));
+    uint32_t reads = fake_fs_stats()->sector_reads;
+    CHECK(serve("/a.txt", SECTOR));
+    CHECK(body_is(v1, sizeof(v1)));
+    CHECK_EQ(etag(), tag);
+    CHECK_EQ(fake_fs_stats()->opens, 2);
+    CHECK_EQ(fake_fs_stats()->sector_reads, reads + 1);
+
+    // host writes more than fits, the file moves to other clusters
+    CHECK(fake_fs_write("a.txt", v2, sizeof(v2)));
+    CHECK(serve("/a.txt", SECTOR));
+    CHECK_EQ(fake_fs_stats()->mounts, 2);
+    CHECK_EQ(fake_fs_stats()->opens, 3);
+    CHECK(body_is(v2, sizeof(v2)));
+    CHECK(etag() != tag);
+    tag = etag();
+
+    CHECK(serve("/a.txt", SECTOR + 1));
+    CHECK(body_is(v2, sizeof(v2)));
+    CHECK_EQ(fake_fs_stats()->opens, 3);
+
+    // in place, same first cluster
+    CHECK(fake_fs_write("a.txt", v3, sizeof(v3)));
+    CHECK(serve("/a.txt", SECTOR));
+    CHECK_EQ(fake_fs_stats()->mounts, 3);
+    CHECK(body_is(v3, sizeof(v3)));
+    CHECK(etag() != tag);
+
+    // while it is being sent
+    struct fs_file file;
+    char buff[SECTOR];
+    CHECK_EQ(fs_open_custom(&file, "/a.txt"), 1);
+    CHECK(fs_read_custom(&file, buff, sizeof(buff)) > 0);
+    CHECK(fake_fs_write("b.txt", v1, sizeof(v1)));
+    CHECK_EQ(fs_read_custom(&file, buff, sizeof(buff)), FS_READ_EOF);
+    CHECK(file.index < file.len);
+    fs_close_custom(&file);
+}
+
+static void test_evict(void) {
+    char names[HTTP_HANDLE_CACHE + 1][16];
+    static char data[HTTP_HANDLE_CACHE + 1][100];
+
+    fake_fs_reset();
+    for (int i = 0; i <= HTTP_HANDLE_CACHE; i++) {
+        snprintf(names[i], sizeof(names[i]), "/file%d.txt", i);
+        fill(data[i], sizeof(data[i]), 'a' + i);
+        CHECK(fake_fs_write(names[i], data[i], sizeof(data[i])));
+    }
+
+    // handles of the old mount are not closed again
+    for (int i = 0; i < HTTP_HANDLE_CACHE; i++) {
+        CHECK(serve(names[i], SECTOR));
+        CHECK(body_is(data[i], sizeof(data[i])));
+    }
+    CHECK_EQ(fake_fs_stats()->opens, HTTP_HANDLE_CACHE);
+    CHECK_EQ(fake_fs_stats()->closes, 0);
+    CHECK_EQ(fake_fs_stats()->open, HTTP_HANDLE_CACHE);
+
+    // hit, file1 is the least recently used now
+    CHECK(serve(names[0], SECTOR));
+    CHECK_EQ(fake_fs_stats()->opens, HTTP_HANDLE_CACHE);
+
+    CHECK(serve(names[HTTP_HANDLE_CACHE], SECTOR));
+    CHECK(body_is(data[HTTP_HANDLE_CACHE], sizeof(data[HTTP_HANDLE_CACHE])));
+    CHECK_EQ(fake_fs_stats()->opens, HTTP_HANDLE_CACHE + 1);
+    CHECK_EQ(fake_fs_stats()->closes, 1);
+    CHECK_EQ(fake_fs_stats()->open, HTTP_HANDLE_CACHE);
+
+    // evicted one is opened again, in place of file2
+    CHECK(serve(names[1], SECTOR));
+    CHECK(body_is(data[1], sizeof(data[1])));
+    CHECK_EQ(fake_fs_stats()->opens, HTTP_HANDLE_CACHE + 2);
+    CHECK_EQ(fake_fs_stats()->closes, 2);
+    CHECK_EQ(fake_fs_stats()->open, HTTP_HANDLE_CACHE);
+
+    CHECK(serve(names[0], SECTOR));
+    CHECK(serve(names[HTTP_HANDLE_CACHE], SECTOR));
+    CHECK_EQ(fake_fs_stats()->opens, HTTP_HANDLE_CACHE + 2);
+
+    // too long to be cached, closed right away, on a new mount
+    const char *name = "/a_file_with_a_name_too_long_to_cache.txt";
+    CHECK(fake_fs_write(name, data[0], sizeof(data[0])));
+    CHECK(serve(name, SECTOR));
+    CHECK(body_is(data[0], sizeof(data[0])));
+    CHECK(serve(name, SECTOR));
+    CHECK_EQ(fake_fs_stats()->mounts, 2);
+    CHECK_EQ(fake_fs_stats()->opens, HTTP_HANDLE_CACHE + 4);
+    CHECK_EQ(fake_fs_stats()->closes, 4);
+    CHECK_EQ(fake_fs_stats()->open, 0);
+}
+
+static void test_header(void) {
+    char buff[160];
+    size_t n = http_header(buff, sizeof(buff), "/data/log.txt", 1234, 0x00C0FFEE, true);
+    CHECK_EQ(n, strlen(buff));
+    CHECK(strcmp(buff,
+                 "HTTP/1.0 200 OK\r\n"
+                 "Content-Length: 1234\r\n"
+                 "Content-Type: text/plain\r\n"
+                 "ETag: W/\"00c0ffee\"\r\n"
+                 "Cache-Control: no-cache\r\n"
+                 "\r\n") == 0);
+
+    n = http_header(buff, sizeof(buff), "/index.html", -1, 0xDEADBEEF, false);
+    CHECK_EQ(n, strlen(buff));
+    CHECK(strcmp(buff,
+                 "HTTP/1.0 304 Not Modified\r\n"
+                 "ETag: \"deadbeef\"\r\n"
+                 "Cache-Control: no-cache\r\n"
+                 "\r\n") == 0);
+
+    // empty files still have a length
+    n = http_header(buff, sizeof(buff), "/empty", 0, 1, true);
+    CHECK(strstr(buff, "Content-Length: 0\r\n") != NULL);
+    CHECK(strstr(buff, "Content-Type: application/octet-stream\r\n") != NULL);
+
+    // httpd generates one when it does not fit
+    CHECK_EQ(http_header(buff, 40, "/index.html", 1234, 1, true), 0);
+    CHECK_EQ(http_header(buff, n, "/empty", 0, 1, true), 0);
+    CHECK_EQ(http_header(buff, n + 1, "/empty", 0, 1, true), n);
+}
+
+static void test_match(void) {
+    const uint32_t tag = 0x0123abcd;
+
+    CHECK(http_etag_match("\"0123abcd\"", tag));
+    CHECK(http_etag_match("W/\"0123abcd\"", tag));
+    CHECK(http_etag_match("*", tag));
+    CHECK(http_etag_match("  *", tag));
+
+    // lists, with and without spaces
+    CHECK(http_etag_match("\"11111111\", \"0123abcd\"", tag));
+    CHECK(http_etag_match("\"11111111\",W/\"0123abcd\",\"22222222\"", tag));
+    CHECK(http_etag_match(" W/\"11111111\" ,\t\"0123abcd\"", tag));
+    CHECK(!http_etag_match("\"11111111\", \"22222222\"", tag));
+
+    // commas within a tag of someone else
+    CHECK(http_etag_match("\"a,b\", \"0123abcd\"", tag));
+    CHECK(!http_etag_match("\"a,\"0123abcd\"\"", tag));
+
+    // only whole tags, in the same case as sent
+    CHECK(!http_etag_match("", tag));
+    CHECK(!http_etag_match("\"0123abc\"", tag));
+    CHECK(!http_etag_match("\"0123abcd0\"", tag));
+    CHECK(!http_etag_match("\"0123ABCD\"", tag));
+    CHECK(!http_etag_match("0123abcd", tag));
+    CHECK(!http_etag_match("w/\"0123abcd\"", tag));
+    CHECK(!http_etag_match("\"0123abcd", tag));
+}
+
+static void test_mime(void) {
+    CHECK(strcmp(http_mime_type("/index.html"), "text/html") == 0);
+    CHECK(strcmp(http_mime_type("/INDEX.HTM"), "text/html") == 0);
+    CHECK(strcmp(http_mime_type("/log.json"), "application/json") == 0);
+    CHECK(strcmp(http_mime_type("/README.md"), "text/plain") == 0);
+    CHECK(strcmp(http_mime_type("/src.tar.xz"), "application/x-xz") == 0);
+    CHECK(strcmp(http_mime_type("/img/photo.JPEG"), "image/jpeg") == 0);
+
+    // no extension, or only on a directory
+    CHECK(strcmp(http_mime_type("/LICENSE"), "application/octet-stream") == 0);
+    CHECK(strcmp(http_mime_type("/v1.2/data"), "application/octet-stream") == 0);
+    CHECK(strcmp(http_mime_type("/file."), "application/octet-stream") == 0);
+    CHECK(strcmp(http_mime_type("/file.bin"), "application/octet-stream") == 0);
+}
+
+static void test_not_modified(void) {
+    static char data[700];
+    fill(data, sizeof(data), 'n');
+    fake_fs_reset();
+    CHECK(fake_fs_write("page.html", data, sizeof(data)));
+
+    // weak, from the directory entry
+    CHECK(serve("/page.html", SECTOR));
+    CHECK(status_is("HTTP/1.0 200 OK\r\n"));
+    CHECK(strstr(res.data, "ETag: W/\"") != NULL);
+    CHECK(strstr(res.data, "Content-Type: text/html\r\n") != NULL);
+    CHECK(body_is(data, sizeof(data)));
+    uint32_t tag = etag();
+    char match[32];
+
+    // as sent, and without the W/
+    snprintf(match, sizeof(match), "W/\"%08lx\"", tag);
+    CHECK(serve_match("/page.html", match));
+    CHECK(status_is("HTTP/1.0 304 Not Modified\r\n"));
+    CHECK_EQ(res.len, res.header_len);
+    CHECK_EQ(etag(), tag);
+    CHECK(strstr(res.data, "ETag: W/\"") != NULL);
+
+    snprintf(match, sizeof(match), "\"0\", \"%08lx\"", tag);
+    CHECK(serve_match("/page.html", match));
+    CHECK(status_is("HTTP/1.0 304 Not Modified\r\n"));
+    CHECK_EQ(res.len, res.header_len);
+
+    // header name in lower case
+    char req[128];
+    snprintf(req, sizeof(req), "GET /page.html HTTP/1.1\r\nif-none-match: W/\"%08lx\"\r\n\r\n", tag);
+    CHECK(serve_request("/page.html", SECTOR, req));
+    CHECK(status_is("HTTP/1.0 304 Not Modified\r\n"));
+
+    // the request does not stick to the next one
+    CHECK(serve("/page.html", SECTOR));
+    CHECK(status_is("HTTP/1.0 200 OK\r\n"));
+    CHECK(body_is(data, sizeof(data)));
+
+    // changed in between
+    CHECK(serve_match("/page.html", "W/\"00000000\""));
+    CHECK(status_is("HTTP/1.0 200 OK\r\n"));
+    CHECK(body_is(data, sizeof(data)));
+    CHECK(fake_fs_write("page.html", data, sizeof(data) - 1));
+    snprintf(match, sizeof(match), "W/\"%08lx\"", tag);
+    CHECK(serve_match("/page.html", match));
+    CHECK(status_is("HTTP/1.0 200 OK\r\n"));
+    CHECK(body_is(data, sizeof(data) - 1));
+    CHECK(etag() != tag);
+
+    // HTTP/0.9 gets neither a header nor a 304
+    CHECK(serve_request("/page.html", SECTOR, "GET /page.html\r\n"));
+    CHECK_EQ(res.header_len, 0);
+    CHECK(body_is(data, sizeof(data) - 1));
+
+    // embedded files, strong CRC from make_fsdata.sh, httpd sends them otherwise
+    CHECK(serve_match("/index.html", "\"1234abcd\""));
+    CHECK(status_is("HTTP/1.0 304 Not Modified\r\n"));
+    CHECK(strstr(res.data, "ETag: \"1234abcd\"\r\n") != NULL);
+    CHECK(serve_match("/index.html", "W/\"1234abcd\""));
+    CHECK(status_is("HTTP/1.0 304 Not Modified\r\n"));
+    CHECK(!serve_match("/index.html", "\"1234abce\""));
+    CHECK(!serve("/index.html", SECTOR));
+    CHECK(!serve_match("/missing.html", "*"));
+
+    // nothing left open by any of them
+    CHECK_EQ(fake_fs_stats()->open, 1);
+}
+
+int main(void) {
+    host_init();
+    fake_fs_reset();
+
+    test_chunk_len();
+    test_stream();
+    test_remount();
+    test_evict();
+    test_header();
+    test_match();
+    test_mime();
+    test_not_modified();
+
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_http");
+}
@@ -0,0 +1,359 @@
+/*
+ * test_influx.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * InfluxDB client of influx.c against a fake server on the lwIP stubs.
+ * Goes through the time sync with /ping, with and without a Date header,
+ * batching of queued points, reuse of the keep-alive connection,
+ * reconnects after the server closed it, and how rejected (4xx) and
+ * failed (5xx) batches are handled.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "config.h"
+#include "influx.h"
+#include "spool.h"
+#include "usb_descriptors.h"
+#include "wifi.h"
+#include "fake_lwip.h"
+#include "host.h"
+
+#define RETRY_MS 10000 // INFLUX_RETRY_MS in influx.c
+
+// time of day from the server, and the same in s since epoch
+#define DATE "Mon, 19 Oct 2026 12:00:00 GMT"
+#define DATE_S 1792411200LL
+
+char string_pico_serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1] = "E6614103E7000001";
+
+static bool ready = true;
+
+bool wifi_ready(void) {
+    return ready;
+}
+
+struct counters {
+    unsigned queued, in_flight;
+    unsigned long points, batches, bytes, drops;
+    unsigned long connects, errors;
+    bool synced;
+};
+
+static struct counters counters;
+
+static void status_line(const char *line, size_t len) {
+    char buff[128] = {0};
+    memcpy(buff, line, MIN(len, sizeof(buff) - 1));
+
+    const char *s;
+    unsigned size;
+    if ((s = strstr(buff, "Queued: ")) != NULL) {
+        sscanf(s, "Queued: %u / %u, in flight: %u", &counters.queued, &size, &counters.in_flight);
+    } else if ((s = strstr(buff, "Points: ")) != NULL) {
+        sscanf(s, "Points: %lu, batches: %lu, bytes: %lu, drops: %lu",
+               &counters.points, &counters.batches, &counters.bytes, &counters.drops);
+    } else if ((s = strstr(buff, "Connects: ")) != NULL) {
+        sscanf(s, "Connects: %lu, errors: %lu", &counters.connects, &counters.errors);
+    } else if (strstr(buff, "InfluxDB ") != NULL) {
+        counters.synced = (strstr(buff, "time synced") != NULL);
+    }
+}
+
+static struct counters influx_counters(void) {
+    memset(&counters, 0, sizeof(counters));
+    host_output_hook = status_line;
+    influx_status();
+    host_output_hook = NULL;
+    return counters;
+}
+
+static uint32_t now(void) {
+    return host_time_us() / 1000;
+}
+
+static void run_ms(uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t++) {
+        sleep_ms(1);
+        influx_run();
+    }
+}
+
+// what the client sent since the last call
+static char sent[FAKE_TCP_TX_LEN + 1];
+
+static size_t take(struct tcp_pcb *pcb) {
+    return fake_tcp_take(pcb, sent, sizeof(sent));
+}
+
+static void respond(struct tcp_pcb *pcb, const char *status, const char *date,
+                    const char *body, uint16_t chunk) {
+    char buff[512];
+    int n = snprintf(buff, sizeof(buff),
+                     "HTTP/1.1 %s\r\n"
+                     "%s%s%s"
+                     "Content-Length: %u\r\n"
+                     "\r\n"
+                     "%s",
+                     status, (date != NULL) ? "Date: " : "",
+                     (date != NULL) ? date : "", (date != NULL) ? "\r\n" : "",
+                     (unsigned)strlen(body), body);
+    fake_tcp_reply(pcb, buff, n, chunk);
+    influx_run();
+}
+
+// lines of the write request in sent, < 0 if it is not one
+static int batch_lines(void) {
+    if (strncmp(sent, "POST /write?db=" INFLUXDB_DATABASE "&precision=ms HTTP/1.1\r\n",
+                strlen("POST /write?db=" INFLUXDB_DATABASE "&precision=ms HTTP/1.1\r\n")) != 0) {
+        return -1;
+    }
+
+    const char *cl = strstr(sent, "Content-Length: ");
+    const char *body = strstr(sent, "\r\n\r\n");
+    if ((cl == NULL) || (body == NULL)) {
+        return -1;
+    }
+    body += 4;
+    CHECK_EQ(atoi(cl + 16), strlen(body));
+
+    int lines = 0;
+    for (const char *p = body; *p != '\0'; p++) {
+        if (*p == '\n') {
+            lines++;
+        }
+    }
+    return lines;
+}
+
+// accept the connection influx_run() just opened and answer its /ping
+static struct tcp_pcb *sync_connection(const char *date) {
+    struct tcp_pcb *pcb = fake_tcp_last();
+    CHECK(fake_tcp_connected_to(pcb, INFLUXDB_HOST, INFLUXDB_PORT));
+
+    fake_tcp_accept(pcb);
+    influx_run();
+    take(pcb);
+    CHECK(strncmp(sent, "GET /ping HTTP/1.1\r\n", 20) == 0);
+
+    respond(pcb, "204 No Content", date, "", 0);
+    return pcb;
+}
+
+static void points(uint16_t n) {
+    for (uint16_t i = 0; i < n; i++) {
+        influx_point("current", 180.0f + i);
+    }
+}
+
+static void test_ping(void) {
+    points(1);
+    uint32_t point_t = now();
+    influx_run();
+    CHECK_EQ(fake_tcp_stats()->pcbs, 1);
+
+    // without a Date the points can not be timestamped
+    struct tcp_pcb *pcb = sync_connection(NULL);
+    CHECK(!fake_tcp_is_open(pcb));
+    struct counters c = influx_counters();
+    CHECK(!c.synced);
+    CHECK_EQ(c.errors, 1);
+    CHECK_EQ(c.queued, 1);
+
+    // backoff
+    run_ms(RETRY_MS - 10);
+    CHECK_EQ(fake_tcp_stats()->pcbs, 1);
+    run_ms(10);
+    CHECK_EQ(fake_tcp_stats()->pcbs, 2);
+
+    // the point is written right away, it waited long enough
+    pcb = fake_tcp_last();
+    fake_tcp_accept(pcb);
+    influx_run();
+    uint32_t ping_t = now();
+    take(pcb);
+    respond(pcb, "204 No Content", DATE, "", 0);
+    CHECK(influx_counters().synced);
+
+    influx_run();
+    take(pcb);
+    CHECK_EQ(batch_lines(), 1);
+
+    char line[128];
+    snprintf(line, sizeof(line), "volcano,device=%s current=180.00 %lld\n",
+             string_pico_serial, DATE_S * 1000 - ping_t + point_t);
+    CHECK(strstr(sent, line) != NULL);
+
+    respond(pcb, "204 No Content", DATE, "", 0);
+    c = influx_counters();
+    CHECK_EQ(c.batches, 1);
+    CHECK_EQ(c.queued, 0);
+    CHECK(fake_tcp_is_open(pcb));
+}
+
+static void test_batching(void) {
+    struct tcp_pcb *pcb = fake_tcp_last();
+    uint32_t pcbs = fake_tcp_stats()->pcbs;
+    uint32_t batches = influx_counters().batches;
+
+    // waits for a full batch
+    points(INFLUXDB_BATCH_POINTS - 1);
+    run_ms(10);
+    CHECK_EQ(take(pcb), 0);
+    points(1);
+    influx_run();
+    take(pcb);
+    CHECK_EQ(batch_lines(), INFLUXDB_BATCH_POINTS);
+    CHECK_EQ(influx_counters().in_flight, INFLUXDB_BATCH_POINTS);
+
+    // response in small pieces
+    respond(pcb, "204 No Content", DATE, "", 7);
+    CHECK_EQ(influx_counters().batches, batches + 1);
+
+    // or for the oldest to get old enough
+    points(INFLUXDB_BATCH_POINTS + 4);
+    influx_run();
+    take(pcb);
+    CHECK_EQ(batch_lines(), INFLUXDB_BATCH_POINTS);
+    respond(pcb, "204 No Content", DATE, "", 0);
+    run_ms(INFLUXDB_FLUSH_MS - 10);
+    CHECK_EQ(take(pcb), 0);
+    run_ms(10);
+    take(pcb);
+    CHECK_EQ(batch_lines(), 4);
+    respond(pcb, "204 No Content", DATE, "", 0);
+
+    // all over the same keep-alive connection
+    struct counters c = influx_counters();
+    CHECK_EQ(c.batches, batches + 3);
+    CHECK_EQ(c.queued, 0);
+    CHECK_EQ(c.drops, 0);
+    CHECK(fake_tcp_is_open(pcb));
+    CHECK_EQ(fake_tcp_stats()->pcbs, pcbs);
+    CHECK_EQ(fake_tcp_stats()->pbufs, 0);
+}
+
+static void test_errors(void) {
+    struct tcp_pcb *pcb = fake_tcp_last();
+    struct counters before = influx_counters();
+
+    // rejected, sending it again would not help
+    points(INFLUXDB_BATCH_POINTS);
+    influx_run();
+    take(pcb);
+    CHECK_EQ(batch_lines(), INFLUXDB_BATCH_POINTS);
+    respond(pcb, "400 Bad Request", DATE, "{\"error\":\"unable to parse\"}", 10);
+
+    struct counters c = influx_counters();
+    CHECK_EQ(c.drops, before.drops + INFLUXDB_BATCH_POINTS);
+    CHECK_EQ(c.errors, before.errors + 1);
+    CHECK_EQ(c.queued, 0);
+    CHECK(fake_tcp_is_open(pcb));
+
+    // server trouble, kept and sent again on a new connection
+    points(INFLUXDB_BATCH_POINTS);
+    influx_run();
+    take(pcb);
+    CHECK_EQ(batch_lines(), INFLUXDB_BATCH_POINTS);
+    respond(pcb, "503 Service Unavailable", DATE, "", 0);
+
+    c = influx_counters();
+    CHECK_EQ(c.drops, before.drops + INFLUXDB_BATCH_POINTS);
+    CHECK_EQ(c.errors, before.errors + 2);
+    CHECK_EQ(c.queued, INFLUXDB_BATCH_POINTS);
+    CHECK_EQ(c.in_flight, 0);
+    CHECK(!fake_tcp_is_open(pcb));
+
+    uint32_t pcbs = fake_tcp_stats()->pcbs;
+    run_ms(RETRY_MS - 10);
+    CHECK_EQ(fake_tcp_stats()->pcbs, pcbs);
+    run_ms(10);
+    CHECK_EQ(fake_tcp_stats()->pcbs, pcbs + 1);
+
+    pcb = sync_connection(DATE);
+    influx_run();
+    take(pcb);
+    CHECK_EQ(batch_lines(), INFLUXDB_BATCH_POINTS);
+    respond(pcb, "204 No Content", DATE, "", 0);
+
+    c = influx_counters();
+    CHECK_EQ(c.batches, before.batches + 1);
+    CHECK_EQ(c.queued, 0);
+    CHECK_EQ(fake_tcp_stats()->pbufs, 0);
+}
+
+static void test_reconnect(void) {
+    struct tcp_pcb *pcb = fake_tcp_last();
+    struct counters before = influx_counters();
+
+    // idle connection closed by the server is not an error
+    fake_tcp_remote_close(pcb);
+    influx_run();
+    CHECK(!fake_tcp_is_open(pcb));
+    CHECK_EQ(influx_counters().errors, before.errors);
+
+    // only reopened for new points
+    uint32_t pcbs = fake_tcp_stats()->pcbs;
+    run_ms(RETRY_MS);
+    CHECK_EQ(fake_tcp_stats()->pcbs, pcbs);
+    points(1);
+    influx_run();
+    CHECK_EQ(fake_tcp_stats()->pcbs, pcbs + 1);
+
+    // clock keeps running from the last sync when a proxy strips the Date
+    pcb = sync_connection(NULL);
+    CHECK(fake_tcp_is_open(pcb));
+    CHECK(influx_counters().synced);
+    CHECK_EQ(influx_counters().errors, before.errors);
+
+    run_ms(INFLUXDB_FLUSH_MS);
+    take(pcb);
+    CHECK_EQ(batch_lines(), 1);
+    respond(pcb, "204 No Content", NULL, "", 0);
+    CHECK_EQ(influx_counters().batches, before.batches + 1);
+
+    // connection reset in the middle of a batch
+    points(INFLUXDB_BATCH_POINTS);
+    influx_run();
+    take(pcb);
+    fake_tcp_fail(pcb, ERR_RST);
+    influx_run();
+    struct counters c = influx_counters();
+    CHECK_EQ(c.errors, before.errors + 1);
+    CHECK_EQ(c.queued, INFLUXDB_BATCH_POINTS);
+    CHECK_EQ(fake_tcp_stats()->open, 0);
+}
+
+int main(void) {
+    host_init();
+    fake_lwip_reset();
+    spool_init();
+
+    test_ping();
+    test_batching();
+    test_errors();
+    test_reconnect();
+
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_influx");
+}
@@ -0,0 +1,245 @@
+/*
+ * test_json.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Renders values with json.c and compares them with the expected text.
+ * Covers string escaping, numbers, the commas between members of nested
+ * objects and arrays, and rendering a document through small windows.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "json.h"
+#include "host.h"
+
+#define OUT_MAX 512
+
+static char out[OUT_MAX + 1];
+static struct json_out o;
+
+static void begin(void) {
+    memset(out, 0, sizeof(out));
+    json_init(&o, out, 0, OUT_MAX);
+}
+
+static bool is(const char *expected) {
+    CHECK(!json_full(&o));
+    out[json_len(&o)] = '\0';
+    if (strcmp(out, expected) != 0) {
+        printf("got \"%s\", expected \"%s\"\n", out, expected);
+        return false;
+    }
+    return true;
+}
+
+static void test_escaping(void) {
+    begin();
+    json_str(&o, "plain text");
+    CHECK(is("\"plain text\""));
+
+    begin();
+    json_str(&o, "q\" b\\ s/");
+    CHECK(is("\"q\\\" b\\\\ s/\""));
+
+    begin();
+    json_str(&o, "n\n r\r t\t");
+    CHECK(is("\"n\\n r\\r t\\t\""));
+
+    begin();
+    json_str(&o, "\x01\x1f\x7f\x80\xff");
+    CHECK(is("\"\\u0001\\u001F\\u007F\\u0080\\u00FF\""));
+
+    begin();
+    json_str(&o, "");
+    CHECK(is("\"\""));
+
+    begin();
+    json_escaped_c(&o, '"');
+    json_escaped_c(&o, 'a');
+    json_escaped_c(&o, '\b');
+    CHECK(is("\\\"a\\u0008"));
+}
+
+static void test_str_n(void) {
+    // fixed size fields, like SSIDs, are not always terminated
+    const char name[4] = { 'a', '"', 'c', 'd' };
+    begin();
+    json_str_n(&o, name, sizeof(name));
+    CHECK(is("\"a\\\"cd\""));
+
+    begin();
+    json_str_n(&o, "abc\0def", 7);
+    CHECK(is("\"abc\""));
+
+    begin();
+    json_str_n(&o, "abcdef", 0);
+    CHECK(is("\"\""));
+}
+
+static void test_numbers(void) {
+    begin();
+    json_int(&o, 0);
+    json_int(&o, -1);
+    json_int(&o, INT32_MAX);
+    json_int(&o, INT32_MIN);
+    CHECK(is("0,-1,2147483647,-2147483648"));
+
+    begin();
+    json_tenths(&o, 0);
+    json_tenths(&o, 5);
+    json_tenths(&o, -5);
+    json_tenths(&o, 1855);
+    json_tenths(&o, -2731);
+    CHECK(is("0.0,0.5,-0.5,185.5,-273.1"));
+
+    begin();
+    json_tenths(&o, INT32_MIN);
+    CHECK(is("-214748364.8"));
+
+    begin();
+    json_bool(&o, true);
+    json_bool(&o, false);
+    json_null(&o);
+    CHECK(is("true,false,null"));
+}
+
+static void test_nesting(void) {
+    begin();
+    json_obj_begin(&o);
+    json_obj_end(&o);
+    CHECK(is("{}"));
+
+    begin();
+    json_obj_begin(&o);
+    json_key(&o, "a");
+    json_int(&o, 1);
+    json_key(&o, "b\"");
+    json_arr_begin(&o);
+    json_arr_begin(&o);
+    json_arr_end(&o);
+    json_obj_begin(&o);
+    json_key(&o, "c");
+    json_null(&o);
+    json_obj_end(&o);
+    json_str(&o, "d");
+    json_arr_end(&o);
+    json_key(&o, "e");
+    json_obj_begin(&o);
+    json_obj_end(&o);
+    json_obj_end(&o);
+    CHECK(is("{\"a\":1,\"b\\\"\":[[],{\"c\":null},\"d\"],\"e\":{}}"));
+    CHECK_EQ(o.depth, 0);
+
+    // top level values are separated as well
+    begin();
+    json_obj_begin(&o);
+    json_obj_end(&o);
+    json_obj_begin(&o);
+    json_obj_end(&o);
+    CHECK(is("{},{}"));
+
+    // deeper than the members bits
+    begin();
+    for (int i = 0; i < (JSON_MAX_DEPTH + 2); i++) {
+        json_arr_begin(&o);
+        json_int(&o, i % 10);
+    }
+    for (int i = 0; i < (JSON_MAX_DEPTH + 2); i++) {
+        json_arr_end(&o);
+    }
+    CHECK_EQ(o.depth, 0);
+    CHECK(!json_full(&o));
+    for (uint32_t i = 0; i < json_len(&o); i++) {
+        if (out[i] == '[') {
+            CHECK(out[i + 1] != ',');
+        }
+    }
+}
+
+static void document(struct json_out *d) {
+    json_obj_begin(d);
+    json_key(d, "name");
+    json_str(d, "Volcano \"Hybrid\"\n");
+    json_key(d, "temp");
+    json_tenths(d, 1855);
+    json_key(d, "list");
+    json_arr_begin(d);
+    for (int i = 0; i < 20; i++) {
+        json_obj_begin(d);
+        json_key(d, "i");
+        json_int(d, i - 10);
+        json_key(d, "s");
+        json_str(d, "\t\\");
+        json_obj_end(d);
+    }
+    json_arr_end(d);
+    json_obj_end(d);
+}
+
+static void test_windows(void) {
+    static char whole[OUT_MAX + 1];
+
+    // counted without buffer first, as for Content-Length
+    struct json_out count;
+    json_init(&count, NULL, 0, 0);
+    document(&count);
+    CHECK(count.pos < OUT_MAX);
+    CHECK_EQ(json_len(&count), 0);
+
+    struct json_out w;
+    json_init(&w, whole, 0, OUT_MAX);
+    document(&w);
+    CHECK(!json_full(&w));
+    CHECK_EQ(json_len(&w), count.pos);
+    whole[json_len(&w)] = '\0';
+
+    static const uint32_t sizes[] = { 1, 2, 7, 64, 100 };
+    for (uint i = 0; i < count_of(sizes); i++) {
+        char piece[100];
+        uint32_t n = 0;
+        while (n < count.pos) {
+            json_init(&w, piece, n, sizes[i]);
+            document(&w);
+            uint32_t len = json_len(&w);
+            CHECK(len > 0);
+            CHECK(len <= sizes[i]);
+            CHECK_EQ(json_full(&w), (n + sizes[i]) < count.pos);
+            if ((len == 0) || (memcmp(piece, whole + n, len) != 0)) {
+                printf("window %lu of %lu differs\n", n, sizes[i]);
+                CHECK(false);
+                break;
+            }
+            n += len;
+        }
+        CHECK_EQ(n, count.pos);
+    }
+}
+
+int main(void) {
+    host_init();
+
+    test_escaping();
+    test_str_n();
+    test_numbers();
+    test_nesting();
+    test_windows();
+
+    return host_result("test_json");
+}
@@ -0,0 +1,245 @@
+/*
+ * test_log_json.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Renders the debug log ring as /log.json does, in chunks of different
+ * sizes, with the ?since= cursor at its edges and while the ring wraps
+ * around and overwrites records that are about to be sent.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+
+#include "log.h"
+#include "log_json.h"
+#include "host.h"
+
+#define DOC_MAX (64 * 1024)
+
+static char doc[DOC_MAX + 1];
+
+// whole document in chunks of the given size, < 0 on error
+static int render(int64_t since, size_t chunk) {
+    struct log_json j;
+    uint32_t promised = log_json_open(&j, since);
+    CHECK(promised <= DOC_MAX);
+
+    size_t n = 0;
+    while (n < DOC_MAX) {
+        int r = log_json_read(&j, doc + n, MIN(chunk, DOC_MAX - n));
+        if (r < 0) {
+            return r;
+        }
+        if (r == 0) {
+            break;
+        }
+        n += r;
+    }
+    doc[n] = '\0';
+
+    CHECK_EQ(n, promised);
+    return n;
+}
+
+static uint32_t records(void) {
+    uint32_t n = 0;
+    for (const char *p = doc; (p = strstr(p, "{\"seq\":")) != NULL; p++) {
+        n++;
+    }
+    return n;
+}
+
+// seq of the first record in the document, -1 without any
+static long first_seq(void) {
+    const char *p = strstr(doc, "{\"seq\":");
+    return p ? strtol(p + 7, NULL, 10) : -1;
+}
+
+static void test_empty(void) {
+    CHECK(render(-1, 4096) > 0);
+    CHECK(strcmp(doc, "[\n]\n") == 0);
+}
+
+static void test_fields(void) {
+    host_time_set_ms(1234);
+    debug("hello %d", 42);
+    debug("error: something failed");
+    debug("Warning, watch out");
+    debug_log(true, "not from debug()\r\n");
+
+    CHECK(render(-1, 4096) > 0);
+    CHECK_EQ(records(), 4);
+    CHECK_EQ(first_seq(), 0);
+    const char *start = "[\n{\"seq\":0,\"time\":1234,\"level\":\"debug\","
+                        "\"module\":\"test_fields\",\"line\":";
+    CHECK(strncmp(doc, start, strlen(start)) == 0);
+    CHECK(strstr(doc, "\"msg\":\"hello 42\"}") != NULL);
+    CHECK(strstr(doc, "\"level\":\"error\"") != NULL);
+    CHECK(strstr(doc, "\"level\":\"warning\"") != NULL);
+    CHECK(strstr(doc, "{\"seq\":3,\"time\":0,\"level\":\"debug\",\"module\":\"\","
+                  "\"line\":0,\"msg\":\"not from debug()\"}") != NULL);
+    CHECK(strcmp(doc + strlen(doc) - 3, "\n]\n") == 0);
+}
+
+static void test_escaping(void) {
+    uint32_t seq = log_next_seq();
+    debug("q\" b\\ t\t c\x01 h\xff");
+
+    CHECK(render(seq - 1, 4096) > 0);
+    CHECK_EQ(records(), 1);
+    CHECK(strstr(doc, "\"msg\":\"q\\\" b\\\\ t\\t c\\u0001 h\\u00FF\"}") != NULL);
+}
+
+static void test_since(void) {
+    uint32_t first = log_first_seq();
+    uint32_t next = log_next_seq();
+    CHECK(next > (first + 2));
+
+    // everything
+    CHECK(render(-1, 4096) > 0);
+    CHECK_EQ(records(), next - first);
+
+    // only newer than since
+    CHECK(render(first, 4096) > 0);
+    CHECK_EQ(first_seq(), first + 1);
+    CHECK_EQ(records(), next - first - 1);
+
+    CHECK(render(next - 2, 4096) > 0);
+    CHECK_EQ(first_seq(), next - 1);
+    CHECK_EQ(records(), 1);
+
+    // up to date
+    CHECK(render(next - 1, 4096) > 0);
+    CHECK(strcmp(doc, "[\n]\n") == 0);
+
+    // cursor from before a reboot
+    CHECK(render(next, 4096) > 0);
+    CHECK_EQ(records(), next - first);
+    CHECK(render(UINT32_MAX, 4096) > 0);
+    CHECK_EQ(records(), next - first);
+
+    // query parameter
+    CHECK_EQ(log_json_since(NULL), -1);
+    CHECK_EQ(log_json_since(""), -1);
+    CHECK_EQ(log_json_since("abc"), -1);
+    CHECK_EQ(log_json_since("-5"), -1);
+    CHECK_EQ(log_json_since("12abc"), -1);
+    CHECK_EQ(log_json_since("4294967296"), -1);
+    CHECK_EQ(log_json_since("99999999999999999999999"), -1);
+    CHECK_EQ(log_json_since("0"), 0);
+    CHECK_EQ(log_json_since("12"), 12);
+    CHECK_EQ(log_json_since("4294967295"), UINT32_MAX);
+}
+
+static void test_chunks(void) {
+    static char whole[DOC_MAX + 1];
+    int len = render(-1, DOC_MAX);
+    CHECK(len > 0);
+    memcpy(whole, doc, len + 1);
+
+    static const size_t sizes[] = { 1, 2, 7, 64, 100, 1460 };
+    for (uint i = 0; i < count_of(sizes); i++) {
+        CHECK_EQ(render(-1, sizes[i]), len);
+        CHECK(strcmp(doc, whole) == 0);
+    }
+}
+
+static void test_wrap(void) {
+    // many more than the ring holds, some of them across its end
+    for (uint i = 0; i < 500; i++) {
+        debug("wrap %u", i);
+    }
+
+    uint32_t first = log_first_seq();
+    uint32_t next = log_next_seq();
+    CHECK(first > 0);
+
+    CHECK(render(-1, 100) > 0);
+    CHECK_EQ(first_seq(), first);
+    CHECK_EQ(records(), next - first);
+
+    // every record is complete, also the ones wrapping around
+    for (uint32_t seq = first; seq < next; seq++) {
+        char rec[32], msg[32];
+        snprintf(rec, sizeof(rec), "{\"seq\":%lu,", seq);
+        snprintf(msg, sizeof(msg), "\"msg\":\"wrap %lu\"}", seq - (next - 500));
+        const char *p = strstr(doc, rec);
+        CHECK(p != NULL);
+        if (p != NULL) {
+            const char *end = strchr(p, '}');
+            CHECK((end != NULL) && (strncmp(end - strlen(msg) + 1, msg, strlen(msg)) == 0));
+        }
+    }
+
+    // cursor already overwritten, continues with the oldest one left
+    CHECK(render(first - 10, 100) > 0);
+    CHECK_EQ(first_seq(), first);
+    CHECK(render(0, 100) > 0);
+    CHECK_EQ(first_seq(), first);
+}
+
+static void test_overwritten(void) {
+    // records gone before they were started become placeholders
+    struct log_json j;
+    uint32_t first = log_first_seq();
+    uint32_t promised = log_json_open(&j, -1);
+    for (uint i = 0; i < 500; i++) {
+        debug("flood %u", i);
+    }
+
+    size_t n = 0;
+    int r;
+    while ((r = log_json_read(&j, doc + n, 64)) > 0) {
+        n += r;
+    }
+    doc[n] = '\0';
+    CHECK_EQ(r, 0);
+    CHECK_EQ(n, promised);
+
+    char lost[32];
+    snprintf(lost, sizeof(lost), "[\n{\"seq\":%lu,\"lost\":true}", first);
+    CHECK(strncmp(doc, lost, strlen(lost)) == 0);
+    CHECK(strstr(doc, "\n]\n") != NULL);
+    CHECK(doc[n - 1] == ' ');
+
+    // a record overwritten while it is partially sent can not be finished
+    log_json_open(&j, -1);
+    CHECK_EQ(log_json_read(&j, doc, 10), 10);
+    for (uint i = 0; i < 500; i++) {
+        debug("flood %u", i);
+    }
+    CHECK(log_json_read(&j, doc, 64) < 0);
+}
+
+int main(void) {
+    host_init();
+
+    test_empty();
+    test_fields();
+    test_escaping();
+    test_since();
+    test_chunks();
+    test_wrap();
+    test_since();
+    test_chunks();
+    test_overwritten();
+
+    return host_result("test_log_json");
+}
@@ -0,0 +1,251 @@
+/*
+ * test_mem.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Loads settings written by older firmware versions from the emulated
+ * flash. The old layouts are spelled out here on their own, so a change
+ * to struct mem_data that breaks them shows up as a failure.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+#include "mem.h"
+#include "workflow.h"
+#include "host.h"
+
+struct v0_step {
+    uint32_t op;
+    uint16_t val;
+    // 2 bytes padding, arg since version 2
+};
+
+struct v0_workflow {
+    char name[WF_MAX_STR_LEN];
+    char author[WF_MAX_STR_LEN];
+    struct v0_step steps[WF_MAX_STEPS];
+    uint16_t count;
+};
+
+struct v0_net {
+    char name[32];
+    char pass[32];
+};
+
+// firmware before the list of known devices
+struct v0_contents {
+    uint8_t version;
+    uint32_t checksum;
+
+    uint16_t net_count;
+    struct v0_net net[5];
+
+    uint16_t backlight;
+    bool wf_auto_connect;
+    bool enable_wifi;
+
+    uint16_t wf_count;
+    struct v0_workflow wf[WF_MAX_FLOWS];
+};
+
+// with known devices, before access points were remembered
+struct v1_contents {
+    uint8_t version;
+    uint32_t checksum;
+
+    uint16_t net_count;
+    struct v0_net net[5];
+
+    uint16_t backlight;
+    bool wf_auto_connect;
+    bool enable_wifi;
+
+    uint16_t known_count;
+    struct known_device known[MODELS_MAX_KNOWN];
+
+    uint16_t wf_count;
+    struct v0_workflow wf[WF_MAX_FLOWS];
+};
+
+static uint8_t image[FLASH_SECTOR_SIZE];
+
+static uint32_t checksum(const uint8_t *d, size_t size) {
+    // CRC32 over everything but the checksum field itself
+    uint32_t c = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++) {
+        if ((i >= 4) && (i < 8)) {
+            continue;
+        }
+        c ^= d[i];
+        for (size_t j = 0; j < 8; j++) {
+            c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+        }
+    }
+    return ~c;
+}
+
+static void store(size_t size) {
+    uint32_t c = checksum(image, size);
+    memcpy(image + 4, &c, sizeof(c));
+
+    host_flash_reset();
+    flash_range_erase(EEPROM_FLASH_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(EEPROM_FLASH_OFFSET, image, FLASH_SECTOR_SIZE);
+}
+
+// the same pump cycle three times, folded into a loop by the migration
+static void v0_workflow(struct v0_workflow *wf) {
+    static const struct v0_step steps[] = {
+        { OP_SET_TEMPERATURE, 1850 },
+        { OP_WAIT_TEMPERATURE, 1850 },
+        { OP_WAIT_TIME, 10000 },
+        { OP_PUMP_TIME, 5000 },
+        { OP_WAIT_TIME, 10000 },
+        { OP_PUMP_TIME, 5000 },
+        { OP_WAIT_TIME, 10000 },
+        { OP_PUMP_TIME, 5000 },
+        { OP_SET_TEMPERATURE, 1900 },
+    };
+
+    memset(wf, 0xAA, sizeof(struct v0_workflow)); // padding is garbage
+    strcpy(wf->name, "Old");
+    strcpy(wf->author, "xythobuz");
+    for (uint i = 0; i < count_of(steps); i++) {
+        wf->steps[i].op = steps[i].op;
+        wf->steps[i].val = steps[i].val;
+    }
+    wf->count = count_of(steps);
+}
+
+static void check_migrated(void) {
+    struct mem_data *d = mem_data();
+
+    CHECK_EQ(d->net_count, 2);
+    CHECK(strcmp(d->net[0].name, "home") == 0);
+    CHECK(strcmp(d->net[0].pass, "secret") == 0);
+    CHECK(strcmp(d->net[1].name, "work") == 0);
+    CHECK(strcmp(d->net[1].pass, "hunter2") == 0);
+    CHECK_EQ(d->net[0].channel, 0);
+    CHECK_EQ(d->net[1].channel, 0);
+
+    CHECK_EQ(d->backlight, 0x1234);
+    CHECK(d->wf_auto_connect);
+    CHECK(d->enable_wifi);
+
+    CHECK_EQ(d->wf_count, 1);
+    struct workflow *wf = &d->wf[0];
+    CHECK(strcmp(wf->name, "Old") == 0);
+    CHECK(strcmp(wf->author, "xythobuz") == 0);
+    CHECK(wf->count < 9);
+    CHECK_EQ(wf->steps[0].op, OP_SET_TEMPERATURE);
+    CHECK_EQ(wf->steps[0].val, 1850);
+    CHECK_EQ(wf->steps[wf->count - 1].op, OP_SET_TEMPERATURE);
+    CHECK_EQ(wf->steps[wf->count - 1].val, 1900);
+    for (uint i = 0; i < wf->count; i++) {
+        if (wf->steps[i].op != OP_LOOP) {
+            CHECK_EQ(wf->steps[i].arg, 0);
+        }
+    }
+    CHECK(wf_validate(wf, false) == 0);
+}
+
+static void test_v0(void) {
+    memset(image, 0, sizeof(image));
+    struct v0_contents *c = (struct v0_contents *)image;
+    c->version = 0;
+    c->net_count = 2;
+    strcpy(c->net[0].name, "home");
+    strcpy(c->net[0].pass, "secret");
+    strcpy(c->net[1].name, "work");
+    strcpy(c->net[1].pass, "hunter2");
+    c->backlight = 0x1234;
+    c->wf_auto_connect = true;
+    c->enable_wifi = true;
+    c->wf_count = 1;
+    v0_workflow(&c->wf[0]);
+    store(sizeof(struct v0_contents));
+
+    mem_load();
+    check_migrated();
+    CHECK_EQ(mem_data()->known_count, 0);
+
+    // written back in the current layout, and loaded again as is
+    mem_write();
+    CHECK_EQ(host_flash[EEPROM_FLASH_OFFSET], MEM_VERSION);
+    mem_load_defaults();
+    mem_load();
+    check_migrated();
+}
+
+static void test_v1(void) {
+    memset(image, 0, sizeof(image));
+    struct v1_contents *c = (struct v1_contents *)image;
+    c->version = 1;
+    c->net_count = 2;
+    strcpy(c->net[0].name, "home");
+    strcpy(c->net[0].pass, "secret");
+    strcpy(c->net[1].name, "work");
+    strcpy(c->net[1].pass, "hunter2");
+    c->backlight = 0x1234;
+    c->wf_auto_connect = true;
+    c->enable_wifi = true;
+    c->known_count = 1;
+    memset(c->known[0].addr, 0x42, sizeof(c->known[0].addr));
+    c->known[0].dev = DEV_CRAFTY;
+    c->wf_count = 1;
+    v0_workflow(&c->wf[0]);
+    store(sizeof(struct v1_contents));
+
+    mem_load();
+    check_migrated();
+    CHECK_EQ(mem_data()->known_count, 1);
+    CHECK_EQ(mem_data()->known[0].addr[5], 0x42);
+    CHECK_EQ(mem_data()->known[0].dev, DEV_CRAFTY);
+}
+
+static void test_invalid(void) {
+    // bad checksum falls back to the defaults
+    memset(image, 0, sizeof(image));
+    struct v0_contents *c = (struct v0_contents *)image;
+    c->version = 0;
+    c->backlight = 0x1234;
+    store(sizeof(struct v0_contents));
+    host_flash[EEPROM_FLASH_OFFSET + 4] ^= 0x01;
+
+    mem_load();
+    CHECK(mem_data()->backlight != 0x1234);
+    CHECK_EQ(mem_data()->wf_count, wf_default_count);
+
+    // so does erased flash
+    host_flash_reset();
+    mem_load();
+    CHECK(mem_data()->backlight != 0x1234);
+    CHECK_EQ(mem_data()->wf_count, wf_default_count);
+}
+
+int main(void) {
+    host_init();
+
+    test_v0();
+    test_v1();
+    test_invalid();
+
+    return host_result("test_mem");
+}
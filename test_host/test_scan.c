@@ -0,0 +1,193 @@
+/*
+ * test_scan.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Replays a dense advertising environment into the scan table of ble.c
+ * and measures the time spent per advertising report. The few devices
+ * we can talk to have to stay in the table, no matter how many others
+ * are around, and results come out sorted by signal strength.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "pico/stdlib.h"
+
+#include "ble.h"
+#include "models.h"
+#include "fake_btstack.h"
+#include "host.h"
+
+#define ADVERTISERS 200
+#define ROUNDS 100
+#define ROUND_MS 100
+
+struct advertiser {
+    bd_addr_t addr;
+    int8_t rssi;
+    char name[32];
+    enum known_devices dev;
+};
+
+static struct advertiser adv[ADVERTISERS];
+static const uint8_t sb_data[] = { 0x00, 0x00, 'T', 'E', 'S', 'T', '0', '0', '0', '1' };
+
+static uint32_t lcg = 1;
+
+static uint32_t rnd(void) {
+    lcg = lcg * 1103515245u + 12345u;
+    return lcg >> 16;
+}
+
+static void populate(void) {
+    for (uint i = 0; i < ADVERTISERS; i++) {
+        struct advertiser *a = &adv[i];
+        for (uint j = 0; j < sizeof(bd_addr_t); j++) {
+            a->addr[j] = rnd();
+        }
+        a->addr[5] = i; // unique
+        a->rssi = -30 - (rnd() % 60);
+        a->dev = DEV_UNKNOWN;
+
+        // the interesting ones are rare, and not the strongest signals
+        if ((i % 50) == 49) {
+            a->rssi = -85 + (i / 50);
+            switch ((i / 50) % 3) {
+            case 0:
+                strcpy(a->name, "S&B VOLCANO H");
+                a->dev = DEV_VOLCANO;
+                break;
+
+            case 1:
+                strcpy(a->name, "STORZ&BICKEL");
+                a->dev = DEV_CRAFTY;
+                break;
+
+            default:
+                snprintf(a->name, sizeof(a->name), "S&B VY%06u", i);
+                a->dev = DEV_VENTY;
+                break;
+            }
+        } else {
+            snprintf(a->name, sizeof(a->name), "Phone %u", i);
+        }
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct ble_scan_result results[BLE_MAX_SCAN_RESULTS];
+
+static void check_results(int32_t n) {
+    CHECK(n > 0);
+    CHECK(n <= BLE_MAX_SCAN_RESULTS);
+
+    for (int32_t i = 1; i < n; i++) {
+        CHECK(results[i - 1].rssi >= results[i].rssi);
+    }
+
+    uint found = 0;
+    for (uint i = 0; i < ADVERTISERS; i++) {
+        if (adv[i].dev == DEV_UNKNOWN) {
+            continue;
+        }
+
+        bool present = false;
+        for (int32_t j = 0; j < n; j++) {
+            if (memcmp(results[j].addr, adv[i].addr, sizeof(bd_addr_t)) == 0) {
+                present = true;
+                CHECK_EQ(results[j].dev, adv[i].dev);
+                CHECK_EQ(results[j].rssi, adv[i].rssi);
+            }
+        }
+        CHECK(present);
+        found += present ? 1 : 0;
+    }
+    CHECK_EQ(found, ADVERTISERS / 50);
+}
+
+int main(void) {
+    host_init();
+
+    fake_bt_reset();
+    ble_init();
+    sleep_ms(10);
+    CHECK(ble_is_ready());
+    ble_scan(BLE_SCAN_ON);
+    sleep_ms(10);
+    CHECK(fake_bt_scanning());
+
+    populate();
+
+    uint64_t t_report = 0, t_results = 0;
+    uint32_t reports = 0;
+
+    for (uint r = 0; r < ROUNDS; r++) {
+        // everyone advertises once per round, in random order
+        uint order[ADVERTISERS];
+        for (uint i = 0; i < ADVERTISERS; i++) {
+            order[i] = i;
+        }
+        for (uint i = ADVERTISERS - 1; i > 0; i--) {
+            uint j = rnd() % (i + 1);
+            uint t = order[i];
+            order[i] = order[j];
+            order[j] = t;
+        }
+
+        uint64_t start = now_ns();
+        for (uint i = 0; i < ADVERTISERS; i++) {
+            const struct advertiser *a = &adv[order[i]];
+
+            // our devices only show up after the table is full of others
+            if ((r < 5) && (a->dev != DEV_UNKNOWN)) {
+                continue;
+            }
+
+            bool sb = (a->dev == DEV_VOLCANO) || (a->dev == DEV_CRAFTY);
+            fake_bt_report(a->addr, 0, a->rssi, a->name,
+                           sb ? sb_data : NULL, sb ? sizeof(sb_data) : 0);
+            reports++;
+        }
+        t_report += now_ns() - start;
+
+        // menu redraw
+        start = now_ns();
+        int32_t n = ble_get_scan_results(results, BLE_MAX_SCAN_RESULTS);
+        t_results += now_ns() - start;
+
+        if (r >= 5) {
+            check_results(n);
+        }
+
+        sleep_ms(ROUND_MS);
+    }
+
+    CHECK_EQ(fake_bt_stats()->scan_reports, reports);
+
+    printf("%u advertisers, %u reports\n", ADVERTISERS, reports);
+    printf("%.0f ns per advertising report\n", (double)t_report / reports);
+    printf("%.0f ns per ble_get_scan_results()\n", (double)t_results / ROUNDS);
+
+    ble_scan(BLE_SCAN_OFF);
+    return host_result("test_scan");
+}
@@ -0,0 +1,217 @@
+/*
+ * test_spool.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Writes points to the flash spool and reads them back, on the
+ * emulated flash of host.c. Covers the delta, varint and zigzag
+ * encoding, reboots in between, and the ring wrapping around.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "config.h"
+#include "spool.h"
+#include "host.h"
+
+#define T0 1700000000000LL // ms since epoch
+
+// about 1000 of these fit in a sector
+#define STEADY_POINTS_PER_SECTOR 1000
+
+struct point {
+    uint8_t field;
+    int64_t t;
+    float value;
+};
+
+// time and value deltas of every varint length, in both directions
+static const struct point edge[] = {
+    { 0, T0, 0.0f },
+    { 1, T0, -0.01f },
+    { 0, T0 + 1, 0.01f },
+    { 2, T0 + 128, 185.5f },
+    { 2, T0 + 128 + 16383, -273.15f },
+    { 3, T0 + 128 + 16383 + 16384, 1.0e6f },
+    { 3, T0 + (1LL << 28), -1.0e6f },
+    { 3, T0 + (1LL << 28) + UINT32_MAX, 2.0e7f },
+    { 3, T0 + (1LL << 28) + UINT32_MAX, -2.0e7f },
+    { 15, T0 + (1LL << 33), 42.42f },
+    { 0, T0 + (1LL << 33), 0.0f },
+    { 1, T0 + (1LL << 33) + 1, -0.01f },
+    { 15, T0 + (1LL << 33) + 2, -42.42f },
+};
+
+// spooled with two decimals
+static float stored(float value) {
+    return lroundf(value * 100.0f) / 100.0f;
+}
+
+static struct point steady(uint32_t i) {
+    struct point p = {
+        .field = i % 4,
+        .t = T0 + i * 1000LL,
+        .value = i / 10.0f,
+    };
+    return p;
+}
+
+static bool read_point(struct point *p) {
+    return spool_read(&p->field, &p->t, &p->value) == 1;
+}
+
+// reads everything, returns the number of points that match in order
+static uint32_t read_steady(uint32_t first, uint32_t count) {
+    uint32_t n = 0;
+    struct point p;
+    while (read_point(&p)) {
+        struct point e = steady(first + n);
+        if ((n >= count) || (p.field != e.field) || (p.t != e.t)
+                || (p.value != stored(e.value))) {
+            printf("point %lu: %u %lld %f\n", first + n, p.field, p.t, p.value);
+            return n;
+        }
+        n++;
+    }
+    return n;
+}
+
+static void test_edge_values(void) {
+    CHECK(spool_empty());
+
+    for (uint i = 0; i < count_of(edge); i++) {
+        CHECK_EQ(spool_append(edge[i].field, edge[i].t, edge[i].value), 0);
+    }
+    CHECK(!spool_empty());
+
+    // the last page is still buffered in RAM
+    spool_flush();
+
+    for (uint i = 0; i < count_of(edge); i++) {
+        struct point p;
+        CHECK(read_point(&p));
+        CHECK_EQ(p.field, edge[i].field);
+        CHECK_EQ(p.t, edge[i].t);
+        CHECK(p.value == stored(edge[i].value));
+    }
+
+    struct point p;
+    CHECK(!read_point(&p));
+    CHECK(spool_empty());
+
+    // invalid field
+    CHECK(spool_append(SPOOL_MAX_FIELDS, T0, 1.0f) < 0);
+    CHECK(spool_empty());
+}
+
+static void test_time_backwards(void) {
+    // clock jumped back after a new sync, starts a new sector
+    CHECK_EQ(spool_append(0, T0 + 5000, 1.0f), 0);
+    CHECK_EQ(spool_append(0, T0, 2.0f), 0);
+    spool_flush();
+
+    struct point p;
+    CHECK(read_point(&p));
+    CHECK_EQ(p.t, T0 + 5000);
+    CHECK(read_point(&p));
+    CHECK_EQ(p.t, T0);
+    CHECK(p.value == 2.0f);
+    CHECK(!read_point(&p));
+}
+
+static void test_reboot(void) {
+    for (uint32_t i = 0; i < 300; i++) {
+        struct point p = steady(i);
+        CHECK_EQ(spool_append(p.field, p.t, p.value), 0);
+    }
+    spool_flush();
+
+    // deltas continue after the points already in flash
+    spool_init();
+    for (uint32_t i = 300; i < 600; i++) {
+        struct point p = steady(i);
+        CHECK_EQ(spool_append(p.field, p.t, p.value), 0);
+    }
+    spool_flush();
+
+    spool_init();
+    CHECK_EQ(read_steady(0, 600), 600);
+    CHECK(spool_empty());
+}
+
+static void test_wrap(void) {
+    // read while writing, so the ring wraps around without losing points
+    const uint32_t total = (INFLUXDB_SPOOL_SECTORS * 3) * STEADY_POINTS_PER_SECTOR;
+    const uint32_t chunk = STEADY_POINTS_PER_SECTOR + 500;
+
+    uint32_t written = 0, read = 0;
+    while (written < total) {
+        for (uint32_t i = 0; i < chunk; i++) {
+            struct point p = steady(written++);
+            CHECK_EQ(spool_append(p.field, p.t, p.value), 0);
+        }
+        spool_flush();
+
+        uint32_t n = read_steady(read, written - read);
+        CHECK_EQ(n, written - read);
+        read += n;
+    }
+    CHECK(spool_empty());
+}
+
+static void test_overflow(void) {
+    // more than fits, the oldest sectors are overwritten
+    const uint32_t total = (INFLUXDB_SPOOL_SECTORS + 2) * STEADY_POINTS_PER_SECTOR;
+    for (uint32_t i = 0; i < total; i++) {
+        struct point p = steady(i);
+        CHECK_EQ(spool_append(p.field, p.t, p.value), 0);
+    }
+    spool_flush();
+
+    // first remaining point is at the start of a sector
+    struct point p;
+    CHECK(read_point(&p));
+    uint32_t first = (p.t - T0) / 1000;
+    CHECK(first > 0);
+    CHECK(first < (total - (INFLUXDB_SPOOL_SECTORS - 1) * STEADY_POINTS_PER_SECTOR));
+
+    // everything after it is still there
+    uint32_t n = read_steady(first + 1, total - first - 1);
+    CHECK_EQ(n, total - first - 1);
+    CHECK(spool_empty());
+}
+
+int main(void) {
+    host_init();
+    spool_init();
+
+    test_edge_values();
+    test_time_backwards();
+    test_reboot();
+    test_wrap();
+    test_overflow();
+
+    // all read points are erased again
+    spool_init();
+    CHECK(spool_empty());
+
+    spool_status();
+    return host_result("test_spool");
+}
@@ -0,0 +1,199 @@
+/*
+ * test_thermal.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Feeds temperature curves sampled once per second into the estimator
+ * of thermal.c. The curves follow a first order heater with a few
+ * seconds of lag, rounded to the 0.1 C the devices report and with
+ * 0.1 C of noise, like the readings the workflow engine gets.
+ */
+
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+
+#include "thermal.h"
+#include "host.h"
+
+#define TARGET 1845 // 185 C setpoint minus the workflow tolerance
+#define ETA_FROM_S 30 // fit has seen enough of the curve
+
+/*
+ * The early estimate only has the last ~20 samples to find the bend of
+ * the curve, so it is just checked to be there. The last minute is
+ * what the run screen counts down and what decides the pump pre-roll.
+ */
+#define ETA_CHECK_MS (60 * 1000)
+#define ETA_MAX_ERROR 0.2f // of the remaining time
+#define ETA_MIN_ERROR_MS 3000 // sampling and rounding
+
+// 45.2 C to 185 C, tau 75 s, 1 s per sample
+static const int16_t heating[] = {
+    453, 453, 451, 451, 472, 492, 511, 529, 549, 567,
+    585, 604, 621, 639, 657, 674, 690, 706, 725, 740,
+    757, 772, 786, 804, 818, 832, 848, 863, 876, 891,
+    904, 919, 933, 945, 958, 973, 985, 998, 1011, 1024,
+    1036, 1048, 1059, 1071, 1083, 1095, 1106, 1117, 1128, 1138,
+    1150, 1160, 1171, 1180, 1191, 1202, 1211, 1221, 1230, 1239,
+    1249, 1258, 1268, 1278, 1286, 1296, 1302, 1312, 1319, 1330,
+    1336, 1345, 1354, 1361, 1369, 1376, 1383, 1392, 1399, 1405,
+    1412, 1422, 1428, 1434, 1441, 1448, 1456, 1461, 1467, 1474,
+    1480, 1488, 1492, 1498, 1504, 1512, 1518, 1522, 1527, 1535,
+    1539, 1545, 1551, 1556, 1560, 1566, 1571, 1577, 1580, 1585,
+    1590, 1595, 1599, 1604, 1609, 1614, 1617, 1622, 1626, 1631,
+    1634, 1640, 1644, 1647, 1653, 1657, 1659, 1663, 1667, 1671,
+    1675, 1677, 1682, 1685, 1689, 1691, 1695, 1698, 1703, 1706,
+    1709, 1712, 1715, 1719, 1720, 1725, 1728, 1731, 1734, 1736,
+    1739, 1742, 1745, 1748, 1750, 1753, 1755, 1758, 1761, 1762,
+    1764, 1768, 1771, 1773, 1775, 1777, 1780, 1781, 1783, 1785,
+    1788, 1791, 1793, 1794, 1797, 1800, 1800, 1803, 1804, 1806,
+    1810, 1810, 1813, 1813, 1816, 1818, 1819, 1821, 1824, 1825,
+    1825, 1828, 1829, 1832, 1832, 1835, 1835, 1838, 1839, 1840,
+    1841, 1843, 1846,
+};
+
+// heater off at 185 C, tau 600 s, 1 s per sample
+static const int16_t cooling[] = {
+    1850, 1848, 1844, 1842, 1839, 1837, 1834, 1831, 1829, 1827,
+    1823, 1820, 1817, 1816, 1813, 1811, 1808, 1805, 1803, 1800,
+    1798, 1794, 1792, 1790, 1787, 1785, 1781, 1779, 1776, 1775,
+    1772, 1769, 1766, 1764, 1762, 1758, 1757, 1754, 1752, 1749,
+    1746, 1745, 1742, 1738, 1736, 1733, 1733, 1729, 1728, 1725,
+    1723, 1719, 1717, 1716, 1712, 1711, 1707, 1704, 1704, 1701,
+    1698, 1695, 1693, 1690, 1688, 1685, 1682, 1680, 1678, 1676,
+    1674, 1671, 1669, 1668, 1665, 1661, 1661, 1658, 1655, 1654,
+    1649, 1647, 1646, 1642, 1641, 1640, 1635, 1635, 1631, 1629,
+};
+
+static void feed(struct thermal_est *e, const int16_t *curve, uint n) {
+    for (uint i = 0; i < n; i++) {
+        thermal_sample(e, i * 1000, curve[i]);
+    }
+}
+
+static void test_heating(void) {
+    struct thermal_est e;
+    thermal_init(&e);
+
+    // no estimate from a single sample
+    thermal_sample(&e, 0, heating[0]);
+    CHECK_EQ(thermal_eta(&e, TARGET), -1);
+    CHECK(thermal_rate(&e) == 0.0f);
+
+    const uint n = count_of(heating);
+    uint32_t reached = (n - 1) * 1000;
+    float worst = 0.0f, worst_end = 0.0f; // relative, absolute in ms
+
+    for (uint i = 1; i < n; i++) {
+        thermal_sample(&e, i * 1000, heating[i]);
+        if (i < ETA_FROM_S) {
+            continue;
+        }
+
+        int32_t eta = thermal_eta(&e, TARGET);
+        int32_t real = reached - i * 1000;
+        if (real == 0) {
+            CHECK_EQ(eta, 0);
+            break;
+        }
+
+        CHECK(eta > 0);
+        float err = abs(eta - real);
+        if ((err / real) > worst) {
+            worst = err / real;
+        }
+        if (real > ETA_CHECK_MS) {
+            continue;
+        }
+
+        float bound = ETA_MAX_ERROR * real;
+        if (bound < ETA_MIN_ERROR_MS) {
+            bound = ETA_MIN_ERROR_MS;
+        }
+        if (err > bound) {
+            printf("at %us: eta %ldms, real %ldms\n", i, eta, real);
+        }
+        CHECK(err <= bound);
+        if (err > worst_end) {
+            worst_end = err;
+        }
+    }
+
+    CHECK(thermal_rate(&e) > 0.0f);
+    printf("Heating: worst ETA error %.1f %% after %ds, %.1fs in the last %ds\n",
+           worst * 100.0f, ETA_FROM_S, worst_end / 1000.0f, ETA_CHECK_MS / 1000);
+}
+
+static void test_cooling(void) {
+    struct thermal_est e;
+    thermal_init(&e);
+    feed(&e, cooling, count_of(cooling));
+
+    // about 0.23 C per second at the end of the curve
+    float rate = thermal_rate(&e);
+    CHECK((rate < -1.5f) && (rate > -3.5f));
+
+    // never getting warmer again, and below the target already
+    CHECK_EQ(thermal_eta(&e, 1900), -1);
+    CHECK_EQ(thermal_eta(&e, 1600), 0);
+}
+
+static void test_constant(void) {
+    struct thermal_est e;
+    thermal_init(&e);
+
+    // all samples at the same temperature, no slope to fit
+    for (uint i = 0; i < 60; i++) {
+        thermal_sample(&e, i * 1000, 1000);
+    }
+    CHECK(thermal_rate(&e) == 0.0f);
+    CHECK_EQ(thermal_eta(&e, 1500), -1);
+    CHECK_EQ(thermal_eta(&e, 1000), 0);
+
+    // samples closer than the minimum interval are merged
+    thermal_init(&e);
+    for (uint i = 0; i < 60; i++) {
+        thermal_sample(&e, i * 10, 1000 + i);
+    }
+    CHECK_EQ(thermal_eta(&e, 1500), -1);
+}
+
+static void test_linear(void) {
+    struct thermal_est e;
+    thermal_init(&e);
+
+    // 1 C per second without curvature, falls back to the constant rate
+    for (uint i = 0; i <= 20; i++) {
+        thermal_sample(&e, i * 1000, 1000 + i * 10);
+    }
+    CHECK(abs((int)(thermal_rate(&e) - 10.0f)) < 1);
+
+    int32_t eta = thermal_eta(&e, 1500);
+    CHECK(abs(eta - 30000) < 500);
+}
+
+int main(void) {
+    host_init();
+
+    test_heating();
+    test_cooling();
+    test_constant();
+    test_linear();
+
+    return host_result("test_thermal");
+}
@@ -0,0 +1,177 @@
+/*
+ * test_venty.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Venty frame decoding, directly and through notifications from the
+ * fake BTstack, with frames shorter and longer than expected.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "ble.h"
+#include "ble_chars.h"
+#include "main.h"
+#include "venty.h"
+#include "fake_btstack.h"
+#include "host.h"
+
+#define CMD_SETTINGS 1
+#define CMD_INTERFACE 6
+#define SETTINGS_FRAME_LEN 20
+#define INTERFACE_FRAME_LEN 6
+
+static void settings_frame(uint8_t *f, int16_t current, int16_t target, uint8_t battery) {
+    memset(f, 0, SETTINGS_FRAME_LEN);
+    f[0] = CMD_SETTINGS;
+    f[2] = current & 0xFF;
+    f[3] = current >> 8;
+    f[4] = target & 0xFF;
+    f[5] = target >> 8;
+    f[8] = battery;
+    f[11] = 1; // heater
+    f[14] = (1 << 3) | (1 << 5); // eco modes
+}
+
+static void test_parse(void) {
+    struct venty_state s = {0};
+    uint8_t f[BLE_MAX_VALUE_LEN];
+
+    settings_frame(f, 1234, 1800, 77);
+    CHECK_EQ(venty_parse(f, SETTINGS_FRAME_LEN, &s), CMD_SETTINGS);
+    CHECK_EQ(s.current_temp, 1234);
+    CHECK_EQ(s.target_temp, 1800);
+    CHECK_EQ(s.battery, 77);
+    CHECK(s.heater);
+    CHECK(s.eco_current);
+    CHECK(s.eco_voltage);
+    CHECK_EQ(s.settings_count, 1);
+
+    // truncated frames leave the state alone
+    struct venty_state prev = s;
+    settings_frame(f, 999, 999, 1);
+    for (uint16_t len = 1; len < SETTINGS_FRAME_LEN; len++) {
+        CHECK_EQ(venty_parse(f, len, &s), -2);
+    }
+    CHECK(memcmp(&prev, &s, sizeof(s)) == 0);
+
+    // trailing bytes are ignored
+    memset(f + SETTINGS_FRAME_LEN, 0xFF, sizeof(f) - SETTINGS_FRAME_LEN);
+    settings_frame(f, 1500, 1600, 50);
+    CHECK_EQ(venty_parse(f, sizeof(f), &s), CMD_SETTINGS);
+    CHECK_EQ(s.current_temp, 1500);
+    CHECK_EQ(s.target_temp, 1600);
+    CHECK_EQ(s.battery, 50);
+    CHECK_EQ(s.settings_count, 2);
+
+    memset(f, 0, sizeof(f));
+    f[0] = CMD_INTERFACE;
+    f[2] = 7;
+    f[5] = 1;
+    CHECK_EQ(venty_parse(f, INTERFACE_FRAME_LEN - 1, &s), -2);
+    CHECK_EQ(s.interface_count, 0);
+    CHECK_EQ(venty_parse(f, INTERFACE_FRAME_LEN, &s), CMD_INTERFACE);
+    CHECK_EQ(s.brightness, 7);
+    CHECK(s.vibration);
+    CHECK_EQ(s.interface_count, 1);
+
+    // unknown commands and invalid parameters
+    f[0] = 0x42;
+    CHECK_EQ(venty_parse(f, sizeof(f), &s), -2);
+    CHECK_EQ(venty_parse(f, 0, &s), -1);
+    CHECK_EQ(venty_parse(NULL, sizeof(f), &s), -1);
+    CHECK_EQ(venty_parse(f, sizeof(f), NULL), -1);
+    CHECK_EQ(s.settings_count, 2);
+    CHECK_EQ(s.interface_count, 1);
+}
+
+static const struct fake_peripheral venty = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x03 },
+    .name = "S&B VY000003",
+    .model = FAKE_MODEL_VENTY,
+    .adv_interval_ms = 100,
+    .advertising = true,
+};
+
+static void notify(int dev, const uint8_t *f, uint8_t len) {
+    fake_bt_notify(dev, CHAR_VENTY_CMD, f, len);
+    for (uint t = 0; t < 100; t++) {
+        sleep_ms(1);
+        main_loop_hw();
+    }
+    venty_poll();
+}
+
+static void test_notify(void) {
+    fake_bt_reset();
+    int dev = fake_bt_add(&venty);
+    ble_init();
+    sleep_ms(10);
+
+    bd_addr_t addr;
+    memcpy(addr, venty.addr, sizeof(bd_addr_t));
+    ble_connect(addr, venty.type);
+    for (uint t = 0; (t < 1000) && !ble_is_connected(); t++) {
+        sleep_ms(1);
+        main_loop_hw();
+    }
+    CHECK(ble_is_connected());
+
+    // subscribes to notifications
+    struct venty_state s;
+    CHECK_EQ(venty_refresh(&s), 0);
+    uint32_t count = venty_get_state().settings_count;
+    CHECK(count > 0);
+
+    uint8_t f[BLE_MAX_VALUE_LEN];
+    settings_frame(f, 2222, 2100, 42);
+    notify(dev, f, SETTINGS_FRAME_LEN - 4);
+    CHECK_EQ(venty_get_state().settings_count, count);
+    CHECK(venty_get_state().current_temp != 2222);
+
+    notify(dev, f, SETTINGS_FRAME_LEN);
+    CHECK_EQ(venty_get_state().settings_count, count + 1);
+    CHECK_EQ(venty_get_state().current_temp, 2222);
+    CHECK_EQ(venty_get_state().battery, 42);
+
+    memset(f, 0xAA, sizeof(f));
+    settings_frame(f, 2001, 2100, 41);
+    notify(dev, f, sizeof(f));
+    CHECK_EQ(venty_get_state().settings_count, count + 2);
+    CHECK_EQ(venty_get_state().current_temp, 2001);
+    CHECK_EQ(venty_get_state().battery, 41);
+
+    // empty notification is dropped
+    notify(dev, f, 0);
+    CHECK_EQ(venty_get_state().settings_count, count + 2);
+
+    CHECK(ble_is_connected());
+    CHECK_EQ(fake_bt_stats()->gatt_rejected, 0);
+}
+
+int main(void) {
+    host_init();
+
+    test_parse();
+    test_notify();
+
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_venty");
+}
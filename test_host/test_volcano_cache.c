@@ -0,0 +1,208 @@
+/*
+ * test_volcano_cache.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * GATT round trips of the Volcano screens against the simulated device,
+ * while the status cache of volcano.c is warm and after it expired.
+ * The config page refresh is the same sequence as fetch_values() in
+ * state_volcano_conf.c, the run screen is the temperature poll of the
+ * workflow engine through the vaporizer ops.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "ble.h"
+#include "config.h"
+#include "main.h"
+#include "vaporizer.h"
+#include "volcano.h"
+#include "fake_btstack.h"
+#include "host.h"
+
+// PRJSTAT1/2/3, both temperatures, shutoff and brightness
+#define SNAPSHOT_READS 7
+
+// firmware, heat hours and minutes are never cached
+#define CONF_UNCACHED_READS 3
+
+static const struct fake_peripheral volcano = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x01 },
+    .name = "S&B VOLCANO H",
+    .model = FAKE_MODEL_VOLCANO,
+    .adv_interval_ms = 100,
+    .advertising = true,
+};
+
+static bool connect(void) {
+    fake_bt_reset();
+    fake_bt_add(&volcano);
+    ble_init();
+    sleep_ms(10);
+
+    bd_addr_t addr;
+    memcpy(addr, volcano.addr, sizeof(bd_addr_t));
+    ble_connect(addr, volcano.type);
+    for (uint t = 0; t < 1000; t++) {
+        if (ble_is_connected()) {
+            return true;
+        }
+        sleep_ms(1);
+        main_loop_hw();
+    }
+    return false;
+}
+
+// round trips of one config page refresh
+static uint32_t conf_refresh(void) {
+    uint32_t start = ble_round_trips();
+
+    CHECK_EQ(volcano_discover_characteristics(false, true), 0);
+
+    struct volcano_snapshot snap;
+    CHECK_EQ(volcano_snapshot(&snap), 0);
+
+    char fw[VOLCANO_FW_LEN + 1];
+    CHECK_EQ(volcano_get_firmware(fw), 0);
+    CHECK(volcano_get_runtime() >= 0);
+
+    return ble_round_trips() - start;
+}
+
+// round trips of one temperature poll of the workflow engine
+static uint32_t run_poll(int16_t *temp) {
+    const struct vaporizer_ops *ops = vaporizer_get(DEV_VOLCANO);
+    uint32_t start = ble_round_trips();
+
+    CHECK_EQ(ops->read_start(VAP_CURRENT_TEMP), 0);
+    int8_t r = 0;
+    for (uint t = 0; (t < 1000) && (r == 0); t++) {
+        r = ops->read_poll(VAP_CURRENT_TEMP, temp);
+        if (r == 0) {
+            sleep_ms(1);
+            main_loop_hw();
+        }
+    }
+    CHECK_EQ(r, 1);
+
+    return ble_round_trips() - start;
+}
+
+static void test_conf(void) {
+    CHECK(connect());
+
+    // handles are discovered once per connection
+    CHECK_EQ(volcano_discover_characteristics(true, true), 0);
+    volcano_invalidate();
+
+    CHECK_EQ(conf_refresh(), SNAPSHOT_READS + CONF_UNCACHED_READS);
+
+    // warm
+    CHECK_EQ(conf_refresh(), CONF_UNCACHED_READS);
+
+    // only the temperature has a short TTL
+    sleep_ms(VOLCANO_CACHE_TEMP_TTL_MS);
+    CHECK_EQ(conf_refresh(), 1 + CONF_UNCACHED_READS);
+
+    // all expired
+    sleep_ms(VOLCANO_CACHE_TTL_MS);
+    CHECK_EQ(conf_refresh(), SNAPSHOT_READS + CONF_UNCACHED_READS);
+
+    // writes only drop what they change
+    CHECK_EQ(volcano_set_brightness(50), 0);
+    CHECK_EQ(volcano_set_vibration(true), 0);
+    CHECK_EQ(conf_refresh(), 2 + CONF_UNCACHED_READS);
+
+    // getters share the snapshot
+    uint32_t start = ble_round_trips();
+    CHECK(volcano_get_unit() != UNIT_INVALID);
+    CHECK(volcano_get_display_cooling() >= 0);
+    CHECK(volcano_get_state() != VOLCANO_STATE_INVALID);
+    CHECK(volcano_get_auto_shutoff() >= 0);
+    CHECK_EQ(ble_round_trips() - start, 0);
+
+    ble_disconnect();
+    sleep_ms(100);
+}
+
+static void test_run(void) {
+    CHECK(connect());
+    CHECK_EQ(volcano_discover_characteristics(true, false), 0);
+    volcano_invalidate();
+
+    int16_t temp = -1;
+    CHECK_EQ(run_poll(&temp), 1);
+    CHECK(temp >= 0);
+
+    // within the TTL, from the value of the previous poll
+    int16_t cached = -1;
+    CHECK_EQ(run_poll(&cached), 0);
+    CHECK_EQ(cached, temp);
+
+    // expired
+    sleep_ms(VOLCANO_CACHE_TEMP_TTL_MS);
+    CHECK_EQ(run_poll(&temp), 1);
+
+    // the engine polls every WF_TEMP_POLL_MS, longer than the TTL
+    for (uint i = 0; i < 5; i++) {
+        sleep_ms(WF_TEMP_POLL_MS);
+        CHECK_EQ(run_poll(&temp), 1);
+    }
+
+    // shares what the screens already fetched
+    struct volcano_snapshot snap;
+    CHECK_EQ(volcano_snapshot(&snap), 0);
+    CHECK_EQ(run_poll(&temp), 0);
+    CHECK_EQ(temp, snap.current_temp);
+
+    // heater state comes from PRJSTAT1 of the snapshot as well
+    int16_t heater = -1;
+    const struct vaporizer_ops *ops = vaporizer_get(DEV_VOLCANO);
+    uint32_t start = ble_round_trips();
+    CHECK_EQ(ops->read_start(VAP_HEATER), 0);
+    CHECK_EQ(ops->read_poll(VAP_HEATER, &heater), 1);
+    CHECK_EQ(ble_round_trips() - start, 0);
+    CHECK_EQ(heater, (snap.state & VOLCANO_STATE_HEATER) ? 1 : 0);
+
+    // what the API shows while a screen owns the link, never read again
+    sleep_ms(VOLCANO_CACHE_TTL_MS);
+    start = ble_round_trips();
+    int16_t v = -1;
+    CHECK_EQ(ops->get_cached(VAP_TARGET_TEMP, &v), 0);
+    CHECK_EQ(v, snap.target_temp);
+    CHECK_EQ(ops->get_cached(VAP_PUMP, &v), 0);
+    CHECK_EQ(v, (snap.state & VOLCANO_STATE_PUMP) ? 1 : 0);
+    CHECK_EQ(ble_round_trips() - start, 0);
+    volcano_invalidate();
+    CHECK(ops->get_cached(VAP_CURRENT_TEMP, &v) < 0);
+
+    ble_disconnect();
+    sleep_ms(100);
+}
+
+int main(void) {
+    host_init();
+
+    test_conf();
+    test_run();
+
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_volcano_cache");
+}
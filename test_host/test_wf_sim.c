@@ -0,0 +1,584 @@
+/*
+ * test_wf_sim.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs the built-in workflows through wf_sim.c and compares the
+ * results and CSV timelines with the ones recorded below. When a change
+ * to the engine or a default workflow is intended, the new values are
+ * printed in the same format, the CSV itself shows up with HOST_VERBOSE.
+ *
+ * The same goes for the unrolled default workflows of before there were
+ * loops and snippets, as they still come out of old flash contents. Once
+ * converted by wf_compact(), like mem.c does on load, and as built-in
+ * workflow of today, they have to give the device the same commands at
+ * the same times as the recorded run of the originals.
+ *
+ * Checks wf_validate() rejects loops nested deeper than the engine can
+ * run them, and loops around no step that does something.
+ *
+ * Also measures how long wf_stop() takes to turn off the heater, on a
+ * device with slow answers, while a write or read is still in flight.
+ * And that the simulation waits for a request wf_reset() left behind.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+
+#include "config.h"
+#include "mem.h"
+#include "thermal.h"
+#include "vaporizer.h"
+#include "workflow.h"
+#include "wf_sim.h"
+#include "host.h"
+
+#define SLOW_TICK_MS 10 // virtual time between wf_run() calls
+#define SLOW_IO_MS 100 // until the slow device answers
+#define SLOW_TIMEOUT_MS (3 * 500) // driver gives up on a write, like BLE_WRTE_TIMEOUT_MS
+
+struct expected {
+    const char *name;
+    uint32_t duration_ms;
+    uint32_t pump_ms;
+    int16_t max_temp;
+    uint32_t target_writes, heater_writes, pump_writes;
+    uint32_t rows;
+    uint32_t hash; // FNV-1a of the CSV rows
+};
+
+static const struct expected expected[] = {
+    { "Default", 500350, 47250, 2045, 4, 2, 10, 524, 0x21AB1012 },
+    { "XXL", 517850, 60250, 2045, 4, 2, 10, 542, 0xB2E80CC3 },
+    { "Vorbi", 621270, 36200, 2165, 4, 2, 8, 645, 0x8FC63EB4 },
+    { "Relaxo", 496350, 47250, 1945, 4, 2, 10, 521, 0x3A74B57B },
+    { "Hotty", 545850, 47250, 2195, 4, 2, 10, 571, 0x45081344 },
+};
+
+// as in workflow_default.c before OP_LOOP and OP_CALL
+#define LEGACY_NOTIFY \
+    { .op = OP_WAIT_TIME, .val = 1000 }, \
+    { .op = OP_PUMP_TIME, .val = 1000 }
+
+#define LEGACY_SESSION(n, t1, p1, t2, p2, t3, p3) { \
+    .name = n, \
+    .author = "xythobuz", \
+    .steps = { \
+        { .op = OP_WAIT_TEMPERATURE, .val = t1 }, \
+        { .op = OP_WAIT_TIME, .val = 10000 }, \
+        { .op = OP_PUMP_TIME, .val = p1 }, \
+        { .op = OP_WAIT_TEMPERATURE, .val = t2 }, \
+        { .op = OP_WAIT_TIME, .val = 5000 }, \
+        { .op = OP_PUMP_TIME, .val = p2 }, \
+        { .op = OP_WAIT_TEMPERATURE, .val = t3 }, \
+        { .op = OP_WAIT_TIME, .val = 5000 }, \
+        { .op = OP_PUMP_TIME, .val = p3 }, \
+        LEGACY_NOTIFY, LEGACY_NOTIFY, \
+        { .op = OP_SET_TEMPERATURE, .val = 1900 }, \
+    }, \
+    .count = 14, \
+}
+
+static const struct workflow legacy[] = {
+    LEGACY_SESSION("Default", 1850, 5000, 1950, 20000, 2050, 20000),
+    LEGACY_SESSION("XXL", 1850, 8000, 1950, 25000, 2050, 25000),
+    {
+        .name = "Vorbi",
+        .author = "Rinor",
+        .steps = {
+            { .op = OP_WAIT_TEMPERATURE, .val = 1760 },
+            { .op = OP_WAIT_TIME, .val = 10000 },
+            { .op = OP_PUMP_TIME, .val = 6000 },
+            { .op = OP_WAIT_TEMPERATURE, .val = 1870 },
+            { .op = OP_WAIT_TIME, .val = 5000 },
+            { .op = OP_PUMP_TIME, .val = 10000 },
+            { .op = OP_WAIT_TEMPERATURE, .val = 2040 },
+            { .op = OP_WAIT_TIME, .val = 3000 },
+            { .op = OP_PUMP_TIME, .val = 10000 },
+            { .op = OP_WAIT_TEMPERATURE, .val = 2170 },
+            { .op = OP_WAIT_TIME, .val = 5000 },
+            { .op = OP_PUMP_TIME, .val = 10000 },
+        },
+        .count = 12,
+    },
+    LEGACY_SESSION("Relaxo", 1750, 5000, 1850, 20000, 1950, 20000),
+    LEGACY_SESSION("Hotty", 1900, 5000, 2050, 20000, 2200, 20000),
+};
+
+struct legacy_expected {
+    uint32_t duration_ms;
+    uint32_t commands; // rows where setpoint, heater or pump changed
+    uint32_t hash; // FNV-1a of those, without the step column
+};
+
+// recorded with the unconverted legacy[] workflows
+static const struct legacy_expected legacy_expected[] = {
+    { 500350, 15, 0x7B4C0459 }, // Default
+    { 517850, 15, 0x21C765F0 }, // XXL
+    { 621270, 14, 0x95849440 }, // Vorbi
+    { 496350, 16, 0xF508DBCC }, // Relaxo
+    { 545850, 16, 0x9931D144 }, // Hotty
+};
+
+struct trace {
+    uint32_t rows;
+    uint32_t hash;
+    uint32_t commands;
+    uint32_t cmd_hash;
+    char last_cmd[48];
+    bool header;
+    bool ordered;
+    uint32_t last_t;
+    int heater, pump; // of the last row
+};
+
+static struct trace trace;
+
+static void trace_line(const char *line, size_t len) {
+    // debug() lines start with the uptime and a space, rows have none
+    if (memchr(line, ' ', len) != NULL) {
+        return;
+    }
+
+    if (strncmp(line, "time,", 5) == 0) {
+        trace.header = true;
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        trace.hash ^= (uint8_t)line[i];
+        trace.hash *= 16777619UL;
+    }
+    trace.rows++;
+
+    // time,step,setpoint,temperature,heater,pump
+    char buff[64] = {0};
+    memcpy(buff, line, MIN(len, sizeof(buff) - 1));
+    unsigned long s, ms;
+    unsigned step;
+    float setpoint, temp;
+    int heater, pump;
+    if (sscanf(buff, "%lu.%lu,%u,%f,%f,%d,%d", &s, &ms, &step,
+               &setpoint, &temp, &heater, &pump) != 7) {
+        printf("invalid row: %s", buff);
+        trace.ordered = false;
+        return;
+    }
+
+    uint32_t t = s * 1000 + ms;
+
+    // what the device was told, independent of how the steps are numbered
+    char cmd[sizeof(trace.last_cmd)];
+    snprintf(cmd, sizeof(cmd), "%.1f,%d,%d", setpoint, heater, pump);
+    if (strcmp(cmd, trace.last_cmd) != 0) {
+        strcpy(trace.last_cmd, cmd);
+        snprintf(buff, sizeof(buff), "%lu,%s", t, cmd);
+        for (size_t i = 0; buff[i] != '\0'; i++) {
+            trace.cmd_hash ^= (uint8_t)buff[i];
+            trace.cmd_hash *= 16777619UL;
+        }
+        trace.commands++;
+    }
+
+    if ((trace.rows > 1) && (t < trace.last_t)) {
+        trace.ordered = false;
+    }
+    trace.last_t = t;
+    trace.heater = heater;
+    trace.pump = pump;
+}
+
+static void run(uint16_t index, struct wf_sim_result *r) {
+    memset(&trace, 0, sizeof(trace));
+    trace.hash = 2166136261UL;
+    trace.cmd_hash = 2166136261UL;
+    trace.ordered = true;
+
+    host_output_hook = trace_line;
+    CHECK_EQ(wf_sim_run(index, true, r), 0);
+    host_output_hook = NULL;
+}
+
+static void check(uint16_t index) {
+    struct wf_sim_result r;
+    run(index, &r);
+
+    printf("    { \"%s\", %lu, %lu, %d, %lu, %lu, %lu, %lu, 0x%08lX },\n",
+           wf_name(index), r.duration_ms, r.pump_ms, r.max_temp,
+           r.target_writes, r.heater_writes, r.pump_writes,
+           trace.rows, trace.hash);
+
+    // timeline makes sense on its own
+    CHECK(!r.error);
+    CHECK(trace.header);
+    CHECK(trace.ordered);
+    CHECK(trace.rows > 0);
+    CHECK(trace.last_t <= r.duration_ms);
+    CHECK_EQ(trace.heater, 0);
+    CHECK_EQ(trace.pump, 0);
+    CHECK(r.reads > 0);
+
+    // and did not change
+    CHECK(index < count_of(expected));
+    if (index >= count_of(expected)) {
+        return;
+    }
+    const struct expected *e = &expected[index];
+    CHECK(strcmp(wf_name(index), e->name) == 0);
+    CHECK_EQ(r.duration_ms, e->duration_ms);
+    CHECK_EQ(r.pump_ms, e->pump_ms);
+    CHECK_EQ(r.max_temp, e->max_temp);
+    CHECK_EQ(r.target_writes, e->target_writes);
+    CHECK_EQ(r.heater_writes, e->heater_writes);
+    CHECK_EQ(r.pump_writes, e->pump_writes);
+    CHECK_EQ(trace.rows, e->rows);
+    CHECK_EQ(trace.hash, e->hash);
+
+    // same result on a second run
+    uint32_t hash = trace.hash;
+    struct wf_sim_result again;
+    run(index, &again);
+    CHECK_EQ(again.duration_ms, r.duration_ms);
+    CHECK_EQ(trace.hash, hash);
+}
+
+// runs wf in the first slot, instead of what is stored there
+static void run_as_stored(const struct workflow *wf, struct wf_sim_result *r) {
+    struct mem_data *mem = mem_data();
+    struct workflow saved = mem->wf[0];
+    mem->wf[0] = *wf;
+    run(0, r);
+    mem->wf[0] = saved;
+}
+
+static bool has_loop(const struct workflow *wf) {
+    for (uint16_t i = 0; i < wf->count; i++) {
+        if (wf->steps[i].op == OP_LOOP) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void check_legacy(uint16_t index) {
+    const struct workflow *orig = &legacy[index];
+    struct wf_sim_result r;
+    run_as_stored(orig, &r);
+
+    printf("    { %lu, %lu, 0x%08lX }, // %s\n",
+           r.duration_ms, trace.commands, trace.cmd_hash, orig->name);
+
+    CHECK(!r.error);
+    CHECK(index < count_of(legacy_expected));
+    if (index >= count_of(legacy_expected)) {
+        return;
+    }
+    const struct legacy_expected *e = &legacy_expected[index];
+    CHECK_EQ(r.duration_ms, e->duration_ms);
+    CHECK_EQ(trace.commands, e->commands);
+    CHECK_EQ(trace.cmd_hash, e->hash);
+
+    // converted on load
+    struct workflow conv = *orig;
+    wf_compact(&conv);
+    CHECK_EQ(wf_validate(&conv, false), 0);
+    CHECK(conv.count <= orig->count);
+    CHECK((conv.count == orig->count) || has_loop(&conv));
+    run_as_stored(&conv, &r);
+    CHECK(!r.error);
+    CHECK_EQ(r.duration_ms, e->duration_ms);
+    CHECK_EQ(trace.commands, e->commands);
+    CHECK_EQ(trace.cmd_hash, e->hash);
+
+    // and the built-in one of today
+    for (uint16_t i = 0; i < wf_count(); i++) {
+        if (strcmp(wf_name(i), orig->name) != 0) {
+            continue;
+        }
+        run(i, &r);
+        CHECK(!r.error);
+        CHECK_EQ(r.duration_ms, e->duration_ms);
+        CHECK_EQ(trace.commands, e->commands);
+        CHECK_EQ(trace.cmd_hash, e->hash);
+    }
+}
+
+// n loops, each around all steps before it
+static struct workflow nested(uint16_t n, bool call) {
+    struct workflow wf = { .name = "Nested", .author = "test" };
+    wf.steps[wf.count++] = (struct wf_step){ .op = OP_WAIT_TIME, .val = 10 };
+    if (call) {
+        wf.steps[wf.count++] = (struct wf_step){ .op = OP_CALL, .val = 0 };
+    }
+    for (uint16_t i = 0; i < n; i++) {
+        wf.steps[wf.count] = (struct wf_step){ .op = OP_LOOP, .val = 2, .arg = wf.count };
+        wf.count++;
+    }
+    return wf;
+}
+
+static void test_validate(void) {
+    // snippet 0 has a loop of its own
+    CHECK(wf_snippet_count > 0);
+
+    struct workflow wf = nested(WF_MAX_LOOPS, false);
+    CHECK_EQ(wf_validate(&wf, false), 0);
+    wf = nested(WF_MAX_LOOPS + 1, false);
+    CHECK(wf_validate(&wf, false) < 0);
+
+    wf = nested(WF_MAX_LOOPS - 1, true);
+    CHECK_EQ(wf_validate(&wf, false), 0);
+    wf = nested(WF_MAX_LOOPS, true);
+    CHECK(wf_validate(&wf, false) < 0);
+
+    // loop around nothing but another loop
+    wf = (struct workflow){ .name = "Empty", .author = "test", .count = 3, .steps = {
+        { .op = OP_WAIT_TIME, .val = 10 },
+        { .op = OP_LOOP, .val = 2, .arg = 1 },
+        { .op = OP_LOOP, .val = 2, .arg = 1 },
+    } };
+    CHECK(wf_validate(&wf, false) < 0);
+
+    // a call counts if the snippet does something
+    wf = (struct workflow){ .name = "Call", .author = "test", .count = 2, .steps = {
+        { .op = OP_CALL, .val = 0 },
+        { .op = OP_LOOP, .val = 2, .arg = 1 },
+    } };
+    CHECK_EQ(wf_validate(&wf, false), 0);
+}
+
+// device with one request in flight at a time, answering after SLOW_IO_MS
+static struct {
+    uint32_t t; // virtual clock
+    struct thermal_model model;
+    bool stall; // writes are never confirmed, they time out
+    uint32_t io_t; // start of the request in flight
+    int32_t heater_off_t; // first heater off write, < 0 before
+} slow;
+
+static uint32_t slow_clock(void) {
+    return slow.t;
+}
+
+static int16_t slow_value(enum vaporizer_value v) {
+    thermal_model_run(&slow.model, slow.t);
+    switch (v) {
+    case VAP_CURRENT_TEMP:
+        return slow.model.current;
+    case VAP_TARGET_TEMP:
+        return slow.model.target;
+    case VAP_HEATER:
+        return slow.model.heater;
+    case VAP_PUMP:
+        return slow.model.pump;
+    }
+    return -1;
+}
+
+static int8_t slow_read_start(enum vaporizer_value v) {
+    (void)v;
+    slow.io_t = slow.t;
+    return 0;
+}
+
+static int8_t slow_read_poll(enum vaporizer_value v, int16_t *value) {
+    if ((slow.t - slow.io_t) < SLOW_IO_MS) {
+        return 0;
+    }
+    *value = slow_value(v);
+    return 1;
+}
+
+static int8_t slow_write_start(enum vaporizer_value v, uint16_t value) {
+    slow.io_t = slow.t;
+    if ((v == VAP_HEATER) && !value && (slow.heater_off_t < 0)) {
+        slow.heater_off_t = slow.t;
+    }
+    if (slow.stall) {
+        return 0;
+    }
+
+    thermal_model_run(&slow.model, slow.t);
+    if (v == VAP_TARGET_TEMP) {
+        slow.model.target = value;
+    } else if (v == VAP_HEATER) {
+        slow.model.heater = value;
+    } else if (v == VAP_PUMP) {
+        slow.model.pump = value;
+    }
+    return 0;
+}
+
+static int8_t slow_write_poll(void) {
+    if (slow.stall) {
+        return ((slow.t - slow.io_t) < SLOW_TIMEOUT_MS) ? 0 : -3;
+    }
+    return ((slow.t - slow.io_t) < SLOW_IO_MS) ? 0 : 1;
+}
+
+// only for the pump capability, the engine must not block
+static int8_t slow_set(bool value) {
+    (void)value;
+    CHECK(false);
+    return -1;
+}
+
+static const struct vaporizer_ops slow_ops = {
+    .name = "Slow Volcano",
+    .dev = DEV_VOLCANO,
+    .caps = VAP_CAP_PUMP | VAP_CAP_STATE,
+    .temp_resolution = 1,
+    .set_heater = slow_set,
+    .set_pump = slow_set,
+    .read_start = slow_read_start,
+    .read_poll = slow_read_poll,
+    .write_start = slow_write_start,
+    .write_poll = slow_write_poll,
+};
+
+static void slow_tick(void) {
+    wf_run();
+    slow.t += SLOW_TICK_MS;
+}
+
+static void slow_start(bool stall) {
+    memset(&slow, 0, sizeof(slow));
+    slow.t = 1000;
+    slow.stall = stall;
+    slow.heater_off_t = -1;
+    thermal_model_init(&slow.model, slow.t);
+
+    wf_set_clock(slow_clock);
+    wf_start_ops(0, &slow_ops);
+    CHECK_EQ(wf_status().status, WF_RUNNING);
+}
+
+// stop now, returns ms until heater off was written, then lets it finish
+static uint32_t slow_stop(void) {
+    uint32_t stop_t = slow.t;
+    wf_stop();
+    while ((slow.heater_off_t < 0) && ((slow.t - stop_t) < (10 * SLOW_TIMEOUT_MS))) {
+        slow_tick();
+    }
+    uint32_t latency = slow.heater_off_t - stop_t;
+
+    slow.stall = false;
+    while ((wf_status().status != WF_IDLE) && ((slow.t - stop_t) < (20 * SLOW_TIMEOUT_MS))) {
+        slow_tick();
+    }
+    CHECK_EQ(wf_status().status, WF_IDLE);
+    CHECK_EQ(slow.model.heater, false);
+    CHECK_EQ(slow.model.pump, false);
+
+    wf_set_clock(NULL);
+    return latency;
+}
+
+static void test_abort_write(void) {
+    // heater on is written first and never confirmed
+    slow_start(true);
+    slow_tick();
+    slow_tick();
+
+    uint32_t latency = slow_stop();
+    printf("Abort during a write: heater off after %lums\n", latency);
+    CHECK(slow.heater_off_t >= 0);
+    CHECK(latency <= (SLOW_TIMEOUT_MS + SLOW_TICK_MS));
+}
+
+static void test_abort_wait_temp(void) {
+    uint32_t worst = 0;
+
+    // at every point of the temperature poll, with and without a read in flight
+    for (uint32_t offset = 0; offset < WF_TEMP_POLL_MS; offset += SLOW_TICK_MS) {
+        slow_start(false);
+        while ((wf_status().status == WF_RUNNING)
+               && (wf_status().step->op != OP_WAIT_TEMPERATURE)) {
+            slow_tick();
+        }
+        CHECK_EQ(wf_status().step->op, OP_WAIT_TEMPERATURE);
+
+        for (uint32_t t = 0; t < (2 * WF_TEMP_POLL_MS + offset); t += SLOW_TICK_MS) {
+            slow_tick();
+        }
+        CHECK_EQ(wf_status().step->op, OP_WAIT_TEMPERATURE);
+
+        uint32_t latency = slow_stop();
+        CHECK(slow.heater_off_t >= 0);
+        worst = MAX(worst, latency);
+    }
+
+    printf("Abort waiting for temperature: heater off after %lums at most\n", worst);
+    CHECK(worst <= (SLOW_TIMEOUT_MS + SLOW_TICK_MS));
+
+    // nothing to wait for but a read of SLOW_IO_MS
+    CHECK(worst <= (SLOW_IO_MS + SLOW_TICK_MS));
+}
+
+static void test_busy(void) {
+    // heater on is written first and never confirmed
+    slow_start(true);
+    slow_tick();
+    slow_tick();
+
+    // forgotten, but the write is still in flight
+    wf_reset();
+    CHECK_EQ(wf_status().status, WF_IDLE);
+    CHECK(wf_status().io_pending);
+    struct wf_sim_result r;
+    CHECK(wf_sim_run(0, false, &r) < 0);
+
+    // drained by wf_run() once the driver gives up
+    while (wf_status().io_pending && (slow.t < (10 * SLOW_TIMEOUT_MS))) {
+        slow_tick();
+    }
+    CHECK(!wf_status().io_pending);
+    wf_set_clock(NULL);
+
+    CHECK_EQ(wf_sim_run(0, false, &r), 0);
+    CHECK(!r.error);
+    CHECK_EQ(r.duration_ms, expected[0].duration_ms);
+}
+
+int main(void) {
+    host_init();
+    mem_load_defaults();
+    CHECK(wf_count() > 0);
+
+    struct wf_sim_result r;
+    CHECK(wf_sim_run(wf_count(), false, &r) < 0);
+
+    printf("Built-in workflows, as in expected[]:\n");
+    for (uint16_t i = 0; i < wf_count(); i++) {
+        check(i);
+    }
+    CHECK_EQ(wf_count(), count_of(expected));
+
+    printf("Legacy workflows, as in legacy_expected[]:\n");
+    for (uint16_t i = 0; i < count_of(legacy); i++) {
+        check_legacy(i);
+    }
+
+    test_validate();
+    test_abort_write();
+    test_abort_wait_temp();
+    test_busy();
+
+    return host_result("test_wf_sim");
+}
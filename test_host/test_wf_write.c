@@ -0,0 +1,232 @@
+/*
+ * test_wf_write.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Confirmed writes of the workflow engine while the fake Volcano answers
+ * writes late, loses their responses or loses them completely. Checks
+ * when each attempt goes out, how many retries there are and that a
+ * write that can not be confirmed ends the workflow with an error.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "ble.h"
+#include "ble_sim.h"
+#include "config.h"
+#include "main.h"
+#include "mem.h"
+#include "workflow.h"
+#include "fake_btstack.h"
+#include "host.h"
+
+#define WRITE_TIMEOUT_MS (3 * 500) // BLE_WRTE_TIMEOUT_MS in ble.c
+
+// heater on and target temperature of the first step
+#define START_WRITES 2
+
+static const struct fake_peripheral volcano = {
+    .addr = { 0xC0, 0xFF, 0xEE, 0x00, 0x00, 0x01 },
+    .name = "S&B VOLCANO H",
+    .model = FAKE_MODEL_VOLCANO,
+    .adv_interval_ms = 100,
+    .advertising = true,
+};
+
+static int dev = -1;
+
+// simulated time of each write request that reached the peripheral
+static uint32_t write_t[16];
+static uint32_t writes = 0;
+
+struct counters {
+    unsigned long writes, retries, failed;
+};
+
+static struct counters counters;
+
+static void stats_line(const char *line, size_t len) {
+    char buff[128] = {0};
+    memcpy(buff, line, MIN(len, sizeof(buff) - 1));
+    const char *s = strstr(buff, "Workflow writes: ");
+    if (s != NULL) {
+        sscanf(s, "Workflow writes: %lu, retries: %lu, failed: %lu",
+               &counters.writes, &counters.retries, &counters.failed);
+    }
+}
+
+static struct counters wf_counters(void) {
+    memset(&counters, 0, sizeof(counters));
+    host_output_hook = stats_line;
+    wf_stats();
+    host_output_hook = NULL;
+    return counters;
+}
+
+static uint32_t now(void) {
+    return host_time_us() / 1000;
+}
+
+static void step(void) {
+    sleep_ms(1);
+    main_loop_hw();
+    wf_run();
+
+    uint32_t n = fake_bt_stats()->gatt_writes;
+    while ((writes < n) && (writes < count_of(write_t))) {
+        write_t[writes++] = now();
+    }
+}
+
+static void run_ms(uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t++) {
+        step();
+    }
+}
+
+static void setup(enum fake_write_mode mode, uint32_t delay_ms) {
+    fake_bt_reset();
+    ble_sim_set_link(BLE_SIM_LATENCY_MS, 0);
+    dev = fake_bt_add(&volcano);
+    ble_init();
+    sleep_ms(10);
+
+    bd_addr_t addr;
+    memcpy(addr, volcano.addr, sizeof(bd_addr_t));
+    ble_connect(addr, volcano.type);
+    for (uint t = 0; (t < 1000) && !ble_is_connected(); t++) {
+        sleep_ms(1);
+        main_loop_hw();
+    }
+    CHECK(ble_is_connected());
+
+    fake_bt_write_mode(dev, mode, delay_ms);
+    writes = 0;
+}
+
+static void teardown(void) {
+    wf_reset();
+    run_ms(WRITE_TIMEOUT_MS);
+    ble_disconnect();
+    sleep_ms(100);
+}
+
+static void test_delayed(void) {
+    setup(FAKE_WRITE_DELAY, WRITE_TIMEOUT_MS / 2);
+    struct counters before = wf_counters();
+
+    wf_start(0, DEV_VOLCANO);
+    run_ms(3 * WRITE_TIMEOUT_MS);
+
+    // slow, but within the timeout
+    CHECK_EQ(writes, START_WRITES);
+    CHECK((write_t[1] - write_t[0]) >= (WRITE_TIMEOUT_MS / 2));
+    CHECK((write_t[1] - write_t[0]) < WRITE_TIMEOUT_MS);
+    CHECK_EQ(wf_status().status, WF_RUNNING);
+    CHECK(!wf_status().error);
+
+    struct counters after = wf_counters();
+    CHECK_EQ(after.writes - before.writes, START_WRITES);
+    CHECK_EQ(after.retries - before.retries, 0);
+    CHECK_EQ(after.failed - before.failed, 0);
+
+    teardown();
+}
+
+static void test_lost_response(void) {
+    setup(FAKE_WRITE_LOSE_RESPONSE, 0);
+    struct counters before = wf_counters();
+
+    wf_start(0, DEV_VOLCANO);
+    run_ms(3 * WRITE_TIMEOUT_MS);
+
+    // each write times out, the read back shows it got set anyway
+    CHECK_EQ(writes, START_WRITES);
+    CHECK((write_t[1] - write_t[0]) >= WRITE_TIMEOUT_MS);
+    CHECK((write_t[1] - write_t[0]) < (WRITE_TIMEOUT_MS + WF_WRITE_BACKOFF_MS));
+    CHECK_EQ(wf_status().status, WF_RUNNING);
+    CHECK(!wf_status().error);
+
+    struct counters after = wf_counters();
+    CHECK_EQ(after.retries - before.retries, 0);
+    CHECK_EQ(after.failed - before.failed, 0);
+
+    teardown();
+}
+
+static void test_lost(void) {
+    setup(FAKE_WRITE_LOSE, 0);
+    struct counters before = wf_counters();
+
+    wf_start(0, DEV_VOLCANO);
+
+    // heater on is never set, so every read back disagrees
+    uint32_t budget = WF_WRITE_ATTEMPTS * (WRITE_TIMEOUT_MS + 100);
+    for (uint32_t b = WF_WRITE_BACKOFF_MS, i = 1; i < WF_WRITE_ATTEMPTS; i++, b *= 2) {
+        budget += b;
+    }
+    uint32_t start = now();
+    while (!wf_status().stopping && (wf_status().status != WF_IDLE)
+           && ((now() - start) < (2 * budget))) {
+        step();
+    }
+    uint32_t failed = now() - start;
+    CHECK(wf_status().stopping);
+    CHECK(wf_status().error);
+    CHECK(failed >= (WF_WRITE_ATTEMPTS * WRITE_TIMEOUT_MS));
+    CHECK(failed <= budget);
+
+    CHECK_EQ(writes, WF_WRITE_ATTEMPTS);
+    for (uint i = 1; i < WF_WRITE_ATTEMPTS; i++) {
+        uint32_t backoff = WF_WRITE_BACKOFF_MS << (i - 1);
+        CHECK((write_t[i] - write_t[i - 1]) >= (WRITE_TIMEOUT_MS + backoff));
+        CHECK((write_t[i] - write_t[i - 1]) < (WRITE_TIMEOUT_MS + backoff + 100));
+    }
+
+    /*
+     * Pump and heater off are lost as well, but the read back
+     * shows both are off already, so they count as done.
+     */
+    run_ms(3 * WRITE_TIMEOUT_MS);
+    CHECK_EQ(wf_status().status, WF_IDLE);
+    CHECK(wf_status().error);
+    CHECK_EQ(writes, WF_WRITE_ATTEMPTS + 2);
+
+    struct counters after = wf_counters();
+    CHECK_EQ(after.writes - before.writes, 3);
+    CHECK_EQ(after.retries - before.retries, WF_WRITE_ATTEMPTS - 1);
+    CHECK_EQ(after.failed - before.failed, 1);
+
+    teardown();
+}
+
+int main(void) {
+    host_init();
+    mem_load_defaults();
+    CHECK(wf_count() > 0);
+
+    test_delayed();
+    test_lost_response();
+    test_lost();
+
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_wf_write");
+}
@@ -0,0 +1,229 @@
+/*
+ * test_wifi.c
+ *
+ * Copyright (c) 2023 Thomas Buck (thomas@xythobuz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * See <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Joining a known network with wifi.c on the fake cyw43 driver. Straight
+ * to the access point remembered from the last join, falling back to the
+ * next remembered one or a scan when it is gone, and when the new access
+ * point is written to flash: only when it changed, and not when the
+ * network was renamed while joining.
+ */
+
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+
+#include "config.h"
+#include "mem.h"
+#include "usb_descriptors.h"
+#include "wifi.h"
+#include "fake_cyw43.h"
+#include "host.h"
+
+#define FAST_JOIN_TIMEOUT_MS 5000 // in wifi.c
+#define STEP_MS 10
+
+char string_pico_serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1] = "E6614103E7000001";
+
+static const struct fake_ap home = {
+    .ssid = "Home",
+    .bssid = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 },
+    .channel = 6,
+    .auth_mode = 4, // WPA2
+    .present = true,
+};
+
+// same network, new router
+static const struct fake_ap home_new = {
+    .ssid = "Home",
+    .bssid = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 },
+    .channel = 1,
+    .auth_mode = 4,
+    .present = true,
+};
+
+static const struct fake_ap work = {
+    .ssid = "Work",
+    .bssid = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x03 },
+    .channel = 11,
+    .auth_mode = 4,
+    .present = true,
+};
+
+static uint32_t mem_writes = 0;
+
+static void count_writes(const char *line, size_t len) {
+    char buff[128] = {0};
+    memcpy(buff, line, MIN(len, sizeof(buff) - 1));
+    if (strstr(buff, " mem_write:") != NULL) {
+        mem_writes++;
+    }
+}
+
+static void hint(struct net_credentials *net, const struct fake_ap *ap) {
+    memcpy(net->bssid, ap->bssid, sizeof(net->bssid));
+    net->channel = ap->channel;
+    net->auth = CYW43_AUTH_WPA2_AES_PSK;
+}
+
+// networks in flash, a hint for each given access point
+static void setup(const struct fake_ap *home_hint, const struct fake_ap *work_hint) {
+    host_flash_reset();
+    mem_load();
+
+    struct mem_data *mem = mem_data();
+    memset(mem->net, 0, sizeof(mem->net));
+    mem->net_count = 2;
+    strcpy(mem->net[0].name, "Home");
+    strcpy(mem->net[0].pass, "password");
+    strcpy(mem->net[1].name, "Work");
+    strcpy(mem->net[1].pass, "secret");
+    if (home_hint != NULL) {
+        hint(&mem->net[0], home_hint);
+    }
+    if (work_hint != NULL) {
+        hint(&mem->net[1], work_hint);
+    }
+    mem_write();
+
+    fake_wifi_reset();
+    mem_writes = 0;
+    host_output_hook = count_writes;
+}
+
+static void teardown(void) {
+    host_output_hook = NULL;
+    wifi_deinit();
+}
+
+// returns ms until wifi_ready(), or 0 on timeout
+static uint32_t run_until_ready(uint32_t timeout_ms) {
+    for (uint32_t t = STEP_MS; t <= timeout_ms; t += STEP_MS) {
+        sleep_ms(STEP_MS);
+        fake_wifi_run();
+        wifi_run();
+        if (wifi_ready()) {
+            return t;
+        }
+    }
+    return 0;
+}
+
+static bool joined(const struct fake_ap *ap) {
+    const struct fake_join *j = fake_wifi_last_join();
+    return (strcmp(j->ssid, ap->ssid) == 0) && (j->auth == CYW43_AUTH_WPA2_AES_PSK)
+           && (!j->fast || ((memcmp(j->bssid, ap->bssid, sizeof(j->bssid)) == 0)
+                            && (j->channel == ap->channel)));
+}
+
+static void test_hint_hit(void) {
+    setup(&home, NULL);
+    fake_wifi_add(&home);
+    fake_wifi_add(&work);
+
+    wifi_init();
+    CHECK(run_until_ready(1000) > 0);
+    CHECK(!fake_wifi_ap_mode());
+
+    // no scan at all
+    CHECK_EQ(fake_wifi_stats()->joins, 1);
+    CHECK_EQ(fake_wifi_stats()->fast_joins, 1);
+    CHECK_EQ(fake_wifi_stats()->scans, 0);
+    CHECK(joined(&home));
+
+    // same access point, nothing to write
+    run_until_ready(100);
+    CHECK_EQ(mem_writes, 0);
+
+    teardown();
+}
+
+static void test_hint_miss(void) {
+    // both remembered access points are gone
+    setup(&home, &work);
+    fake_wifi_add(&home_new);
+    int w = fake_wifi_add(&work);
+    fake_wifi_set(w, false, work.channel);
+
+    wifi_init();
+    CHECK_EQ(fake_wifi_stats()->fast_joins, 1);
+    CHECK(joined(&home));
+
+    // unknown BSSID fails right away, the next hint is tried
+    sleep_ms(STEP_MS);
+    fake_wifi_run();
+    wifi_run();
+    CHECK_EQ(fake_wifi_stats()->fast_joins, 2);
+    CHECK_EQ(fake_wifi_stats()->scans, 0);
+
+    // out of range, only the timeout tells
+    uint32_t t = run_until_ready(3 * FAST_JOIN_TIMEOUT_MS);
+    CHECK(t > FAST_JOIN_TIMEOUT_MS);
+    CHECK(t < (FAST_JOIN_TIMEOUT_MS + 1000));
+
+    // then the scan found the new one
+    CHECK_EQ(fake_wifi_stats()->fast_joins, 2);
+    CHECK_EQ(fake_wifi_stats()->scans, 1);
+    CHECK_EQ(fake_wifi_stats()->joins, 3);
+    CHECK(!fake_wifi_last_join()->fast);
+    CHECK_EQ(fake_wifi_last_join()->channel, CYW43_CHANNEL_NONE);
+
+    // and remembered it
+    run_until_ready(100);
+    CHECK_EQ(mem_writes, 1);
+    CHECK_EQ(mem_data()->net[0].channel, home_new.channel);
+    CHECK(memcmp(mem_data()->net[0].bssid, home_new.bssid, 6) == 0);
+    CHECK_EQ(mem_data()->net[1].channel, work.channel);
+
+    // for the next boot
+    teardown();
+    mem_load();
+    CHECK_EQ(mem_data()->net[0].channel, home_new.channel);
+}
+
+static void test_renamed(void) {
+    setup(&home, NULL);
+    fake_wifi_add(&home);
+
+    wifi_init();
+    CHECK(joined(&home));
+
+    // edited while joining, the hint belongs to the old name
+    strcpy(mem_data()->net[0].name, "Cottage");
+    mem_data()->net[0].channel = 0;
+
+    CHECK(run_until_ready(1000) > 0);
+    run_until_ready(100);
+    CHECK_EQ(mem_data()->net[0].channel, 0);
+    CHECK_EQ(mem_writes, 0);
+
+    teardown();
+}
+
+int main(void) {
+    host_init();
+
+    test_hint_hit();
+    test_hint_miss();
+    test_renamed();
+
+    CHECK_EQ(cyw43_thread_depth(), 0);
+    return host_result("test_wifi");
+}
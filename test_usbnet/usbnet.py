@@ -0,0 +1,83 @@
+#!/usr/bin/env python
+
+# Checks the USB network interface of the firmware from a Linux host.
+# Finds the CDC-NCM interface, waits for the DHCP lease, then measures
+# latency and throughput of the web server over USB.
+#
+# Usage: usbnet.py [path ...]
+
+import sys
+import os
+import time
+import json
+import subprocess
+import urllib.request
+
+device_ip = "192.168.7.1"
+host_ip = "192.168.7.2"
+usb_vid = "cafe"
+
+def find_interface():
+    for name in os.listdir("/sys/class/net"):
+        dev = os.path.realpath("/sys/class/net/{}/device".format(name))
+        driver = os.path.basename(os.path.realpath(dev + "/driver"))
+        try:
+            with open(dev + "/../idVendor") as f:
+                vid = f.read().strip()
+        except OSError:
+            continue
+        if (vid == usb_vid) and (driver == "cdc_ncm"):
+            return name
+    return None
+
+def wait_for_lease(iface, timeout):
+    start = time.time()
+    while (time.time() - start) < timeout:
+        out = subprocess.run(["ip", "-4", "-o", "addr", "show", "dev", iface],
+                             capture_output=True, text=True).stdout
+        if host_ip in out:
+            return time.time() - start
+        time.sleep(0.2)
+    return None
+
+def ping():
+    out = subprocess.run(["ping", "-c", "20", "-i", "0.2", "-q", device_ip],
+                         capture_output=True, text=True).stdout
+    print(out.strip().split("\n")[-1])
+
+def get(path):
+    with urllib.request.urlopen("http://" + device_ip + path, timeout=10) as r:
+        return r.read()
+
+def throughput(path, count):
+    total = 0
+    start = time.time()
+    for i in range(0, count):
+        total += len(get(path))
+    t = time.time() - start
+    print("{}: {} bytes in {:.2f}s, {:.1f} KiB/s, {:.0f}ms per request".format(
+          path, total, t, total / 1024 / t, t / count * 1000))
+
+iface = find_interface()
+if iface == None:
+    print("no CDC-NCM interface with vendor id {} found".format(usb_vid))
+    sys.exit(1)
+print("interface: {}".format(iface))
+
+t = wait_for_lease(iface, 30)
+if t == None:
+    print("no {} on {}, is a DHCP client running?".format(host_ip, iface))
+    print("eg.: sudo ip link set {} up && sudo dhclient -v {}".format(iface, iface))
+    sys.exit(1)
+print("lease after {:.1f}s".format(t))
+
+ping()
+
+state = json.loads(get("/api/state.json"))
+print("state: {}".format(state))
+
+paths = sys.argv[1:]
+if len(paths) == 0:
+    paths = [ "/index.html", "/api/state.json", "/log.json" ]
+for p in paths:
+    throughput(p, 20)